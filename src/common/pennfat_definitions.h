@@ -68,25 +68,73 @@ typedef struct {
     uint8_t  type;         // 1 byte: file type (0: unknown, 1: regular, 2: directory, 4: symbolic link).
     uint8_t  perm;         // 1 byte: permissions (0, 2, 4, 5, 6, or 7).
     time_t   mtime;        // 8 bytes: creation/modification time.
-    char     reserved[16]; // 16 bytes reserved.
+    uint16_t first_block_hi; // 2 bytes: high half of first_block (wide images only, else 0).
+    char     reserved[14]; // 14 bytes reserved.
 } __attribute__((packed)) dir_entry_t;  // Ensure no padding
 
+/* FAT entry values. Block numbers are 32 bits wide in memory; a narrow (v1)
+   image stores them in 16 bits and marks the end of a chain with
+   FAT_EOC_NARROW, which the kernel's fat_get()/fat_set() translate. */
+#define FAT_FREE 0x0000
+#define FAT_EOC 0xFFFFFFFFu  // End-Of-Chain
+#define FAT_EOC_NARROW 0xFFFF
+
+/* Wide (v2) images start with a superblock block recording the format; a
+   narrow image starts with its FAT, whose first entry holds the format word
+   (at most 32 FAT blocks in the high byte), so the magic never matches it */
+#define PENNFAT_MAGIC "PENNFAT2"
+#define PENNFAT_VERSION_NARROW 1
+#define PENNFAT_VERSION_WIDE 2
+#define PENNFAT_NARROW_MAX_FAT_BLOCKS 32
+#define PENNFAT_WIDE_MAX_FAT_BLOCKS 65535
+#define PENNFAT_NARROW_MAX_BLOCK_CONFIG 4
+#define PENNFAT_WIDE_MAX_BLOCK_CONFIG 7
+
+typedef struct {
+    char     magic[8];     // PENNFAT_MAGIC, not NUL-terminated
+    uint32_t version;      // PENNFAT_VERSION_WIDE
+    uint32_t block_size;   // bytes per block
+    uint32_t fat_blocks;   // blocks in the FAT region, after this block
+    uint32_t fat_entries;  // 32-bit FAT entries, including entries 0 and 1
+    uint32_t root_block;   // first block of the root directory (always 1)
+} __attribute__((packed)) pennfat_superblock_t;
+
+/* Remembered position in a file's FAT chain, so sequential access resumes the
+ * walk instead of starting over at first_block */
+typedef struct {
+    uint32_t index;  // File block index of `block`
+    uint32_t block;  // Physical block at `index` (0 = no position cached)
+} chain_cursor_t;
+
 /* File Descriptor Table Entry */
 typedef struct {
     int      in_use;        // FD slot is active
     int      sysfile_index; // Index into system-wide file table
     int      mode;          // F_READ, F_WRITE, or F_APPEND
     uint32_t offset;        // Current file pointer offset
+    uint32_t ra_next;       // Offset a sequential reader would read next
+    uint32_t ra_window;     // Read-ahead window in blocks (0 = not sequential)
+    uint32_t ra_end;        // File block index read-ahead has reached
+    chain_cursor_t chain;   // Last block located through this fd
 } fd_entry_t;
 
 /* System-Wide File Table Entry */
 typedef struct {
     int      ref_count;   // Number of FDs referencing this file
     int      in_use;      // Whether this entry is active
-    uint16_t first_block; // Starting block (from directory)
+    uint32_t first_block; // Starting block (from directory)
     uint32_t size;        // File size in bytes
     time_t   mtime;       // Last modification time
-    int      dir_index;   // Index in the directory array
+    uint64_t dir_index;   // Pseudo-inode: entry block << 16 | index in block
+    uint32_t* block_map;  // File block index -> physical block (lazy, may be NULL)
+    uint32_t map_len;     // Entries of block_map filled in (a chain prefix)
+    uint32_t map_cap;     // Entries allocated for block_map
+    uint64_t map_tick;    // Last map lookup, for least-recently-used eviction
+    char*    delay_buf;   // Data past the chain, not yet given blocks (may be NULL)
+    uint32_t delay_from;  // Chain length in blocks; delay_buf holds blocks from here
+    uint32_t delay_cap;   // Bytes allocated for delay_buf (past the size: zeroes)
+    uint32_t delay_blocks; // Free blocks reserved for delay_buf's data
+    int      delay_failed; // Delayed data was lost; not yet reported to anyone
 } system_file_t;
 
 #endif /* PENNFAT_DEFINITIONS_H */
\ No newline at end of file
@@ -0,0 +1,123 @@
+#ifndef PENNFAT_BLOCKDEV_H
+#define PENNFAT_BLOCKDEV_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "../common/pennfat_errors.h"
+
+/* Block device backends the image can be accessed through */
+typedef enum {
+  PENNFAT_BACKEND_PREAD,     // positional pread(2)/pwrite(2) on the image fd
+  PENNFAT_BACKEND_MMAP,      // whole image mapped; msync of dirty pages only
+  PENNFAT_BACKEND_IO_URING,  // batched async I/O (-DPENNFAT_IO_URING builds)
+} pennfat_backend_t;
+
+/* One transfer of a batch submitted with blockdev_submit() */
+typedef struct {
+  void* buf;   // source (write) or destination (read)
+  size_t len;  // bytes
+  off_t off;   // absolute image offset
+  bool write;  // true for a write, false for a read
+} blockdev_io_t;
+
+typedef struct pennfat_blockdev pennfat_blockdev_t;
+
+/*
+ * Backend operations. All offsets are absolute byte offsets into the image,
+ * and every operation must be safe to call from several threads at once: no
+ * backend may rely on the fd's file offset.
+ */
+typedef struct {
+  const char* name;
+
+  /* open: Sets up backend state once dev->fd and dev->image_size are set. */
+  int (*open)(pennfat_blockdev_t* dev);
+  /* close: Releases backend state. Does not close dev->fd. */
+  void (*close)(pennfat_blockdev_t* dev);
+
+  /* read_at / write_at: Transfer up to len bytes; return bytes or -1. */
+  ssize_t (*read_at)(pennfat_blockdev_t* dev, void* buf, size_t len, off_t off);
+  ssize_t (*write_at)(pennfat_blockdev_t* dev,
+                      const void* buf,
+                      size_t len,
+                      off_t off);
+
+  /* sync: Makes every completed write durable. */
+  int (*sync)(pennfat_blockdev_t* dev);
+
+  /*
+   * ptr (optional): Direct pointer to [off, off + len) of the image, or NULL.
+   * Only backends that map the image provide it; callers that modify bytes
+   * through the pointer must report them with mark_dirty.
+   */
+  void* (*ptr)(pennfat_blockdev_t* dev, off_t off, size_t len);
+  void (*mark_dirty)(pennfat_blockdev_t* dev, off_t off, size_t len);
+
+  /*
+   * submit (optional): Issues all n transfers at once and waits for every one
+   * of them; 0 only if each moved its full length. Backends without it get
+   * the transfers issued one after another.
+   */
+  int (*submit)(pennfat_blockdev_t* dev, blockdev_io_t* ios, int n);
+} pennfat_blockdev_ops_t;
+
+struct pennfat_blockdev {
+  const pennfat_blockdev_ops_t* ops;
+  int fd;             // image file descriptor (owned by the caller)
+  size_t image_size;  // bytes, from fstat at open time
+  void* priv;         // backend-private state
+};
+
+/*
+ * blockdev_open: Attaches backend `kind` to the open image `fd`. A backend
+ * that is not built in or cannot start (e.g. io_uring disabled by the host)
+ * falls back to PENNFAT_BACKEND_PREAD; dev->ops->name tells which one runs.
+ */
+PennFatErr blockdev_open(pennfat_blockdev_t* dev,
+                         pennfat_backend_t kind,
+                         int fd);
+
+/* blockdev_close: Detaches the backend. The image fd stays open. */
+void blockdev_close(pennfat_blockdev_t* dev);
+
+/*
+ * blockdev_read / blockdev_write: Transfer exactly len bytes at off, retrying
+ * short transfers and EINTR. Return 0 on success and -1 on failure.
+ */
+int blockdev_read(pennfat_blockdev_t* dev, void* buf, size_t len, off_t off);
+int blockdev_write(pennfat_blockdev_t* dev,
+                   const void* buf,
+                   size_t len,
+                   off_t off);
+
+/*
+ * blockdev_submit: Performs a batch of transfers, all in flight together when
+ * the backend supports it. Returns 0 when every transfer completed in full.
+ */
+int blockdev_submit(pennfat_blockdev_t* dev, blockdev_io_t* ios, int n);
+
+/* blockdev_sync: Makes all completed writes durable (0 / -1). */
+int blockdev_sync(pennfat_blockdev_t* dev);
+
+/*
+ * blockdev_ptr: Direct pointer to [off, off + len) of the image when the
+ * backend maps it (see pennfat_blockdev_ops_t.ptr), NULL otherwise.
+ */
+void* blockdev_ptr(pennfat_blockdev_t* dev, off_t off, size_t len);
+
+/* blockdev_mark_dirty: Reports an in-place change made through blockdev_ptr. */
+void blockdev_mark_dirty(pennfat_blockdev_t* dev, off_t off, size_t len);
+
+/* blockdev_is_mapped: True if the attached backend maps the image. */
+bool blockdev_is_mapped(const pennfat_blockdev_t* dev);
+
+/* blockdev_name: Human-readable name of backend `kind`. */
+const char* blockdev_name(pennfat_backend_t kind);
+
+/* blockdev_parse: Looks a backend up by name (0 on success, -1 if unknown). */
+int blockdev_parse(const char* name, pennfat_backend_t* out);
+
+#endif /* PENNFAT_BLOCKDEV_H */
@@ -0,0 +1,195 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pennfat_bufpool.h"
+
+// ---------------------------------------------------------------------------
+// Block buffer slab
+//
+// The FS helpers (directory entry reads/writes, lookups, symlinks, k_read and
+// k_write's partial blocks) each need one block of scratch space per call.
+// Instead of a malloc/free pair every time, a mount carves a fixed number of
+// aligned, block-sized buffers out of one slab and threads the idle ones on
+// a free stack, so acquire and release are a push/pop under g_pool_lock.
+//
+// When the slab runs dry the buffer comes from the heap instead; release
+// tells the two apart by address. With -DPENNFAT_BUFPOOL_DEBUG every slab
+// buffer remembers where it was acquired, released buffers are poisoned, and
+// double or foreign releases abort.
+// ---------------------------------------------------------------------------
+
+#define NO_BUF (-1)
+#define POISON_BYTE 0xA5
+
+typedef struct {
+  int next_free;  // next idle buffer on the free stack
+#ifdef PENNFAT_BUFPOOL_DEBUG
+  bool held;         // handed out and not yet released
+  const char* file;  // acquire site
+  int line;
+#endif
+} bpool_slot_t;
+
+static char* g_slab = NULL;
+static bpool_slot_t* g_slots = NULL;
+static uint32_t g_nbufs = 0;
+static size_t g_stride = 0;      // buffer size rounded up to the alignment
+static uint32_t g_buf_size = 0;  // bytes handed to callers
+static int g_free_top = NO_BUF;
+static uint32_t g_heap_held = 0;  // overflow buffers not yet released
+
+static bpool_stats_t g_stats;
+
+static pthread_mutex_t g_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int slot_of(const void* buf) {
+  const char* p = buf;
+  if (!g_slab || p < g_slab || p >= g_slab + g_nbufs * g_stride)
+    return NO_BUF;
+#ifdef PENNFAT_BUFPOOL_DEBUG
+  if ((size_t)(p - g_slab) % g_stride != 0) {
+    fprintf(stderr, "bpool: release of %p, inside a slab buffer\n", buf);
+    abort();
+  }
+#endif
+  return (int)((size_t)(p - g_slab) / g_stride);
+}
+
+static void* heap_buffer(void) {
+  return aligned_alloc(PENNFAT_BUFPOOL_ALIGN, g_stride);
+}
+
+PennFatErr bpool_init(uint32_t block_size, uint32_t nbufs) {
+  if (block_size == 0 || nbufs == 0)
+    return PennFatErr_INVAD;
+  if (g_slab)
+    bpool_destroy();
+
+  pthread_mutex_lock(&g_pool_lock);
+
+  size_t stride = (block_size + PENNFAT_BUFPOOL_ALIGN - 1) &
+                  ~(size_t)(PENNFAT_BUFPOOL_ALIGN - 1);
+  g_slab = aligned_alloc(PENNFAT_BUFPOOL_ALIGN, stride * nbufs);
+  g_slots = calloc(nbufs, sizeof(bpool_slot_t));
+  if (!g_slab || !g_slots) {
+    free(g_slab);
+    free(g_slots);
+    g_slab = NULL;
+    g_slots = NULL;
+    pthread_mutex_unlock(&g_pool_lock);
+    return PennFatErr_OUTOFMEM;
+  }
+
+  // Buffer 0 ends up on top so a quiet mount keeps reusing the same lines
+  g_free_top = NO_BUF;
+  for (int i = (int)nbufs - 1; i >= 0; i--) {
+    g_slots[i].next_free = g_free_top;
+    g_free_top = i;
+  }
+
+  g_nbufs = nbufs;
+  g_stride = stride;
+  g_buf_size = block_size;
+  g_heap_held = 0;
+  memset(&g_stats, 0, sizeof(g_stats));
+  pthread_mutex_unlock(&g_pool_lock);
+  return PennFatErr_OK;
+}
+
+uint32_t bpool_destroy(void) {
+  pthread_mutex_lock(&g_pool_lock);
+  uint32_t leaked = g_stats.in_use;
+#ifdef PENNFAT_BUFPOOL_DEBUG
+  for (uint32_t i = 0; g_slots && i < g_nbufs; i++) {
+    if (g_slots[i].held)
+      fprintf(stderr, "bpool: buffer %u leaked, acquired at %s:%d\n", i,
+              g_slots[i].file, g_slots[i].line);
+  }
+  if (g_heap_held > 0)
+    fprintf(stderr, "bpool: %u overflow buffer(s) leaked\n", g_heap_held);
+#endif
+  free(g_slab);
+  free(g_slots);
+  g_slab = NULL;
+  g_slots = NULL;
+  g_nbufs = 0;
+  g_free_top = NO_BUF;
+  g_stats.in_use = 0;
+  pthread_mutex_unlock(&g_pool_lock);
+  return leaked;
+}
+
+void* bpool_acquire_at(const char* file, int line) {
+  pthread_mutex_lock(&g_pool_lock);
+  if (!g_slab) {
+    pthread_mutex_unlock(&g_pool_lock);
+    return NULL;
+  }
+
+  void* buf;
+  int i = g_free_top;
+  if (i != NO_BUF) {
+    g_free_top = g_slots[i].next_free;
+    buf = g_slab + (size_t)i * g_stride;
+#ifdef PENNFAT_BUFPOOL_DEBUG
+    g_slots[i].held = true;
+    g_slots[i].file = file;
+    g_slots[i].line = line;
+#endif
+  } else {
+    buf = heap_buffer();
+    if (!buf) {
+      pthread_mutex_unlock(&g_pool_lock);
+      return NULL;
+    }
+    g_heap_held++;
+    g_stats.overflows++;
+  }
+
+  g_stats.acquires++;
+  if (++g_stats.in_use > g_stats.high_water)
+    g_stats.high_water = g_stats.in_use;
+  pthread_mutex_unlock(&g_pool_lock);
+  (void)file;
+  (void)line;
+  return buf;
+}
+
+void bpool_release(void* buf) {
+  if (!buf)
+    return;
+  pthread_mutex_lock(&g_pool_lock);
+  int i = slot_of(buf);
+  if (i == NO_BUF) {
+    // Overflow buffer, or one that outlived its mount
+    if (g_heap_held > 0) {
+      g_heap_held--;
+      g_stats.in_use--;
+    }
+    pthread_mutex_unlock(&g_pool_lock);
+    free(buf);
+    return;
+  }
+
+#ifdef PENNFAT_BUFPOOL_DEBUG
+  if (!g_slots[i].held) {
+    fprintf(stderr, "bpool: buffer %d released twice\n", i);
+    abort();
+  }
+  g_slots[i].held = false;
+  memset(buf, POISON_BYTE, g_buf_size);
+#endif
+  g_slots[i].next_free = g_free_top;
+  g_free_top = i;
+  g_stats.in_use--;
+  pthread_mutex_unlock(&g_pool_lock);
+}
+
+void bpool_get_stats(bpool_stats_t* out) {
+  pthread_mutex_lock(&g_pool_lock);
+  *out = g_stats;
+  pthread_mutex_unlock(&g_pool_lock);
+}
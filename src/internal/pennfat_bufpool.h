@@ -0,0 +1,56 @@
+#ifndef PENNFAT_BUFPOOL_H
+#define PENNFAT_BUFPOOL_H
+
+#include <stdint.h>
+
+#include "../common/pennfat_errors.h"
+
+/* Number of block buffers in the per-mount slab. Nested helpers (e.g. ls -l
+ * resolving a symlink) hold a few at once; acquires past this are served by
+ * the heap and counted as overflows. Override with -DPENNFAT_BUFPOOL_BUFS=N. */
+#ifndef PENNFAT_BUFPOOL_BUFS
+#define PENNFAT_BUFPOOL_BUFS 16
+#endif
+
+/* Alignment of every buffer, so block copies never straddle a cache line */
+#define PENNFAT_BUFPOOL_ALIGN 64
+
+/* Counters exposed through k_stats() */
+typedef struct {
+  uint64_t acquires;    // buffers handed out
+  uint64_t overflows;   // of those, served by the heap (slab was empty)
+  uint32_t in_use;      // buffers currently held
+  uint32_t high_water;  // most buffers held at once
+} bpool_stats_t;
+
+/*
+ * bpool_init: Carves `nbufs` buffers of `block_size` bytes out of one aligned
+ * slab. Must be called once per mount, after the block size is known.
+ */
+PennFatErr bpool_init(uint32_t block_size, uint32_t nbufs);
+
+/*
+ * bpool_destroy: Releases the slab and returns how many buffers were still
+ * held (leaked). Debug builds also print where each one was acquired.
+ */
+uint32_t bpool_destroy(void);
+
+/*
+ * bpool_acquire: Hands out one block-sized buffer with undefined contents, or
+ * NULL if the pool is not initialized or the heap is exhausted. Debug builds
+ * (-DPENNFAT_BUFPOOL_DEBUG) record the call site for leak reports.
+ */
+#ifdef PENNFAT_BUFPOOL_DEBUG
+#define bpool_acquire() bpool_acquire_at(__FILE__, __LINE__)
+#else
+#define bpool_acquire() bpool_acquire_at(NULL, 0)
+#endif
+void* bpool_acquire_at(const char* file, int line);
+
+/* bpool_release: Returns a buffer from bpool_acquire(). NULL is ignored. */
+void bpool_release(void* buf);
+
+/* bpool_get_stats: Snapshot of the pool counters. */
+void bpool_get_stats(bpool_stats_t* out);
+
+#endif /* PENNFAT_BUFPOOL_H */
@@ -0,0 +1,383 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pennfat_cache.h"
+
+// ---------------------------------------------------------------------------
+// Write-back block buffer cache
+//
+// A fixed pool of block frames indexed by a chained hash on the block number.
+// Replacement uses the CLOCK algorithm: every access sets a frame's reference
+// bit, and the hand clears bits until it finds a frame that has not been
+// touched since its last sweep. Dirty frames are written back on eviction or
+// by bcache_flush().
+//
+// Every public entry point takes g_cache_lock so the periodic flusher thread
+// (see k_mount_opts) can write back frames while the kernel keeps using the
+// cache.
+// ---------------------------------------------------------------------------
+
+#define NO_FRAME (-1)
+
+typedef struct {
+  uint32_t block;   // block number held by this frame
+  bool valid;       // frame holds a block
+  bool dirty;       // frame differs from the device copy
+  bool referenced;  // CLOCK reference bit
+  bool prefetched;  // installed by read-ahead, not yet read on demand
+  int hash_next;    // next frame in the same hash bucket
+  char* data;       // g_block_size bytes
+} bcache_frame_t;
+
+static bcache_frame_t* g_frames = NULL;
+static char* g_frame_data = NULL;
+static int* g_buckets = NULL;
+static uint32_t g_nframes = 0;
+static uint32_t g_nbuckets = 0;  // power of two
+static uint32_t g_clock_hand = 0;
+static uint32_t g_frame_size = 0;
+
+static bcache_read_fn g_raw_read = NULL;
+static bcache_write_fn g_raw_write = NULL;
+
+static bcache_stats_t g_stats;
+
+static pthread_mutex_t g_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline uint32_t bucket_of(uint32_t block) {
+  // Fibonacci hashing spreads sequential block numbers across buckets
+  return (block * 2654435761u) & (g_nbuckets - 1);
+}
+
+static int lookup_frame(uint32_t block) {
+  for (int f = g_buckets[bucket_of(block)]; f != NO_FRAME;
+       f = g_frames[f].hash_next) {
+    if (g_frames[f].block == block)
+      return f;
+  }
+  return NO_FRAME;
+}
+
+static void hash_insert(int f) {
+  uint32_t b = bucket_of(g_frames[f].block);
+  g_frames[f].hash_next = g_buckets[b];
+  g_buckets[b] = f;
+}
+
+static void hash_remove(int f) {
+  int* link = &g_buckets[bucket_of(g_frames[f].block)];
+  while (*link != NO_FRAME) {
+    if (*link == f) {
+      *link = g_frames[f].hash_next;
+      break;
+    }
+    link = &g_frames[*link].hash_next;
+  }
+  g_frames[f].hash_next = NO_FRAME;
+}
+
+/*
+ * claim_frame: Returns a frame ready to receive `block`, evicting (and writing
+ * back) the CLOCK victim if no free frame exists. The returned frame is
+ * hashed under `block` but its contents are undefined.
+ */
+static int claim_frame(uint32_t block) {
+  int victim = NO_FRAME;
+
+  // Two sweeps are always enough: the first clears every reference bit.
+  for (uint32_t scanned = 0; scanned < 2 * g_nframes; scanned++) {
+    bcache_frame_t* fr = &g_frames[g_clock_hand];
+    uint32_t idx = g_clock_hand;
+    g_clock_hand = (g_clock_hand + 1) % g_nframes;
+
+    if (!fr->valid) {
+      victim = idx;
+      break;
+    }
+    if (fr->referenced) {
+      fr->referenced = false;
+      continue;
+    }
+    victim = idx;
+    break;
+  }
+  if (victim == NO_FRAME)
+    return NO_FRAME;
+
+  bcache_frame_t* fr = &g_frames[victim];
+  if (fr->valid) {
+    if (fr->dirty) {
+      if (g_raw_write(fr->data, fr->block) != 0)
+        return NO_FRAME;
+      g_stats.writebacks++;
+    }
+    hash_remove(victim);
+    g_stats.evictions++;
+  }
+
+  fr->block = block;
+  fr->valid = true;
+  fr->dirty = false;
+  fr->referenced = true;
+  fr->prefetched = false;
+  hash_insert(victim);
+  return victim;
+}
+
+static void drop_frame(int f) {
+  hash_remove(f);
+  g_frames[f].valid = false;
+  g_frames[f].dirty = false;
+  g_frames[f].referenced = false;
+  g_frames[f].prefetched = false;
+}
+
+/* demand_hit: Accounts a demand access to a resident frame. */
+static void demand_hit(int f) {
+  g_stats.hits++;
+  g_frames[f].referenced = true;
+  if (g_frames[f].prefetched) {
+    g_frames[f].prefetched = false;
+    g_stats.prefetch_hits++;
+  }
+}
+
+PennFatErr bcache_init(uint32_t block_size,
+                       uint32_t nframes,
+                       bcache_read_fn raw_read,
+                       bcache_write_fn raw_write) {
+  if (block_size == 0 || nframes == 0 || !raw_read || !raw_write)
+    return PennFatErr_INVAD;
+  if (g_frames)
+    bcache_destroy();
+
+  pthread_mutex_lock(&g_cache_lock);
+
+  g_nbuckets = 1;
+  while (g_nbuckets < 2 * nframes)
+    g_nbuckets <<= 1;
+
+  g_frames = calloc(nframes, sizeof(bcache_frame_t));
+  g_frame_data = malloc((size_t)nframes * block_size);
+  g_buckets = malloc(g_nbuckets * sizeof(int));
+  if (!g_frames || !g_frame_data || !g_buckets) {
+    free(g_frames);
+    free(g_frame_data);
+    free(g_buckets);
+    g_frames = NULL;
+    g_frame_data = NULL;
+    g_buckets = NULL;
+    pthread_mutex_unlock(&g_cache_lock);
+    return PennFatErr_OUTOFMEM;
+  }
+
+  for (uint32_t i = 0; i < g_nbuckets; i++)
+    g_buckets[i] = NO_FRAME;
+  for (uint32_t i = 0; i < nframes; i++) {
+    g_frames[i].hash_next = NO_FRAME;
+    g_frames[i].data = g_frame_data + (size_t)i * block_size;
+  }
+
+  g_nframes = nframes;
+  g_frame_size = block_size;
+  g_clock_hand = 0;
+  g_raw_read = raw_read;
+  g_raw_write = raw_write;
+  memset(&g_stats, 0, sizeof(g_stats));
+  pthread_mutex_unlock(&g_cache_lock);
+  return PennFatErr_OK;
+}
+
+void bcache_destroy(void) {
+  pthread_mutex_lock(&g_cache_lock);
+  free(g_frames);
+  free(g_frame_data);
+  free(g_buckets);
+  g_frames = NULL;
+  g_frame_data = NULL;
+  g_buckets = NULL;
+  g_nframes = 0;
+  g_nbuckets = 0;
+  g_raw_read = NULL;
+  g_raw_write = NULL;
+  pthread_mutex_unlock(&g_cache_lock);
+}
+
+int bcache_read(void* buf, uint32_t block_index) {
+  pthread_mutex_lock(&g_cache_lock);
+  if (!g_frames) {
+    pthread_mutex_unlock(&g_cache_lock);
+    return -1;
+  }
+
+  int rc = 0;
+  int f = lookup_frame(block_index);
+  if (f != NO_FRAME) {
+    demand_hit(f);
+    memcpy(buf, g_frames[f].data, g_frame_size);
+  } else {
+    g_stats.misses++;
+    f = claim_frame(block_index);
+    if (f == NO_FRAME) {
+      rc = g_raw_read(buf, block_index);  // cache wedged; go straight through
+    } else if (g_raw_read(g_frames[f].data, block_index) != 0) {
+      drop_frame(f);
+      rc = -1;
+    } else {
+      memcpy(buf, g_frames[f].data, g_frame_size);
+    }
+  }
+
+  pthread_mutex_unlock(&g_cache_lock);
+  return rc;
+}
+
+int bcache_write(const void* buf, uint32_t block_index, bool write_through) {
+  pthread_mutex_lock(&g_cache_lock);
+  if (!g_frames) {
+    pthread_mutex_unlock(&g_cache_lock);
+    return -1;
+  }
+
+  int rc = 0;
+  int f = lookup_frame(block_index);
+  if (f != NO_FRAME) {
+    demand_hit(f);
+  } else {
+    g_stats.misses++;
+    // Whole-block overwrite: no need to fetch the old contents
+    f = claim_frame(block_index);
+  }
+
+  if (f == NO_FRAME) {
+    rc = g_raw_write(buf, block_index);
+  } else {
+    memcpy(g_frames[f].data, buf, g_frame_size);
+    g_frames[f].referenced = true;
+    g_frames[f].dirty = true;
+    if (write_through) {
+      rc = g_raw_write(buf, block_index);
+      if (rc == 0)
+        g_frames[f].dirty = false;
+    }
+  }
+
+  pthread_mutex_unlock(&g_cache_lock);
+  return rc;
+}
+
+static int compare_frame_block(const void* a, const void* b) {
+  uint32_t ba = g_frames[*(const int*)a].block;
+  uint32_t bb = g_frames[*(const int*)b].block;
+  return (ba > bb) - (ba < bb);
+}
+
+int bcache_flush(void) {
+  pthread_mutex_lock(&g_cache_lock);
+  if (!g_frames) {
+    pthread_mutex_unlock(&g_cache_lock);
+    return 0;
+  }
+
+  int* dirty = malloc(g_nframes * sizeof(int));
+  uint32_t ndirty = 0;
+  if (!dirty) {
+    pthread_mutex_unlock(&g_cache_lock);
+    return -1;
+  }
+
+  for (uint32_t i = 0; i < g_nframes; i++) {
+    if (g_frames[i].valid && g_frames[i].dirty)
+      dirty[ndirty++] = (int)i;
+  }
+  // Ascending block order keeps the write-back as sequential as possible
+  qsort(dirty, ndirty, sizeof(int), compare_frame_block);
+
+  int rc = 0;
+  for (uint32_t i = 0; i < ndirty; i++) {
+    bcache_frame_t* fr = &g_frames[dirty[i]];
+    if (g_raw_write(fr->data, fr->block) != 0) {
+      rc = -1;
+      continue;  // keep it dirty, try the rest
+    }
+    fr->dirty = false;
+    g_stats.writebacks++;
+  }
+
+  free(dirty);
+  pthread_mutex_unlock(&g_cache_lock);
+  return rc;
+}
+
+void bcache_invalidate(uint32_t block_index) {
+  pthread_mutex_lock(&g_cache_lock);
+  if (g_frames) {
+    int f = lookup_frame(block_index);
+    if (f != NO_FRAME)
+      drop_frame(f);
+  }
+  pthread_mutex_unlock(&g_cache_lock);
+}
+
+void bcache_invalidate_range(uint32_t first, uint32_t count) {
+  pthread_mutex_lock(&g_cache_lock);
+  for (uint32_t i = 0; g_frames && i < g_nframes; i++) {
+    bcache_frame_t* fr = &g_frames[i];
+    if (fr->valid && fr->block - first < count)
+      drop_frame((int)i);
+  }
+  pthread_mutex_unlock(&g_cache_lock);
+}
+
+void bcache_overlay(void* buf, uint32_t first, uint32_t count) {
+  pthread_mutex_lock(&g_cache_lock);
+  for (uint32_t i = 0; g_frames && i < g_nframes; i++) {
+    bcache_frame_t* fr = &g_frames[i];
+    if (fr->valid && fr->block - first < count) {
+      memcpy((char*)buf + (size_t)(fr->block - first) * g_frame_size, fr->data,
+             g_frame_size);
+    }
+  }
+  pthread_mutex_unlock(&g_cache_lock);
+}
+
+void bcache_install(const void* buf, uint32_t first, uint32_t count) {
+  pthread_mutex_lock(&g_cache_lock);
+  for (uint32_t i = 0; g_frames && i < count; i++) {
+    if (lookup_frame(first + i) != NO_FRAME)
+      continue;
+    int f = claim_frame(first + i);
+    if (f == NO_FRAME)
+      break;
+    memcpy(g_frames[f].data, (const char*)buf + (size_t)i * g_frame_size,
+           g_frame_size);
+    g_frames[f].prefetched = true;
+    g_stats.prefetched++;
+  }
+  pthread_mutex_unlock(&g_cache_lock);
+}
+
+uint32_t bcache_read_resident(void* buf, uint32_t first, uint32_t count) {
+  uint32_t n = 0;
+  pthread_mutex_lock(&g_cache_lock);
+  for (; g_frames && n < count; n++) {
+    int f = lookup_frame(first + n);
+    if (f == NO_FRAME)
+      break;
+    demand_hit(f);
+    memcpy((char*)buf + (size_t)n * g_frame_size, g_frames[f].data,
+           g_frame_size);
+  }
+  pthread_mutex_unlock(&g_cache_lock);
+  return n;
+}
+
+void bcache_get_stats(bcache_stats_t* out, uint32_t* nframes_out) {
+  pthread_mutex_lock(&g_cache_lock);
+  if (out)
+    *out = g_stats;
+  if (nframes_out)
+    *nframes_out = g_nframes;
+  pthread_mutex_unlock(&g_cache_lock);
+}
@@ -0,0 +1,90 @@
+#ifndef PENNFAT_CACHE_H
+#define PENNFAT_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "../common/pennfat_errors.h"
+
+/* Number of block frames in the buffer cache. Override at build time with
+ * -DPENNFAT_CACHE_FRAMES=N to size the cache for a particular image. */
+#ifndef PENNFAT_CACHE_FRAMES
+#define PENNFAT_CACHE_FRAMES 64
+#endif
+
+/* Raw device accessors the cache falls through to on a miss / write-back.
+ * Both return 0 on success and -1 on failure, like read_block/write_block. */
+typedef int (*bcache_read_fn)(void* buf, uint32_t block_index);
+typedef int (*bcache_write_fn)(const void* buf, uint32_t block_index);
+
+/* Counters exposed so the cache can be sized against real images */
+typedef struct {
+  uint64_t hits;           // lookups satisfied from a resident frame
+  uint64_t misses;         // lookups that had to claim a frame
+  uint64_t evictions;      // valid frames recycled by the CLOCK hand
+  uint64_t writebacks;     // dirty frames written to the device
+  uint64_t prefetched;     // blocks installed by read-ahead (bcache_install)
+  uint64_t prefetch_hits;  // of those, blocks later read on demand
+} bcache_stats_t;
+
+/*
+ * bcache_init: Allocates `nframes` frames of `block_size` bytes each and
+ * installs the raw device accessors. Must be called once per mount.
+ */
+PennFatErr bcache_init(uint32_t block_size,
+                       uint32_t nframes,
+                       bcache_read_fn raw_read,
+                       bcache_write_fn raw_write);
+
+/*
+ * bcache_destroy: Releases all frames. Dirty frames are NOT written back;
+ * call bcache_flush() first.
+ */
+void bcache_destroy(void);
+
+/* bcache_read: Copies block `block_index` into buf (g_block_size bytes). */
+int bcache_read(void* buf, uint32_t block_index);
+
+/*
+ * bcache_write: Replaces block `block_index` with buf and marks it dirty. With
+ * write_through the block is also written to the device immediately and the
+ * frame is left clean.
+ */
+int bcache_write(const void* buf, uint32_t block_index, bool write_through);
+
+/* bcache_flush: Writes back every dirty frame in ascending block order. */
+int bcache_flush(void);
+
+/* bcache_invalidate: Drops a block from the cache without writing it back. */
+void bcache_invalidate(uint32_t block_index);
+
+/*
+ * bcache_invalidate_range: Drops blocks [first, first + count) from the cache
+ * without writing them back. Used after a run was written around the cache.
+ */
+void bcache_invalidate_range(uint32_t first, uint32_t count);
+
+/*
+ * bcache_overlay: buf holds blocks [first, first + count) as just read from
+ * the device around the cache; copies every resident frame in that range over
+ * it so the caller sees the same bytes bcache_read() would return.
+ */
+void bcache_overlay(void* buf, uint32_t first, uint32_t count);
+
+/*
+ * bcache_install: Inserts blocks [first, first + count), read ahead from the
+ * device into buf, as clean frames. Blocks already resident are left alone
+ * since the cached copy may be newer.
+ */
+void bcache_install(const void* buf, uint32_t first, uint32_t count);
+
+/*
+ * bcache_read_resident: Copies the longest resident prefix of blocks
+ * [first, first + count) into buf and returns its length in blocks.
+ */
+uint32_t bcache_read_resident(void* buf, uint32_t first, uint32_t count);
+
+/* bcache_get_stats: Snapshot of the cache counters. */
+void bcache_get_stats(bcache_stats_t* out, uint32_t* nframes_out);
+
+#endif /* PENNFAT_CACHE_H */
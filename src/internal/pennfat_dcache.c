@@ -0,0 +1,225 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "pennfat_dcache.h"
+
+// ---------------------------------------------------------------------------
+// Dentry cache
+//
+// Remembers what looking a name up in a directory found: a copy of the entry
+// and where it lives, or that there is no such entry (a negative result).
+// resolve_path walks a path one component at a time, so with the results for
+// each (directory, component) pair cached a path resolves without reading any
+// directory block, and a path that does not exist fails just as fast.
+//
+// Results sit in a fixed table with two chained hashes: by (directory, name)
+// for lookups and by the entry's block and slot so that rewriting an entry
+// (size, time, permissions on close/chmod/touch, or its deletion by unlink,
+// rmdir and rename) updates or drops exactly the result it affects. Adding an
+// entry drops the negative result for its name. Replacement is CLOCK, like
+// the buffer cache.
+// ---------------------------------------------------------------------------
+
+#define NO_ENTRY (-1)
+#define NAME_LEN sizeof(((dir_entry_t*)0)->name)
+
+typedef struct {
+  uint32_t parent;  // directory the name was looked up in
+  uint32_t block;   // found only: block and slot of the entry
+  uint32_t index;
+  bool valid;       // slot holds a result
+  bool found;       // false = negative result
+  bool referenced;  // CLOCK reference bit
+  int name_next;    // next result in the same (parent, name) bucket
+  int loc_next;     // found only: next result in the same location bucket
+  char name[NAME_LEN];
+  dir_entry_t entry;  // found only
+} dcache_entry_t;
+
+static dcache_entry_t g_entries[PENNFAT_DCACHE_ENTRIES];
+static int g_name_buckets[PENNFAT_DCACHE_ENTRIES];
+static int g_loc_buckets[PENNFAT_DCACHE_ENTRIES];
+static bool g_ready = false;
+static uint32_t g_hand = 0;
+static dcache_stats_t g_stats;
+
+static void reset(void) {
+  for (int i = 0; i < PENNFAT_DCACHE_ENTRIES; i++) {
+    g_entries[i].valid = false;
+    g_name_buckets[i] = NO_ENTRY;
+    g_loc_buckets[i] = NO_ENTRY;
+  }
+  g_hand = 0;
+  g_ready = true;
+}
+
+static uint32_t name_bucket(uint32_t parent, const char* name) {
+  uint32_t h = 2166136261u ^ (parent * 2654435761u);
+  for (size_t i = 0; i < NAME_LEN && name[i]; i++)
+    h = (h ^ (uint8_t)name[i]) * 16777619u;
+  return h % PENNFAT_DCACHE_ENTRIES;
+}
+
+static uint32_t loc_bucket(uint32_t block, uint32_t index) {
+  return (block * 2654435761u + index) % PENNFAT_DCACHE_ENTRIES;
+}
+
+static int find(uint32_t parent, const char* name) {
+  for (int e = g_name_buckets[name_bucket(parent, name)]; e != NO_ENTRY;
+       e = g_entries[e].name_next) {
+    if (g_entries[e].parent == parent &&
+        strncmp(g_entries[e].name, name, NAME_LEN) == 0)
+      return e;
+  }
+  return NO_ENTRY;
+}
+
+static void unlink_from(int* link, int e, bool by_name) {
+  while (*link != NO_ENTRY) {
+    if (*link == e) {
+      *link = by_name ? g_entries[e].name_next : g_entries[e].loc_next;
+      return;
+    }
+    link = by_name ? &g_entries[*link].name_next : &g_entries[*link].loc_next;
+  }
+}
+
+static void remove_entry(int e) {
+  dcache_entry_t* d = &g_entries[e];
+  unlink_from(&g_name_buckets[name_bucket(d->parent, d->name)], e, true);
+  if (d->found)
+    unlink_from(&g_loc_buckets[loc_bucket(d->block, d->index)], e, false);
+  d->valid = false;
+}
+
+/* Picks a slot for a new result with the CLOCK hand */
+static int claim(void) {
+  for (;;) {
+    dcache_entry_t* d = &g_entries[g_hand];
+    int e = (int)g_hand;
+    g_hand = (g_hand + 1) % PENNFAT_DCACHE_ENTRIES;
+    if (!d->valid)
+      return e;
+    if (d->referenced) {
+      d->referenced = false;
+      continue;
+    }
+    remove_entry(e);
+    return e;
+  }
+}
+
+int dcache_lookup(uint32_t parent,
+                  const char* name,
+                  dir_entry_t* entry_out,
+                  uint32_t* block_out,
+                  uint32_t* index_out) {
+  if (!g_ready)
+    reset();
+  int e = strlen(name) < NAME_LEN ? find(parent, name) : NO_ENTRY;
+  if (e == NO_ENTRY) {
+    g_stats.misses++;
+    return -1;
+  }
+
+  dcache_entry_t* d = &g_entries[e];
+  d->referenced = true;
+  g_stats.hits++;
+  if (!d->found) {
+    g_stats.negative_hits++;
+    return 0;
+  }
+  *entry_out = d->entry;
+  *block_out = d->block;
+  *index_out = d->index;
+  return 1;
+}
+
+void dcache_insert(uint32_t parent,
+                   const char* name,
+                   const dir_entry_t* entry,
+                   uint32_t block,
+                   uint32_t index) {
+  if (!g_ready)
+    reset();
+  if (strlen(name) >= NAME_LEN)
+    return;  // never matches an entry; a truncated key could
+  int e = find(parent, name);
+  if (e != NO_ENTRY)
+    remove_entry(e);
+  e = claim();
+
+  dcache_entry_t* d = &g_entries[e];
+  d->parent = parent;
+  strcpy(d->name, name);
+  d->valid = true;
+  d->referenced = true;
+  d->found = entry != NULL;
+  uint32_t b = name_bucket(parent, name);
+  d->name_next = g_name_buckets[b];
+  g_name_buckets[b] = e;
+  if (entry) {
+    d->entry = *entry;
+    d->block = block;
+    d->index = index;
+    b = loc_bucket(block, index);
+    d->loc_next = g_loc_buckets[b];
+    g_loc_buckets[b] = e;
+  }
+}
+
+void dcache_forget(uint32_t parent, const char* name) {
+  if (!g_ready)
+    return;
+  int e = find(parent, name);
+  if (e != NO_ENTRY) {
+    remove_entry(e);
+    g_stats.invalidations++;
+  }
+}
+
+void dcache_entry_written(uint32_t block,
+                          uint32_t index,
+                          const dir_entry_t* entry) {
+  if (!g_ready)
+    return;
+  for (int e = g_loc_buckets[loc_bucket(block, index)]; e != NO_ENTRY;
+       e = g_entries[e].loc_next) {
+    dcache_entry_t* d = &g_entries[e];
+    if (d->block != block || d->index != index)
+      continue;
+    uint8_t mark = (uint8_t)entry->name[0];
+    if (mark != 0 && mark != 1 && mark != 2 &&
+        strncmp(d->name, entry->name, NAME_LEN) == 0) {
+      d->entry = *entry;
+    } else {
+      remove_entry(e);
+      g_stats.invalidations++;
+    }
+    return;  // one entry, one result: its name in its own directory
+  }
+}
+
+void dcache_forget_dir(uint32_t parent) {
+  if (!g_ready)
+    return;
+  for (int e = 0; e < PENNFAT_DCACHE_ENTRIES; e++) {
+    if (g_entries[e].valid && g_entries[e].parent == parent) {
+      remove_entry(e);
+      g_stats.invalidations++;
+    }
+  }
+}
+
+void dcache_clear(void) {
+  reset();
+}
+
+void dcache_destroy(void) {
+  reset();
+  memset(&g_stats, 0, sizeof(g_stats));
+}
+
+void dcache_get_stats(dcache_stats_t* out) {
+  *out = g_stats;
+}
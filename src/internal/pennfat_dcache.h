@@ -0,0 +1,72 @@
+#ifndef PENNFAT_DCACHE_H
+#define PENNFAT_DCACHE_H
+
+#include <stdint.h>
+
+#include "../common/pennfat_definitions.h"
+
+/* Number of (directory, name) results the dentry cache holds. Override at
+ * build time with -DPENNFAT_DCACHE_ENTRIES=N. */
+#ifndef PENNFAT_DCACHE_ENTRIES
+#define PENNFAT_DCACHE_ENTRIES 1024
+#endif
+
+/* Counters exposed through k_stats() */
+typedef struct {
+  uint64_t hits;           // lookups answered from the cache
+  uint64_t negative_hits;  // of those, answered "no such entry"
+  uint64_t misses;         // lookups that went to the directory
+  uint64_t invalidations;  // cached results dropped because they changed
+} dcache_stats_t;
+
+/*
+ * dcache_lookup: Looks up the result of finding `name` in the directory whose
+ * chain starts at `parent`. Returns 1 and the entry with its block and slot
+ * if the name was found there, 0 if it was not (a negative entry), or -1 if
+ * nothing is cached.
+ */
+int dcache_lookup(uint32_t parent,
+                  const char* name,
+                  dir_entry_t* entry_out,
+                  uint32_t* block_out,
+                  uint32_t* index_out);
+
+/*
+ * dcache_insert: Caches the result of finding `name` in `parent`: `entry` at
+ * `block`/`index`, or a negative entry if `entry` is NULL. Replaces the least
+ * recently used result once the cache is full. Names too long to be stored
+ * in a directory entry are not cached.
+ */
+void dcache_insert(uint32_t parent,
+                   const char* name,
+                   const dir_entry_t* entry,
+                   uint32_t block,
+                   uint32_t index);
+
+/* dcache_forget: Drops the result for `name` in `parent`, e.g. once an entry
+ * of that name was added there. */
+void dcache_forget(uint32_t parent, const char* name);
+
+/*
+ * dcache_entry_written: The directory entry at `block`/`index` was rewritten
+ * as `entry`. A cached copy of it is updated, or dropped if the entry was
+ * deleted or renamed.
+ */
+void dcache_entry_written(uint32_t block,
+                          uint32_t index,
+                          const dir_entry_t* entry);
+
+/* dcache_forget_dir: Drops every result looked up in `parent`, e.g. when the
+ * directory is removed and its blocks may be reused. */
+void dcache_forget_dir(uint32_t parent);
+
+/* dcache_clear: Drops every cached result (chains relocated). */
+void dcache_clear(void);
+
+/* dcache_destroy: Drops every cached result and resets the counters. */
+void dcache_destroy(void);
+
+/* dcache_get_stats: Snapshot of the cache counters. */
+void dcache_get_stats(dcache_stats_t* out);
+
+#endif /* PENNFAT_DCACHE_H */
@@ -0,0 +1,346 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "pennfat_dirindex.h"
+
+// ---------------------------------------------------------------------------
+// Directory name index
+//
+// One open-addressing hash table per directory, keyed by entry name, giving
+// the block and slot the entry lives in. The kernel builds a directory's
+// table on the first lookup there (one scan of its chain) and reports every
+// later change to the set of names in it, so a lookup is a hash probe: a miss
+// touches no block at all and a hit reads only the block holding the entry.
+//
+// Tables use linear probing with backward-shift deletion, so removals leave
+// no tombstones behind, and double once they are three quarters full. The
+// tables of all directories share PENNFAT_DIRINDEX_BUDGET; creating or
+// growing one past it drops the least recently used other tables, which are
+// simply rebuilt from disk if needed again.
+//
+// Each table also tracks where the next entry of its directory can go, so
+// adding one needs no scan: the deleted slots (name[0] == 1) left by unlink,
+// rmdir and rename, reused last-deleted first, and after those the
+// never-used slots at the end of the chain's last block, which always form a
+// suffix of it since slots are only ever filled in order there.
+// ---------------------------------------------------------------------------
+
+#define DIR_BUCKETS 64  // chains of indexed directories, by first block
+#define MIN_SLOTS 16    // slots in a new table (power of two)
+#define NAME_LEN 32     // dir_entry_t.name, NUL included
+
+typedef struct {
+  uint32_t hash;  // of name; 0 = empty slot
+  uint32_t block;
+  uint32_t index;
+  char name[NAME_LEN];
+} dindex_slot_t;
+
+typedef struct dindex_dir {
+  uint32_t dir;         // first block of the directory's chain
+  uint32_t count;       // names in slots
+  uint32_t mask;        // slots - 1
+  uint32_t per_block;   // directory entries per block
+  uint32_t tail_block;  // last block of the chain (0 = not known yet)
+  uint32_t tail_next;   // first never-used entry in it (per_block: none)
+  uint32_t ntombs;      // deleted entries listed in tombs
+  uint32_t tomb_cap;    // entries allocated for tombs
+  uint64_t tick;        // last use, for least-recently-used eviction
+  size_t bytes;         // memory held by this table
+  dindex_slot_t* slots;
+  uint64_t* tombs;          // block << 32 | index of each deleted entry
+  struct dindex_dir* next;  // next directory in the same bucket
+} dindex_dir_t;
+
+static dindex_dir_t* g_dirs[DIR_BUCKETS];
+static uint64_t g_tick = 0;
+static dindex_stats_t g_stats;
+
+static inline uint32_t dir_bucket(uint32_t dir) {
+  return (dir * 2654435761u) >> 26;  // top 6 bits: DIR_BUCKETS
+}
+
+/* FNV-1a over the name, never 0 so 0 can mark an empty slot */
+static uint32_t name_hash(const char* name) {
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < NAME_LEN && name[i]; i++)
+    h = (h ^ (uint8_t)name[i]) * 16777619u;
+  return h ? h : 1;
+}
+
+static inline size_t table_bytes(uint32_t nslots) {
+  return sizeof(dindex_dir_t) + (size_t)nslots * sizeof(dindex_slot_t);
+}
+
+/* Adjusts d's share of the budget by `delta` bytes */
+static inline void charge(dindex_dir_t* d, ptrdiff_t delta) {
+  d->bytes += delta;
+  g_stats.bytes += delta;
+}
+
+static dindex_dir_t** find_link(uint32_t dir) {
+  dindex_dir_t** link = &g_dirs[dir_bucket(dir)];
+  while (*link && (*link)->dir != dir)
+    link = &(*link)->next;
+  return link;
+}
+
+static void free_table(dindex_dir_t** link) {
+  dindex_dir_t* d = *link;
+  *link = d->next;
+  g_stats.bytes -= d->bytes;
+  g_stats.dirs--;
+  free(d->slots);
+  free(d->tombs);
+  free(d);
+}
+
+/*
+ * reserve: Makes room for `bytes` more index memory within the budget by
+ * dropping the least recently used tables other than `keep`. Returns false
+ * if the budget cannot fit it.
+ */
+static bool reserve(const dindex_dir_t* keep, size_t bytes) {
+  while (g_stats.bytes + bytes > PENNFAT_DIRINDEX_BUDGET) {
+    dindex_dir_t** lru = NULL;
+    for (int b = 0; b < DIR_BUCKETS; b++) {
+      for (dindex_dir_t** link = &g_dirs[b]; *link; link = &(*link)->next) {
+        if (*link != keep && (!lru || (*link)->tick < (*lru)->tick))
+          lru = link;
+      }
+    }
+    if (!lru)
+      return false;
+    free_table(lru);
+    g_stats.evictions++;
+  }
+  return true;
+}
+
+/* Slot holding `name` in d, or the empty slot ending its probe sequence */
+static dindex_slot_t* probe(const dindex_dir_t* d,
+                            const char* name,
+                            uint32_t hash) {
+  for (uint32_t i = hash & d->mask;; i = (i + 1) & d->mask) {
+    dindex_slot_t* s = &d->slots[i];
+    if (s->hash == 0 ||
+        (s->hash == hash && strncmp(s->name, name, NAME_LEN) == 0))
+      return s;
+  }
+}
+
+static bool grow(dindex_dir_t* d) {
+  uint32_t nslots = (d->mask + 1) * 2;
+  if (!reserve(d, table_bytes(nslots) - table_bytes(d->mask + 1)))
+    return false;
+  dindex_slot_t* slots = calloc(nslots, sizeof(dindex_slot_t));
+  if (!slots)
+    return false;
+
+  dindex_slot_t* old = d->slots;
+  uint32_t old_slots = d->mask + 1;
+  d->slots = slots;
+  d->mask = nslots - 1;
+  for (uint32_t i = 0; i < old_slots; i++) {
+    if (old[i].hash)
+      *probe(d, old[i].name, old[i].hash) = old[i];
+  }
+  free(old);
+  charge(d, (ptrdiff_t)(table_bytes(nslots) - table_bytes(old_slots)));
+  return true;
+}
+
+/* Lists entry `index` of `block` as deleted; drops d if it cannot */
+static void push_tomb(dindex_dir_t* d, uint32_t block, uint32_t index) {
+  if (d->ntombs == d->tomb_cap) {
+    uint32_t cap = d->tomb_cap ? d->tomb_cap * 2 : 16;
+    size_t grow = (cap - d->tomb_cap) * sizeof(uint64_t);
+    uint64_t* tombs = reserve(d, grow)
+                          ? realloc(d->tombs, cap * sizeof(uint64_t))
+                          : NULL;
+    if (!tombs) {
+      dindex_drop(d->dir);
+      g_stats.evictions++;
+      return;
+    }
+    d->tombs = tombs;
+    d->tomb_cap = cap;
+    charge(d, (ptrdiff_t)grow);
+  }
+  d->tombs[d->ntombs++] = (uint64_t)block << 32 | index;
+}
+
+int dindex_find(uint32_t dir,
+                const char* name,
+                uint32_t* block_out,
+                uint32_t* index_out) {
+  dindex_dir_t* d = *find_link(dir);
+  if (!d)
+    return -1;
+  d->tick = ++g_tick;
+  g_stats.lookups++;
+
+  const dindex_slot_t* s = probe(d, name, name_hash(name));
+  if (s->hash == 0)
+    return 0;
+  *block_out = s->block;
+  *index_out = s->index;
+  return 1;
+}
+
+bool dindex_create(uint32_t dir, uint32_t per_block) {
+  dindex_drop(dir);
+  if (!reserve(NULL, table_bytes(MIN_SLOTS)))
+    return false;
+  dindex_dir_t* d = calloc(1, sizeof(dindex_dir_t));
+  if (!d)
+    return false;
+  d->slots = calloc(MIN_SLOTS, sizeof(dindex_slot_t));
+  if (!d->slots) {
+    free(d);
+    return false;
+  }
+  d->dir = dir;
+  d->mask = MIN_SLOTS - 1;
+  d->per_block = per_block;
+  d->tick = ++g_tick;
+
+  dindex_dir_t** head = &g_dirs[dir_bucket(dir)];
+  d->next = *head;
+  *head = d;
+  charge(d, (ptrdiff_t)table_bytes(MIN_SLOTS));
+  g_stats.dirs++;
+  g_stats.builds++;
+  return true;
+}
+
+bool dindex_add(uint32_t dir,
+                const char* name,
+                uint32_t block,
+                uint32_t index) {
+  dindex_dir_t* d = *find_link(dir);
+  if (!d)
+    return false;
+
+  // Keep at most three quarters of the slots in use so probes stay short.
+  // grow() may free other tables, so no link into the bucket survives it.
+  if ((d->count + 1) * 4 > (d->mask + 1) * 3 && !grow(d)) {
+    dindex_drop(dir);
+    g_stats.evictions++;
+    return false;
+  }
+  uint32_t hash = name_hash(name);
+  dindex_slot_t* s = probe(d, name, hash);
+  if (s->hash) {
+    // Two live entries with one name: only a scan knows which one wins
+    dindex_drop(dir);
+    return false;
+  }
+  s->hash = hash;
+  s->block = block;
+  s->index = index;
+  strncpy(s->name, name, NAME_LEN - 1);
+  s->name[NAME_LEN - 1] = '\0';
+  d->count++;
+  return true;
+}
+
+void dindex_remove(uint32_t dir,
+                   const char* name,
+                   uint32_t block,
+                   uint32_t index) {
+  dindex_dir_t** link = find_link(dir);
+  dindex_dir_t* d = *link;
+  if (!d)
+    return;
+
+  dindex_slot_t* s = probe(d, name, name_hash(name));
+  if (s->hash == 0)
+    return;
+  if (s->block != block || s->index != index) {
+    free_table(link);  // out of step with the directory: rebuild it
+    return;
+  }
+
+  // Backward-shift deletion: pull later members of the probe run into the
+  // hole so lookups never need tombstones
+  uint32_t hole = (uint32_t)(s - d->slots);
+  for (uint32_t i = (hole + 1) & d->mask; d->slots[i].hash;
+       i = (i + 1) & d->mask) {
+    uint32_t home = d->slots[i].hash & d->mask;
+    // Move slot i back unless its home lies cyclically in (hole, i]
+    if (((i - home) & d->mask) >= ((i - hole) & d->mask)) {
+      d->slots[hole] = d->slots[i];
+      hole = i;
+    }
+  }
+  memset(&d->slots[hole], 0, sizeof(dindex_slot_t));
+  d->count--;
+  push_tomb(d, block, index);
+}
+
+bool dindex_add_tomb(uint32_t dir, uint32_t block, uint32_t index) {
+  dindex_dir_t* d = *find_link(dir);
+  if (!d)
+    return false;
+  push_tomb(d, block, index);
+  return *find_link(dir) != NULL;
+}
+
+void dindex_set_tail(uint32_t dir, uint32_t block, uint32_t next) {
+  dindex_dir_t* d = *find_link(dir);
+  if (d) {
+    d->tail_block = block;
+    d->tail_next = next;
+  }
+}
+
+int dindex_take_slot(uint32_t dir, uint32_t* block_out, uint32_t* index_out) {
+  dindex_dir_t* d = *find_link(dir);
+  if (!d || d->tail_block == 0)
+    return -1;
+  d->tick = ++g_tick;
+  if (d->ntombs > 0) {
+    uint64_t tomb = d->tombs[--d->ntombs];
+    *block_out = (uint32_t)(tomb >> 32);
+    *index_out = (uint32_t)tomb;
+  } else {
+    *block_out = d->tail_block;
+    if (d->tail_next == d->per_block)
+      return 0;
+    *index_out = d->tail_next++;
+  }
+  g_stats.slot_hints++;
+  return 1;
+}
+
+bool dindex_usage(uint32_t dir, uint32_t* live_out, uint32_t* deleted_out) {
+  const dindex_dir_t* d = *find_link(dir);
+  if (!d)
+    return false;
+  *live_out = d->count;
+  *deleted_out = d->ntombs;
+  return true;
+}
+
+void dindex_drop(uint32_t dir) {
+  dindex_dir_t** link = find_link(dir);
+  if (*link)
+    free_table(link);
+}
+
+void dindex_clear(void) {
+  for (int b = 0; b < DIR_BUCKETS; b++) {
+    while (g_dirs[b])
+      free_table(&g_dirs[b]);
+  }
+}
+
+void dindex_destroy(void) {
+  dindex_clear();
+  memset(&g_stats, 0, sizeof(g_stats));
+}
+
+void dindex_get_stats(dindex_stats_t* out) {
+  *out = g_stats;
+}
@@ -0,0 +1,104 @@
+#ifndef PENNFAT_DIRINDEX_H
+#define PENNFAT_DIRINDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Memory all directory indexes may hold together; past it the least recently
+ * used ones are dropped. Override with -DPENNFAT_DIRINDEX_BUDGET=BYTES. */
+#ifndef PENNFAT_DIRINDEX_BUDGET
+#define PENNFAT_DIRINDEX_BUDGET (512 * 1024)
+#endif
+
+/* Counters exposed through k_stats() */
+typedef struct {
+  uint64_t lookups;     // names looked up in an indexed directory
+  uint64_t builds;      // indexes started (one directory scan each)
+  uint64_t evictions;   // indexes dropped to stay within the budget
+  uint64_t slot_hints;  // entries placed without scanning for a free slot
+  uint32_t dirs;        // directories currently indexed
+  size_t bytes;         // memory held by the indexes
+} dindex_stats_t;
+
+/*
+ * dindex_find: Looks `name` up in the index of the directory whose chain
+ * starts at `dir`. Returns 1 and the entry's block and slot if it is there,
+ * 0 if the directory has no such entry, or -1 if the directory is not
+ * indexed.
+ */
+int dindex_find(uint32_t dir,
+                const char* name,
+                uint32_t* block_out,
+                uint32_t* index_out);
+
+/*
+ * dindex_create: Starts an empty index for `dir`, whose blocks hold
+ * `per_block` entries each, replacing any old one, and makes room for it by
+ * dropping other indexes. The caller then reports every live entry with
+ * dindex_add(), every deleted one with dindex_add_tomb() and the end of the
+ * chain with dindex_set_tail(). Returns false if it does not fit.
+ */
+bool dindex_create(uint32_t dir, uint32_t per_block);
+
+/*
+ * dindex_add: Records that `name` now lives at `block`/`index` of `dir`.
+ * Ignored if `dir` is not indexed. If the name is already there or the index
+ * cannot grow, the whole index is dropped and gets rebuilt on the next
+ * lookup. Returns whether `dir` is still indexed.
+ */
+bool dindex_add(uint32_t dir,
+                const char* name,
+                uint32_t block,
+                uint32_t index);
+
+/*
+ * dindex_remove: Records that the entry `name` at `block`/`index` of `dir`
+ * was deleted, leaving a slot dindex_take_slot() can hand out again. Ignored
+ * if `dir` is not indexed.
+ */
+void dindex_remove(uint32_t dir,
+                   const char* name,
+                   uint32_t block,
+                   uint32_t index);
+
+/*
+ * dindex_add_tomb: Records a deleted entry found while building the index.
+ * Returns whether `dir` is still indexed, like dindex_add().
+ */
+bool dindex_add_tomb(uint32_t dir, uint32_t block, uint32_t index);
+
+/*
+ * dindex_set_tail: Records that `block` is the last block of `dir`'s chain
+ * and that its entries from `next` on were never used.
+ */
+void dindex_set_tail(uint32_t dir, uint32_t block, uint32_t next);
+
+/*
+ * dindex_take_slot: Claims a slot for a new entry in `dir`. Returns 1 and
+ * its block and index; 0 if every slot is taken, with the chain's last block
+ * in *block_out to link a new one to (then report it with dindex_set_tail);
+ * or -1 if `dir` is not indexed. The caller fills the slot and reports the
+ * entry with dindex_add().
+ */
+int dindex_take_slot(uint32_t dir, uint32_t* block_out, uint32_t* index_out);
+
+/*
+ * dindex_usage: Reports how many live and deleted entries the index of `dir`
+ * knows of. Returns false if `dir` is not indexed.
+ */
+bool dindex_usage(uint32_t dir, uint32_t* live_out, uint32_t* deleted_out);
+
+/* dindex_drop: Forgets the index of `dir`, e.g. when it is removed. */
+void dindex_drop(uint32_t dir);
+
+/* dindex_clear: Forgets every index (unmount, chains relocated). */
+void dindex_clear(void);
+
+/* dindex_destroy: Forgets every index and resets the counters (unmount). */
+void dindex_destroy(void);
+
+/* dindex_get_stats: Snapshot of the index counters. */
+void dindex_get_stats(dindex_stats_t* out);
+
+#endif /* PENNFAT_DIRINDEX_H */
@@ -0,0 +1,384 @@
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FATSCAN_X86 1
+#endif
+
+#include "pennfat_fatscan.h"
+
+// ---------------------------------------------------------------------------
+// FAT scan kernels
+//
+// Every scan is built on two primitives that look at 64 consecutive entries
+// and return one bit per entry: "is free" (zero) and "is valid" (free,
+// end-of-chain, or a block number in [2, limit)). With the bits in hand,
+// counting is a popcount and run searches are count-trailing-zeros steps, so
+// only the primitives differ between implementations.
+//
+// The SSE2 and AVX2 primitives compare 8/16 (narrow) or 4/8 (wide) entries
+// per instruction and pack the results into the mask with movemask. They
+// are compiled with target attributes, so the rest of the build needs no
+// -m flags, and picked at first use from what the CPU reports. Ranges that do
+// not fill a whole group of 64 entries fall back to the plain C primitive.
+// ---------------------------------------------------------------------------
+
+typedef struct {
+  const char* name;
+  uint64_t (*free64)(const void* fat, bool wide, uint32_t index);
+  uint64_t (*valid64)(const void* fat, bool wide, uint32_t index,
+                      uint32_t limit);
+} fatscan_ops_t;
+
+static inline uint32_t entry_at(const void* fat, bool wide, uint32_t index) {
+  return wide ? ((const uint32_t*)fat)[index] : ((const uint16_t*)fat)[index];
+}
+
+static inline bool entry_valid(uint32_t value, bool wide, uint32_t limit) {
+  uint32_t eoc = wide ? 0xFFFFFFFFu : 0xFFFFu;
+  return value == 0 || value == eoc || (value >= 2 && value < limit);
+}
+
+/* Plain C primitives over `n` (at most 64) entries */
+static uint64_t free_bits(const void* fat,
+                          bool wide,
+                          uint32_t index,
+                          uint32_t n) {
+  uint64_t mask = 0;
+  for (uint32_t i = 0; i < n; i++)
+    mask |= (uint64_t)(entry_at(fat, wide, index + i) == 0) << i;
+  return mask;
+}
+
+static uint64_t valid_bits(const void* fat,
+                           bool wide,
+                           uint32_t index,
+                           uint32_t limit,
+                           uint32_t n) {
+  uint64_t mask = 0;
+  for (uint32_t i = 0; i < n; i++)
+    mask |= (uint64_t)entry_valid(entry_at(fat, wide, index + i), wide, limit)
+            << i;
+  return mask;
+}
+
+static uint64_t free64_c(const void* fat, bool wide, uint32_t index) {
+  return free_bits(fat, wide, index, 64);
+}
+
+static uint64_t valid64_c(const void* fat,
+                          bool wide,
+                          uint32_t index,
+                          uint32_t limit) {
+  return valid_bits(fat, wide, index, limit, 64);
+}
+
+static const fatscan_ops_t ops_c = {"c", free64_c, valid64_c};
+
+#ifdef FATSCAN_X86
+
+// Unsigned range checks use signed compares on values with the top bit
+// flipped, since SSE2/AVX2 only compare signed integers
+
+__attribute__((target("sse2"))) static uint64_t free64_sse2(const void* fat,
+                                                            bool wide,
+                                                            uint32_t index) {
+  const __m128i zero = _mm_setzero_si128();
+  uint64_t mask = 0;
+  if (wide) {
+    const __m128i* p = (const __m128i*)((const uint32_t*)fat + index);
+    for (int i = 0; i < 16; i++) {
+      __m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128(p + i), zero);
+      mask |= (uint64_t)_mm_movemask_ps(_mm_castsi128_ps(eq)) << (4 * i);
+    }
+  } else {
+    const __m128i* p = (const __m128i*)((const uint16_t*)fat + index);
+    for (int i = 0; i < 4; i++) {
+      __m128i a = _mm_cmpeq_epi16(_mm_loadu_si128(p + 2 * i), zero);
+      __m128i b = _mm_cmpeq_epi16(_mm_loadu_si128(p + 2 * i + 1), zero);
+      mask |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_packs_epi16(a, b))
+              << (16 * i);
+    }
+  }
+  return mask;
+}
+
+__attribute__((target("sse2"))) static uint64_t valid64_sse2(const void* fat,
+                                                             bool wide,
+                                                             uint32_t index,
+                                                             uint32_t limit) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ones = _mm_set1_epi32(-1);
+  uint64_t mask = 0;
+  if (wide) {
+    const __m128i bias = _mm_set1_epi32(INT32_MIN);
+    const __m128i lo = _mm_set1_epi32((int32_t)(1u ^ 0x80000000u));
+    const __m128i hi = _mm_set1_epi32((int32_t)(limit ^ 0x80000000u));
+    const __m128i* p = (const __m128i*)((const uint32_t*)fat + index);
+    for (int i = 0; i < 16; i++) {
+      __m128i v = _mm_loadu_si128(p + i);
+      __m128i x = _mm_xor_si128(v, bias);
+      __m128i in_range =
+          _mm_and_si128(_mm_cmpgt_epi32(x, lo), _mm_cmpgt_epi32(hi, x));
+      __m128i ok = _mm_or_si128(
+          _mm_or_si128(_mm_cmpeq_epi32(v, zero), _mm_cmpeq_epi32(v, ones)),
+          in_range);
+      mask |= (uint64_t)_mm_movemask_ps(_mm_castsi128_ps(ok)) << (4 * i);
+    }
+  } else {
+    if (limit > 0xFFFF)
+      limit = 0xFFFF;
+    const __m128i bias = _mm_set1_epi16(INT16_MIN);
+    const __m128i lo = _mm_set1_epi16((int16_t)(1u ^ 0x8000u));
+    const __m128i hi = _mm_set1_epi16((int16_t)(limit ^ 0x8000u));
+    const __m128i* p = (const __m128i*)((const uint16_t*)fat + index);
+    __m128i ok[2];
+    for (int i = 0; i < 8; i++) {
+      __m128i v = _mm_loadu_si128(p + i);
+      __m128i x = _mm_xor_si128(v, bias);
+      __m128i in_range =
+          _mm_and_si128(_mm_cmpgt_epi16(x, lo), _mm_cmpgt_epi16(hi, x));
+      ok[i & 1] = _mm_or_si128(
+          _mm_or_si128(_mm_cmpeq_epi16(v, zero), _mm_cmpeq_epi16(v, ones)),
+          in_range);
+      if (i & 1)
+        mask |= (uint64_t)(uint16_t)_mm_movemask_epi8(
+                    _mm_packs_epi16(ok[0], ok[1]))
+                << (8 * (i - 1));
+    }
+  }
+  return mask;
+}
+
+static const fatscan_ops_t ops_sse2 = {"sse2", free64_sse2, valid64_sse2};
+
+/* Packs two vectors of 16-bit masks into 32 mask bits, in entry order
+   (packs works per 128-bit lane, so the quadwords come out interleaved) */
+__attribute__((target("avx2"))) static inline uint32_t pack16_avx2(__m256i a,
+                                                                   __m256i b) {
+  __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi16(a, b), 0xD8);
+  return (uint32_t)_mm256_movemask_epi8(packed);
+}
+
+__attribute__((target("avx2"))) static uint64_t free64_avx2(const void* fat,
+                                                            bool wide,
+                                                            uint32_t index) {
+  const __m256i zero = _mm256_setzero_si256();
+  uint64_t mask = 0;
+  if (wide) {
+    const __m256i* p = (const __m256i*)((const uint32_t*)fat + index);
+    for (int i = 0; i < 8; i++) {
+      __m256i eq = _mm256_cmpeq_epi32(_mm256_loadu_si256(p + i), zero);
+      mask |= (uint64_t)_mm256_movemask_ps(_mm256_castsi256_ps(eq)) << (8 * i);
+    }
+  } else {
+    const __m256i* p = (const __m256i*)((const uint16_t*)fat + index);
+    for (int i = 0; i < 2; i++) {
+      __m256i a = _mm256_cmpeq_epi16(_mm256_loadu_si256(p + 2 * i), zero);
+      __m256i b = _mm256_cmpeq_epi16(_mm256_loadu_si256(p + 2 * i + 1), zero);
+      mask |= (uint64_t)pack16_avx2(a, b) << (32 * i);
+    }
+  }
+  return mask;
+}
+
+__attribute__((target("avx2"))) static uint64_t valid64_avx2(const void* fat,
+                                                             bool wide,
+                                                             uint32_t index,
+                                                             uint32_t limit) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i ones = _mm256_set1_epi32(-1);
+  uint64_t mask = 0;
+  if (wide) {
+    const __m256i bias = _mm256_set1_epi32(INT32_MIN);
+    const __m256i lo = _mm256_set1_epi32((int32_t)(1u ^ 0x80000000u));
+    const __m256i hi = _mm256_set1_epi32((int32_t)(limit ^ 0x80000000u));
+    const __m256i* p = (const __m256i*)((const uint32_t*)fat + index);
+    for (int i = 0; i < 8; i++) {
+      __m256i v = _mm256_loadu_si256(p + i);
+      __m256i x = _mm256_xor_si256(v, bias);
+      __m256i in_range = _mm256_and_si256(_mm256_cmpgt_epi32(x, lo),
+                                          _mm256_cmpgt_epi32(hi, x));
+      __m256i ok = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi32(v, zero),
+                                                   _mm256_cmpeq_epi32(v, ones)),
+                                   in_range);
+      mask |= (uint64_t)_mm256_movemask_ps(_mm256_castsi256_ps(ok)) << (8 * i);
+    }
+  } else {
+    if (limit > 0xFFFF)
+      limit = 0xFFFF;
+    const __m256i bias = _mm256_set1_epi16(INT16_MIN);
+    const __m256i lo = _mm256_set1_epi16((int16_t)(1u ^ 0x8000u));
+    const __m256i hi = _mm256_set1_epi16((int16_t)(limit ^ 0x8000u));
+    const __m256i* p = (const __m256i*)((const uint16_t*)fat + index);
+    __m256i ok[2];
+    for (int i = 0; i < 4; i++) {
+      __m256i v = _mm256_loadu_si256(p + i);
+      __m256i x = _mm256_xor_si256(v, bias);
+      __m256i in_range = _mm256_and_si256(_mm256_cmpgt_epi16(x, lo),
+                                          _mm256_cmpgt_epi16(hi, x));
+      ok[i & 1] = _mm256_or_si256(
+          _mm256_or_si256(_mm256_cmpeq_epi16(v, zero),
+                          _mm256_cmpeq_epi16(v, ones)),
+          in_range);
+      if (i & 1)
+        mask |= (uint64_t)pack16_avx2(ok[0], ok[1]) << (16 * (i - 1));
+    }
+  }
+  return mask;
+}
+
+static const fatscan_ops_t ops_avx2 = {"avx2", free64_avx2, valid64_avx2};
+
+#endif /* FATSCAN_X86 */
+
+static const fatscan_ops_t* g_ops = NULL;
+
+static const fatscan_ops_t* ops(void) {
+  const fatscan_ops_t* o = __atomic_load_n(&g_ops, __ATOMIC_ACQUIRE);
+  if (o)
+    return o;
+  o = &ops_c;
+#ifdef FATSCAN_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    o = &ops_avx2;
+  else if (__builtin_cpu_supports("sse2"))
+    o = &ops_sse2;
+#endif
+  __atomic_store_n(&g_ops, o, __ATOMIC_RELEASE);
+  return o;
+}
+
+/* Free bits for the up to 64 entries from `index`, bounded by `to` */
+static inline uint64_t free_group(const fatscan_ops_t* o,
+                                  const void* fat,
+                                  bool wide,
+                                  uint32_t index,
+                                  uint32_t to) {
+  if (to - index >= 64)
+    return o->free64(fat, wide, index);
+  return free_bits(fat, wide, index, to - index);
+}
+
+uint32_t fatscan_free_mask(const void* fat,
+                           uint32_t entry_size,
+                           uint32_t from,
+                           uint32_t to,
+                           uint64_t* words) {
+  const fatscan_ops_t* o = ops();
+  bool wide = entry_size == sizeof(uint32_t);
+  uint32_t nfree = 0;
+  for (uint32_t i = from; i < to; i += 64) {
+    uint64_t mask = free_group(o, fat, wide, i, to);
+    words[(i - from) / 64] = mask;
+    nfree += (uint32_t)__builtin_popcountll(mask);
+    if (to - i <= 64)
+      break;  // i += 64 could wrap
+  }
+  return nfree;
+}
+
+uint32_t fatscan_count_free(const void* fat,
+                            uint32_t entry_size,
+                            uint32_t from,
+                            uint32_t to) {
+  const fatscan_ops_t* o = ops();
+  bool wide = entry_size == sizeof(uint32_t);
+  uint32_t nfree = 0;
+  for (uint32_t i = from; i < to; i += 64) {
+    nfree += (uint32_t)__builtin_popcountll(free_group(o, fat, wide, i, to));
+    if (to - i <= 64)
+      break;
+  }
+  return nfree;
+}
+
+uint32_t fatscan_find_free_run(const void* fat,
+                               uint32_t entry_size,
+                               uint32_t from,
+                               uint32_t to,
+                               uint32_t k) {
+  if (k == 0 || from >= to)
+    return from < to ? from : to;
+  const fatscan_ops_t* o = ops();
+  bool wide = entry_size == sizeof(uint32_t);
+  uint32_t run_start = from;
+  uint32_t run_len = 0;
+  for (uint32_t i = from; i < to; i += 64) {
+    uint32_t nbits = to - i < 64 ? to - i : 64;
+    uint64_t mask = free_group(o, fat, wide, i, to);
+    uint32_t pos = 0;
+    while (pos < nbits) {
+      uint64_t rest = mask >> pos;
+      if (rest & 1) {
+        uint32_t ones =
+            ~rest == 0 ? 64 - pos : (uint32_t)__builtin_ctzll(~rest);
+        if (ones > nbits - pos)
+          ones = nbits - pos;
+        if (run_len == 0)
+          run_start = i + pos;
+        run_len += ones;
+        if (run_len >= k)
+          return run_start;
+        pos += ones;
+      } else {
+        run_len = 0;
+        if (rest == 0)
+          break;
+        pos += (uint32_t)__builtin_ctzll(rest);
+      }
+    }
+    if (to - i <= 64)
+      break;
+  }
+  return to;
+}
+
+uint32_t fatscan_count_invalid(const void* fat,
+                               uint32_t entry_size,
+                               uint32_t from,
+                               uint32_t to,
+                               uint32_t limit,
+                               uint32_t* first) {
+  const fatscan_ops_t* o = ops();
+  bool wide = entry_size == sizeof(uint32_t);
+  uint32_t invalid = 0;
+  uint32_t lowest = to;
+  for (uint32_t i = from; i < to; i += 64) {
+    uint32_t nbits = to - i < 64 ? to - i : 64;
+    uint64_t bad = nbits == 64 ? ~o->valid64(fat, wide, i, limit)
+                               : ~valid_bits(fat, wide, i, limit, nbits) &
+                                     ((1ull << nbits) - 1);
+    if (bad && lowest == to)
+      lowest = i + (uint32_t)__builtin_ctzll(bad);
+    invalid += (uint32_t)__builtin_popcountll(bad);
+    if (to - i <= 64)
+      break;
+  }
+  if (first)
+    *first = lowest;
+  return invalid;
+}
+
+const char* fatscan_impl(void) {
+  return ops()->name;
+}
+
+int fatscan_select(const char* name) {
+  const fatscan_ops_t* o = NULL;
+  if (strcmp(name, "c") == 0)
+    o = &ops_c;
+#ifdef FATSCAN_X86
+  __builtin_cpu_init();
+  if (strcmp(name, "sse2") == 0 && __builtin_cpu_supports("sse2"))
+    o = &ops_sse2;
+  if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2"))
+    o = &ops_avx2;
+#endif
+  if (!o)
+    return -1;
+  __atomic_store_n(&g_ops, o, __ATOMIC_RELEASE);
+  return 0;
+}
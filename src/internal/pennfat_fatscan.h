@@ -0,0 +1,61 @@
+#ifndef PENNFAT_FATSCAN_H
+#define PENNFAT_FATSCAN_H
+
+#include <stdint.h>
+
+/*
+ * Bulk scans over a FAT of `entry_size`-byte entries (2 for narrow images, 4
+ * for wide ones), 64 entries per step. Each scan runs on the widest
+ * implementation the host supports (AVX2, SSE2 or plain C), picked on first
+ * use. Entry indexes are absolute; [from, to) is the range scanned.
+ */
+
+/*
+ * fatscan_free_mask: Sets bit (i - from) % 64 of words[(i - from) / 64] for
+ * every free (zero) entry i in [from, to) and clears the rest of the bits up
+ * to the next multiple of 64. Returns the number of free entries.
+ */
+uint32_t fatscan_free_mask(const void* fat,
+                           uint32_t entry_size,
+                           uint32_t from,
+                           uint32_t to,
+                           uint64_t* words);
+
+/* fatscan_count_free: Number of free entries in [from, to). */
+uint32_t fatscan_count_free(const void* fat,
+                            uint32_t entry_size,
+                            uint32_t from,
+                            uint32_t to);
+
+/*
+ * fatscan_find_free_run: First entry of the lowest run of at least `k`
+ * consecutive free entries in [from, to), or `to` if there is none.
+ */
+uint32_t fatscan_find_free_run(const void* fat,
+                               uint32_t entry_size,
+                               uint32_t from,
+                               uint32_t to,
+                               uint32_t k);
+
+/*
+ * fatscan_count_invalid: Number of entries in [from, to) that are neither
+ * free, end-of-chain (all ones), nor a block number in [2, limit). *first
+ * (if not NULL) gets the lowest such entry, or `to`.
+ */
+uint32_t fatscan_count_invalid(const void* fat,
+                               uint32_t entry_size,
+                               uint32_t from,
+                               uint32_t to,
+                               uint32_t limit,
+                               uint32_t* first);
+
+/* fatscan_impl: Name of the implementation in use ("avx2", "sse2", "c"). */
+const char* fatscan_impl(void);
+
+/*
+ * fatscan_select: Switches to the named implementation, e.g. to compare
+ * them. Returns 0, or -1 if the host cannot run it.
+ */
+int fatscan_select(const char* name);
+
+#endif /* PENNFAT_FATSCAN_H */
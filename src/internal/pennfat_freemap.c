@@ -0,0 +1,218 @@
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "pennfat_fatscan.h"
+#include "pennfat_freemap.h"
+
+// ---------------------------------------------------------------------------
+// Free-space index
+//
+// One bit per FAT entry (set = free) packed into 64-bit words, plus a
+// summary level with one bit per word that still has a free block in it.
+// A 32-block FAT of 4 KiB blocks has 64 Ki entries: 1024 words and 16
+// summary words, so finding the next non-empty word is a handful of
+// count-trailing-zeros steps instead of a walk over the FAT. A wide image
+// with 16 Mi entries needs 2 MiB of words and 32 KiB of summary.
+//
+// Allocation is next-fit: the search starts where the previous one ended,
+// so filling the disk is linear overall and freed blocks behind the cursor
+// are picked up again after it wraps. fmap_alloc_run() hands out a whole
+// run of consecutive free entries at once, preferring the entry right after
+// the caller's chain tail and otherwise the first run long enough for the
+// request, so a file grown by large writes stays physically contiguous. On
+// fragmented free space it gives up after a bounded number of runs and takes
+// the longest of them, keeping each call cheap.
+//
+// The FAT stays the source of truth; the kernel rebuilds the index at every
+// mount (one bulk scan, see pennfat_fatscan.c) and reports each change to a
+// FAT entry's free/used state through fmap_alloc/fmap_alloc_run/fmap_release.
+// ---------------------------------------------------------------------------
+
+static uint64_t* g_words = NULL;    // bit b of word w: entry w * 64 + b free
+static uint64_t* g_summary = NULL;  // bit w of summary word s: word s * 64 + w
+static uint32_t g_nwords = 0;
+static uint32_t g_nsummary = 0;
+static uint32_t g_first = 0;    // lowest allocatable entry
+static uint32_t g_entries = 0;  // one past the highest allocatable entry
+static uint32_t g_cursor = 0;   // next-fit starting point
+static uint32_t g_free = 0;
+
+static inline void set_free(uint32_t block) {
+  uint32_t w = block >> 6;
+  g_words[w] |= 1ull << (block & 63);
+  g_summary[w >> 6] |= 1ull << (w & 63);
+}
+
+static inline void set_used(uint32_t block) {
+  uint32_t w = block >> 6;
+  g_words[w] &= ~(1ull << (block & 63));
+  if (g_words[w] == 0)
+    g_summary[w >> 6] &= ~(1ull << (w & 63));
+}
+
+/* First word at or after `from` with a free bit, or g_nwords if none */
+static uint32_t next_word(uint32_t from) {
+  uint32_t s = from >> 6;
+  if (s >= g_nsummary)
+    return g_nwords;
+  uint64_t bits = g_summary[s] & (~0ull << (from & 63));
+  while (!bits) {
+    if (++s >= g_nsummary)
+      return g_nwords;
+    bits = g_summary[s];
+  }
+  return (s << 6) + (uint32_t)__builtin_ctzll(bits);
+}
+
+/* Lowest free block at or after `from`, or g_entries if none */
+static uint32_t next_free(uint32_t from) {
+  if (from >= g_entries)
+    return g_entries;
+  uint32_t w = from >> 6;
+  uint64_t bits = g_words[w] & (~0ull << (from & 63));
+  if (!bits) {
+    w = next_word(w + 1);
+    if (w >= g_nwords)
+      return g_entries;
+    bits = g_words[w];
+  }
+  return (w << 6) + (uint32_t)__builtin_ctzll(bits);
+}
+
+/* Free blocks in a row starting at `block`, counting at most `max`. Each
+   word is one count-trailing-zeros step; bits past g_entries are never set. */
+static uint32_t run_length(uint32_t block, uint32_t max) {
+  uint32_t n = 0;
+  while (n < max && block + n < g_entries) {
+    uint32_t b = block + n;
+    uint64_t used = ~(g_words[b >> 6] >> (b & 63));
+    uint32_t ones = used ? (uint32_t)__builtin_ctzll(used) : 64;
+    n += ones;
+    if (ones < 64 - (b & 63))
+      break;  // the run ends inside this word
+  }
+  return n < max ? n : max;
+}
+
+/* Marks [block, block + count) used and moves the cursor past it */
+static void claim(uint32_t block, uint32_t count) {
+  for (uint32_t i = 0; i < count; i++)
+    set_used(block + i);
+  g_free -= count;
+  g_cursor = block + count < g_entries ? block + count : g_first;
+}
+
+PennFatErr fmap_init(const void* fat,
+                     uint32_t entry_size,
+                     uint32_t first,
+                     uint32_t nentries) {
+  if (!fat || first >= nentries ||
+      (entry_size != sizeof(uint16_t) && entry_size != sizeof(uint32_t)))
+    return PennFatErr_INVAD;
+  fmap_destroy();
+
+  g_nwords = (nentries + 63) / 64;
+  g_nsummary = (g_nwords + 63) / 64;
+  g_words = calloc(g_nwords, sizeof(uint64_t));
+  g_summary = calloc(g_nsummary, sizeof(uint64_t));
+  if (!g_words || !g_summary) {
+    fmap_destroy();
+    return PennFatErr_OUTOFMEM;
+  }
+
+  g_first = first;
+  g_entries = nentries;
+
+  // One bulk scan fills the words 64 entries at a time; the entries below
+  // `first` are never handed out, whatever their FAT value
+  g_free = fatscan_free_mask(fat, entry_size, 0, nentries, g_words);
+  for (uint32_t i = 0; i < first; i++) {
+    if (g_words[i >> 6] & (1ull << (i & 63))) {
+      g_words[i >> 6] &= ~(1ull << (i & 63));
+      g_free--;
+    }
+  }
+  for (uint32_t w = 0; w < g_nwords; w++) {
+    if (g_words[w])
+      g_summary[w >> 6] |= 1ull << (w & 63);
+  }
+  g_cursor = first;
+  return PennFatErr_OK;
+}
+
+void fmap_destroy(void) {
+  free(g_words);
+  free(g_summary);
+  g_words = NULL;
+  g_summary = NULL;
+  g_nwords = 0;
+  g_nsummary = 0;
+  g_entries = 0;
+  g_free = 0;
+}
+
+int fmap_alloc(void) {
+  if (g_free == 0)
+    return -1;
+
+  uint32_t block = next_free(g_cursor);
+  if (block >= g_entries)
+    block = next_free(g_first);
+  claim(block, 1);
+  return (int)block;
+}
+
+int fmap_alloc_run(uint32_t hint, uint32_t want, uint32_t* count_out) {
+  if (g_free == 0 || want == 0)
+    return -1;
+
+  uint32_t best = g_entries;
+  uint32_t best_len = 0;
+  if (hint >= g_first && hint < g_entries) {
+    best = hint;
+    best_len = run_length(hint, want);
+  }
+
+  // Next-fit: from the cursor to the end, then from the start to the cursor.
+  // At most PENNFAT_FMAP_RUN_PROBES runs are looked at, so a request no run
+  // can satisfy settles for the longest nearby one instead of visiting every
+  // hole on the disk, and a caller growing a chain piece by piece pays for
+  // each piece, not for the whole free space each time.
+  uint32_t probes = PENNFAT_FMAP_RUN_PROBES;
+  for (int pass = 0; pass < 2 && best_len < want && probes > 0; pass++) {
+    uint32_t stop = pass ? g_cursor : g_entries;
+    uint32_t len = 0;
+    for (uint32_t b = next_free(pass ? g_first : g_cursor);
+         b < stop && probes > 0; b = next_free(b + len)) {
+      probes--;
+      len = run_length(b, want);
+      if (len > best_len) {
+        best = b;
+        best_len = len;
+        if (len == want)
+          break;
+      }
+    }
+  }
+
+  claim(best, best_len);
+  *count_out = best_len;
+  return (int)best;
+}
+
+void fmap_release(uint32_t block) {
+  if (!g_words || block < g_first || block >= g_entries)
+    return;
+  if (g_words[block >> 6] & (1ull << (block & 63)))
+    return;  // already free
+  set_free(block);
+  g_free++;
+}
+
+uint32_t fmap_free_count(void) {
+  return g_free;
+}
+
+uint32_t fmap_capacity(void) {
+  return g_entries > g_first ? g_entries - g_first : 0;
+}
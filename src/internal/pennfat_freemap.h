@@ -0,0 +1,54 @@
+#ifndef PENNFAT_FREEMAP_H
+#define PENNFAT_FREEMAP_H
+
+#include <stdint.h>
+
+#include "../common/pennfat_errors.h"
+
+/*
+ * fmap_init: Builds the free-space index from the FAT, whose entries are
+ * `entry_size` bytes wide (2 for narrow images, 4 for wide ones). Entries
+ * [first, nentries) that are 0 start out free; everything below `first` is
+ * never handed out. Must be called once per mount.
+ */
+PennFatErr fmap_init(const void* fat,
+                     uint32_t entry_size,
+                     uint32_t first,
+                     uint32_t nentries);
+
+/* fmap_destroy: Releases the index. */
+void fmap_destroy(void);
+
+/*
+ * fmap_alloc: Claims the first free block at or after the next-fit cursor,
+ * wrapping around once, and moves the cursor past it. Returns -1 when no
+ * block is free. The caller updates the FAT entry itself.
+ */
+int fmap_alloc(void);
+
+/* Free runs fmap_alloc_run() examines before it settles for the longest one
+ * seen. Override at build time with -DPENNFAT_FMAP_RUN_PROBES=N. */
+#ifndef PENNFAT_FMAP_RUN_PROBES
+#define PENNFAT_FMAP_RUN_PROBES 64
+#endif
+
+/*
+ * fmap_alloc_run: Claims up to `want` consecutive free blocks and returns the
+ * first one, or -1 when no block is free. The run starts at `hint` if that
+ * block is free and the run there is at least as long as any other; otherwise
+ * at the first run after the cursor that covers `want`, or the longest of the
+ * first PENNFAT_FMAP_RUN_PROBES runs found. *count_out receives the run
+ * length (at least 1).
+ */
+int fmap_alloc_run(uint32_t hint, uint32_t want, uint32_t* count_out);
+
+/* fmap_release: Marks `block` free again after its FAT entry was cleared. */
+void fmap_release(uint32_t block);
+
+/* fmap_free_count: Number of free blocks, kept up to date in O(1). */
+uint32_t fmap_free_count(void);
+
+/* fmap_capacity: Number of allocatable blocks (nentries - first). */
+uint32_t fmap_capacity(void);
+
+#endif /* PENNFAT_FREEMAP_H */
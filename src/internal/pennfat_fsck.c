@@ -0,0 +1,699 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../common/pennfat_definitions.h"
+#include "pennfat_fatscan.h"
+#include "pennfat_fsck.h"
+
+// ---------------------------------------------------------------------------
+// Offline consistency check
+//
+// fsck_run() maps an unmounted image and checks it in three passes:
+//
+// 1. Tree walk. Worker threads take directories and files off a shared
+//    queue. A directory's worker walks its chain, validates each entry and
+//    queues the subdirectories and files it finds; a file's worker walks its
+//    chain and checks the size against it. Every block walked is claimed in
+//    an owner table with a compare-and-swap, so a block reached twice by one
+//    chain is a loop and a block reached by two chains is a cross-link, no
+//    matter which threads walked them or in what order.
+// 2. Leak scan. The FAT is split into one range per thread; an allocated
+//    entry that no chain claimed is leaked. Free entries are skipped 64 at a
+//    time with the bulk scans from pennfat_fatscan.c.
+// 3. Symlinks collected in pass 1 are resolved against the tree, absolute
+//    targets from the root and relative ones from the link's directory.
+//
+// With repair, a broken chain is ended at its last good block and the size
+// clamped to what is left; entries that are garbage, were deleted while open
+// or have no valid first block are deleted; "." and ".." are rewritten; and
+// leaked blocks (including those of deleted entries) are freed. Of two
+// cross-linked chains, the one walked second loses the shared blocks.
+// Dangling symlinks are only reported.
+// ---------------------------------------------------------------------------
+
+#define FSCK_PATH_MAX 256
+#define FSCK_SYMLINK_DEPTH 8
+
+typedef enum { ITEM_DIR, ITEM_FILE } fsck_kind_t;
+
+typedef struct {
+  fsck_kind_t kind;
+  dir_entry_t* entry;  // in the mapping; NULL for the root directory
+  uint32_t dir_block;  // first block of the directory holding `entry`
+  char path[FSCK_PATH_MAX];
+} fsck_item_t;
+
+// Image geometry
+static char* g_base = NULL;  // whole image, mapped
+static size_t g_len = 0;
+static char* g_fat = NULL;  // FAT inside g_base
+static bool g_wide = false;
+static uint32_t g_block_size = 0;
+static uint32_t g_entries = 0;  // block numbers below this are in the image
+static size_t g_data_offset = 0;
+
+// Pass state
+static uint32_t* g_owner = NULL;  // chain id per block, 0 = unclaimed
+static uint32_t g_next_id = 0;
+static bool g_repair = false;
+static pennfat_fsck_report_t* g_report = NULL;
+static pennfat_fsck_fn g_fn = NULL;
+static void* g_fn_arg = NULL;
+static pthread_mutex_t g_report_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Work queue (pass 1) and the symlinks it collects, both under g_queue_lock
+static fsck_item_t** g_queue = NULL;
+static size_t g_queue_len = 0;
+static size_t g_queue_cap = 0;
+static uint32_t g_busy = 0;  // workers processing an item
+static fsck_item_t** g_links = NULL;
+static size_t g_links_len = 0;
+static size_t g_links_cap = 0;
+static pthread_mutex_t g_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_queue_cond = PTHREAD_COND_INITIALIZER;
+
+static inline uint32_t fat_get(uint32_t index) {
+  if (g_wide)
+    return ((const uint32_t*)g_fat)[index];
+  uint16_t entry = ((const uint16_t*)g_fat)[index];
+  return entry == FAT_EOC_NARROW ? FAT_EOC : entry;
+}
+
+static inline void fat_set(uint32_t index, uint32_t value) {
+  if (g_wide)
+    ((uint32_t*)g_fat)[index] = value;
+  else
+    ((uint16_t*)g_fat)[index] = (uint16_t)value;
+}
+
+static inline uint32_t dirent_block(const dir_entry_t* e) {
+  if (!g_wide)
+    return e->first_block == FAT_EOC_NARROW ? FAT_EOC : e->first_block;
+  return (uint32_t)e->first_block_hi << 16 | e->first_block;
+}
+
+static inline void dirent_set_block(dir_entry_t* e, uint32_t block) {
+  e->first_block = (uint16_t)block;
+  e->first_block_hi = g_wide ? (uint16_t)(block >> 16) : 0;
+}
+
+static inline char* block_ptr(uint32_t block) {
+  return g_base + g_data_offset + (size_t)(block - 1) * g_block_size;
+}
+
+static inline void count(uint32_t* counter, uint32_t n) {
+  __atomic_add_fetch(counter, n, __ATOMIC_RELAXED);
+}
+
+/*
+ * problem: Counts `n` problems in *counter (and as repaired when repairing
+ * and `fixable`) and hands the formatted description to the callback. A NULL
+ * counter only passes the message on.
+ */
+static void problem(uint32_t* counter,
+                    uint32_t n,
+                    bool fixable,
+                    const char* fmt,
+                    ...) {
+  char line[2 * FSCK_PATH_MAX];
+  va_list ap;
+  va_start(ap, fmt);
+  vsnprintf(line, sizeof(line), fmt, ap);
+  va_end(ap);
+
+  pthread_mutex_lock(&g_report_lock);
+  if (counter)
+    *counter += n;
+  if (counter && g_repair && fixable)
+    g_report->repaired += n;
+  if (g_fn)
+    g_fn(line, g_fn_arg);
+  pthread_mutex_unlock(&g_report_lock);
+}
+
+/*
+ * read_geometry: Works out the format of the image mapped at g_base, the
+ * same way k_mount does. Returns PennFatErr_INVAD if it is not PennFAT.
+ */
+static PennFatErr read_geometry(void) {
+  if (g_len < sizeof(pennfat_superblock_t))
+    return PennFatErr_INVAD;
+
+  uint32_t fat_blocks;
+  pennfat_superblock_t sb;
+  memcpy(&sb, g_base, sizeof(sb));
+  if (memcmp(sb.magic, PENNFAT_MAGIC, sizeof(sb.magic)) == 0) {
+    bool known_size = false;
+    for (int i = 0; i <= PENNFAT_WIDE_MAX_BLOCK_CONFIG; i++)
+      known_size |= sb.block_size == 256u << i;
+    if (sb.version != PENNFAT_VERSION_WIDE || !known_size ||
+        sb.fat_blocks < 1 || sb.fat_blocks > PENNFAT_WIDE_MAX_FAT_BLOCKS ||
+        sb.root_block != 1 || sb.fat_entries < 3 ||
+        sb.fat_entries > (uint64_t)sb.fat_blocks * sb.block_size / 4)
+      return PennFatErr_INVAD;
+    g_wide = true;
+    g_block_size = sb.block_size;
+    fat_blocks = sb.fat_blocks;
+    g_entries = sb.fat_entries;
+    g_data_offset = (size_t)(1 + fat_blocks) * g_block_size;
+    g_fat = g_base + g_block_size;
+  } else {
+    uint16_t super_entry;
+    memcpy(&super_entry, g_base, sizeof(super_entry));
+    uint32_t config = super_entry & 0xFF;
+    fat_blocks = super_entry >> 8;
+    if (config > PENNFAT_NARROW_MAX_BLOCK_CONFIG || fat_blocks < 1 ||
+        fat_blocks > PENNFAT_NARROW_MAX_FAT_BLOCKS)
+      return PennFatErr_INVAD;
+    g_wide = false;
+    g_block_size = 256u << config;
+    g_entries = fat_blocks * g_block_size / sizeof(uint16_t);
+    if (g_entries > FAT_EOC_NARROW)
+      g_entries = FAT_EOC_NARROW;
+    g_data_offset = (size_t)fat_blocks * g_block_size;
+    g_fat = g_base;
+  }
+
+  // A truncated image only holds the blocks that fit in it
+  if (g_len < g_data_offset + g_block_size)
+    return PennFatErr_INVAD;
+  size_t in_image = (g_len - g_data_offset) / g_block_size + 1;
+  if (in_image < g_entries)
+    g_entries = (uint32_t)in_image;
+  return PennFatErr_OK;
+}
+
+/*
+ * walk_chain: Claims the chain starting at `first` for chain `id`, stopping
+ * at its end or at the first bad link, which is reported. *len gets the
+ * blocks claimed and *last the last of them (0 if even `first` was bad).
+ * Returns true if the chain ended cleanly.
+ */
+static bool walk_chain(uint32_t first,
+                       uint32_t id,
+                       const char* path,
+                       uint32_t* len,
+                       uint32_t* last) {
+  *len = 0;
+  *last = 0;
+  for (uint32_t block = first; block != FAT_EOC; block = fat_get(block)) {
+    // Block 1 needs no special case: the root directory, walked before
+    // anything else, claims it, so any other chain reaching it is cross-linked
+    if (block == FAT_FREE || block >= g_entries) {
+      problem(&g_report->bad_chains, 1, true,
+              "%s: chain %s at block %u (link %u)", path,
+              block == FAT_FREE ? "runs into a free block"
+                                : "leaves the data region",
+              *last, block);
+      return false;
+    }
+    uint32_t owner = 0;
+    if (!__atomic_compare_exchange_n(&g_owner[block], &owner, id, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      if (owner == id)
+        problem(&g_report->bad_chains, 1, true,
+                "%s: chain loops back to block %u after %u blocks", path,
+                block, *len);
+      else
+        problem(&g_report->cross_links, 1, true,
+                "%s: chain is cross-linked with another at block %u", path,
+                block);
+      return false;
+    }
+    (*len)++;
+    *last = block;
+  }
+  return true;
+}
+
+/*
+ * end_chain: Repairs a chain walk_chain() stopped early: ends it at its last
+ * good block, or deletes the entry if there was none. Returns false if the
+ * entry was deleted.
+ */
+static bool end_chain(dir_entry_t* entry, uint32_t last) {
+  if (!g_repair)
+    return true;
+  if (last != 0) {
+    fat_set(last, FAT_EOC);
+    return true;
+  }
+  if (entry)
+    entry->name[0] = 1;
+  return false;
+}
+
+static void enqueue(fsck_item_t* item) {
+  pthread_mutex_lock(&g_queue_lock);
+  if (g_queue_len == g_queue_cap) {
+    size_t cap = g_queue_cap ? 2 * g_queue_cap : 64;
+    fsck_item_t** grown = realloc(g_queue, cap * sizeof(*grown));
+    if (!grown) {
+      pthread_mutex_unlock(&g_queue_lock);
+      problem(NULL, 0, false, "%s: out of memory, not checked", item->path);
+      free(item);
+      return;
+    }
+    g_queue = grown;
+    g_queue_cap = cap;
+  }
+  g_queue[g_queue_len++] = item;
+  pthread_cond_signal(&g_queue_cond);
+  pthread_mutex_unlock(&g_queue_lock);
+}
+
+/* keep_link: Remembers a symlink for pass 3. Returns false if it was not. */
+static bool keep_link(fsck_item_t* item) {
+  pthread_mutex_lock(&g_queue_lock);
+  if (g_links_len == g_links_cap) {
+    size_t cap = g_links_cap ? 2 * g_links_cap : 16;
+    fsck_item_t** grown = realloc(g_links, cap * sizeof(*grown));
+    if (!grown) {
+      pthread_mutex_unlock(&g_queue_lock);
+      return false;
+    }
+    g_links = grown;
+    g_links_cap = cap;
+  }
+  g_links[g_links_len++] = item;
+  pthread_mutex_unlock(&g_queue_lock);
+  return true;
+}
+
+static uint32_t new_chain_id(void) {
+  return __atomic_add_fetch(&g_next_id, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * check_file: Pass 1 for a regular file or symlink. Returns true if the item
+ * was kept for pass 3.
+ */
+static bool check_file(fsck_item_t* item) {
+  dir_entry_t* e = item->entry;
+  uint32_t len;
+  uint32_t last;
+  if (!walk_chain(dirent_block(e), new_chain_id(), item->path, &len, &last) &&
+      !end_chain(e, last))
+    return false;
+  count(&g_report->blocks_used, len);
+  if (len == 0)
+    return false;  // no usable first block; reported above
+
+  uint64_t capacity = (uint64_t)len * g_block_size;
+  if (e->size > capacity) {
+    problem(&g_report->size_errors, 1, true,
+            "%s: size %u is larger than its %u block(s)", item->path, e->size,
+            len);
+    if (g_repair)
+      e->size = (uint32_t)capacity;
+  }
+
+  if (e->type != 4)
+    return false;
+  if (e->size == 0 || e->size >= FSCK_PATH_MAX || e->size > g_block_size) {
+    problem(&g_report->bad_entries, 1, true,
+            "%s: symlink target length %u is invalid", item->path, e->size);
+    if (g_repair)
+      e->name[0] = 1;
+    return false;
+  }
+  return keep_link(item);
+}
+
+/*
+ * check_dot: Checks that "." or ".." in directory `path` points at `want`.
+ */
+static void check_dot(dir_entry_t* e, uint32_t want, const char* path) {
+  if (e->type == 2 && dirent_block(e) == want)
+    return;
+  problem(&g_report->bad_entries, 1, true,
+          "%s: '%s' points at block %u, not %u", path, e->name,
+          dirent_block(e), want);
+  if (g_repair) {
+    e->type = 2;
+    dirent_set_block(e, want);
+  }
+}
+
+/* valid_entry: Whether a live entry's name, type and permissions make sense */
+static bool valid_entry(const dir_entry_t* e) {
+  return memchr(e->name, '\0', sizeof(e->name)) != NULL &&
+         (e->type == 1 || e->type == 2 || e->type == 4) && VALID_PERM(e->perm);
+}
+
+/* check_dir: Pass 1 for a directory. */
+static void check_dir(fsck_item_t* item) {
+  bool is_root = item->entry == NULL;
+  uint32_t first = is_root ? 1 : dirent_block(item->entry);
+  uint32_t len;
+  uint32_t last;
+  if (!walk_chain(first, new_chain_id(), item->path, &len, &last) &&
+      !end_chain(item->entry, last))
+    return;
+  count(&g_report->blocks_used, len);
+  if (len == 0)
+    return;
+
+  uint32_t per_block = g_block_size / sizeof(dir_entry_t);
+  size_t path_len = strlen(item->path);
+  uint32_t block = first;
+  bool end = false;
+  for (uint32_t n = 0; n < len && !end; n++, block = fat_get(block)) {
+    dir_entry_t* entries = (dir_entry_t*)block_ptr(block);
+    for (uint32_t i = 0; i < per_block; i++) {
+      dir_entry_t* e = &entries[i];
+      if (e->name[0] == 0) {
+        end = true;  // end of directory
+        break;
+      }
+      if ((uint8_t)e->name[0] == 1)
+        continue;
+      if ((uint8_t)e->name[0] == 2) {
+        problem(&g_report->bad_entries, 1, true,
+                "%s: entry %u was deleted while open; its blocks are leaked",
+                item->path, n * per_block + i);
+        if (g_repair)
+          e->name[0] = 1;
+        continue;
+      }
+      if (!is_root && strcmp(e->name, ".") == 0) {
+        check_dot(e, first, item->path);
+        continue;
+      }
+      if (!is_root && strcmp(e->name, "..") == 0) {
+        check_dot(e, item->dir_block, item->path);
+        continue;
+      }
+      if (!valid_entry(e)) {
+        problem(&g_report->bad_entries, 1, true,
+                "%s: entry %u is not a valid directory entry", item->path,
+                n * per_block + i);
+        if (g_repair)
+          e->name[0] = 1;
+        continue;
+      }
+
+      fsck_item_t* child = malloc(sizeof(*child));
+      if (!child) {
+        problem(NULL, 0, false, "%s/%s: out of memory, not checked",
+                item->path, e->name);
+        continue;
+      }
+      child->kind = e->type == 2 ? ITEM_DIR : ITEM_FILE;
+      child->entry = e;
+      child->dir_block = first;
+      int len = snprintf(child->path, sizeof(child->path), "%s%s%.*s",
+                         item->path, path_len > 1 ? "/" : "",
+                         (int)sizeof(e->name), e->name);
+      if (len < 0 || (size_t)len >= sizeof(child->path)) {
+        // Mark the cut so reports never show a wrong but plausible path
+        strcpy(child->path + sizeof(child->path) - 4, "...");
+        problem(NULL, 0, false, "%s: path too long, shown truncated",
+                child->path);
+      }
+      if (e->type == 2)
+        count(&g_report->dirs, 1);
+      else
+        count(e->type == 4 ? &g_report->symlinks : &g_report->files, 1);
+      enqueue(child);
+    }
+  }
+}
+
+static void* tree_worker(void* arg) {
+  (void)arg;
+  pthread_mutex_lock(&g_queue_lock);
+  for (;;) {
+    while (g_queue_len == 0 && g_busy > 0)
+      pthread_cond_wait(&g_queue_cond, &g_queue_lock);
+    if (g_queue_len == 0)
+      break;  // nothing queued and nobody left to queue more
+    fsck_item_t* item = g_queue[--g_queue_len];
+    g_busy++;
+    pthread_mutex_unlock(&g_queue_lock);
+
+    bool kept = false;
+    if (item->kind == ITEM_DIR)
+      check_dir(item);
+    else
+      kept = check_file(item);
+    if (!kept)
+      free(item);
+
+    pthread_mutex_lock(&g_queue_lock);
+    if (--g_busy == 0 && g_queue_len == 0)
+      pthread_cond_broadcast(&g_queue_cond);
+  }
+  pthread_mutex_unlock(&g_queue_lock);
+  return NULL;
+}
+
+typedef struct {
+  uint32_t from;
+  uint32_t to;
+} fsck_range_t;
+
+/* leak_worker: Pass 2 over FAT entries [from, to), 64 at a time */
+static void* leak_worker(void* arg) {
+  const fsck_range_t* r = arg;
+  uint32_t entry_size = g_wide ? sizeof(uint32_t) : sizeof(uint16_t);
+  uint32_t run_start = 0;
+  uint32_t run = 0;
+  for (uint32_t base = r->from; base < r->to; base += 64) {
+    uint32_t n = r->to - base < 64 ? r->to - base : 64;
+    uint64_t free_mask;
+    fatscan_free_mask(g_fat, entry_size, base, base + n, &free_mask);
+    uint64_t allocated = ~free_mask & (n == 64 ? ~0ull : (1ull << n) - 1);
+    for (uint32_t i = 0; i < n; i++) {
+      uint32_t b = base + i;
+      if (((allocated >> i) & 1) &&
+          __atomic_load_n(&g_owner[b], __ATOMIC_RELAXED) == 0) {
+        if (run++ == 0)
+          run_start = b;
+        if (g_repair)
+          fat_set(b, FAT_FREE);
+        continue;
+      }
+      if (run > 0)
+        problem(&g_report->leaked, run, true,
+                "blocks %u-%u are allocated but unreachable", run_start,
+                run_start + run - 1);
+      run = 0;
+      if ((allocated >> i) == 0)
+        break;  // the rest of the group is free
+    }
+  }
+  if (run > 0)
+    problem(&g_report->leaked, run, true,
+            "blocks %u-%u are allocated but unreachable", run_start,
+            run_start + run - 1);
+  return NULL;
+}
+
+/*
+ * find_entry: Looks `name` up in the directory starting at `dir_block`.
+ * Returns NULL if it is not there.
+ */
+static const dir_entry_t* find_entry(uint32_t dir_block, const char* name) {
+  uint32_t per_block = g_block_size / sizeof(dir_entry_t);
+  uint32_t steps = 0;
+  for (uint32_t block = dir_block;
+       block != FAT_EOC && block >= 1 && block < g_entries && steps < g_entries;
+       block = fat_get(block), steps++) {
+    const dir_entry_t* entries = (const dir_entry_t*)block_ptr(block);
+    for (uint32_t i = 0; i < per_block; i++) {
+      if (entries[i].name[0] == 0)
+        return NULL;
+      if ((uint8_t)entries[i].name[0] > 2 &&
+          strncmp(entries[i].name, name, sizeof(entries[i].name)) == 0)
+        return &entries[i];
+    }
+  }
+  return NULL;
+}
+
+/*
+ * target_exists: Whether `path` names an existing entry, resolving relative
+ * paths from the directory at `dir_block` and following symlinks up to
+ * FSCK_SYMLINK_DEPTH deep.
+ */
+static bool target_exists(const char* path, uint32_t dir_block, int depth) {
+  if (depth > FSCK_SYMLINK_DEPTH)
+    return false;
+
+  char copy[FSCK_PATH_MAX];
+  snprintf(copy, sizeof(copy), "%s", path);
+  uint32_t dir = path[0] == '/' ? 1 : dir_block;
+  char* save = NULL;
+  for (char* comp = strtok_r(copy, "/", &save); comp;
+       comp = strtok_r(NULL, "/", &save)) {
+    if (strcmp(comp, ".") == 0 || (dir == 1 && strcmp(comp, "..") == 0))
+      continue;  // the root is its own parent
+    const dir_entry_t* e = find_entry(dir, comp);
+    if (!e)
+      return false;
+    if (e->type == 4) {
+      char target[FSCK_PATH_MAX];
+      uint32_t block = dirent_block(e);
+      if (e->size == 0 || e->size >= sizeof(target) ||
+          e->size > g_block_size || block < 1 || block >= g_entries)
+        return false;
+      memcpy(target, block_ptr(block), e->size);
+      target[e->size] = '\0';
+      char* rest = strtok_r(NULL, "", &save);
+      if (rest) {
+        size_t n = strlen(target);
+        snprintf(target + n, sizeof(target) - n, "/%s", rest);
+      }
+      return target_exists(target, dir, depth + 1);
+    }
+    if (e->type != 2)
+      return strtok_r(NULL, "/", &save) == NULL;
+    dir = dirent_block(e);
+  }
+  return true;
+}
+
+/* check_link: Pass 3 for one symlink kept by check_file */
+static void check_link(const fsck_item_t* item) {
+  const dir_entry_t* e = item->entry;
+  if ((uint8_t)e->name[0] <= 2)
+    return;  // deleted by a repair since
+  char target[FSCK_PATH_MAX];
+  memcpy(target, block_ptr(dirent_block(e)), e->size);
+  target[e->size] = '\0';
+  if (!target_exists(target, item->dir_block, 1))
+    problem(&g_report->dangling, 1, false, "%s: symlink target '%s' is missing",
+            item->path, target);
+}
+
+static void reset_state(void) {
+  for (size_t i = 0; i < g_queue_len; i++)
+    free(g_queue[i]);
+  for (size_t i = 0; i < g_links_len; i++)
+    free(g_links[i]);
+  free(g_queue);
+  free(g_links);
+  free(g_owner);
+  g_queue = NULL;
+  g_links = NULL;
+  g_owner = NULL;
+  g_queue_len = g_queue_cap = 0;
+  g_links_len = g_links_cap = 0;
+  g_busy = 0;
+  g_next_id = 0;
+}
+
+PennFatErr fsck_run(const char* fs_name,
+                    bool repair,
+                    uint32_t threads,
+                    pennfat_fsck_fn fn,
+                    void* arg,
+                    pennfat_fsck_report_t* report) {
+  if (!fs_name || !report)
+    return PennFatErr_INVAD;
+  if (threads == 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = cpus > 0 ? (uint32_t)cpus : 1;
+  }
+  if (threads > FSCK_MAX_THREADS)
+    threads = FSCK_MAX_THREADS;
+
+  int fd = open(fs_name, repair ? O_RDWR : O_RDONLY);
+  if (fd < 0)
+    return PennFatErr_INTERNAL;
+  struct stat st;
+  if (fstat(fd, &st) < 0 || st.st_size <= 0) {
+    close(fd);
+    return PennFatErr_INVAD;
+  }
+  g_len = (size_t)st.st_size;
+  int prot = repair ? PROT_READ | PROT_WRITE : PROT_READ;
+  g_base = mmap(NULL, g_len, prot, MAP_SHARED, fd, 0);
+  close(fd);
+  if (g_base == MAP_FAILED) {
+    g_base = NULL;
+    return PennFatErr_INTERNAL;
+  }
+
+  PennFatErr err = read_geometry();
+  g_owner = err == PennFatErr_OK ? calloc(g_entries, sizeof(uint32_t)) : NULL;
+  fsck_item_t* root = err == PennFatErr_OK ? calloc(1, sizeof(*root)) : NULL;
+  if (err == PennFatErr_OK && (!g_owner || !root)) {
+    free(root);
+    err = PennFatErr_OUTOFMEM;
+  }
+  if (err != PennFatErr_OK) {
+    reset_state();
+    munmap(g_base, g_len);
+    g_base = NULL;
+    return err;
+  }
+
+  memset(report, 0, sizeof(*report));
+  report->threads = threads;
+  g_report = report;
+  g_repair = repair;
+  g_fn = fn;
+  g_fn_arg = arg;
+
+  pthread_t tids[FSCK_MAX_THREADS];
+  fsck_range_t ranges[FSCK_MAX_THREADS];
+
+  // Pass 1: the tree, from the root directory
+  root->kind = ITEM_DIR;
+  root->dir_block = 1;
+  strcpy(root->path, "/");
+  report->dirs = 1;
+  enqueue(root);
+  uint32_t started = 0;
+  while (started < threads &&
+         pthread_create(&tids[started], NULL, tree_worker, NULL) == 0)
+    started++;
+  if (started == 0)
+    tree_worker(NULL);
+  for (uint32_t t = 0; t < started; t++)
+    pthread_join(tids[t], NULL);
+
+  // Pass 2: leaked blocks, one FAT range per thread
+  uint32_t span = (g_entries - 2 + threads - 1) / threads;
+  started = 0;
+  for (uint32_t t = 0; t < threads; t++) {
+    ranges[t].from = 2 + t * span;
+    ranges[t].to = ranges[t].from + span < g_entries ? ranges[t].from + span
+                                                     : g_entries;
+    if (ranges[t].from >= ranges[t].to)
+      break;
+    if (pthread_create(&tids[started], NULL, leak_worker, &ranges[t]) == 0)
+      started++;
+    else
+      leak_worker(&ranges[t]);
+  }
+  for (uint32_t t = 0; t < started; t++)
+    pthread_join(tids[t], NULL);
+
+  report->free_blocks =
+      fatscan_count_free(g_fat, g_wide ? sizeof(uint32_t) : sizeof(uint16_t),
+                         2, g_entries);
+
+  // Pass 3: symlink targets
+  for (size_t i = 0; i < g_links_len; i++)
+    check_link(g_links[i]);
+
+  if (repair && report->repaired > 0 && msync(g_base, g_len, MS_SYNC) < 0)
+    err = PennFatErr_IO;
+  reset_state();
+  munmap(g_base, g_len);
+  g_base = NULL;
+  g_report = NULL;
+  g_fn = NULL;
+  return err;
+}
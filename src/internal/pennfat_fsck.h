@@ -0,0 +1,28 @@
+#ifndef PENNFAT_FSCK_H
+#define PENNFAT_FSCK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "../common/pennfat_errors.h"
+#include "pennfat_kernel.h"
+
+/* Most worker threads fsck_run() starts */
+#define FSCK_MAX_THREADS 64
+
+/*
+ * fsck_run: Checks the unmounted image `fs_name` with `threads` worker
+ * threads (0 = one per online CPU) and fills in *report. With `repair` the
+ * problems found are fixed in place. fn (optional) gets one line per problem,
+ * possibly from several threads, one call at a time. Returns an error only
+ * when the image cannot be opened or is not a PennFAT image; problems in it
+ * are counted in the report.
+ */
+PennFatErr fsck_run(const char* fs_name,
+                    bool repair,
+                    uint32_t threads,
+                    pennfat_fsck_fn fn,
+                    void* arg,
+                    pennfat_fsck_report_t* report);
+
+#endif /* PENNFAT_FSCK_H */
@@ -1,5 +1,7 @@
 #include <errno.h>  // IWYU pragma: keep [errno]
 #include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,6 +14,14 @@
 #include "../common/pennfat_definitions.h"
 #include "../common/pennfat_errors.h"
 #include "../util/logger.h"
+#include "pennfat_blockdev.h"
+#include "pennfat_bufpool.h"
+#include "pennfat_cache.h"
+#include "pennfat_dcache.h"
+#include "pennfat_dirindex.h"
+#include "pennfat_fatscan.h"
+#include "pennfat_freemap.h"
+#include "pennfat_fsck.h"
 #include "pennfat_kernel.h"
 
 // ---------------------------------------------------------------------------
@@ -42,19 +52,17 @@ void pennfat_kernel_cleanup(void) {
 // 1) DEFINITIONS AND CONSTANTS
 // ---------------------------------------------------------------------------
 
-/* FAT entry definitions */
-#define FAT_FREE 0x0000
-#define FAT_EOC 0xFFFF  // End-Of-Chain
-
 /* Table sizes */
 #define MAX_SYSTEM_FILES \
   64  // Subject to chanage; maximum number of system-wide file entries
 #define MAX_FD 32  // Subject to change; max number of open file descriptors
 #define MAX_DIR_ENTRIES \
   128  // Subject to change; maximum number of entries in the root directory
+#define MAX_DIR_STREAMS 16  // directories open through k_opendir at once
 
-/* Allowed block sizes mapping */
-static const int block_sizes[] = {256, 512, 1024, 2048, 4096};
+/* Allowed block sizes mapping; configs past 4 are for wide images only */
+static const int block_sizes[] = {256, 512, 1024, 2048, 4096, 8192, 16384,
+                                  32768};
 
 // ---------------------------------------------------------------------------
 // 2) GLOBAL DATA STRUCTURES
@@ -63,18 +71,31 @@ static const int block_sizes[] = {256, 512, 1024, 2048, 4096};
 // static int g_mounted = 0;            // 1 if a filesystem is mounted; 0
 // otherwise
 static int g_fs_fd = -1;             // File descriptor for the FS image
+static pennfat_blockdev_t g_dev;     // Block I/O backend attached to g_fs_fd
 static uint32_t g_block_size = 512;  // Actual block size (set during mount)
-static uint16_t* g_fat = NULL;       // Pointer to the mapped FAT region
+static void* g_fat = NULL;           // Pointer to the mapped FAT region
+static bool g_fat_wide = false;      // 32-bit FAT entries (v2 image)
+static void* g_fat_map = NULL;       // Start of the mapping (v2: superblock)
+static size_t g_fat_map_len = 0;     // Bytes mapped at g_fat_map
+static uint64_t* g_fat_dirty = NULL;  // one bit per page of g_fat_map
+static size_t g_fat_pages = 0;        // pages covering g_fat_map_len
+static size_t g_page_size = 4096;     // host page size, set at mount
+static uint64_t g_fat_msyncs = 0;     // msync() calls made for FAT pages
+static uint64_t g_fat_pages_synced = 0;
 static dir_entry_t* g_root_dir =
     NULL;  // Pointer to the root directory block (1 block)
 
-/* The superblock info is embedded in FAT[0]:
- * MSB = number of FAT blocks; LSB = block_size_config.
+/* The superblock info is embedded in FAT[0] on narrow images:
+ * MSB = number of FAT blocks; LSB = block_size_config. Wide images have a
+ * pennfat_superblock_t in a block of its own in front of the FAT.
  * For helper routines we store parsed info here:
  */
 typedef struct {
-  uint32_t fat_block_count;  /* number of FAT blocks (from FAT[0]'s MSB) */
-  uint32_t data_start_block; /* computed: FAT region size in blocks */
+  uint32_t version;          /* PENNFAT_VERSION_NARROW or _WIDE */
+  uint32_t fat_block_count;  /* number of FAT blocks */
+  uint32_t data_start_block; /* first allocatable block (2) */
+  uint32_t fat_entries;      /* FAT entries that can name a block */
+  off_t data_offset;         /* image offset of block 1 */
 } superblock_t;
 static superblock_t g_superblock;
 
@@ -82,23 +103,104 @@ static superblock_t g_superblock;
 static system_file_t g_sysfile_table[MAX_SYSTEM_FILES];
 static fd_entry_t g_fd_table[MAX_FD];
 
+/* Directories open for k_readdir; the cursor names the next slot to look at */
+typedef struct {
+  bool in_use;
+  uint32_t dir;    // first block of the directory's chain
+  uint32_t block;  // block holding the next slot (FAT_EOC: all read)
+  uint32_t slot;   // index of that slot in the block
+} dir_stream_t;
+static dir_stream_t g_dir_streams[MAX_DIR_STREAMS];
+
 /* Current working directory block - starts at root (block 1) */
-static uint16_t g_cwd_block = 1;
+static uint32_t g_cwd_block = 1;
 
 /* Maximum path depth for directory traversal */
 #define MAX_DEPTH 32
 #define PATH_MAX 256
 
-/* We'll use a simpler approach without a block cache */
+/* Device I/O counters (below the buffer cache) */
+static uint64_t g_dev_reads = 0;
+static uint64_t g_dev_writes = 0;
+static uint64_t g_dev_syncs = 0;     // also bumped by the periodic flusher
+static uint64_t g_dev_requests = 0;  // backend transfers (one per run)
+static uint64_t g_rmw_skipped = 0;   // partial k_write blocks not read first
+
+/* Sequential read-ahead window bounds, in blocks. The window starts at MIN
+   on the first sequential k_read and doubles on each further one up to MAX
+   (and never past half the block cache). */
+#ifndef PENNFAT_READAHEAD_MIN
+#define PENNFAT_READAHEAD_MIN 4
+#endif
+#ifndef PENNFAT_READAHEAD_MAX
+#define PENNFAT_READAHEAD_MAX 32
+#endif
+
+/* Memory budget for the block maps of open files, in bytes per mount (0
+   disables them), and how many blocks past its chain cursor an fd still walks
+   instead of consulting or building a map. The default skip covers a full
+   read-ahead window, so purely sequential readers never build one. */
+#ifndef PENNFAT_BLOCKMAP_BUDGET
+#define PENNFAT_BLOCKMAP_BUDGET (256 * 1024)
+#endif
+#ifndef PENNFAT_BLOCKMAP_SKIP
+#define PENNFAT_BLOCKMAP_SKIP PENNFAT_READAHEAD_MAX
+#endif
+
+static size_t g_map_bytes = 0;      // block map memory in use
+static uint64_t g_map_tick = 0;     // clock for system_file_t.map_tick
+static uint64_t g_map_lookups = 0;  // blocks located through a map
+
+/* Delayed allocation: data a k_write puts past the end of a file's chain is
+   held in memory (system_file_t.delay_*) and only gets blocks when the file
+   is closed or synced, when a PENNFAT_SYNC_PERIODIC period has passed (see
+   periodic_flusher), or when the buffers of all open files would exceed
+   this many bytes. The whole region is then allocated at once, so it lands
+   in one run. The free blocks it will need are reserved as it is buffered.
+   0 disables delaying, and PENNFAT_SYNC_ALWAYS mounts never delay. */
+#ifndef PENNFAT_DELALLOC_BUDGET
+#define PENNFAT_DELALLOC_BUDGET (1024 * 1024)
+#endif
+
+static size_t g_delay_bytes = 0;       // delay buffer memory in use
+static uint32_t g_delay_reserved = 0;  // free blocks promised to delayed data
+static uint64_t g_delay_flushes = 0;   // delayed regions given blocks
+static uint64_t g_delay_dropped = 0;   // delayed blocks truncated before that
+
+/* Directory compaction: a directory is packed and its emptied trailing
+   blocks freed once this percentage of the slots it has used hold deleted
+   entries (see maybe_compact_dir). 0 leaves it to k_compact(). */
+#ifndef PENNFAT_DIR_COMPACT_RATIO
+#define PENNFAT_DIR_COMPACT_RATIO 50
+#endif
+
+static uint64_t g_dir_compactions = 0;   // directories packed
+static uint64_t g_dir_blocks_freed = 0;  // directory blocks given back
+
+/* Above 0 while a caller still relies on directory entries staying in their
+   slots; maybe_compact_dir() does nothing until it drops back. */
+static int g_compact_held = 0;
+
+/* Durability policy chosen at mount time (see pennfat_sync_policy_t) */
+static pennfat_sync_policy_t g_sync_policy = PENNFAT_SYNC_ALWAYS;
+static uint32_t g_sync_period_ms = PENNFAT_DEFAULT_SYNC_PERIOD_MS;
+
+/* Background flusher used by PENNFAT_SYNC_PERIODIC */
+static pthread_t g_flusher_thread;
+static bool g_flusher_running = false;
+static bool g_flusher_stop = false;
+static pthread_mutex_t g_flusher_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_flusher_cond = PTHREAD_COND_INITIALIZER;
+static bool g_delay_due = false;  // a period passed; flush delay buffers
 
 /* Path resolution result structure */
 typedef struct {
   bool found;                 // Whether the path was found
   bool is_root;               // Whether this is the root directory
   dir_entry_t entry;          // The directory entry if found
-  uint16_t entry_block;       // Block containing the entry
+  uint32_t entry_block;       // Block containing the entry
   int entry_index_in_block;   // Index of entry within the block
-  uint16_t parent_dir_block;  // Block of parent directory
+  uint32_t parent_dir_block;  // Block of parent directory
 } resolved_path_t;
 
 // ---------------------------------------------------------------------------
@@ -113,61 +215,390 @@ static const char* get_filename_from_path(const char* path) {
   return last_slash ? last_slash + 1 : path;
 }
 
-// We'll use a simpler approach without a block cache
+/*
+ * block_offset: Byte offset of data block `block_index` in the image. Data
+ * blocks are numbered from 1 (the root directory) and start right after the
+ * FAT region.
+ */
+static inline off_t block_offset(uint32_t block_index) {
+  return g_superblock.data_offset + (off_t)(block_index - 1) * g_block_size;
+}
+
+/*
+ * fat_get / fat_set: Read and write FAT entry `index` in either entry width.
+ * A narrow end-of-chain mark reads back as FAT_EOC, and FAT_EOC is stored
+ * narrow as FAT_EOC_NARROW (its low 16 bits).
+ */
+static inline uint32_t fat_get(uint32_t index) {
+  if (g_fat_wide)
+    return ((const uint32_t*)g_fat)[index];
+  uint16_t entry = ((const uint16_t*)g_fat)[index];
+  return entry == FAT_EOC_NARROW ? FAT_EOC : entry;
+}
 
-static inline void perm_to_str(uint8_t perm, char* str) {
-  str[0] = (perm & PERM_READ) ? 'r' : '-';
-  str[1] = (perm & PERM_WRITE) ? 'w' : '-';
-  str[2] = (perm & PERM_EXEC) ? 'x' : '-';
-  str[3] = '\0';
+static inline void fat_set(uint32_t index, uint32_t value) {
+  size_t entry_size = g_fat_wide ? sizeof(uint32_t) : sizeof(uint16_t);
+  if (g_fat_wide)
+    ((uint32_t*)g_fat)[index] = value;
+  else
+    ((uint16_t*)g_fat)[index] = (uint16_t)value;
+
+  // Mark the page after the store, so a concurrent fat_flush() that takes
+  // the bit either sees the new entry or leaves the bit for the next flush
+  size_t page = ((size_t)((char*)g_fat - (char*)g_fat_map) +
+                 (size_t)index * entry_size) /
+                g_page_size;
+  uint64_t bit = 1ull << (page & 63);
+  if (!(__atomic_load_n(&g_fat_dirty[page >> 6], __ATOMIC_RELAXED) & bit))
+    __atomic_fetch_or(&g_fat_dirty[page >> 6], bit, __ATOMIC_RELEASE);
 }
 
 /*
- * read_block: Reads a block from the FS image using g_fs_fd.
- * Calculates offset = block_index * g_block_size.
+ * fat_flush: msync()s the FAT pages changed since the last flush, one call
+ * per run of consecutive dirty pages, instead of the whole mapping. Pages
+ * whose msync fails stay dirty. Returns 0 on success, -1 on failure.
  */
-static int read_block(void* buf, uint32_t block_index) {
+static int fat_flush(void) {
+  int rc = 0;
+  size_t run_start = 0;
+  size_t run_len = 0;
+  size_t nwords = (g_fat_pages + 63) / 64;
+  for (size_t w = 0; w <= nwords; w++) {
+    uint64_t bits =
+        w < nwords ? __atomic_exchange_n(&g_fat_dirty[w], 0, __ATOMIC_ACQUIRE)
+                   : 0;
+    for (size_t b = 0; b < 64; b++) {
+      bool dirty = (bits >> b) & 1;
+      if (dirty && run_len > 0 && run_start + run_len == w * 64 + b) {
+        run_len++;
+        continue;
+      }
+      if (run_len > 0) {
+        size_t off = run_start * g_page_size;
+        size_t len = run_len * g_page_size;
+        if (off + len > g_fat_map_len)
+          len = g_fat_map_len - off;
+        __atomic_add_fetch(&g_fat_msyncs, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&g_fat_pages_synced, run_len, __ATOMIC_RELAXED);
+        if (msync((char*)g_fat_map + off, len, MS_SYNC) < 0) {
+          for (size_t p = run_start; p < run_start + run_len; p++)
+            __atomic_fetch_or(&g_fat_dirty[p >> 6], 1ull << (p & 63),
+                              __ATOMIC_RELAXED);
+          rc = -1;
+        }
+        run_len = 0;
+      }
+      if (dirty) {
+        run_start = w * 64 + b;
+        run_len = 1;
+      }
+      if (!(bits >> b))
+        break;  // no dirty pages left in this word
+    }
+  }
+  return rc;
+}
+
+/*
+ * fat_unmap: Unmaps the FAT region and drops its dirty-page bitmap.
+ */
+static int fat_unmap(void) {
+  int rc = munmap(g_fat_map, g_fat_map_len);
+  free(g_fat_dirty);
+  g_fat_dirty = NULL;
+  g_fat_pages = 0;
+  g_fat = NULL;
+  g_fat_map = NULL;
+  g_fat_map_len = 0;
+  return rc;
+}
+
+/*
+ * dirent_block / dirent_set_block: An entry's first block. Wide images keep
+ * its high 16 bits in first_block_hi, which narrow images leave unused.
+ */
+static inline uint32_t dirent_block(const dir_entry_t* entry) {
+  if (!g_fat_wide)
+    return entry->first_block == FAT_EOC_NARROW ? FAT_EOC : entry->first_block;
+  return (uint32_t)entry->first_block_hi << 16 | entry->first_block;
+}
+
+static inline void dirent_set_block(dir_entry_t* entry, uint32_t block) {
+  entry->first_block = (uint16_t)block;
+  entry->first_block_hi = g_fat_wide ? (uint16_t)(block >> 16) : 0;
+}
+
+/*
+ * dev_read_block: Reads a block straight from the FS image through the block
+ * device backend, bypassing the buffer cache.
+ */
+static int dev_read_block(void* buf, uint32_t block_index) {
   if (g_fs_fd < 0)
     return -1;
-
-  off_t offset = block_index * g_block_size;
-  if (lseek(g_fs_fd, offset, SEEK_SET) < 0)
+  if (blockdev_read(&g_dev, buf, g_block_size, block_offset(block_index)) != 0)
     return -1;
+  __atomic_add_fetch(&g_dev_reads, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&g_dev_requests, 1, __ATOMIC_RELAXED);
+  return 0;
+}
 
-  ssize_t bytes_read = read(g_fs_fd, buf, g_block_size);
-  if (bytes_read != g_block_size)
+/*
+ * dev_write_block: Writes a block straight to the FS image through the block
+ * device backend, bypassing the buffer cache. Durability is handled by the
+ * caller (see sync_device).
+ */
+static int dev_write_block(const void* buf, uint32_t block_index) {
+  if (g_fs_fd < 0)
     return -1;
+  if (blockdev_write(&g_dev, buf, g_block_size, block_offset(block_index)) !=
+      0)
+    return -1;
+  __atomic_add_fetch(&g_dev_writes, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&g_dev_requests, 1, __ATOMIC_RELAXED);
+  return 0;
+}
 
+/*
+ * sync_device: Flushes the image's data to stable storage.
+ */
+static int sync_device(void) {
+  if (g_fs_fd < 0)
+    return -1;
+  __atomic_add_fetch(&g_dev_syncs, 1, __ATOMIC_RELAXED);
+  if (blockdev_sync(&g_dev) < 0) {
+    LOG_ERR("[sync_device] Failed to sync filesystem image: %s",
+            strerror(errno));
+    return -1;
+  }
   return 0;
 }
 
 /*
- * write_block: Writes a block to the FS image using g_fs_fd.
- * Computes offset = block_index * g_block_size.
- * Always flushes to disk to ensure data integrity.
+ * read_block: Reads a block through the buffer cache. A mapped image (mmap
+ * backend) is already backed by the page cache, so it is read directly.
  */
-static int write_block(const void* buf, uint32_t block_index) {
+static int read_block(void* buf, uint32_t block_index) {
   if (g_fs_fd < 0)
     return -1;
+  if (blockdev_is_mapped(&g_dev))
+    return dev_read_block(buf, block_index);
+  return bcache_read(buf, block_index);
+}
 
-  off_t offset = block_index * g_block_size;
-  if (lseek(g_fs_fd, offset, SEEK_SET) < 0)
+/*
+ * write_block: Writes a block into the buffer cache. Under
+ * PENNFAT_SYNC_ALWAYS the block is written through and synced right away;
+ * otherwise it reaches the image when it is evicted or when the cache is
+ * flushed according to the mount's durability policy.
+ */
+static int write_block(const void* buf, uint32_t block_index) {
+  if (g_fs_fd < 0)
     return -1;
+  if (blockdev_is_mapped(&g_dev)) {
+    if (dev_write_block(buf, block_index) != 0)
+      return -1;
+    return g_sync_policy == PENNFAT_SYNC_ALWAYS ? sync_device() : 0;
+  }
+  if (g_sync_policy != PENNFAT_SYNC_ALWAYS)
+    return bcache_write(buf, block_index, false);
 
-  ssize_t bytes_written = write(g_fs_fd, buf, g_block_size);
-  if (bytes_written != g_block_size)
+  if (bcache_write(buf, block_index, true) != 0)
     return -1;
+  return sync_device();
+}
+
+/*
+ * mapped_block: Direct pointer to data block `block_index` inside the image
+ * mapping, or NULL unless the image is mounted with the mmap backend.
+ */
+static char* mapped_block(uint32_t block_index) {
+  return blockdev_ptr(&g_dev, block_offset(block_index), g_block_size);
+}
+
+/*
+ * mapped_block_written: Records `len` bytes at `offset_in_block` of a mapped
+ * block as modified in place, and syncs them under PENNFAT_SYNC_ALWAYS.
+ */
+static int mapped_block_written(uint32_t block_index,
+                                uint32_t offset_in_block,
+                                uint32_t len) {
+  blockdev_mark_dirty(&g_dev, block_offset(block_index) + offset_in_block,
+                      len);
+  return g_sync_policy == PENNFAT_SYNC_ALWAYS ? sync_device() : 0;
+}
+
+/*
+ * Whole-block runs collected by k_read/k_write and handed to the backend as
+ * one batch, so a backend with real async I/O (io_uring) has all of them in
+ * flight at once instead of one synchronous request at a time.
+ */
+#define PENNFAT_IO_BATCH 32
 
-  // Always flush to disk immediately to ensure data integrity
-  if (fdatasync(g_fs_fd) < 0) {
-    LOG_ERR("[write_block] Failed to sync block %u to disk: %s", block_index,
+typedef struct {
+  blockdev_io_t io[PENNFAT_IO_BATCH];
+  uint32_t first[PENNFAT_IO_BATCH];  // first block of each run
+  uint32_t count[PENNFAT_IO_BATCH];  // blocks in each run
+  int n;
+} run_batch_t;
+
+/*
+ * run_batch_add: Queues `count` physically consecutive data blocks starting
+ * at `first`, to be read into / written from buf. The caller submits the
+ * batch once it is full.
+ */
+static void run_batch_add(run_batch_t* b,
+                          void* buf,
+                          uint32_t first,
+                          uint32_t count,
+                          bool write) {
+  b->io[b->n] = (blockdev_io_t){.buf = buf,
+                                .len = (size_t)count * g_block_size,
+                                .off = block_offset(first),
+                                .write = write};
+  b->first[b->n] = first;
+  b->count[b->n] = count;
+  b->n++;
+}
+
+/*
+ * run_batch_submit: Issues every queued run around the buffer cache and
+ * empties the batch. Cached copies of written blocks are dropped first; reads
+ * get any cached copies laid over them so newer, unflushed data wins.
+ */
+static int run_batch_submit(run_batch_t* b) {
+  if (b->n == 0)
+    return 0;
+
+  bool any_write = false;
+  uint64_t blocks = 0;
+  for (int i = 0; i < b->n; i++) {
+    if (b->io[i].write) {
+      bcache_invalidate_range(b->first[i], b->count[i]);
+      any_write = true;
+    }
+    blocks += b->count[i];
+  }
+
+  int rc = blockdev_submit(&g_dev, b->io, b->n);
+  if (rc == 0) {
+    for (int i = 0; i < b->n; i++) {
+      if (!b->io[i].write)
+        bcache_overlay(b->io[i].buf, b->first[i], b->count[i]);
+    }
+    __atomic_add_fetch(any_write ? &g_dev_writes : &g_dev_reads, blocks,
+                       __ATOMIC_RELAXED);
+    __atomic_add_fetch(&g_dev_requests, (uint64_t)b->n, __ATOMIC_RELAXED);
+    if (any_write && g_sync_policy == PENNFAT_SYNC_ALWAYS)
+      rc = sync_device();
+  }
+  b->n = 0;
+  return rc;
+}
+
+/*
+ * flush_block_cache: Writes back every dirty cached block and, unless the
+ * image is mounted with PENNFAT_SYNC_NONE, the changed FAT pages, then syncs
+ * the image once.
+ */
+static PennFatErr flush_block_cache(void) {
+  if (bcache_flush() != 0) {
+    LOG_ERR("[flush_block_cache] Failed to write back dirty blocks.");
+    return PennFatErr_IO;
+  }
+  if (g_sync_policy == PENNFAT_SYNC_NONE)
+    return PennFatErr_OK;
+  if (fat_flush() < 0) {
+    LOG_ERR("[flush_block_cache] Failed to synchronize FAT pages: %s",
             strerror(errno));
-    return -1;
+    return PennFatErr_IO;
   }
+  if (sync_device() != 0)
+    return PennFatErr_IO;
+  return PennFatErr_OK;
+}
+
+/*
+ * durability_point: Called where the on-close policy promises data is on
+ * disk (k_close, symlink creation). The other policies either already synced
+ * (always), leave it to the flusher thread (periodic) or never sync (none).
+ */
+static PennFatErr durability_point(void) {
+  if (g_sync_policy != PENNFAT_SYNC_ON_CLOSE)
+    return PennFatErr_OK;
+  return flush_block_cache();
+}
+
+/*
+ * periodic_flusher: Background thread for PENNFAT_SYNC_PERIODIC. Every
+ * g_sync_period_ms it writes back the FAT and the dirty cached blocks and
+ * syncs the image, until k_unmount asks it to stop.
+ *
+ * Delayed data has no blocks yet, and allocating them here would race with
+ * the kernel call in progress, so the thread only raises g_delay_due. The
+ * next k_open, k_read or k_write writes the delay buffers back, and the sync
+ * after it makes them durable. Data written by a file left idle stays in
+ * memory until that file is used again, closed or synced.
+ */
+static void* periodic_flusher(void* arg) {
+  (void)arg;
+
+  pthread_mutex_lock(&g_flusher_lock);
+  while (!g_flusher_stop) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += g_sync_period_ms / 1000;
+    deadline.tv_nsec += (long)(g_sync_period_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(&g_flusher_cond, &g_flusher_lock, &deadline);
+    if (g_flusher_stop)
+      break;
 
+    pthread_mutex_unlock(&g_flusher_lock);
+    __atomic_store_n(&g_delay_due, true, __ATOMIC_RELEASE);
+    if (fat_flush() < 0 || bcache_flush() != 0 ||
+        sync_device() != 0) {
+      LOG_ERR("[periodic_flusher] Periodic flush failed: %s", strerror(errno));
+    }
+    pthread_mutex_lock(&g_flusher_lock);
+  }
+  pthread_mutex_unlock(&g_flusher_lock);
+  return NULL;
+}
+
+/*
+ * start_periodic_flusher: Spawns periodic_flusher with every signal blocked,
+ * so the scheduler's SIGALRM and spthread suspend signals are never delivered
+ * to it.
+ */
+static int start_periodic_flusher(void) {
+  sigset_t all, old;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+
+  g_flusher_stop = false;
+  g_delay_due = false;
+  int rc = pthread_create(&g_flusher_thread, NULL, periodic_flusher, NULL);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  if (rc != 0)
+    return -1;
+  g_flusher_running = true;
   return 0;
 }
 
+static void stop_periodic_flusher(void) {
+  if (!g_flusher_running)
+    return;
+  pthread_mutex_lock(&g_flusher_lock);
+  g_flusher_stop = true;
+  pthread_cond_signal(&g_flusher_cond);
+  pthread_mutex_unlock(&g_flusher_lock);
+  pthread_join(g_flusher_thread, NULL);
+  g_flusher_running = false;
+}
+
 // Helper to read the target of a symbolic link
 static PennFatErr read_symlink_target(const dir_entry_t* link_entry,
                                       char* target_buf,
@@ -182,19 +613,19 @@ static PennFatErr read_symlink_target(const dir_entry_t* link_entry,
 
   LOG_DEBUG(
       "[read_symlink_target] Reading symlink target: first_block=%u, size=%u",
-      link_entry->first_block, link_entry->size);
+      dirent_block(link_entry), link_entry->size);
 
   // Read the block containing the target path
-  char* block_buffer = malloc(g_block_size);
+  char* block_buffer = bpool_acquire();
   if (!block_buffer) {
     LOG_ERR("[read_symlink_target] Failed to allocate memory for block buffer");
     return PennFatErr_OUTOFMEM;
   }
 
-  if (read_block(block_buffer, link_entry->first_block) != 0) {
+  if (read_block(block_buffer, dirent_block(link_entry)) != 0) {
     LOG_ERR("[read_symlink_target] Failed to read block %u",
-            link_entry->first_block);
-    free(block_buffer);
+            dirent_block(link_entry));
+    bpool_release(block_buffer);
     return PennFatErr_IO;
   }
 
@@ -212,77 +643,621 @@ static PennFatErr read_symlink_target(const dir_entry_t* link_entry,
 
   LOG_DEBUG("[read_symlink_target] Read symlink target: '%s'", target_buf);
 
-  free(block_buffer);
+  bpool_release(block_buffer);
   return PennFatErr_OK;
 }
 
+/*
+ * blockmap_drop: Frees sf's block map. Must be called whenever sf's chain is
+ * freed or replaced, and when sf is released.
+ */
+static void blockmap_drop(system_file_t* sf) {
+  if (!sf->block_map)
+    return;
+  g_map_bytes -= sf->map_cap * sizeof(uint32_t);
+  free(sf->block_map);
+  sf->block_map = NULL;
+  sf->map_len = 0;
+  sf->map_cap = 0;
+}
+
+/*
+ * blockmap_reserve: Makes room for `bytes` more block map memory within
+ * PENNFAT_BLOCKMAP_BUDGET by dropping the least recently used maps of files
+ * other than `keep`. Returns false if the budget cannot fit it.
+ */
+static bool blockmap_reserve(const system_file_t* keep, size_t bytes) {
+  while (g_map_bytes + bytes > PENNFAT_BLOCKMAP_BUDGET) {
+    system_file_t* lru = NULL;
+    for (int i = 0; i < MAX_SYSTEM_FILES; i++) {
+      system_file_t* sf = &g_sysfile_table[i];
+      if (sf->in_use && sf->block_map && sf != keep &&
+          (!lru || sf->map_tick < lru->map_tick))
+        lru = sf;
+    }
+    if (!lru)
+      return false;
+    blockmap_drop(lru);
+  }
+  return true;
+}
+
+/*
+ * blockmap_fill: Extends sf's block map (building it on first use) with the
+ * rest of its chain, as far as the budget allows. Returns true if the map
+ * then covers file block `index`.
+ */
+static bool blockmap_fill(system_file_t* sf, uint32_t index) {
+  uint32_t block = sf->map_len ? fat_get(sf->block_map[sf->map_len - 1])
+                               : sf->first_block;
+  uint32_t limit = fmap_capacity();  // a longer chain would be a cycle
+  while (block != FAT_EOC && block != FAT_FREE && sf->map_len < limit) {
+    if (sf->map_len == sf->map_cap) {
+      uint32_t cap = sf->map_cap ? sf->map_cap * 2 : 64;
+      size_t grow = (cap - sf->map_cap) * sizeof(uint32_t);
+      if (!blockmap_reserve(sf, grow))
+        break;
+      uint32_t* map = realloc(sf->block_map, cap * sizeof(uint32_t));
+      if (!map)
+        break;
+      sf->block_map = map;
+      sf->map_cap = cap;
+      g_map_bytes += grow;
+    }
+    sf->block_map[sf->map_len++] = block;
+    block = fat_get(block);
+  }
+  return index < sf->map_len;
+}
+
 /*
  * locate_block_in_chain: Given a file offset, finds the physical block and the
- * offset within that block, by walking the FAT chain starting at start_block.
+ * offset within that block in sf's FAT chain.
+ *
+ * Targets at most PENNFAT_BLOCKMAP_SKIP blocks past the cursor (sequential
+ * access) are reached by walking on from the cursor's block. Anything else
+ * (a seek, or the first access far into the file) is looked up in sf's block
+ * map, which is built from the chain on first need. Without a map the walk
+ * starts at the cursor when it lies before the target and at first_block
+ * otherwise. With a cursor, it is left on the block found.
  */
-static int locate_block_in_chain(uint16_t start_block,
+static int locate_block_in_chain(system_file_t* sf,
+                                 chain_cursor_t* cursor,
                                  uint32_t file_offset,
-                                 uint16_t* block_out,
+                                 uint32_t* block_out,
                                  uint32_t* offset_in_block) {
-  if (start_block == FAT_FREE || start_block == FAT_EOC)
+  if (sf->first_block == FAT_FREE || sf->first_block == FAT_EOC)
     return -1;
 
   uint32_t block_count = file_offset / g_block_size;
   *offset_in_block = file_offset % g_block_size;
-  uint16_t current = start_block;
-  for (uint32_t i = 0; i < block_count; i++) {
-    if (current == FAT_EOC)
-      return -1;
-
-    current = g_fat[current];
+  bool have_cursor = cursor && cursor->block != FAT_FREE &&
+                     cursor->index <= block_count;
+  bool near = have_cursor &&
+              block_count - cursor->index <= PENNFAT_BLOCKMAP_SKIP;
+
+  uint32_t current = sf->first_block;
+  if (!near && block_count > PENNFAT_BLOCKMAP_SKIP &&
+      (block_count < sf->map_len || blockmap_fill(sf, block_count))) {
+    current = sf->block_map[block_count];
+    sf->map_tick = ++g_map_tick;
+    g_map_lookups++;
+  } else {
+    uint32_t i = 0;
+    if (have_cursor) {
+      current = cursor->block;
+      i = cursor->index;
+    }
+    for (; i < block_count; i++) {
+      current = fat_get(current);
+      if (current == FAT_EOC || current == FAT_FREE)
+        return -1;  // offset lies past the end of the chain
+    }
   }
 
+  if (cursor) {
+    cursor->index = block_count;
+    cursor->block = current;
+  }
   *block_out = current;
   return 0;
 }
 
 /*
- * allocate_free_block: Scans the FAT (from data_start_block onward) to find a
- * free block, marks it as allocated (FAT_EOC), and returns its index. Returns
- * -1 if no free block.
+ * invalidate_chain_caches: Forgets the chain position of every fd open on
+ * system file `sys_idx` and drops its block map. Needed whenever its chain is
+ * freed or replaced (truncate, unlink), since the cached blocks may be handed
+ * out again.
+ */
+static void invalidate_chain_caches(int sys_idx) {
+  for (int fd = 0; fd < MAX_FD; fd++) {
+    if (g_fd_table[fd].in_use && g_fd_table[fd].sysfile_index == sys_idx)
+      g_fd_table[fd].chain.block = FAT_FREE;
+  }
+  blockmap_drop(&g_sysfile_table[sys_idx]);
+}
+
+/*
+ * chain_run_length: Number of blocks, starting at `block` and capped at
+ * max_blocks, that follow one another physically in the FAT chain (block,
+ * block + 1, ...). Such a run is a single contiguous extent of the image.
+ */
+static uint32_t chain_run_length(uint32_t block, uint32_t max_blocks) {
+  uint32_t n = 1;
+  while (n < max_blocks && fat_get(block + n - 1) == (uint32_t)(block + n))
+    n++;
+  return n;
+}
+
+/*
+ * allocate_free_block: Takes the next free block from the free-space index
+ * (next-fit, see pennfat_freemap.c), marks it as allocated (FAT_EOC), and
+ * returns its index. Returns -1 if no free block is left over after the
+ * blocks reserved for delayed data.
  */
 static int allocate_free_block(void) {
-  uint32_t total_entries =
-      (g_superblock.fat_block_count * g_block_size) / sizeof(uint16_t);
-  for (uint32_t i = g_superblock.data_start_block; i < total_entries; i++) {
-    if (g_fat[i] == FAT_FREE) {
-      g_fat[i] = FAT_EOC;
-      return i;
-    }
+  if (fmap_free_count() <= g_delay_reserved)
+    return -1;
+  int block = fmap_alloc();
+  if (block >= 0)
+    fat_set(block, FAT_EOC);
+  return block;
+}
+
+/*
+ * allocate_free_run: Takes up to `want` physically consecutive free blocks in
+ * one step (see fmap_alloc_run), preferring a run that starts at `hint`, and
+ * links them into a chain of their own ending in FAT_EOC. Returns the first
+ * block and stores the run length in *count, or returns -1 if no block is
+ * free. Blocks reserved for delayed data are left alone.
+ */
+static int allocate_free_run(uint32_t hint, uint32_t want, uint32_t* count) {
+  if (fmap_free_count() <= g_delay_reserved)
+    return -1;
+  if (want > fmap_free_count() - g_delay_reserved)
+    want = fmap_free_count() - g_delay_reserved;
+  int first = fmap_alloc_run(hint, want, count);
+  if (first < 0)
+    return -1;
+  for (uint32_t i = 0; i + 1 < *count; i++)
+    fat_set(first + i, (uint32_t)(first + i + 1));
+  fat_set(first + *count - 1, FAT_EOC);
+  return first;
+}
+
+/*
+ * release_block: Marks a single block free in the FAT and the free-space
+ * index. Every site that frees a block, including allocation rollbacks, must
+ * go through here so the index and the cached free count stay in sync.
+ */
+static void release_block(uint32_t block) {
+  fat_set(block, FAT_FREE);
+  fmap_release(block);
+}
+
+/*
+ * chain_walk: Counts the blocks of the chain starting at first_block, from
+ * `cursor` on when it is set, and stops at the tail or once `nblocks` are
+ * counted. Returns the count and leaves the block reached in *last.
+ */
+static uint32_t chain_walk(uint32_t first_block,
+                           const chain_cursor_t* cursor,
+                           uint32_t nblocks,
+                           uint32_t* last) {
+  uint32_t len = 1;
+  *last = first_block;
+  if (cursor && cursor->block != FAT_FREE) {
+    len = cursor->index + 1;
+    *last = cursor->block;
+  }
+  while (len < nblocks && fat_get(*last) != FAT_EOC) {
+    *last = fat_get(*last);
+    len++;
+  }
+  return len;
+}
+
+/*
+ * extend_chain: Appends free blocks to the chain starting at first_block until
+ * it is at least `nblocks` long, stopping early if the disk fills up. The walk
+ * to the tail starts from `cursor` (left untouched) when it is set. Blocks are
+ * taken as contiguous runs sized to what is still missing, starting right
+ * after the current tail when possible, so the chain stays one extent where
+ * free space allows. The walk stops as soon as the chain is known to be long
+ * enough, so writes into preallocated blocks (k_fallocate) cost no walk to
+ * the tail. Returns the chain length reached, capped at that point.
+ */
+static uint32_t extend_chain(uint32_t first_block,
+                             const chain_cursor_t* cursor,
+                             uint32_t nblocks) {
+  uint32_t last;
+  uint32_t len = chain_walk(first_block, cursor, nblocks, &last);
+  while (len < nblocks) {
+    uint32_t got;
+    int run = allocate_free_run(last + 1u, nblocks - len, &got);
+    if (run < 0)
+      break;
+    fat_set(last, (uint32_t)run);
+    last = (uint32_t)(run + got - 1);
+    len += got;
   }
-  return -1;
+  return len;
+}
+
+/*
+ * update_readahead: Called at the start of every k_read. A read that picks
+ * up exactly where the previous one on this fd stopped grows the window;
+ * anything else switches read-ahead off until the pattern is sequential again.
+ */
+static void update_readahead(fd_entry_t* fdesc) {
+  uint32_t max = PENNFAT_READAHEAD_MAX;
+  if (max > PENNFAT_CACHE_FRAMES / 2)
+    max = PENNFAT_CACHE_FRAMES / 2;
+
+  if (fdesc->offset != fdesc->ra_next || max == 0) {
+    fdesc->ra_window = 0;
+    fdesc->ra_end = 0;
+  } else if (fdesc->ra_window == 0) {
+    fdesc->ra_window = PENNFAT_READAHEAD_MIN < max ? PENNFAT_READAHEAD_MIN : max;
+  } else if (fdesc->ra_window < max) {
+    fdesc->ra_window = fdesc->ra_window * 2 < max ? fdesc->ra_window * 2 : max;
+  }
+}
+
+/*
+ * readahead: Called at the end of a sequential k_read. Once less than half a
+ * window of read-ahead is left in front of the reader, pulls the rest of the
+ * window into the buffer cache: one device request per physically contiguous
+ * run, all runs submitted as one batch. Refilling in half-window steps keeps
+ * requests large instead of topping up a few blocks on every call.
+ */
+static void readahead(fd_entry_t* fdesc, system_file_t* sf) {
+  if (fdesc->ra_window == 0 || blockdev_is_mapped(&g_dev))
+    return;
+
+  uint32_t file_blocks = (sf->size + g_block_size - 1) / g_block_size;
+  uint32_t next = (fdesc->offset + g_block_size - 1) / g_block_size;
+  if (fdesc->ra_end > next && fdesc->ra_end - next > fdesc->ra_window / 2)
+    return;
+  uint32_t start = next > fdesc->ra_end ? next : fdesc->ra_end;
+  uint32_t end = next + fdesc->ra_window;
+  if (end > file_blocks)
+    end = file_blocks;
+  if (start >= end)
+    return;
+
+  uint32_t block;
+  uint32_t unused;
+  chain_cursor_t cursor = fdesc->chain;  // k_read's position stays put
+  if (locate_block_in_chain(sf, &cursor, start * g_block_size, &block,
+                            &unused) < 0)
+    return;
+  char* buf = malloc((size_t)(end - start) * g_block_size);
+  if (!buf)
+    return;
+
+  run_batch_t batch = {.n = 0};
+  uint32_t queued = 0;
+  while (start + queued < end && batch.n < PENNFAT_IO_BATCH) {
+    uint32_t run = chain_run_length(block, end - start - queued);
+    run_batch_add(&batch, buf + (size_t)queued * g_block_size, block, run,
+                  false);
+    queued += run;
+    block = fat_get(block + run - 1);
+    if (block == FAT_EOC || block == FAT_FREE)
+      break;
+  }
+
+  int nruns = batch.n;
+  if (run_batch_submit(&batch) == 0) {
+    for (int i = 0; i < nruns; i++)
+      bcache_install(batch.io[i].buf, batch.first[i], batch.count[i]);
+    fdesc->ra_end = start + queued;
+  }
+  free(buf);
 }
 
 /*
  * free_block_chain: Frees all blocks in a chain starting from start_block.
  * Sets all FAT entries in the chain to FAT_FREE.
  */
-static PennFatErr free_block_chain(uint16_t start_block) {
+static PennFatErr free_block_chain(uint32_t start_block) {
   if (start_block == FAT_FREE || start_block == FAT_EOC) {
     return PennFatErr_OK;  // Nothing to free
   }
 
-  uint16_t current = start_block;
-  uint16_t next;
+  uint32_t current = start_block;
+  uint32_t next;
 
   while (current != FAT_EOC && current != FAT_FREE) {
-    next = g_fat[current];
-    g_fat[current] = FAT_FREE;
+    next = fat_get(current);
+    release_block(current);
     current = next;
   }
 
   return PennFatErr_OK;
 }
 
+/*
+ * cut_chain_after: Makes `last` the final block of its chain and frees every
+ * block that followed it. The chain is ended with a single FAT update before
+ * the tail is released, so it never links into freed blocks.
+ */
+static void cut_chain_after(uint32_t last) {
+  uint32_t tail = fat_get(last);
+  if (tail == FAT_EOC)
+    return;
+  fat_set(last, FAT_EOC);
+  free_block_chain(tail);
+}
+
+/*
+ * zero_file_range: Overwrites bytes [from, to) of sf's data with zeroes, so
+ * blocks a file grows into never expose what a deleted file left there.
+ * Every block in the range must already be part of the chain.
+ */
+static int zero_file_range(system_file_t* sf, uint32_t from, uint32_t to) {
+  char* block_buf = NULL;
+  if (!blockdev_is_mapped(&g_dev) && !(block_buf = bpool_acquire()))
+    return -1;
+
+  int rc = 0;
+  chain_cursor_t cursor = {.index = 0, .block = FAT_FREE};
+  while (rc == 0 && from < to) {
+    uint32_t block;
+    uint32_t offset_in_block;
+    if (locate_block_in_chain(sf, &cursor, from, &block, &offset_in_block) <
+        0) {
+      rc = -1;
+      break;
+    }
+    uint32_t chunk = g_block_size - offset_in_block;
+    if (chunk > to - from)
+      chunk = to - from;
+
+    if (!block_buf) {
+      char* dst = mapped_block(block);
+      if (!dst) {
+        rc = -1;
+        break;
+      }
+      memset(dst + offset_in_block, 0, chunk);
+      rc = mapped_block_written(block, offset_in_block, chunk);
+    } else {
+      if (chunk < g_block_size && read_block(block_buf, block) < 0) {
+        rc = -1;
+        break;
+      }
+      memset(block_buf + offset_in_block, 0, chunk);
+      rc = write_block(block_buf, block);
+    }
+    from += chunk;
+  }
+  bpool_release(block_buf);
+  return rc;
+}
+
+/*
+ * delay_release: Frees sf's delay buffer and hands its reserved blocks back.
+ * Whatever data it held is gone; see delay_flush() to keep it.
+ */
+static void delay_release(system_file_t* sf) {
+  if (!sf->delay_buf)
+    return;
+  free(sf->delay_buf);
+  g_delay_bytes -= sf->delay_cap;
+  g_delay_reserved -= sf->delay_blocks;
+  sf->delay_buf = NULL;
+  sf->delay_cap = 0;
+  sf->delay_blocks = 0;
+}
+
+/*
+ * delay_reserve: Makes sf's delay buffer, starting at file block `from`, big
+ * enough for `nblocks` blocks and reserves free blocks for them. Fails,
+ * leaving the buffer as it was, when that would take more free blocks than
+ * are unreserved or more than PENNFAT_DELALLOC_BUDGET bytes of buffers.
+ */
+static bool delay_reserve(system_file_t* sf, uint32_t from, uint32_t nblocks) {
+  if (g_sync_policy == PENNFAT_SYNC_ALWAYS || PENNFAT_DELALLOC_BUDGET == 0)
+    return false;
+  uint32_t extra = nblocks > sf->delay_blocks ? nblocks - sf->delay_blocks : 0;
+  if (fmap_free_count() < g_delay_reserved + extra)
+    return false;
+
+  size_t bytes = (size_t)nblocks * g_block_size;
+  if (bytes > sf->delay_cap) {
+    size_t others = g_delay_bytes - sf->delay_cap;
+    size_t cap = 2 * (size_t)sf->delay_cap;
+    if (cap < bytes || others + cap > PENNFAT_DELALLOC_BUDGET)
+      cap = bytes;
+    if (others + cap > PENNFAT_DELALLOC_BUDGET)
+      return false;
+    char* grown = realloc(sf->delay_buf, cap);
+    if (!grown)
+      return false;
+    memset(grown + sf->delay_cap, 0, cap - sf->delay_cap);
+    if (!sf->delay_buf)
+      sf->delay_from = from;
+    g_delay_bytes = others + cap;
+    sf->delay_buf = grown;
+    sf->delay_cap = (uint32_t)cap;
+  }
+  g_delay_reserved += extra;
+  sf->delay_blocks += extra;
+  return true;
+}
+
+/*
+ * delay_flush: Gives sf's delayed data its blocks and writes it out. The
+ * reservation is handed back first, so one extend_chain() call allocates the
+ * whole region knowing its full size and can place it as a single run. The
+ * buffer is released even if the write fails; the file's size is then cut
+ * back to the data that reached its chain, and sf->delay_failed stays set
+ * until delay_take_error() reports it. Returns 0, or -1 if the blocks could
+ * not be allocated or written.
+ */
+static int delay_flush(system_file_t* sf) {
+  if (!sf->delay_buf)
+    return 0;
+
+  uint32_t from = sf->delay_from;
+  uint32_t start = from * g_block_size;
+  uint32_t nblocks =
+      sf->size > start ? (sf->size - start + g_block_size - 1) / g_block_size
+                       : 0;
+  g_delay_reserved -= sf->delay_blocks;
+  sf->delay_blocks = 0;
+
+  // Walk to the tail through the block map when the chain is long
+  chain_cursor_t tail = {.index = 0, .block = FAT_FREE};
+  uint32_t block;
+  uint32_t unused;
+  int rc = 0;
+  if (nblocks > 0 &&
+      (locate_block_in_chain(sf, &tail, (from - 1) * g_block_size, &block,
+                             &unused) < 0 ||
+       extend_chain(sf->first_block, &tail, from + nblocks) < from + nblocks ||
+       locate_block_in_chain(sf, &tail, start, &block, &unused) < 0))
+    rc = -1;
+
+  run_batch_t batch = {.n = 0};
+  uint32_t stored = 0;  // leading blocks known to have reached the chain
+  for (uint32_t done = 0; rc == 0 && done < nblocks;) {
+    const char* src = sf->delay_buf + (size_t)done * g_block_size;
+    uint32_t run = chain_run_length(block, nblocks - done);
+    if (blockdev_is_mapped(&g_dev)) {
+      for (uint32_t i = 0; rc == 0 && i < run; i++) {
+        char* dst = mapped_block(block + i);
+        if (!dst) {
+          rc = -1;
+          break;
+        }
+        memcpy(dst, src + (size_t)i * g_block_size, g_block_size);
+        rc = mapped_block_written(block + i, 0, g_block_size);
+        if (rc == 0)
+          stored = done + i + 1;
+      }
+    } else {
+      run_batch_add(&batch, (void*)src, block, run, true);
+      if (batch.n == PENNFAT_IO_BATCH) {
+        rc = run_batch_submit(&batch);
+        if (rc == 0)
+          stored = done + run;
+      }
+    }
+    done += run;
+    if (done < nblocks)
+      block = fat_get(block + run - 1);
+  }
+  if (run_batch_submit(&batch) < 0)
+    rc = -1;
+  else if (rc == 0)
+    stored = nblocks;
+
+  if (rc < 0) {
+    // The rest is lost; the file must not claim bytes its chain lacks
+    uint32_t kept = start + stored * g_block_size;
+    if (sf->size > kept) {
+      sf->size = kept;
+      sf->mtime = time(NULL);
+    }
+    sf->delay_failed = 1;
+  }
+  delay_release(sf);
+  g_delay_flushes++;
+  return rc;
+}
+
+/*
+ * delay_take_error: Returns true, once, if delayed data of sf was lost since
+ * the last call. Every call that reports the loss to its caller takes it, so
+ * a failure nobody was told about still fails the file's next k_close.
+ */
+static bool delay_take_error(system_file_t* sf) {
+  bool failed = sf->delay_failed;
+  sf->delay_failed = 0;
+  return failed;
+}
+
+/*
+ * delay_flush_all: delay_flush() for every open file. Returns -1 if any of
+ * them lost delayed data, now or in an earlier flush not yet reported.
+ */
+static int delay_flush_all(void) {
+  int rc = 0;
+  for (int i = 0; i < MAX_SYSTEM_FILES; i++) {
+    system_file_t* sf = &g_sysfile_table[i];
+    if (!sf->in_use)
+      continue;
+    delay_flush(sf);
+    if (delay_take_error(sf))
+      rc = -1;
+  }
+  return rc;
+}
+
+/*
+ * delay_flush_if_due: Flushes every delay buffer once periodic_flusher has
+ * asked for it. Called on entry to the calls that use open files. A failure
+ * is not reported to that call, which may be about another file; it stays
+ * on the file whose data was lost until its k_close or a k_sync.
+ */
+static void delay_flush_if_due(void) {
+  if (!__atomic_exchange_n(&g_delay_due, false, __ATOMIC_ACQ_REL))
+    return;
+  for (int i = 0; i < MAX_SYSTEM_FILES; i++) {
+    system_file_t* sf = &g_sysfile_table[i];
+    if (sf->in_use && delay_flush(sf) < 0)
+      LOG_ERR("[delay_flush_if_due] Lost delayed data of block %u.",
+              sf->first_block);
+  }
+}
+
+/*
+ * delay_prepare: Decides where k_write's `n` bytes at fdesc->offset go, and
+ * returns how many leading bytes are written through the chain, which is
+ * made long enough for them. The rest lies past the chain and goes into sf's
+ * delay buffer, which has been sized and reserved for it. When the rest
+ * cannot be delayed, any delayed data is flushed first (keeping the chain in
+ * file order) and the whole write is allocated right away, as before. If the
+ * disk fills up first, only the bytes the chain then covers are returned.
+ * Returns PennFatErr_NOSPACE if it does not reach fdesc->offset at all, and
+ * PennFatErr_IO if the flush lost delayed data.
+ */
+static int delay_prepare(fd_entry_t* fdesc, system_file_t* sf, uint32_t n) {
+  uint32_t nblocks =
+      (uint32_t)((fdesc->offset + (uint64_t)n + g_block_size - 1) /
+                 g_block_size);
+  uint32_t unused;
+  uint32_t from = sf->delay_buf ? sf->delay_from
+                                : chain_walk(sf->first_block, &fdesc->chain,
+                                             nblocks, &unused);
+  if (from >= nblocks)
+    return (int)n;  // Within the chain, e.g. preallocated by k_fallocate
+  if (delay_reserve(sf, from, nblocks - from)) {
+    uint32_t start = from * g_block_size;
+    return fdesc->offset < start ? (int)(start - fdesc->offset) : 0;
+  }
+
+  delay_flush(sf);
+  if (delay_take_error(sf)) {
+    LOG_ERR("[k_write] Failed to write back delayed data of block %u.",
+            sf->first_block);
+    return PennFatErr_IO;
+  }
+  uint64_t covered = (uint64_t)extend_chain(sf->first_block, &fdesc->chain,
+                                            nblocks) *
+                     g_block_size;
+  if (covered <= fdesc->offset)
+    return PennFatErr_NOSPACE;
+  return covered - fdesc->offset < n ? (int)(covered - fdesc->offset) : (int)n;
+}
+
 /*
  * read_dirent: Reads a directory entry from a specific block and index.
  */
-static PennFatErr read_dirent(uint16_t block_num,
+static PennFatErr read_dirent(uint32_t block_num,
                               int index,
                               dir_entry_t* entry) {
   if (!entry)
@@ -290,12 +1265,12 @@ static PennFatErr read_dirent(uint16_t block_num,
   if (block_num == FAT_FREE || block_num == FAT_EOC)
     return PennFatErr_INVAD;
 
-  char* block_buffer = malloc(g_block_size);
+  char* block_buffer = bpool_acquire();
   if (!block_buffer)
     return PennFatErr_OUTOFMEM;
 
   if (read_block(block_buffer, block_num) != 0) {
-    free(block_buffer);
+    bpool_release(block_buffer);
     return PennFatErr_IO;
   }
 
@@ -303,19 +1278,19 @@ static PennFatErr read_dirent(uint16_t block_num,
   uint32_t entries_per_block = g_block_size / sizeof(dir_entry_t);
 
   if (index < 0 || (uint32_t)index >= entries_per_block) {
-    free(block_buffer);
+    bpool_release(block_buffer);
     return PennFatErr_INVAD;
   }
 
   memcpy(entry, &dir_entries[index], sizeof(dir_entry_t));
-  free(block_buffer);
+  bpool_release(block_buffer);
   return PennFatErr_OK;
 }
 
 /*
  * write_dirent: Writes a directory entry to a specific block and index.
  */
-static PennFatErr write_dirent(uint16_t block_num,
+static PennFatErr write_dirent(uint32_t block_num,
                                int index,
                                const dir_entry_t* entry) {
   if (!entry)
@@ -323,12 +1298,12 @@ static PennFatErr write_dirent(uint16_t block_num,
   if (block_num == FAT_FREE || block_num == FAT_EOC)
     return PennFatErr_INVAD;
 
-  char* block_buffer = malloc(g_block_size);
+  char* block_buffer = bpool_acquire();
   if (!block_buffer)
     return PennFatErr_OUTOFMEM;
 
   if (read_block(block_buffer, block_num) != 0) {
-    free(block_buffer);
+    bpool_release(block_buffer);
     return PennFatErr_IO;
   }
 
@@ -336,7 +1311,7 @@ static PennFatErr write_dirent(uint16_t block_num,
   uint32_t entries_per_block = g_block_size / sizeof(dir_entry_t);
 
   if (index < 0 || (uint32_t)index >= entries_per_block) {
-    free(block_buffer);
+    bpool_release(block_buffer);
     return PennFatErr_INVAD;
   }
 
@@ -348,13 +1323,14 @@ static PennFatErr write_dirent(uint16_t block_num,
 
   // Force the block to be written to disk immediately for directory blocks
   if (write_block(block_buffer, block_num) != 0) {
-    free(block_buffer);
+    bpool_release(block_buffer);
     return PennFatErr_IO;
   }
+  dcache_entry_written(block_num, (uint32_t)index, entry);
 
   // The write_block function already flushes to disk
 
-  free(block_buffer);
+  bpool_release(block_buffer);
   return PennFatErr_OK;
 }
 
@@ -445,12 +1421,12 @@ static int __attribute__((unused)) lookup_entry(const char* fname, int mode) {
     memset(&g_root_dir[idx], 0, sizeof(dir_entry_t));  // Clear the entry
     return PennFatErr_NOSPACE;  // No free blocks available
   }
-  g_root_dir[idx].first_block = (uint16_t)block;
+  dirent_set_block(&g_root_dir[idx], (uint32_t)block);
 
   LOG_DEBUG(
       "[lookup_entry] Created new file entry for '%s' at index %d with "
       "starting block %u.",
-      fname, idx, g_root_dir[idx].first_block);
+      fname, idx, dirent_block(&g_root_dir[idx]));
 
   return idx;
 }
@@ -459,17 +1435,23 @@ static int __attribute__((unused)) lookup_entry(const char* fname, int mode) {
 // 3) SYSTEM-WIDE FILE TABLE (SWFT) HELPERS
 // ---------------------------------------------------------------------------
 
+/* make_pseudo_inode: Key of an open file in the SWFT: where its directory
+ * entry lives */
+static inline uint64_t make_pseudo_inode(uint32_t entry_block, int index) {
+  return (uint64_t)entry_block << 16 | (uint32_t)index;
+}
+
 /* find_and_increment_sysfile: If the file is already open, increment its ref
  * count */
-static int find_and_increment_sysfile(int pseudo_inode) {  // Takes pseudo-inode
+static int find_and_increment_sysfile(uint64_t pseudo_inode) {
   for (int i = 0; i < MAX_SYSTEM_FILES; i++) {
     if (g_sysfile_table[i].in_use &&
         g_sysfile_table[i].dir_index == pseudo_inode) {  // Compare pseudo-inode
       g_sysfile_table[i].ref_count++;
       LOG_DEBUG(
           "[find_and_increment_sysfile] Found existing SWFT entry %d for "
-          "pseudo-inode 0x%x, ref count %d.",
-          i, pseudo_inode, g_sysfile_table[i].ref_count);
+          "pseudo-inode 0x%llx, ref count %d.",
+          i, (unsigned long long)pseudo_inode, g_sysfile_table[i].ref_count);
       return i;
     }
   }
@@ -478,21 +1460,22 @@ static int find_and_increment_sysfile(int pseudo_inode) {  // Takes pseudo-inode
 
 /* Create SWFT entry using resolved path info */
 static int create_sysfile_entry_from_resolved(const resolved_path_t* resolved,
-                                              int pseudo_inode) {
+                                              uint64_t pseudo_inode) {
   for (int i = 0; i < MAX_SYSTEM_FILES; i++) {
     if (!g_sysfile_table[i].in_use) {
       g_sysfile_table[i].in_use = true;
       g_sysfile_table[i].ref_count = 1;
       g_sysfile_table[i].dir_index = pseudo_inode;  // Store pseudo-inode
-      g_sysfile_table[i].first_block = resolved->entry.first_block;
+      g_sysfile_table[i].first_block = dirent_block(&resolved->entry);
       g_sysfile_table[i].size = resolved->entry.size;
       g_sysfile_table[i].mtime = resolved->entry.mtime;
       // Store other relevant info if needed (e.g., permissions?)
 
       LOG_DEBUG(
           "[create_sysfile_entry] Created new SWFT entry %d for pseudo-inode "
-          "0x%x (block %u, size %u).",
-          i, pseudo_inode, resolved->entry.first_block, resolved->entry.size);
+          "0x%llx (block %u, size %u).",
+          i, (unsigned long long)pseudo_inode, dirent_block(&resolved->entry),
+          resolved->entry.size);
       return i;
     }
   }
@@ -514,8 +1497,8 @@ static void release_sysfile_entry(int sys_idx) {
   if (g_sysfile_table[sys_idx].ref_count <= 0) {
     // Entry is no longer referenced by any FD. Update the directory entry on
     // disk.
-    int pseudo_inode = g_sysfile_table[sys_idx].dir_index;
-    uint16_t entry_block = (pseudo_inode >> 16) & 0xFFFF;
+    uint64_t pseudo_inode = g_sysfile_table[sys_idx].dir_index;
+    uint32_t entry_block = (uint32_t)(pseudo_inode >> 16);
     int entry_index = pseudo_inode & 0xFFFF;
 
     dir_entry_t current_entry;
@@ -524,16 +1507,16 @@ static void release_sysfile_entry(int sys_idx) {
       // Only update if the entry hasn't been deleted/changed underneath us
       LOG_DEBUG(
           "[release_sysfile_entry] Checking dirent update condition for SWFT "
-          "%d (pseudo-inode 0x%x).",
-          sys_idx, pseudo_inode);
+          "%d (pseudo-inode 0x%llx).",
+          sys_idx, (unsigned long long)pseudo_inode);
       LOG_DEBUG(
           "[release_sysfile_entry] Disk dirent: name[0]=%d, first_block=%u. "
           "SWFT: first_block=%u",
-          (int)current_entry.name[0], current_entry.first_block,
+          (int)current_entry.name[0], dirent_block(&current_entry),
           g_sysfile_table[sys_idx].first_block);
       if (current_entry.name[0] != 0 && (uint8_t)current_entry.name[0] != 1 &&
           (uint8_t)current_entry.name[0] != 2 &&
-          current_entry.first_block ==
+          dirent_block(&current_entry) ==
               g_sysfile_table[sys_idx].first_block)  // Basic check
       {
         LOG_DEBUG(
@@ -543,34 +1526,36 @@ static void release_sysfile_entry(int sys_idx) {
         current_entry.size = g_sysfile_table[sys_idx].size;
         current_entry.mtime = g_sysfile_table[sys_idx].mtime;
         // first_block might change during writes, update it too
-        current_entry.first_block = g_sysfile_table[sys_idx].first_block;
+        dirent_set_block(&current_entry, g_sysfile_table[sys_idx].first_block);
 
         err = write_dirent(entry_block, entry_index, &current_entry);
         if (err != PennFatErr_OK) {
           LOG_ERR(
               "[release_sysfile_entry] Failed to write updated dirent for SWFT "
-              "%d (pseudo-inode 0x%x) on close (Error %d).",
-              sys_idx, pseudo_inode, err);
+              "%d (pseudo-inode 0x%llx) on close (Error %d).",
+              sys_idx, (unsigned long long)pseudo_inode, err);
         } else {
           LOG_DEBUG(
               "[release_sysfile_entry] Updated dirent on disk for SWFT %d "
-              "(pseudo-inode 0x%x) on close.",
-              sys_idx, pseudo_inode);
+              "(pseudo-inode 0x%llx) on close.",
+              sys_idx, (unsigned long long)pseudo_inode);
         }
       } else {
         LOG_WARN(
-            "[release_sysfile_entry] Dirent for SWFT %d (pseudo-inode 0x%x) "
+            "[release_sysfile_entry] Dirent for SWFT %d (pseudo-inode 0x%llx) "
             "seems changed/deleted; skipping disk update on close.",
-            sys_idx, pseudo_inode);
+            sys_idx, (unsigned long long)pseudo_inode);
       }
     } else {
       LOG_ERR(
           "[release_sysfile_entry] Failed to read dirent for SWFT %d "
-          "(pseudo-inode 0x%x) on close (Error %d). Cannot update disk.",
-          sys_idx, pseudo_inode, err);
+          "(pseudo-inode 0x%llx) on close (Error %d). Cannot update disk.",
+          sys_idx, (unsigned long long)pseudo_inode, err);
     }
 
     // Clear the SWFT entry
+    blockmap_drop(&g_sysfile_table[sys_idx]);
+    delay_release(&g_sysfile_table[sys_idx]);
     memset(&g_sysfile_table[sys_idx], 0, sizeof(system_file_t));
     LOG_DEBUG("[release_sysfile_entry] Released SWFT entry %d.", sys_idx);
   }
@@ -578,30 +1563,48 @@ static void release_sysfile_entry(int sys_idx) {
 
 /*
  * add_dirent_to_dir: Adds a directory entry to a directory block.
- * Finds the first available slot in the directory and adds the entry there.
+ * An indexed directory hands out a free slot (or says there is none) without
+ * a scan; otherwise the first available slot in the chain is used. A new block
+ * is linked to the chain when every slot is taken.
  */
-static PennFatErr add_dirent_to_dir(uint16_t dir_block,
+static PennFatErr add_dirent_to_dir(uint32_t dir_block,
                                     const dir_entry_t* entry) {
   if (!entry)
     return PennFatErr_INVAD;
   if (dir_block == FAT_FREE || dir_block == FAT_EOC)
     return PennFatErr_INVAD;
 
-  char* block_buffer = malloc(g_block_size);
+  char* block_buffer = bpool_acquire();
   if (!block_buffer)
     return PennFatErr_OUTOFMEM;
 
-  uint16_t current_block = dir_block;
+  uint32_t current_block = dir_block;
   dir_entry_t* dir_entries;
   uint32_t entries_per_block = g_block_size / sizeof(dir_entry_t);
   bool found_slot = false;
-  uint16_t slot_block = 0;
+  uint32_t slot_block = 0;
   int slot_index = -1;
+  uint32_t last_block = FAT_FREE;  // chain tail, if the index knows it
+
+  uint32_t hint_block, hint_index;
+  int hinted = dindex_take_slot(dir_block, &hint_block, &hint_index);
+  if (hinted > 0) {
+    if (read_block(block_buffer, hint_block) != 0) {
+      dindex_drop(dir_block);  // the slot it handed out is lost
+      bpool_release(block_buffer);
+      return PennFatErr_IO;
+    }
+    found_slot = true;
+    slot_block = hint_block;
+    slot_index = (int)hint_index;
+  } else if (hinted == 0) {
+    last_block = hint_block;
+  }
 
   // Search for an available slot in the directory chain
-  while (current_block != FAT_EOC && current_block != FAT_FREE) {
+  while (hinted < 0 && current_block != FAT_EOC && current_block != FAT_FREE) {
     if (read_block(block_buffer, current_block) != 0) {
-      free(block_buffer);
+      bpool_release(block_buffer);
       return PennFatErr_IO;
     }
 
@@ -619,57 +1622,56 @@ static PennFatErr add_dirent_to_dir(uint16_t dir_block,
     }
 
     if (found_slot)
-      break;
+      break;  // block_buffer still holds slot_block
 
     // Move to the next block in the directory chain
-    current_block = g_fat[current_block];
+    current_block = fat_get(current_block);
   }
 
   // If no slot found, allocate a new block for the directory
   if (!found_slot) {
     int new_block = allocate_free_block();
     if (new_block < 0) {
-      free(block_buffer);
+      bpool_release(block_buffer);
       return PennFatErr_NOSPACE;
     }
 
     // Find the last block in the directory chain
-    current_block = dir_block;
-    while (g_fat[current_block] != FAT_EOC) {
-      current_block = g_fat[current_block];
+    current_block = last_block != FAT_FREE ? last_block : dir_block;
+    while (fat_get(current_block) != FAT_EOC) {
+      current_block = fat_get(current_block);
     }
 
     // Link the new block to the chain
-    g_fat[current_block] = (uint16_t)new_block;
+    fat_set(current_block, (uint32_t)new_block);
 
-    // Clear the new block
+    // The new block holds just the entry, in its first slot
     memset(block_buffer, 0, g_block_size);
+    memcpy(block_buffer, entry, sizeof(dir_entry_t));
     if (write_block(block_buffer, new_block) != 0) {
-      g_fat[current_block] = FAT_EOC;  // Rollback
-      g_fat[new_block] = FAT_FREE;     // Free the allocated block
-      free(block_buffer);
+      fat_set(current_block, FAT_EOC);  // Rollback
+      release_block(new_block);  // Free the allocated block
+      bpool_release(block_buffer);
       return PennFatErr_IO;
     }
-
-    slot_block = (uint16_t)new_block;
+    dindex_set_tail(dir_block, (uint32_t)new_block, 1);
+    slot_block = (uint32_t)new_block;
     slot_index = 0;
-  }
-
-  // Write the entry to the found/allocated slot
-  if (read_block(block_buffer, slot_block) != 0) {
-    free(block_buffer);
-    return PennFatErr_IO;
-  }
-
-  dir_entries = (dir_entry_t*)block_buffer;
-  memcpy(&dir_entries[slot_index], entry, sizeof(dir_entry_t));
+  } else {
+    // Write the entry to the found slot
+    dir_entries = (dir_entry_t*)block_buffer;
+    memcpy(&dir_entries[slot_index], entry, sizeof(dir_entry_t));
 
-  if (write_block(block_buffer, slot_block) != 0) {
-    free(block_buffer);
-    return PennFatErr_IO;
+    if (write_block(block_buffer, slot_block) != 0) {
+      dindex_drop(dir_block);
+      bpool_release(block_buffer);
+      return PennFatErr_IO;
+    }
   }
+  dindex_add(dir_block, entry->name, slot_block, (uint32_t)slot_index);
+  dcache_forget(dir_block, entry->name);
 
-  free(block_buffer);
+  bpool_release(block_buffer);
   return PennFatErr_OK;
 }
 
@@ -677,7 +1679,7 @@ static PennFatErr add_dirent_to_dir(uint16_t dir_block,
  * find_entry_in_dir: Searches for an entry with the given name in a directory.
  * If found, fills the resolved structure with the entry details.
  */
-static PennFatErr find_entry_in_dir(uint16_t dir_block,
+static PennFatErr find_entry_in_dir(uint32_t dir_block,
                                     const char* name,
                                     resolved_path_t* resolved) {
   if (!name || !resolved)
@@ -685,11 +1687,11 @@ static PennFatErr find_entry_in_dir(uint16_t dir_block,
   if (dir_block == FAT_FREE || dir_block == FAT_EOC)
     return PennFatErr_INVAD;
 
-  char* block_buffer = malloc(g_block_size);
+  char* block_buffer = bpool_acquire();
   if (!block_buffer)
     return PennFatErr_OUTOFMEM;
 
-  uint16_t current_block = dir_block;
+  uint32_t current_block = dir_block;
   dir_entry_t* dir_entries;
   uint32_t entries_per_block = g_block_size / sizeof(dir_entry_t);
   bool found = false;
@@ -699,50 +1701,261 @@ static PennFatErr find_entry_in_dir(uint16_t dir_block,
   resolved->is_root = false;
   resolved->parent_dir_block = dir_block;
 
+  // An indexed directory answers from its name index: a miss reads nothing
+  // and a hit reads the one block holding the entry
+  uint32_t entry_block, entry_index;
+  int indexed = dindex_find(dir_block, name, &entry_block, &entry_index);
+  if (indexed == 0) {
+    bpool_release(block_buffer);
+    return PennFatErr_OK;
+  }
+  if (indexed > 0) {
+    if (read_block(block_buffer, entry_block) != 0) {
+      bpool_release(block_buffer);
+      return PennFatErr_IO;
+    }
+    dir_entries = (dir_entry_t*)block_buffer;
+    if (strncmp(dir_entries[entry_index].name, name,
+                sizeof(dir_entries[entry_index].name)) == 0) {
+      resolved->found = true;
+      resolved->entry_block = entry_block;
+      resolved->entry_index_in_block = (int)entry_index;
+      memcpy(&resolved->entry, &dir_entries[entry_index], sizeof(dir_entry_t));
+      bpool_release(block_buffer);
+      return PennFatErr_OK;
+    }
+    LOG_WARN("[find_entry_in_dir] Index of directory %u is stale for '%s'.",
+             dir_block, name);
+    dindex_drop(dir_block);
+  }
+
+  // Otherwise scan the chain, building the index on the way unless it does
+  // not fit; then the scan stops at the match as before
+  bool indexing = dindex_create(dir_block, entries_per_block);
+  uint32_t tail_block = dir_block, tail_next = 0;
+
   // Search for the entry in the directory chain
   while (current_block != FAT_EOC && current_block != FAT_FREE) {
     if (read_block(block_buffer, current_block) != 0) {
-      free(block_buffer);
+      if (indexing)
+        dindex_drop(dir_block);
+      bpool_release(block_buffer);
       return PennFatErr_IO;
     }
 
     dir_entries = (dir_entry_t*)block_buffer;
+    tail_block = current_block;
+    tail_next = entries_per_block;
 
     // Look for the entry with matching name
     for (uint32_t i = 0; i < entries_per_block; i++) {
       if (dir_entries[i].name[0] == 0) {
         // End of directory
+        tail_next = i;
         break;
       }
 
       if ((uint8_t)dir_entries[i].name[0] == 1 ||
           (uint8_t)dir_entries[i].name[0] == 2) {
-        // Deleted entry, skip
+        // Deleted entry, skip (a 1 can take a new entry)
+        if (indexing && (uint8_t)dir_entries[i].name[0] == 1)
+          indexing = dindex_add_tomb(dir_block, current_block, i);
         continue;
       }
 
-      if (strcmp(dir_entries[i].name, name) == 0) {
+      if (indexing)
+        indexing =
+            dindex_add(dir_block, dir_entries[i].name, current_block, i);
+
+      if (!found && strcmp(dir_entries[i].name, name) == 0) {
         // Found the entry
         found = true;
         resolved->found = true;
         resolved->entry_block = current_block;
         resolved->entry_index_in_block = i;
         memcpy(&resolved->entry, &dir_entries[i], sizeof(dir_entry_t));
-        break;
       }
+      if (found && !indexing)
+        break;
     }
 
-    if (found)
+    if (found && !indexing)
       break;
 
     // Move to the next block in the directory chain
-    current_block = g_fat[current_block];
+    current_block = fat_get(current_block);
+  }
+  if (indexing)
+    dindex_set_tail(dir_block, tail_block, tail_next);
+
+  bpool_release(block_buffer);
+  return PennFatErr_OK;
+}
+
+/*
+ * lookup_component: find_entry_in_dir() through the dentry cache, which
+ * remembers both found entries and names that are not there.
+ */
+static PennFatErr lookup_component(uint32_t dir_block,
+                                   const char* name,
+                                   resolved_path_t* resolved) {
+  uint32_t entry_block, entry_index;
+  int cached = dcache_lookup(dir_block, name, &resolved->entry, &entry_block,
+                             &entry_index);
+  if (cached >= 0) {
+    resolved->found = cached > 0;
+    resolved->is_root = false;
+    resolved->parent_dir_block = dir_block;
+    if (resolved->found) {
+      resolved->entry_block = entry_block;
+      resolved->entry_index_in_block = (int)entry_index;
+    }
+    return PennFatErr_OK;
   }
 
-  free(block_buffer);
+  PennFatErr err = find_entry_in_dir(dir_block, name, resolved);
+  if (err != PennFatErr_OK)
+    return err;
+  dcache_insert(dir_block, name, resolved->found ? &resolved->entry : NULL,
+                resolved->entry_block,
+                (uint32_t)resolved->entry_index_in_block);
   return PennFatErr_OK;
 }
 
+/*
+ * compact_dir: Packs the live entries of the directory whose chain starts at
+ * dir_block into the front of its chain, keeping their order, and frees the
+ * blocks left empty behind them. Entries only move within the chain and its
+ * first block stays, so "." and ".." links and working directories are
+ * unaffected. The directory's index is rebuilt from the packed layout and
+ * its dentry cache results are dropped. Refused with PennFatErr_BUSY while
+ * one of its files is open (the SWFT knows open files by their slot) or the
+ * directory is being read with k_readdir(). Returns the blocks freed.
+ */
+static PennFatErr compact_dir(uint32_t dir_block) {
+  for (int dh = 0; dh < MAX_DIR_STREAMS; dh++) {
+    if (g_dir_streams[dh].in_use && g_dir_streams[dh].dir == dir_block)
+      return PennFatErr_BUSY;
+  }
+  for (uint32_t b = dir_block; b != FAT_EOC && b != FAT_FREE; b = fat_get(b)) {
+    for (int i = 0; i < MAX_SYSTEM_FILES; i++) {
+      if (g_sysfile_table[i].in_use &&
+          (uint32_t)(g_sysfile_table[i].dir_index >> 16) == b)
+        return PennFatErr_BUSY;
+    }
+  }
+
+  char* in_buf = bpool_acquire();
+  char* out_buf = bpool_acquire();
+  if (!in_buf || !out_buf) {
+    if (in_buf)
+      bpool_release(in_buf);
+    if (out_buf)
+      bpool_release(out_buf);
+    return PennFatErr_OUTOFMEM;
+  }
+  const dir_entry_t* in = (const dir_entry_t*)in_buf;
+  dir_entry_t* out = (dir_entry_t*)out_buf;
+  uint32_t entries_per_block = g_block_size / sizeof(dir_entry_t);
+
+  // Copy entries from the read position (block, i) down to the write
+  // position (out_block, out_next), which never passes it. A packed block is
+  // written once full, when every slot it covers has been read. Until the
+  // first deleted or unused slot the two positions coincide and nothing
+  // needs writing.
+  dcache_forget_dir(dir_block);
+  bool indexing = dindex_create(dir_block, entries_per_block);
+  uint32_t out_block = dir_block, out_next = 0, last = dir_block;
+  bool shifted = false;  // entries already moved down
+  bool dropped = false;  // deleted entries skipped
+  PennFatErr err = PennFatErr_OK;
+  memset(out_buf, 0, g_block_size);
+
+  for (uint32_t block = dir_block; block != FAT_EOC && block != FAT_FREE;
+       block = fat_get(block)) {
+    if (read_block(in_buf, block) != 0) {
+      err = PennFatErr_IO;
+      break;
+    }
+    for (uint32_t i = 0; i < entries_per_block; i++) {
+      uint8_t mark = (uint8_t)in[i].name[0];
+      if (mark == 0)
+        break;  // rest of the block was never used
+      if (mark == 1 || mark == 2) {
+        dropped = true;
+        continue;
+      }
+      if (out_block != block || out_next != i)
+        shifted = true;
+      out[out_next] = in[i];
+      if (indexing)
+        indexing = dindex_add(dir_block, in[i].name, out_block, out_next);
+      if (++out_next == entries_per_block) {
+        if (shifted && write_block(out_buf, out_block) != 0) {
+          err = PennFatErr_IO;
+          break;
+        }
+        last = out_block;
+        out_block = fat_get(out_block);
+        out_next = 0;
+        memset(out_buf, 0, g_block_size);
+      }
+    }
+    if (err != PennFatErr_OK)
+      break;
+  }
+
+  // The last packed block also clears the slots behind its entries
+  if (err == PennFatErr_OK && (out_next > 0 || out_block == dir_block)) {
+    if ((shifted || dropped) && write_block(out_buf, out_block) != 0)
+      err = PennFatErr_IO;
+    last = out_block;
+  }
+  bpool_release(in_buf);
+  bpool_release(out_buf);
+  if (err != PennFatErr_OK) {
+    LOG_ERR("[compact_dir] Failed to compact directory %u.", dir_block);
+    dindex_drop(dir_block);
+    return err;
+  }
+
+  uint32_t freed = 0;
+  for (uint32_t b = fat_get(last); b != FAT_EOC && b != FAT_FREE;
+       b = fat_get(b))
+    freed++;
+  cut_chain_after(last);
+  if (indexing)
+    dindex_set_tail(dir_block, last,
+                    last == out_block ? out_next : entries_per_block);
+
+  g_dir_compactions++;
+  g_dir_blocks_freed += freed;
+  LOG_INFO("[compact_dir] Compacted directory %u, freeing %u block(s).",
+           dir_block, freed);
+  return (PennFatErr)freed;
+}
+
+/*
+ * maybe_compact_dir: Compacts the directory at dir_block once deleted
+ * entries make up PENNFAT_DIR_COMPACT_RATIO percent of the slots it has used
+ * and at least a block's worth of them, so packing always frees a block.
+ * Only indexed directories are considered: their index keeps both counts.
+ */
+static void maybe_compact_dir(uint32_t dir_block) {
+  uint32_t live, deleted;
+  if (PENNFAT_DIR_COMPACT_RATIO == 0 || g_compact_held > 0 ||
+      !dindex_usage(dir_block, &live, &deleted))
+    return;
+  if (deleted < g_block_size / sizeof(dir_entry_t) ||
+      (uint64_t)deleted * 100 <
+          (uint64_t)(live + deleted) * PENNFAT_DIR_COMPACT_RATIO)
+    return;
+  PennFatErr err = compact_dir(dir_block);
+  if (err < 0)
+    LOG_DEBUG("[maybe_compact_dir] Directory %u not compacted (Error %d).",
+              dir_block, err);
+}
+
 /*
  * resolve_path: Resolves a path to a directory entry.
  * Handles absolute and relative paths, as well as '.' and '..' components.
@@ -784,7 +1997,7 @@ static PennFatErr resolve_path_internal(const char* path,
       strcpy(resolved->entry.name, "/");
       resolved->entry.type = 2;  // Directory
       resolved->entry.perm = DEF_PERM;
-      resolved->entry.first_block = 1;
+      dirent_set_block(&resolved->entry, 1);
       resolved->entry.mtime = time(NULL);
     } else {
       // For non-root directories, we need to find the entry in the parent
@@ -794,14 +2007,14 @@ static PennFatErr resolve_path_internal(const char* path,
       strcpy(resolved->entry.name, ".");
       resolved->entry.type = 2;  // Directory
       resolved->entry.perm = DEF_PERM;
-      resolved->entry.first_block = g_cwd_block;
+      dirent_set_block(&resolved->entry, g_cwd_block);
     }
 
     return PennFatErr_OK;
   }
 
   // Determine if this is an absolute or relative path
-  uint16_t current_dir;
+  uint32_t current_dir;
   if (path[0] == '/') {
     // Absolute path, start from root
     current_dir = 1;  // Root directory is always block 1
@@ -824,7 +2037,7 @@ static PennFatErr resolve_path_internal(const char* path,
     strcpy(resolved->entry.name, "/");
     resolved->entry.type = 2;  // Directory
     resolved->entry.perm = DEF_PERM;
-    resolved->entry.first_block = 1;
+    dirent_set_block(&resolved->entry, 1);
     resolved->entry.mtime = time(NULL);
 
     return PennFatErr_OK;
@@ -836,7 +2049,7 @@ static PennFatErr resolve_path_internal(const char* path,
   path_copy[PATH_MAX - 1] = '\0';
 
   char* component = strtok(path_copy, "/");
-  uint16_t parent_dir = current_dir;
+  uint32_t parent_dir = current_dir;
 
   while (component != NULL) {
     // Handle '.' and '..' special cases
@@ -854,13 +2067,13 @@ static PennFatErr resolve_path_internal(const char* path,
 
       // Find the '..' entry in the current directory to get the parent
       resolved_path_t dotdot_resolved;
-      PennFatErr err = find_entry_in_dir(current_dir, "..", &dotdot_resolved);
+      PennFatErr err = lookup_component(current_dir, "..", &dotdot_resolved);
       if (err != PennFatErr_OK || !dotdot_resolved.found) {
         return err;  // Error finding parent directory
       }
 
       parent_dir = current_dir;
-      current_dir = dotdot_resolved.entry.first_block;
+      current_dir = dirent_block(&dotdot_resolved.entry);
       component = strtok(NULL, "/");
       continue;
     }
@@ -869,7 +2082,7 @@ static PennFatErr resolve_path_internal(const char* path,
     parent_dir = current_dir;
     resolved_path_t component_resolved;
     PennFatErr err =
-        find_entry_in_dir(current_dir, component, &component_resolved);
+        lookup_component(current_dir, component, &component_resolved);
     if (err != PennFatErr_OK) {
       return err;  // Error during lookup
     }
@@ -923,7 +2136,7 @@ static PennFatErr resolve_path_internal(const char* path,
     }
 
     // Continue to the next component
-    current_dir = component_resolved.entry.first_block;
+    current_dir = dirent_block(&component_resolved.entry);
     component = next_component;
   }
 
@@ -940,7 +2153,7 @@ static PennFatErr resolve_path_internal(const char* path,
   strcpy(resolved->entry.name, ".");  // Use '.' as a placeholder
   resolved->entry.type = 2;           // Directory
   resolved->entry.perm = DEF_PERM;
-  resolved->entry.first_block = current_dir;
+  dirent_set_block(&resolved->entry, current_dir);
   resolved->entry.mtime = time(NULL);
 
   return PennFatErr_OK;
@@ -1007,6 +2220,7 @@ PennFatErr k_open(const char* path, int mode) {
     LOG_ERR("[k_open] Failed to open file: Invalid path (NULL).");
     return PennFatErr_INVAD;
   }
+  delay_flush_if_due();
   // Allow empty path only if relative (handled by resolve_path correctly)
   if (path[0] == '\0' && g_cwd_block == 1) {
     LOG_ERR(
@@ -1060,28 +2274,26 @@ PennFatErr k_open(const char* path, int mode) {
     if (HAS_WRITE(mode) && !HAS_APPEND(mode)) {
       LOG_DEBUG("[k_open] Truncating file '%s' (block %u, index %d)", path,
                 dir_entry_block, dir_entry_index);
-      // Free existing block chain
-      err = free_block_chain(resolved.entry.first_block);
-      if (err != PennFatErr_OK) {
-        LOG_ERR(
-            "[k_open] Failed to free blocks during truncation for '%s' (Error "
-            "%d).",
-            path, err);
-        return err;
-      }
-      // Allocate a single new block (or reuse first if possible?) - simpler to
-      // always alloc new
-      int first_block = allocate_free_block();
-      if (first_block < 0) {
-        LOG_ERR(
-            "[k_open] Failed to allocate first block during truncation for "
-            "'%s'.",
-            path);
-        return PennFatErr_NOSPACE;
+      // Keep the first block and free the rest of the chain in one cut; a
+      // file without a block gets a fresh one
+      uint32_t first_block = dirent_block(&resolved.entry);
+      bool fresh_block = first_block == FAT_FREE || first_block == FAT_EOC;
+      if (!fresh_block) {
+        cut_chain_after(first_block);
+      } else {
+        int block = allocate_free_block();
+        if (block < 0) {
+          LOG_ERR(
+              "[k_open] Failed to allocate first block during truncation for "
+              "'%s'.",
+              path);
+          return PennFatErr_NOSPACE;
+        }
+        first_block = (uint32_t)block;
       }
 
       // Update the directory entry
-      resolved.entry.first_block = (uint16_t)first_block;
+      dirent_set_block(&resolved.entry, first_block);
       resolved.entry.size = 0;
       resolved.entry.mtime = time(NULL);
       err = write_dirent(dir_entry_block, dir_entry_index, &resolved.entry);
@@ -1090,8 +2302,8 @@ PennFatErr k_open(const char* path, int mode) {
             "[k_open] Failed to write updated dirent during truncation for "
             "'%s' (Error %d).",
             path, err);
-        // Attempt rollback? Free the newly allocated block.
-        g_fat[first_block] = FAT_FREE;
+        if (fresh_block)
+          release_block(first_block);  // Roll back the allocation
         return err;
       }
     }
@@ -1101,8 +2313,8 @@ PennFatErr k_open(const char* path, int mode) {
     // the file We'll synthesize one for the SWFT lookup, although it's not
     // ideal. A better approach might store inode number if we had one, or use
     // path resolution result. For now, use block+index combo as key.
-    int combined_index =
-        (dir_entry_block << 16) | dir_entry_index;  // Pseudo-inode
+    uint64_t combined_index =
+        make_pseudo_inode(dir_entry_block, dir_entry_index);
     sys_idx =
         find_and_increment_sysfile(combined_index);  // Modify SWFT helpers
     if (sys_idx < 0) {
@@ -1112,6 +2324,15 @@ PennFatErr k_open(const char* path, int mode) {
         LOG_ERR("[k_open] Failed to create system file entry for '%s'.", path);
         return PennFatErr_OUTOFMEM;
       }
+    } else if (HAS_WRITE(mode) && !HAS_APPEND(mode)) {
+      // Truncated while open elsewhere: the old chain is gone, so the other
+      // fds must follow the new one
+      g_sysfile_table[sys_idx].first_block = dirent_block(&resolved.entry);
+      g_delay_dropped += g_sysfile_table[sys_idx].delay_blocks;
+      delay_release(&g_sysfile_table[sys_idx]);
+      g_sysfile_table[sys_idx].size = 0;
+      g_sysfile_table[sys_idx].mtime = resolved.entry.mtime;
+      invalidate_chain_caches(sys_idx);
     }
 
   } else {
@@ -1155,7 +2376,7 @@ PennFatErr k_open(const char* path, int mode) {
     strncpy(new_entry.name, filename, sizeof(new_entry.name) - 1);
     new_entry.type = 1;         // Regular file
     new_entry.perm = DEF_PERM;  // Default permissions
-    new_entry.first_block = (uint16_t)first_block;
+    dirent_set_block(&new_entry, (uint32_t)first_block);
     new_entry.size = 0;
     new_entry.mtime = time(NULL);
 
@@ -1166,7 +2387,7 @@ PennFatErr k_open(const char* path, int mode) {
           "[k_open] Failed to add entry for '%s' to parent directory block %u "
           "(Error %d)",
           filename, resolved.parent_dir_block, err);
-      g_fat[first_block] = FAT_FREE;  // Rollback block allocation
+      release_block(first_block);  // Rollback block allocation
       return err;
     }
     LOG_DEBUG("[k_open] Created new file '%s' in directory block %u", filename,
@@ -1195,8 +2416,8 @@ PennFatErr k_open(const char* path, int mode) {
            sizeof(dir_entry_t));  // Update resolved info
 
     // Create system file table entry
-    int combined_index =
-        (dir_entry_block << 16) | dir_entry_index;  // Pseudo-inode
+    uint64_t combined_index =
+        make_pseudo_inode(dir_entry_block, dir_entry_index);
     sys_idx = create_sysfile_entry_from_resolved(
         &created_resolved, combined_index);  // Modify SWFT helpers
     if (sys_idx < 0) {
@@ -1207,7 +2428,9 @@ PennFatErr k_open(const char* path, int mode) {
       memset(&deleted_entry, 0, sizeof(dir_entry_t));
       deleted_entry.name[0] = 1;  // Mark as deleted
       write_dirent(dir_entry_block, dir_entry_index, &deleted_entry);
-      free_block_chain(new_entry.first_block);
+      dindex_remove(resolved.parent_dir_block, new_entry.name,
+                    dir_entry_block, dir_entry_index);
+      free_block_chain(dirent_block(&new_entry));
       return PennFatErr_OUTOFMEM;
     }
   }
@@ -1220,6 +2443,10 @@ PennFatErr k_open(const char* path, int mode) {
       g_fd_table[fd].mode = mode;
       // Set offset: end for append, 0 otherwise
       g_fd_table[fd].offset = (HAS_APPEND(mode)) ? resolved.entry.size : 0;
+      g_fd_table[fd].ra_next = g_fd_table[fd].offset;
+      g_fd_table[fd].ra_window = 0;
+      g_fd_table[fd].ra_end = 0;
+      g_fd_table[fd].chain.block = FAT_FREE;
 
       LOG_INFO(
           "[k_open] Assigned file descriptor %d for path '%s' (SWFT index %d)",
@@ -1259,6 +2486,7 @@ PennFatErr k_read(int fd, int n, char* buf) {
         fd);
     return PennFatErr_INTERNAL;
   }
+  delay_flush_if_due();
 
   fd_entry_t* fdesc = &g_fd_table[fd];
   int sys_idx = fdesc->sysfile_index;
@@ -1287,15 +2515,21 @@ PennFatErr k_read(int fd, int n, char* buf) {
     return PennFatErr_SUCCESS;
   }
 
+  update_readahead(fdesc);
+
   int to_read = (n < (int)size_left) ? n : (int)size_left;
   int total_read = 0;
-  char* block_buf = malloc(g_block_size);
-  if (!block_buf) {
-    LOG_ERR(
-        "[k_read] Failed to allocate buffer for reading from file descriptor "
-        "%d: Out of memory.",
-        fd);
-    return PennFatErr_INTERNAL;
+  /* A mapped image is read in place; otherwise bounce through a block */
+  char* block_buf = NULL;
+  if (!blockdev_is_mapped(&g_dev)) {
+    block_buf = bpool_acquire();
+    if (!block_buf) {
+      LOG_ERR(
+          "[k_read] Failed to allocate buffer for reading from file "
+          "descriptor %d: Out of memory.",
+          fd);
+      return PennFatErr_INTERNAL;
+    }
   }
 
   LOG_INFO(
@@ -1303,27 +2537,69 @@ PennFatErr k_read(int fd, int n, char* buf) {
       "starting at offset %u.",
       to_read, fd, sys_idx, fdesc->offset);
 
+  run_batch_t batch = {.n = 0};
+  int batch_start = 0;  // total_read before the first queued run
   while (total_read < to_read) {
-    uint16_t block_num;
+    uint32_t block_num;
     uint32_t offset_in_block;
 
-    if (locate_block_in_chain(sf->first_block, fdesc->offset, &block_num,
-                              &offset_in_block) < 0)
-      break;
-    if (read_block(block_buf, block_num) < 0)
+    /* Data past the chain still sits in the delay buffer */
+    if (sf->delay_buf && fdesc->offset >= sf->delay_from * g_block_size) {
+      memcpy(buf + total_read,
+             sf->delay_buf + (fdesc->offset - sf->delay_from * g_block_size),
+             to_read - total_read);
+      fdesc->offset += to_read - total_read;
+      total_read = to_read;
       break;
+    }
 
+    if (locate_block_in_chain(sf, &fdesc->chain, fdesc->offset, &block_num,
+                              &offset_in_block) < 0)
+      break;
     uint32_t chunk = g_block_size - offset_in_block;
     int remain = to_read - total_read;
+
+    /* Whole blocks that are contiguous on disk: one request for the run */
+    if (block_buf && offset_in_block == 0 && (uint32_t)remain >= g_block_size) {
+      uint32_t run = chain_run_length(block_num, remain / g_block_size);
+      /* Blocks already cached (typically read ahead) are served from there */
+      uint32_t cached = bcache_read_resident(buf + total_read, block_num, run);
+      if (cached < run) {
+        if (batch.n == 0)
+          batch_start = total_read;
+        run_batch_add(&batch, buf + total_read + cached * g_block_size,
+                      block_num + cached, run - cached, false);
+      }
+      chunk = run * g_block_size;
+      total_read += chunk;
+      fdesc->offset += chunk;
+      if (batch.n == PENNFAT_IO_BATCH && run_batch_submit(&batch) < 0) {
+        fdesc->offset -= total_read - batch_start;
+        total_read = batch_start;
+        break;
+      }
+      continue;
+    }
+
+    const char* src = block_buf ? block_buf : mapped_block(block_num);
+    if (!src || (block_buf && read_block(block_buf, block_num) < 0))
+      break;
     if (chunk > (uint32_t)remain)
       chunk = remain;
 
-    memcpy(buf + total_read, block_buf + offset_in_block, chunk);
+    memcpy(buf + total_read, src + offset_in_block, chunk);
     total_read += chunk;
     fdesc->offset += chunk;
   }
+  if (run_batch_submit(&batch) < 0) {
+    fdesc->offset -= total_read - batch_start;
+    total_read = batch_start;
+  }
+
+  fdesc->ra_next = fdesc->offset;
+  readahead(fdesc, sf);
 
-  free(block_buf);
+  bpool_release(block_buf);
   return total_read;
 }
 
@@ -1349,6 +2625,7 @@ PennFatErr k_write(int fd, const char* buf, int n) {
         fd);
     return PennFatErr_INTERNAL;
   }
+  delay_flush_if_due();
 
   fd_entry_t* fdesc = &g_fd_table[fd];
   int sys_idx = fdesc->sysfile_index;
@@ -1368,51 +2645,122 @@ PennFatErr k_write(int fd, const char* buf, int n) {
   }
 
   int total_written = 0;
-  char* block_buf = malloc(g_block_size);
-  if (!block_buf) {
-    LOG_ERR(
-        "[k_write] Failed to allocate buffer for writing to file descriptor "
-        "%d: Out of memory.",
-        fd);
-    return PennFatErr_INTERNAL;
+  /* A mapped image is written in place; otherwise read-modify-write */
+  char* block_buf = NULL;
+  if (!blockdev_is_mapped(&g_dev)) {
+    block_buf = bpool_acquire();
+    if (!block_buf) {
+      LOG_ERR(
+          "[k_write] Failed to allocate buffer for writing to file "
+          "descriptor %d: Out of memory.",
+          fd);
+      return PennFatErr_INTERNAL;
+    }
   }
 
-  while (total_written < n) {
-    uint16_t block_num;
-    uint32_t offset_in_block;
-
-    if (locate_block_in_chain(sf->first_block, fdesc->offset, &block_num,
-                              &offset_in_block) < 0) {
-      /* Need to allocate a new block */
-      uint16_t last = sf->first_block;
-      while (g_fat[last] != FAT_EOC)
-        last = g_fat[last];
-      int newblk = allocate_free_block();
-      if (newblk < 0)
-        break;
-      g_fat[last] = (uint16_t)newblk;
-      block_num = (uint16_t)newblk;
-      offset_in_block = 0;
+  /* Bytes past the end of the chain are held back for delayed allocation;
+     otherwise every block the write needs is allocated up front, so a
+     fresh image hands out one contiguous run instead of a block per
+     iteration. On a full disk `direct` is as much as the chain could cover */
+  int direct = n > 0 ? delay_prepare(fdesc, sf, (uint32_t)n) : 0;
+  if (direct < 0) {
+    bpool_release(block_buf);
+    return direct;
+  }
+
+  /* A write past EOF leaves a gap that must read back as zeroes. Blocks
+     freed by another file (or reserved by k_fallocate) still hold old data,
+     so the part of the gap in the chain is cleared; the delay buffer's part
+     already is zero */
+  if (n > 0 && fdesc->offset > sf->size) {
+    uint32_t gap_end = fdesc->offset;
+    if (sf->delay_buf && gap_end > sf->delay_from * g_block_size)
+      gap_end = sf->delay_from * g_block_size;
+    if (gap_end > sf->size && zero_file_range(sf, sf->size, gap_end) < 0) {
+      bpool_release(block_buf);
+      return PennFatErr_IO;
     }
+  }
 
-    if (read_block(block_buf, block_num) < 0)
-      break;
+  uint32_t old_size = sf->size;  // bytes past this are not worth reading
+  run_batch_t batch = {.n = 0};
+  int batch_start = 0;  // total_written before the first queued run
+  while (total_written < direct) {
+    uint32_t block_num;
+    uint32_t offset_in_block;
+
+    if (locate_block_in_chain(sf, &fdesc->chain, fdesc->offset, &block_num,
+                              &offset_in_block) < 0)
+      break;  // disk full: extend_chain could not cover the whole write
 
     uint32_t chunk = g_block_size - offset_in_block;
-    int remain = n - total_written;
+    int remain = direct - total_written;
     if (chunk > (uint32_t)remain)
       chunk = remain;
 
-    memcpy(block_buf + offset_in_block, buf + total_written, chunk);
-    if (write_block(block_buf, block_num) < 0)
-      break;
+    if (block_buf && offset_in_block == 0 && (uint32_t)remain >= g_block_size) {
+      /* Whole blocks that are contiguous on disk: one request for the run */
+      uint32_t run = chain_run_length(block_num, remain / g_block_size);
+      if (batch.n == 0)
+        batch_start = total_written;
+      run_batch_add(&batch, (char*)buf + total_written, block_num, run, true);
+      chunk = run * g_block_size;
+      total_written += chunk;
+      fdesc->offset += chunk;
+      if (batch.n == PENNFAT_IO_BATCH && run_batch_submit(&batch) < 0) {
+        fdesc->offset -= total_written - batch_start;
+        total_written = batch_start;
+        break;
+      }
+      continue;
+    }
+
+    if (!block_buf) {
+      char* dst = mapped_block(block_num);
+      if (!dst)
+        break;
+      memcpy(dst + offset_in_block, buf + total_written, chunk);
+      if (mapped_block_written(block_num, offset_in_block, chunk) < 0)
+        break;
+    } else {
+      /* Only read the old block if some of the file's existing bytes in it
+         survive this write; a block past the old EOF (e.g. one extend_chain
+         just allocated) is built from zeroes instead */
+      uint32_t block_start = fdesc->offset - offset_in_block;
+      bool keeps_head = offset_in_block > 0 && block_start < old_size;
+      bool keeps_tail = fdesc->offset + chunk < old_size;
+      if (keeps_head || keeps_tail) {
+        if (read_block(block_buf, block_num) < 0)
+          break;
+      } else {
+        memset(block_buf, 0, offset_in_block);
+        memset(block_buf + offset_in_block + chunk, 0,
+               g_block_size - offset_in_block - chunk);
+        __atomic_add_fetch(&g_rmw_skipped, 1, __ATOMIC_RELAXED);
+      }
+      memcpy(block_buf + offset_in_block, buf + total_written, chunk);
+      if (write_block(block_buf, block_num) < 0)
+        break;
+    }
 
     total_written += chunk;
     fdesc->offset += chunk;
-    if (fdesc->offset > sf->size) {
-      sf->size = fdesc->offset;
-      sf->mtime = time(NULL);
-    }
+  }
+  if (run_batch_submit(&batch) < 0) {
+    fdesc->offset -= total_written - batch_start;
+    total_written = batch_start;
+  }
+  if (total_written == direct && direct < n && sf->delay_buf) {
+    // The rest lies in the delay buffer, zero-filled up to fdesc->offset
+    memcpy(sf->delay_buf + (fdesc->offset - sf->delay_from * g_block_size),
+           buf + total_written, n - total_written);
+    fdesc->offset += n - total_written;
+    total_written = n;
+  }
+
+  if (fdesc->offset > sf->size) {
+    sf->size = fdesc->offset;
+    sf->mtime = time(NULL);
   }
 
   LOG_INFO(
@@ -1420,7 +2768,7 @@ PennFatErr k_write(int fd, const char* buf, int n) {
       "index %d). New file size is %u bytes.",
       total_written, fd, sys_idx, sf->size);
 
-  free(block_buf);
+  bpool_release(block_buf);
   return total_written;
 }
 
@@ -1443,10 +2791,24 @@ PennFatErr k_close(int fd) {
     return PennFatErr_INTERNAL;
   }
 
+  /* The fd is closed even if delayed data was lost; the size written back
+     to its entry then covers only what reached the chain */
   int sys_idx = g_fd_table[fd].sysfile_index;
+  delay_flush(&g_sysfile_table[sys_idx]);
+  bool lost = delay_take_error(&g_sysfile_table[sys_idx]);
   g_fd_table[fd].in_use = false;
   release_sysfile_entry(sys_idx);
 
+  PennFatErr err = durability_point();
+  if (err != PennFatErr_OK) {
+    LOG_ERR("[k_close] Failed to flush block cache while closing fd %d.", fd);
+    return err;
+  }
+  if (lost) {
+    LOG_ERR("[k_close] Delayed data of fd %d could not be written back.", fd);
+    return PennFatErr_IO;
+  }
+
   LOG_INFO(
       "[k_close] Successfully closed file descriptor %d (sysfile index %d).",
       fd, sys_idx);
@@ -1505,8 +2867,8 @@ PennFatErr k_unlink(const char* path) {
   }
 
   // Check if the file is currently open (check SWFT reference count)
-  int pseudo_inode =
-      (resolved.entry_block << 16) | resolved.entry_index_in_block;
+  uint64_t pseudo_inode =
+      make_pseudo_inode(resolved.entry_block, resolved.entry_index_in_block);
   int sys_idx = find_and_increment_sysfile(pseudo_inode);
   if (sys_idx >= 0) {  // Found an entry
     if (g_sysfile_table[sys_idx].ref_count >
@@ -1524,20 +2886,22 @@ PennFatErr k_unlink(const char* path) {
   }
 
   // Free the blocks used by the file (if any)
-  if (resolved.entry.first_block != FAT_EOC &&
-      resolved.entry.first_block != FAT_FREE) {
-    err = free_block_chain(resolved.entry.first_block);
+  if (dirent_block(&resolved.entry) != FAT_EOC &&
+      dirent_block(&resolved.entry) != FAT_FREE) {
+    err = free_block_chain(dirent_block(&resolved.entry));
     if (err != PennFatErr_OK) {
       LOG_ERR(
           "[k_unlink] Failed to free blocks for '%s' starting at %u (Error "
           "%d).",
-          path, resolved.entry.first_block, err);
+          path, dirent_block(&resolved.entry), err);
       // Continue to remove dirent, but log error. FS state might be
       // inconsistent.
     } else {
       LOG_DEBUG("[k_unlink] Freed block chain starting at %u for file '%s'",
-                resolved.entry.first_block, path);
+                dirent_block(&resolved.entry), path);
     }
+    if (sys_idx >= 0)
+      invalidate_chain_caches(sys_idx);
   }
 
   // Mark the directory entry as deleted in the parent directory
@@ -1553,6 +2917,9 @@ PennFatErr k_unlink(const char* path) {
         resolved.entry.name, resolved.entry_block, err);
     return err;  // Failed to update parent directory
   }
+  dindex_remove(resolved.parent_dir_block, resolved.entry.name,
+                resolved.entry_block, resolved.entry_index_in_block);
+  maybe_compact_dir(resolved.parent_dir_block);
   LOG_DEBUG(
       "[k_unlink] Marked entry for '%s' as deleted in parent block %u index %d",
       resolved.entry.name, resolved.entry_block, resolved.entry_index_in_block);
@@ -1623,6 +2990,10 @@ PennFatErr k_lseek(int fd, int offset, int whence) {
   }
 
   fdesc->offset = (uint32_t)new_offset;
+  /* A seek breaks any sequential pattern: start read-ahead over */
+  fdesc->ra_next = UINT32_MAX;
+  fdesc->ra_window = 0;
+  fdesc->ra_end = 0;
   LOG_INFO(
       "[k_lseek] Successfully sought in file descriptor %d (sysfile index %d) "
       "to new offset %u.",
@@ -1631,206 +3002,325 @@ PennFatErr k_lseek(int fd, int offset, int whence) {
   return fdesc->offset;
 }
 
-/**
- * List the file filename in the current directory. If filename is NULL, list
- * all files in the current directory. This should act as very similar to posix,
- * displaying the first block of the file, its permissions (you can leave this
- * for the time being, chmod will be required to be implemented later), size,
- * latest modification timestamp and filename.
+/*
+ * k_ftruncate: Sets the size of the file open on fd to `length` bytes.
+ * Shrinking ends the chain at the block holding the new last byte and frees
+ * the whole tail at once (a file keeps at least its first block). Growing
+ * appends the missing blocks as contiguous runs and zero-fills the new bytes.
+ * Offsets of fds past the new end are left alone, as with ftruncate(2).
  */
-PennFatErr k_ls(const char* path) {
+PennFatErr k_ftruncate(int fd, int length) {
   if (!g_mounted) {
-    LOG_WARN("[k_ls] Failed to list files: Filesystem not mounted.");
+    LOG_WARN(
+        "[k_ftruncate] Failed to truncate file descriptor %d: Filesystem not "
+        "mounted.",
+        fd);
     return PennFatErr_NOT_MOUNTED;
   }
-
-  const char* target = (path && path[0] != '\0') ? path : ".";
-  LOG_INFO("[k_ls] Listing directory contents for path: '%s'", target);
-
-  resolved_path_t resolved;
-  PennFatErr err = resolve_path(target, &resolved);
-  if (err != PennFatErr_OK) {
-    LOG_ERR("[k_ls] Path resolution failed for '%s' with error %d", target,
-            err);
-    return err;
+  if (fd < 0 || fd >= MAX_FD || !g_fd_table[fd].in_use) {
+    LOG_ERR(
+        "[k_ftruncate] Failed to truncate file descriptor %d: Invalid file "
+        "descriptor or not in use.",
+        fd);
+    return PennFatErr_INTERNAL;
   }
-
-  if (!resolved.found) {
-    LOG_ERR("[k_ls] Cannot list '%s': Path does not exist.", target);
-    return PennFatErr_EXISTS;
+  if (length < 0) {
+    LOG_ERR("[k_ftruncate] Invalid length %d for file descriptor %d.", length,
+            fd);
+    return PennFatErr_INVAD;
   }
 
-  uint16_t dir_to_list_block;
-  if (resolved.is_root) {
-    dir_to_list_block = 1;                // Root directory is always block 1
-  } else if (resolved.entry.type == 2) {  // Directory
-    dir_to_list_block = resolved.entry.first_block;
-  } else {
-    LOG_ERR("[k_ls] Cannot list '%s': Not a directory.", target);
-    return PennFatErr_NOTDIR;
+  fd_entry_t* fdesc = &g_fd_table[fd];
+  int sys_idx = fdesc->sysfile_index;
+  system_file_t* sf = &g_sysfile_table[sys_idx];
+  if (HAS_READ(fdesc->mode)) {
+    LOG_WARN(
+        "[k_ftruncate] Cannot truncate file descriptor %d: File opened in "
+        "read-only mode.",
+        fd);
+    return PennFatErr_PERM;
   }
-
-  // Directory listing implementation...
-  printf("Listing directory block %u:\n", dir_to_list_block);
-  printf("      Block Perm Size       Timestamp             Name\n");
-  printf("------------------------------------------------------------\n");
-
-  char* block_buffer = malloc(g_block_size);
-  if (!block_buffer) {
-    return PennFatErr_OUTOFMEM;
+  if (sf->first_block == FAT_FREE || sf->first_block == FAT_EOC) {
+    LOG_ERR("[k_ftruncate] File descriptor %d has no block chain.", fd);
+    return PennFatErr_INTERNAL;
   }
 
-  dir_entry_t* dir_entries = (dir_entry_t*)block_buffer;
-  uint32_t entries_per_block = g_block_size / sizeof(dir_entry_t);
-  int entries_found = 0;
+  uint32_t new_size = (uint32_t)length;
+  uint32_t nblocks = (new_size + g_block_size - 1) / g_block_size;
+  if (nblocks == 0)
+    nblocks = 1;
+
+  if (sf->delay_buf) {
+    uint32_t start = sf->delay_from * g_block_size;
+    if (new_size < start) {
+      // The delayed data is cut off before it ever got blocks
+      g_delay_dropped += sf->delay_blocks;
+      delay_release(sf);
+    } else if (new_size <= sf->size) {
+      // Hand back the reservation of the blocks cut off the buffer's end
+      uint32_t keep = (new_size - start + g_block_size - 1) / g_block_size;
+      if (sf->delay_blocks > keep) {
+        g_delay_dropped += sf->delay_blocks - keep;
+        g_delay_reserved -= sf->delay_blocks - keep;
+        sf->delay_blocks = keep;
+      }
+      memset(sf->delay_buf + (new_size - start), 0, sf->size - new_size);
+      sf->size = new_size;
+      sf->mtime = time(NULL);
+      return PennFatErr_OK;
+    } else {
+      delay_flush(sf);
+      if (delay_take_error(sf)) {
+        LOG_ERR("[k_ftruncate] Failed to write back delayed data of fd %d.",
+                fd);
+        return PennFatErr_IO;
+      }
+    }
+  }
 
-  uint16_t current_block = dir_to_list_block;
-  while (current_block != FAT_EOC && current_block != FAT_FREE) {
-    if (read_block(block_buffer, current_block)) {
-      fprintf(stderr, "Error reading block %u\n", current_block);
-      free(block_buffer);
+  if (new_size <= sf->size) {
+    // Same size still cuts the blocks k_fallocate reserved past the end
+    uint32_t last;
+    uint32_t unused;
+    if (locate_block_in_chain(sf, NULL, (nblocks - 1) * g_block_size, &last,
+                              &unused) < 0) {
+      LOG_ERR(
+          "[k_ftruncate] Chain of file descriptor %d is shorter than %u "
+          "blocks.",
+          fd, nblocks);
+      return PennFatErr_INTERNAL;
+    }
+    cut_chain_after(last);
+    invalidate_chain_caches(sys_idx);
+    // The rest of the new last block must read as zeroes if the file grows
+    uint32_t kept_end = nblocks * g_block_size;
+    if (kept_end > sf->size)
+      kept_end = sf->size;
+    if (new_size < kept_end && zero_file_range(sf, new_size, kept_end) < 0) {
+      LOG_ERR("[k_ftruncate] Failed to zero-fill file descriptor %d.", fd);
       return PennFatErr_IO;
     }
-
-    for (uint32_t i = 0; i < entries_per_block; i++) {
-      if (dir_entries[i].name[0] == 0)
-        break;  // End of entries
-      if ((uint8_t)dir_entries[i].name[0] == 1 ||
-          (uint8_t)dir_entries[i].name[0] == 2)
-        continue;  // Skip deleted
-
-      entries_found++;
-
-      // Format permissions
-      char perm_str[4];
-      perm_to_str(dir_entries[i].perm, perm_str);
-
-      // Format time
-      char time_str[20];
-      struct tm* tm_info = localtime(&dir_entries[i].mtime);
-      strftime(time_str, sizeof(time_str), "%b %d %H:%M",
-               tm_info ? tm_info : NULL);
-
-      // Determine entry type
-      char type_char = '-';
-      if (dir_entries[i].type == 2)
-        type_char = 'd';
-      else if (dir_entries[i].type == 4)
-        type_char = 'l';
-
-      printf("%10u %c%s %-10u %s %s", dir_entries[i].first_block, type_char,
-             perm_str, dir_entries[i].size, time_str, dir_entries[i].name);
-
-      // Handle symlink target if needed
-      if (dir_entries[i].type == 4) {
-        char target_buf[g_block_size];
-        if (read_block(target_buf, dir_entries[i].first_block)) {
-          printf(" -> [Error reading target]");
-        } else {
-          target_buf[g_block_size - 1] = '\0';
-          printf(" -> %s", target_buf);
-        }
-      }
-      printf("\n");
+  } else if (new_size > sf->size) {
+    if (extend_chain(sf->first_block, &fdesc->chain, nblocks) < nblocks) {
+      LOG_ERR("[k_ftruncate] No space to grow file descriptor %d to %u bytes.",
+              fd, new_size);
+      return PennFatErr_NOSPACE;
+    }
+    if (zero_file_range(sf, sf->size, new_size) < 0) {
+      LOG_ERR("[k_ftruncate] Failed to zero-fill file descriptor %d.", fd);
+      return PennFatErr_IO;
     }
-
-    current_block = g_fat[current_block];
   }
 
-  free(block_buffer);
+  sf->size = new_size;
+  sf->mtime = time(NULL);
+  LOG_INFO(
+      "[k_ftruncate] File descriptor %d (sysfile index %d) is now %u bytes.",
+      fd, sys_idx, new_size);
+  return PennFatErr_OK;
+}
+
+/*
+ * k_fallocate: Makes sure the chain of the file open on fd has blocks for at
+ * least `length` bytes, without changing its size. The blocks are appended as
+ * contiguous runs, so later k_writes up to `length` allocate nothing. They
+ * stay with the file until k_ftruncate, a truncating k_open or k_unlink.
+ * Returns PennFatErr_NOSPACE if the disk filled up first; the blocks reserved
+ * until then are kept.
+ */
+PennFatErr k_fallocate(int fd, int length) {
+  if (!g_mounted) {
+    LOG_WARN(
+        "[k_fallocate] Failed to allocate for file descriptor %d: Filesystem "
+        "not mounted.",
+        fd);
+    return PennFatErr_NOT_MOUNTED;
+  }
+  if (fd < 0 || fd >= MAX_FD || !g_fd_table[fd].in_use) {
+    LOG_ERR(
+        "[k_fallocate] Failed to allocate for file descriptor %d: Invalid "
+        "file descriptor or not in use.",
+        fd);
+    return PennFatErr_INTERNAL;
+  }
+  if (length < 0) {
+    LOG_ERR("[k_fallocate] Invalid length %d for file descriptor %d.", length,
+            fd);
+    return PennFatErr_INVAD;
+  }
 
-  if (entries_found == 0) {
-    printf("(Directory is empty)\n");
+  fd_entry_t* fdesc = &g_fd_table[fd];
+  system_file_t* sf = &g_sysfile_table[fdesc->sysfile_index];
+  if (HAS_READ(fdesc->mode)) {
+    LOG_WARN(
+        "[k_fallocate] Cannot allocate for file descriptor %d: File opened "
+        "in read-only mode.",
+        fd);
+    return PennFatErr_PERM;
+  }
+  if (sf->first_block == FAT_FREE || sf->first_block == FAT_EOC) {
+    LOG_ERR("[k_fallocate] File descriptor %d has no block chain.", fd);
+    return PennFatErr_INTERNAL;
   }
-  printf("------------------------------------------------------------\n");
 
+  delay_flush(sf);
+  if (delay_take_error(sf)) {
+    LOG_ERR("[k_fallocate] Failed to write back delayed data of fd %d.", fd);
+    return PennFatErr_IO;
+  }
+  uint32_t nblocks = ((uint32_t)length + g_block_size - 1) / g_block_size;
+  if (nblocks > 0 &&
+      extend_chain(sf->first_block, &fdesc->chain, nblocks) < nblocks) {
+    LOG_ERR(
+        "[k_fallocate] No space to reserve %d bytes for file descriptor %d.",
+        length, fd);
+    return PennFatErr_NOSPACE;
+  }
+  LOG_INFO("[k_fallocate] Reserved %u blocks for file descriptor %d.", nblocks,
+           fd);
   return PennFatErr_OK;
 }
 
-PennFatErr k_ls_long(const char* path) {
+/*
+ * k_opendir: Opens the directory at path (NULL or "" = the current one) for
+ * reading with k_readdir(). Returns a directory handle whose cursor sits on
+ * the first entry, or a negative error code.
+ */
+PennFatErr k_opendir(const char* path) {
   if (!g_mounted) {
-    LOG_WARN("[k_ls_long] Filesystem not mounted");
+    LOG_WARN("[k_opendir] Failed to open directory: Filesystem not mounted.");
     return PennFatErr_NOT_MOUNTED;
   }
 
   const char* target = (path && path[0] != '\0') ? path : ".";
-  LOG_INFO("[k_ls_long] Long listing for: '%s'", target);
-
   resolved_path_t resolved;
   PennFatErr err = resolve_path(target, &resolved);
   if (err != PennFatErr_OK) {
-    LOG_ERR("[k_ls_long] Path resolution failed");
+    LOG_ERR("[k_opendir] Path resolution failed for '%s' with error %d",
+            target, err);
     return err;
   }
-
   if (!resolved.found) {
-    LOG_ERR("[k_ls_long] Path not found");
+    LOG_ERR("[k_opendir] Cannot open '%s': Path does not exist.", target);
     return PennFatErr_EXISTS;
   }
-
   if (!resolved.is_root && resolved.entry.type != 2) {
-    LOG_ERR("[k_ls_long] Not a directory");
+    LOG_ERR("[k_opendir] Cannot open '%s': Not a directory.", target);
     return PennFatErr_NOTDIR;
   }
 
-  uint16_t dir_block = resolved.is_root ? 1 : resolved.entry.first_block;
-  printf("total %u\n",
-         /* Calculate total blocks used */ 0);  // TODO: Implement block count
+  for (int dh = 0; dh < MAX_DIR_STREAMS; dh++) {
+    dir_stream_t* s = &g_dir_streams[dh];
+    if (s->in_use)
+      continue;
+    s->in_use = true;
+    s->dir = resolved.is_root ? 1 : dirent_block(&resolved.entry);
+    s->block = s->dir;
+    s->slot = 0;
+    LOG_INFO("[k_opendir] Opened directory '%s' (block %u) as handle %d.",
+             target, s->dir, dh);
+    return dh;
+  }
+  LOG_ERR("[k_opendir] Cannot open '%s': No free directory handles.", target);
+  return PennFatErr_OUTOFMEM;
+}
 
-  char* block_buf = malloc(g_block_size);
-  if (!block_buf)
-    return PennFatErr_OUTOFMEM;
+/*
+ * k_readdir: Copies up to max live entries of the directory open as dh into
+ * buf, in directory order, and moves its cursor past them. Deleted and
+ * never-used slots are skipped. Each call reads only the blocks it needs, so
+ * a directory of any size can be listed a batch at a time. Returns the number
+ * of entries copied (0 once the whole directory was read) or a negative error
+ * code.
+ */
+PennFatErr k_readdir(int dh, dir_entry_t* buf, int max) {
+  if (!g_mounted) {
+    LOG_WARN("[k_readdir] Failed to read directory: Filesystem not mounted.");
+    return PennFatErr_NOT_MOUNTED;
+  }
+  if (dh < 0 || dh >= MAX_DIR_STREAMS || !g_dir_streams[dh].in_use) {
+    LOG_ERR("[k_readdir] Invalid directory handle %d.", dh);
+    return PennFatErr_INVAD;
+  }
+  if (!buf || max < 0) {
+    LOG_ERR("[k_readdir] Invalid buffer for directory handle %d.", dh);
+    return PennFatErr_INVAD;
+  }
 
-  uint16_t current_block = dir_block;
-  while (current_block != FAT_EOC && current_block != FAT_FREE) {
-    if (read_block(block_buf, current_block)) {
-      free(block_buf);
+  dir_stream_t* s = &g_dir_streams[dh];
+  uint32_t entries_per_block = g_block_size / sizeof(dir_entry_t);
+  char* block_buffer = NULL;
+  int n = 0;
+
+  while (n < max && s->block != FAT_EOC && s->block != FAT_FREE) {
+    if (!block_buffer && !(block_buffer = bpool_acquire()))
+      return PennFatErr_OUTOFMEM;
+    if (read_block(block_buffer, s->block) != 0) {
+      LOG_ERR("[k_readdir] Failed to read block %u of directory %u.", s->block,
+              s->dir);
+      bpool_release(block_buffer);
       return PennFatErr_IO;
     }
 
-    dir_entry_t* entries = (dir_entry_t*)block_buf;
-    uint32_t entries_per_block = g_block_size / sizeof(dir_entry_t);
-
-    for (uint32_t i = 0; i < entries_per_block; i++) {
-      if (entries[i].name[0] == 0)
+    const dir_entry_t* entries = (const dir_entry_t*)block_buffer;
+    while (n < max && s->slot < entries_per_block) {
+      uint8_t mark = (uint8_t)entries[s->slot].name[0];
+      if (mark == 0) {
+        s->slot = entries_per_block;  // rest of the block was never used
         break;
-      if ((uint8_t)entries[i].name[0] <= 2)
-        continue;  // Skip empty/deleted
-
-      // Format permissions
-      char perm_str[11];
-      snprintf(perm_str, sizeof(perm_str), "%c%c%c%c%c%c%c%c%c%c",
-               entries[i].type == 2 ? 'd' : '-',
-               entries[i].perm & PERM_READ ? 'r' : '-',
-               entries[i].perm & PERM_WRITE ? 'w' : '-',
-               entries[i].perm & PERM_EXEC ? 'x' : '-', '-', '-', '-', '-', '-',
-               '-');  // Placeholder for other permissions
-
-      // Format time
-      char time_str[20];
-      struct tm* tm = localtime(&entries[i].mtime);
-      strftime(time_str, sizeof(time_str), "%b %d %H:%M", tm);
-
-      printf("%s 1 %u %u %8u %s %s", perm_str, entries[i].first_block,
-             entries[i].size,
-             entries[i].size,  // Using size twice as placeholder
-             time_str, entries[i].name);
-
-      if (entries[i].type == 4) {  // Symlink
-        char target[g_block_size];
-        if (read_block(target, entries[i].first_block) == 0) {
-          target[g_block_size - 1] = '\0';
-          printf(" -> %s", target);
-        }
       }
-      printf("\n");
+      if (mark != 1 && mark != 2)
+        buf[n++] = entries[s->slot];
+      s->slot++;
+    }
+    if (s->slot == entries_per_block) {
+      s->block = fat_get(s->block);
+      s->slot = 0;
     }
-    current_block = g_fat[current_block];
   }
 
-  free(block_buf);
+  if (block_buffer)
+    bpool_release(block_buffer);
+  return n;
+}
+
+/* k_closedir: Releases a handle returned by k_opendir(). */
+PennFatErr k_closedir(int dh) {
+  if (dh < 0 || dh >= MAX_DIR_STREAMS || !g_dir_streams[dh].in_use) {
+    LOG_ERR("[k_closedir] Invalid directory handle %d.", dh);
+    return PennFatErr_INVAD;
+  }
+  g_dir_streams[dh].in_use = false;
   return PennFatErr_OK;
 }
+
+/*
+ * k_compact: Packs the directory at path (NULL or "" = the current one) now,
+ * whatever its share of deleted entries. Returns the number of blocks freed,
+ * or PennFatErr_BUSY if one of its files or the directory itself is open.
+ */
+PennFatErr k_compact(const char* path) {
+  if (!g_mounted) {
+    LOG_WARN("[k_compact] Failed to compact: Filesystem not mounted.");
+    return PennFatErr_NOT_MOUNTED;
+  }
+
+  const char* target = (path && path[0] != '\0') ? path : ".";
+  resolved_path_t resolved;
+  PennFatErr err = resolve_path(target, &resolved);
+  if (err != PennFatErr_OK)
+    return err;
+  if (!resolved.found) {
+    LOG_ERR("[k_compact] Cannot compact '%s': Path does not exist.", target);
+    return PennFatErr_EXISTS;
+  }
+  if (!resolved.is_root && resolved.entry.type != 2) {
+    LOG_ERR("[k_compact] Cannot compact '%s': Not a directory.", target);
+    return PennFatErr_NOTDIR;
+  }
+  return compact_dir(resolved.is_root ? 1 : dirent_block(&resolved.entry));
+}
+
 /*
  * k_touch: A kernel-level "touch" operation.
  *
@@ -1929,7 +3419,7 @@ PennFatErr k_touch(const char* path) {
     strncpy(new_entry.name, filename, sizeof(new_entry.name) - 1);
     new_entry.type = 1;                             // Regular file
     new_entry.perm = DEF_PERM;                      // Default permissions
-    new_entry.first_block = (uint16_t)first_block;  // Point to allocated block
+    dirent_set_block(&new_entry, first_block);  // Point to allocated block
     new_entry.size = 0;                             // Size is 0
     new_entry.mtime = time(NULL);
 
@@ -1940,7 +3430,7 @@ PennFatErr k_touch(const char* path) {
           "[k_touch] Failed to add entry for '%s' to parent directory block %u "
           "(Error %d)",
           filename, resolved.parent_dir_block, err);
-      g_fat[first_block] = FAT_FREE;  // Rollback block allocation
+      release_block(first_block);  // Rollback block allocation
       return err;
     }
     LOG_DEBUG("[k_touch] Created new file '%s' in directory block %u", filename,
@@ -2014,22 +3504,112 @@ PennFatErr k_chmod(const char* path, uint8_t new_perm) {
 
 /* --- Mount/Unmount Functions --- */
 
+/*
+ * read_format: Reads the start of the image mounted on g_dev and sets up
+ * g_superblock, g_block_size and g_fat_wide for it. A wide image begins
+ * with a pennfat_superblock_t; anything else is taken as a narrow image whose
+ * FAT[0] holds the format word (MSB = FAT blocks, LSB = block size config).
+ */
+static PennFatErr read_format(const char* fs_name) {
+  pennfat_superblock_t sb;
+  if (blockdev_read(&g_dev, &sb, sizeof(sb), 0) != 0) {
+    LOG_CRIT(
+        "[k_mount] Failed to read superblock from filesystem file '%s': %s",
+        fs_name, strerror(errno));
+    return PennFatErr_INTERNAL;
+  }
+
+  if (memcmp(sb.magic, PENNFAT_MAGIC, sizeof(sb.magic)) == 0) {
+    if (sb.version != PENNFAT_VERSION_WIDE) {
+      LOG_ERR("[k_mount] Unsupported format version %u.", sb.version);
+      return PennFatErr_INVAD;
+    }
+    bool known_size = false;
+    for (int i = 0; i <= PENNFAT_WIDE_MAX_BLOCK_CONFIG; i++)
+      known_size |= sb.block_size == (uint32_t)block_sizes[i];
+    if (!known_size || sb.fat_blocks < 1 ||
+        sb.fat_blocks > PENNFAT_WIDE_MAX_FAT_BLOCKS || sb.root_block != 1 ||
+        sb.fat_entries < 3 ||
+        sb.fat_entries > (uint64_t)sb.fat_blocks * sb.block_size / 4) {
+      LOG_ERR("[k_mount] Invalid wide superblock (block size %u, %u FAT "
+              "blocks, %u entries).",
+              sb.block_size, sb.fat_blocks, sb.fat_entries);
+      return PennFatErr_INVAD;
+    }
+    g_fat_wide = true;
+    g_block_size = sb.block_size;
+    g_superblock.version = PENNFAT_VERSION_WIDE;
+    g_superblock.fat_block_count = sb.fat_blocks;
+    g_superblock.fat_entries = sb.fat_entries;
+    g_superblock.data_offset = (off_t)(1 + sb.fat_blocks) * sb.block_size;
+  } else {
+    /* Interpret FAT[0] in little-endian format:
+       - LSB (lower 8 bits) is block_size_config (0–4).
+       - MSB (upper 8 bits) is the number of FAT blocks.
+    */
+    uint16_t super_entry;
+    memcpy(&super_entry, &sb, sizeof(super_entry));
+    uint8_t block_size_config = super_entry & 0xFF;
+    uint8_t fat_blocks = (super_entry >> 8) & 0xFF;
+    if (block_size_config > PENNFAT_NARROW_MAX_BLOCK_CONFIG) {
+      LOG_ERR("[k_mount] Invalid block size config: %u", block_size_config);
+      return PennFatErr_INVAD;
+    }
+    if (fat_blocks < 1 || fat_blocks > PENNFAT_NARROW_MAX_FAT_BLOCKS) {
+      LOG_ERR("[k_mount] Invalid number of FAT blocks: %u", fat_blocks);
+      return PennFatErr_INVAD;
+    }
+    g_fat_wide = false;
+    g_block_size = block_sizes[block_size_config];
+    g_superblock.version = PENNFAT_VERSION_NARROW;
+    g_superblock.fat_block_count = fat_blocks;
+    /* Entry FAT_EOC_NARROW itself can never be linked into a chain, so a
+       full-size FAT stops one short of it */
+    g_superblock.fat_entries = fat_blocks * g_block_size / sizeof(uint16_t);
+    if (g_superblock.fat_entries > FAT_EOC_NARROW)
+      g_superblock.fat_entries = FAT_EOC_NARROW;
+    g_superblock.data_offset = (off_t)fat_blocks * g_block_size;
+  }
+
+  /* Data blocks start at index 2: index 0 holds formatting info (or is
+     reserved) and index 1 is the root directory */
+  g_superblock.data_start_block = 2;
+  return PennFatErr_OK;
+}
+
 /*
  * mount: Mounts the PennFAT filesystem.
- * The FAT region (of predetermined size) is mapped starting at offset 0.
- * The superblock functionality is implemented by reading FAT[0]:
- *   - The least-significant byte (LSB) is the block_size_config.
- *   - The most-significant byte (MSB) is the number of FAT blocks.
- * Based on that, we compute g_block_size and the FAT region size, and then
- * read the root directory from the first data block.
+ * read_format() works out the block size and FAT size from the superblock
+ * (wide images) or FAT[0] (narrow images); the FAT region is then mapped and
+ * the root directory read from the first data block.
  */
 PennFatErr k_mount(const char* fs_name) {
+  return k_mount_opts(fs_name, NULL);
+}
+
+/*
+ * k_mount_opts: Same as k_mount, with mount options. A NULL opts mounts with
+ * the defaults: PENNFAT_SYNC_ALWAYS, as every mount behaved before policies
+ * existed, on the pread backend. Callers opt into the faster policies.
+ */
+PennFatErr k_mount_opts(const char* fs_name, const pennfat_mount_opts_t* opts) {
   if (g_mounted) {
     LOG_WARN("[k_mount] Failed to mount filesystem '%s': Already mounted.",
              fs_name);
     return PennFatErr_UNEXPCMD;
   }
 
+  pennfat_sync_policy_t policy =
+      opts ? opts->sync_policy : PENNFAT_SYNC_ALWAYS;
+  uint32_t period_ms = (opts && opts->sync_period_ms)
+                           ? opts->sync_period_ms
+                           : PENNFAT_DEFAULT_SYNC_PERIOD_MS;
+  pennfat_backend_t backend = opts ? opts->backend : PENNFAT_BACKEND_PREAD;
+  if (policy < PENNFAT_SYNC_ALWAYS || policy > PENNFAT_SYNC_NONE) {
+    LOG_ERR("[k_mount] Invalid durability policy %d.", policy);
+    return PennFatErr_INVAD;
+  }
+
   /* Open the filesystem file using open(2) for read/write */
   int fd = open(fs_name, O_RDWR);
   if (fd < 0) {
@@ -2039,128 +3619,191 @@ PennFatErr k_mount(const char* fs_name) {
   }
   g_fs_fd = fd;
 
-  /* Read the first 2 bytes from the file to get FAT[0] (the superblock info) */
-  uint16_t super_entry;
-  ssize_t rd = read(fd, &super_entry, sizeof(super_entry));
-  if (rd != sizeof(super_entry)) {
-    LOG_CRIT(
-        "[k_mount] Failed to read superblock from filesystem file '%s': %s",
-        fs_name, strerror(errno));
-    close(fd);
-    return PennFatErr_INTERNAL;
-  }
-
-  /* Interpret FAT[0] in little-endian format:
-     - LSB (lower 8 bits) is block_size_config (0–4).
-     - MSB (upper 8 bits) is the number of FAT blocks.
-  */
-  uint8_t block_size_config = super_entry & 0xFF;
-  uint8_t fat_blocks = (super_entry >> 8) & 0xFF;
-
-  size_t n_cfgs = sizeof(block_sizes) / sizeof(block_sizes[0]);
-  if (block_size_config >= n_cfgs) {
-    LOG_ERR("[k_mount] Invalid block size config: %u", block_size_config);
+  /* Attach the block I/O backend; all image reads below go through it */
+  PennFatErr dev_err = blockdev_open(&g_dev, backend, fd);
+  if (dev_err != PennFatErr_OK) {
+    LOG_CRIT("[k_mount] Failed to attach '%s' backend to '%s'.",
+             blockdev_name(backend), fs_name);
     close(fd);
-    return PennFatErr_INVAD;
-  }
-  if (fat_blocks < 1 || fat_blocks > 32) {
-    LOG_ERR("[k_mount] Invalid number of FAT blocks: %u", fat_blocks);
+    g_fs_fd = -1;
+    return dev_err;
+  }
+  if (strcmp(g_dev.ops->name, blockdev_name(backend)) != 0)
+    LOG_WARN("[k_mount] The '%s' backend is unavailable; '%s' uses %s.",
+             blockdev_name(backend), fs_name, g_dev.ops->name);
+
+  /* Work out the format from the start of the image: a wide superblock, or
+     a narrow FAT whose first entry is the format word */
+  PennFatErr fmt_err = read_format(fs_name);
+  if (fmt_err != PennFatErr_OK) {
+    blockdev_close(&g_dev);
     close(fd);
-    return PennFatErr_INVAD;
+    g_fs_fd = -1;
+    return fmt_err;
   }
 
-  /* Compute the actual block size */
-  g_block_size = block_sizes[block_size_config];
-
-  /* Compute the FAT region size (in bytes) */
-  uint32_t fat_region_size = fat_blocks * g_block_size;
-
   LOG_DEBUG(
-      "[k_mount] Mounting filesystem '%s' with block size %u bytes and %u FAT "
-      "blocks.",
-      fs_name, g_block_size, fat_blocks);
-
-  /* Map the FAT region into memory using mmap(2).
-     The FAT region is stored at offset 0.
-  */
-  g_fat =
-      mmap(NULL, fat_region_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-  if (g_fat == MAP_FAILED) {
+      "[k_mount] Mounting filesystem '%s' (format v%u) with block size %u "
+      "bytes and %u FAT blocks.",
+      fs_name, g_superblock.version, g_block_size,
+      g_superblock.fat_block_count);
+
+  /* Map the FAT region into memory using mmap(2). A narrow FAT is stored at
+     offset 0; a wide one follows the superblock block, which is mapped too
+     since mmap offsets must be page-aligned. */
+  size_t fat_region_size = (size_t)g_superblock.fat_block_count * g_block_size;
+  g_fat_map_len = (size_t)g_superblock.data_offset;
+  g_fat_map =
+      mmap(NULL, g_fat_map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (g_fat_map == MAP_FAILED) {
     LOG_CRIT("[k_mount] Failed to map FAT region from filesystem file '%s': %s",
              fs_name, strerror(errno));
+    g_fat_map = NULL;
+    blockdev_close(&g_dev);
     close(fd);
+    g_fs_fd = -1;
     return PennFatErr_INTERNAL;
   }
-
-  /* Optionally verify that the mapped FAT[0] matches the super_entry we read */
-  if (g_fat[0] != super_entry) {
-    LOG_CRIT("[k_mount] FAT[0] mismatch: expected 0x%04x, got 0x%04x",
-             super_entry, g_fat[0]);
-    munmap(g_fat, fat_region_size);
+  g_fat = (char*)g_fat_map + (g_fat_map_len - fat_region_size);
+  g_page_size = (size_t)sysconf(_SC_PAGESIZE);
+  g_fat_pages = (g_fat_map_len + g_page_size - 1) / g_page_size;
+  g_fat_dirty = calloc((g_fat_pages + 63) / 64, sizeof(uint64_t));
+  if (!g_fat_dirty) {
+    LOG_CRIT("[k_mount] Failed to allocate the FAT dirty-page bitmap.");
+    fat_unmap();
+    blockdev_close(&g_dev);
     close(fd);
-    return PennFatErr_INTERNAL;
+    g_fs_fd = -1;
+    return PennFatErr_OUTOFMEM;
   }
 
-  /* Set up the superblock info from FAT[0]:
-     - g_superblock.fat_block_count is set from fat_blocks.
-     - Data blocks start at index 2: index 0 holds formatting info and index 1
-     is reserved for the root directory.
-  */
-  g_superblock.fat_block_count = fat_blocks;
-  g_superblock.data_start_block = 2;
-
-  /* Read the root directory region.
-     According to our mkfs, the root directory is stored in the first data
-     block, which immediately follows the FAT region. Its size is one block
-     (g_block_size bytes). Compute the offset for the root directory:
-         root_offset = fat_region_size
-  */
-  off_t root_offset = fat_region_size;
+  /* Read the root directory region: one block, stored in block 1, right
+     after the FAT region */
+  off_t root_offset = g_superblock.data_offset;
   g_root_dir = malloc(g_block_size);
   if (!g_root_dir) {
     LOG_CRIT("[k_mount] Failed to allocate memory for root directory: %s",
              strerror(errno));
-    munmap(g_fat, fat_region_size);
+    fat_unmap();
+    blockdev_close(&g_dev);
     close(fd);
     return PennFatErr_OUTOFMEM;
   }
 
-  if (lseek(fd, root_offset, SEEK_SET) < 0) {
+  if (blockdev_read(&g_dev, g_root_dir, g_block_size, root_offset) != 0) {
     LOG_CRIT(
-        "[k_mount] Failed to seek to root directory in filesystem file '%s': "
-        "%s",
+        "[k_mount] Failed to read root directory from filesystem file '%s': %s",
         fs_name, strerror(errno));
     free(g_root_dir);
-    munmap(g_fat, fat_region_size);
+    fat_unmap();
+    blockdev_close(&g_dev);
     close(fd);
     return PennFatErr_INTERNAL;
   }
 
-  if (read(fd, g_root_dir, g_block_size) != (ssize_t)g_block_size) {
-    LOG_CRIT(
-        "[k_mount] Failed to read root directory from filesystem file '%s': %s",
-        fs_name, strerror(errno));
+  LOG_DEBUG(
+      "[k_mount] Successfully read root directory from offset %u in filesystem "
+      "file '%s'.",
+      root_offset, fs_name);
+
+  /* Clear system-wide and FD tables (if necessary) */
+  memset(g_sysfile_table, 0, sizeof(g_sysfile_table));
+  memset(g_fd_table, 0, sizeof(g_fd_table));
+  g_dev_reads = 0;
+  g_dev_writes = 0;
+  g_dev_syncs = 0;
+  g_dev_requests = 0;
+  g_rmw_skipped = 0;
+  g_map_bytes = 0;
+  g_map_lookups = 0;
+  g_delay_bytes = 0;
+  g_delay_reserved = 0;
+  g_delay_flushes = 0;
+  g_delay_dropped = 0;
+  g_fat_msyncs = 0;
+  g_fat_pages_synced = 0;
+  g_dir_compactions = 0;
+  g_dir_blocks_freed = 0;
+
+  /* Set up the buffer cache in front of the data region. A mapped image
+     already lives in the page cache, so it gets none. */
+  if (!blockdev_is_mapped(&g_dev) &&
+      bcache_init(g_block_size, PENNFAT_CACHE_FRAMES, dev_read_block,
+                  dev_write_block) != PennFatErr_OK) {
+    LOG_CRIT("[k_mount] Failed to allocate block cache (%u frames).",
+             PENNFAT_CACHE_FRAMES);
+    free(g_root_dir);
+    g_root_dir = NULL;
+    fat_unmap();
+    blockdev_close(&g_dev);
+    close(fd);
+    g_fs_fd = -1;
+    return PennFatErr_OUTOFMEM;
+  }
+
+  /* Scratch block buffers for the FS helpers, sized for this image */
+  if (bpool_init(g_block_size, PENNFAT_BUFPOOL_BUFS) != PennFatErr_OK) {
+    LOG_CRIT("[k_mount] Failed to allocate block buffer slab (%u buffers).",
+             PENNFAT_BUFPOOL_BUFS);
+    bcache_destroy();
+    free(g_root_dir);
+    g_root_dir = NULL;
+    fat_unmap();
+    blockdev_close(&g_dev);
+    close(fd);
+    g_fs_fd = -1;
+    return PennFatErr_OUTOFMEM;
+  }
+
+  /* Index the free blocks */
+  if (fmap_init(g_fat, g_fat_wide ? sizeof(uint32_t) : sizeof(uint16_t),
+                g_superblock.data_start_block,
+                g_superblock.fat_entries) != PennFatErr_OK) {
+    LOG_CRIT("[k_mount] Failed to build free-space index (%u entries).",
+             g_superblock.fat_entries);
+    bpool_destroy();
+    bcache_destroy();
+    free(g_root_dir);
+    g_root_dir = NULL;
+    fat_unmap();
+    blockdev_close(&g_dev);
+    close(fd);
+    g_fs_fd = -1;
+    return PennFatErr_OUTOFMEM;
+  }
+
+  /* An entry that is neither free, end-of-chain nor a data block number
+     means the image is damaged; mount anyway and point at fsck */
+  uint32_t first_bad;
+  uint32_t bad = fatscan_count_invalid(
+      g_fat, g_fat_wide ? sizeof(uint32_t) : sizeof(uint16_t), 1,
+      g_superblock.fat_entries, g_superblock.fat_entries, &first_bad);
+  if (bad > 0)
+    LOG_WARN(
+        "[k_mount] %u FAT entries hold invalid block numbers (first: entry "
+        "%u); run fsck.",
+        bad, first_bad);
+
+  g_sync_policy = policy;
+  g_sync_period_ms = period_ms;
+  if (policy == PENNFAT_SYNC_PERIODIC && start_periodic_flusher() != 0) {
+    LOG_CRIT("[k_mount] Failed to start periodic flusher thread.");
+    bcache_destroy();
+    bpool_destroy();
+    fmap_destroy();
     free(g_root_dir);
-    munmap(g_fat, fat_region_size);
+    g_root_dir = NULL;
+    fat_unmap();
+    blockdev_close(&g_dev);
     close(fd);
+    g_fs_fd = -1;
     return PennFatErr_INTERNAL;
   }
 
-  LOG_DEBUG(
-      "[k_mount] Successfully read root directory from offset %u in filesystem "
-      "file '%s'.",
-      root_offset, fs_name);
-
-  /* Clear system-wide and FD tables (if necessary) */
-  memset(g_sysfile_table, 0, sizeof(g_sysfile_table));
-  memset(g_fd_table, 0, sizeof(g_fd_table));
-
-  /* No block cache initialization needed */
-
   LOG_INFO(
       "[k_mount] Successfully mounted filesystem '%s' with block size %u "
-      "bytes.",
-      fs_name, g_block_size);
+      "bytes (durability policy %d, %s backend).",
+      fs_name, g_block_size, policy, g_dev.ops->name);
 
   g_mounted = 1;
   return PennFatErr_SUCCESS;
@@ -2174,20 +3817,10 @@ PennFatErr k_unmount(void) {
     return PennFatErr_NOT_MOUNTED;
   }
 
-  /* Recompute FAT region size:
-     FAT[0] contains the formatting info:
-       MSB = number of FAT blocks
-     Calculate:
-       fat_blocks = (g_fat[0] >> 8) & 0xff
-       fat_region_size = fat_blocks * g_block_size
-  */
-  uint8_t fat_blocks = (g_fat[0] >> 8) & 0xff;
-  uint32_t fat_region_size = fat_blocks * g_block_size;
-
   LOG_DEBUG(
       "[k_unmount] Unmounting filesystem with %u FAT blocks, block size %u "
       "bytes.",
-      fat_blocks, g_block_size);
+      g_superblock.fat_block_count, g_block_size);
 
   /* Close all open file descriptors to ensure metadata is written back */
   for (int fd = 0; fd < MAX_FD; fd++) {
@@ -2196,61 +3829,73 @@ PennFatErr k_unmount(void) {
       k_close(fd);
     }
   }
+  memset(g_dir_streams, 0, sizeof(g_dir_streams));
 
-  /* No block cache to flush */
+  /* The flusher must not race with the final write-back below */
+  stop_periodic_flusher();
 
-  /* Write the root directory directly to disk */
-  LOG_INFO("[k_unmount] Writing root directory to disk...");
-  off_t root_offset = fat_region_size;
-  if (lseek(g_fs_fd, root_offset, SEEK_SET) < 0) {
-    LOG_CRIT(
-        "[k_unmount] Failed to seek to root directory in filesystem file: %s",
-        strerror(errno));
-    return PennFatErr_INTERNAL;
-  }
-  if (write(g_fs_fd, g_root_dir, g_block_size) != (ssize_t)g_block_size) {
-    LOG_CRIT(
-        "[k_unmount] Failed to write root directory to filesystem file: %s",
-        strerror(errno));
-    return PennFatErr_INTERNAL;
+  /* Write back everything still sitting in the block cache. The root
+     directory lives in block 1 and is only ever updated through the cache,
+     so g_root_dir (a snapshot taken at mount time) must not be written back
+     over it. */
+  LOG_INFO("[k_unmount] Flushing block cache to disk...");
+  if (bcache_flush() != 0) {
+    LOG_CRIT("[k_unmount] Failed to write back dirty cached blocks.");
+    return PennFatErr_IO;
   }
+  bcache_destroy();
 
-  /* Synchronize the mapped FAT region to disk */
-  if (msync(g_fat, fat_region_size, MS_SYNC) < 0) {
+  uint32_t leaked = bpool_destroy();
+  if (leaked > 0)
+    LOG_ERR("[k_unmount] %u block buffer(s) were never released.", leaked);
+  fmap_destroy();
+  dindex_destroy();
+  dcache_destroy();
+
+  /* Synchronize the FAT pages changed since the last flush (scratch images
+     skip this; munmap still leaves the FAT in the page cache) */
+  if (g_sync_policy != PENNFAT_SYNC_NONE &&
+      fat_flush() < 0) {
     LOG_CRIT("[k_unmount] Failed to synchronize FAT region to disk: %s",
              strerror(errno));
     return PennFatErr_INTERNAL;
   }
 
   /* Unmap the FAT region */
-  if (munmap(g_fat, fat_region_size) < 0) {
+  if (fat_unmap() < 0) {
     LOG_CRIT("[k_unmount] Failed to unmap FAT region: %s", strerror(errno));
     return PennFatErr_INTERNAL;
   }
-  g_fat = NULL;
+  g_fat_wide = false;
 
   /* Free the allocated root directory buffer */
   free(g_root_dir);
   g_root_dir = NULL;
 
-  /* Ensure all written data is flushed to the disk */
+  /* Ensure all written data is flushed to the disk. A mapped image only
+     needs its dirty pages msync()ed. */
   LOG_INFO("[k_unmount] Syncing all filesystem data to disk...");
-  if (fsync(g_fs_fd) < 0) {
+  if (g_sync_policy != PENNFAT_SYNC_NONE &&
+      (blockdev_is_mapped(&g_dev) ? blockdev_sync(&g_dev) : fsync(g_fs_fd)) <
+          0) {
     LOG_CRIT("[k_unmount] Failed to sync filesystem data to disk: %s",
              strerror(errno));
     // Even if fsync fails, try to close the file descriptor
+    blockdev_close(&g_dev);
     close(g_fs_fd);
     g_fs_fd = -1;  // Mark as closed
     return PennFatErr_INTERNAL;
   }
   LOG_INFO("[k_unmount] All filesystem data successfully synced to disk.");
 
-  /* Close the filesystem file */
+  /* Detach the backend and close the filesystem file */
+  blockdev_close(&g_dev);
   if (close(g_fs_fd) < 0) {
     LOG_ERR("[k_unmount] Failed to close filesystem file: %s", strerror(errno));
     return PennFatErr_INTERNAL;
   }
   g_fs_fd = -1;
+  g_sync_policy = PENNFAT_SYNC_ALWAYS;
 
   LOG_INFO("[k_unmount] Successfully unmounted filesystem.");
 
@@ -2258,6 +3903,390 @@ PennFatErr k_unmount(void) {
   return 0;
 }
 
+// ---------------------------------------------------------------------------
+// Defragmentation
+//
+// k_defrag walks the directory tree from the root. Every file, directory and
+// symlink whose chain has more than one extent is copied into a free run
+// long enough to hold it in one piece, its directory entry is pointed at the
+// copy, and only then is the old chain freed, so a failure at any step
+// leaves the file intact. Directories also get their '.' and '..' entries
+// (and g_cwd_block) retargeted. The root directory must stay at block 1 and
+// is only reported. A chain that does not fit into any free run is left
+// where it is.
+// ---------------------------------------------------------------------------
+
+/* Blocks copied per step when a chain is relocated */
+#define DEFRAG_WINDOW 64
+
+typedef struct {
+  bool dry_run;
+  pennfat_defrag_fn fn;
+  void* arg;
+  pennfat_defrag_report_t* report;
+  char path[PATH_MAX];  // path of the entry being processed
+} defrag_ctx_t;
+
+/*
+ * chain_extents: Number of physically contiguous runs in the chain starting
+ * at `first`; its length in blocks goes to *blocks_out.
+ */
+static uint32_t chain_extents(uint32_t first, uint32_t* blocks_out) {
+  uint32_t blocks = 0;
+  uint32_t extents = 0;
+  uint32_t limit = fmap_capacity();  // a longer chain would be a cycle
+  uint32_t block = first;
+  while (block != FAT_EOC && block != FAT_FREE && blocks < limit) {
+    uint32_t run = chain_run_length(block, limit - blocks);
+    blocks += run;
+    extents++;
+    block = fat_get(block + run - 1);
+  }
+  *blocks_out = blocks;
+  return extents;
+}
+
+/*
+ * copy_chain: Copies the `nblocks` blocks of the chain starting at `first`
+ * into the consecutive blocks starting at `dest`, DEFRAG_WINDOW blocks at a
+ * time: each window is read as one batch of runs and written as a single run.
+ */
+static int copy_chain(uint32_t first, uint32_t dest, uint32_t nblocks) {
+  char* buf = malloc((size_t)DEFRAG_WINDOW * g_block_size);
+  if (!buf)
+    return -1;
+
+  uint32_t block = first;
+  uint32_t done = 0;
+  int rc = 0;
+  while (rc == 0 && done < nblocks) {
+    uint32_t want = nblocks - done < DEFRAG_WINDOW ? nblocks - done
+                                                   : DEFRAG_WINDOW;
+    run_batch_t batch = {.n = 0};
+    uint32_t queued = 0;
+    while (rc == 0 && queued < want) {
+      uint32_t run = chain_run_length(block, want - queued);
+      run_batch_add(&batch, buf + (size_t)queued * g_block_size, block, run,
+                    false);
+      queued += run;
+      block = fat_get(block + run - 1);
+      if (batch.n == PENNFAT_IO_BATCH)
+        rc = run_batch_submit(&batch);
+    }
+    if (rc == 0)
+      rc = run_batch_submit(&batch);
+    if (rc == 0) {
+      run_batch_add(&batch, buf, dest + done, want, true);
+      rc = run_batch_submit(&batch);
+    }
+    done += want;
+  }
+
+  free(buf);
+  return rc;
+}
+
+/*
+ * fix_dot_entries: Points the '.' and '..' entries in the first block of
+ * directory `dir` at `dir` and `parent`, writing the block only if either
+ * was stale (the directory or its parent was relocated).
+ */
+static PennFatErr fix_dot_entries(uint32_t dir, uint32_t parent) {
+  char* buf = bpool_acquire();
+  if (!buf)
+    return PennFatErr_OUTOFMEM;
+  if (read_block(buf, dir) != 0) {
+    bpool_release(buf);
+    return PennFatErr_IO;
+  }
+
+  dir_entry_t* entries = (dir_entry_t*)buf;
+  uint32_t entries_per_block = g_block_size / sizeof(dir_entry_t);
+  bool changed = false;
+  for (uint32_t i = 0; i < entries_per_block && entries[i].name[0]; i++) {
+    uint32_t want = 0;
+    if (strcmp(entries[i].name, ".") == 0)
+      want = dir;
+    else if (strcmp(entries[i].name, "..") == 0)
+      want = parent;
+    if (want && dirent_block(&entries[i]) != want) {
+      dirent_set_block(&entries[i], want);
+      changed = true;
+    }
+  }
+
+  PennFatErr err = PennFatErr_OK;
+  if (changed && write_block(buf, dir) != 0)
+    err = PennFatErr_IO;
+  bpool_release(buf);
+  return err;
+}
+
+/*
+ * defrag_entry: Measures the chain of `entry` (slot `index` of directory
+ * block `dir_block`) and, unless this is a dry run, relocates it into a
+ * single extent when it has more than one. entry->first_block is updated in
+ * place so the caller sees the new location.
+ */
+static PennFatErr defrag_entry(defrag_ctx_t* ctx,
+                               uint32_t dir_block,
+                               int index,
+                               dir_entry_t* entry) {
+  uint32_t blocks;
+  uint32_t before = chain_extents(dirent_block(entry), &blocks);
+  uint32_t after = before;
+
+  if (before > 1 && !ctx->dry_run) {
+    uint32_t got;
+    int dest = allocate_free_run(0, blocks, &got);
+    if (dest >= 0 && got < blocks) {
+      free_block_chain((uint32_t)dest);
+      dest = -1;
+    }
+    if (dest < 0) {
+      ctx->report->skipped++;
+    } else {
+      uint32_t old = dirent_block(entry);
+      if (copy_chain(old, (uint32_t)dest, blocks) != 0) {
+        free_block_chain((uint32_t)dest);
+        LOG_ERR("[k_defrag] Failed to copy '%s' to block %d.", ctx->path,
+                dest);
+        return PennFatErr_IO;
+      }
+      dirent_set_block(entry, (uint32_t)dest);
+      PennFatErr err = write_dirent(dir_block, index, entry);
+      if (err != PennFatErr_OK) {
+        dirent_set_block(entry, old);
+        free_block_chain((uint32_t)dest);
+        return err;
+      }
+      free_block_chain(old);
+      if (g_cwd_block == old)
+        g_cwd_block = (uint32_t)dest;
+      LOG_DEBUG("[k_defrag] Moved '%s' (%u blocks, %u extents) %u -> %d.",
+                ctx->path, blocks, before, old, dest);
+      after = 1;
+      ctx->report->moved++;
+    }
+  }
+
+  ctx->report->chains++;
+  ctx->report->blocks += blocks;
+  ctx->report->extents_before += before;
+  ctx->report->extents_after += after;
+  if (ctx->fn)
+    ctx->fn(ctx->path, blocks, before, after, ctx->arg);
+  return PennFatErr_OK;
+}
+
+/*
+ * defrag_dir: Runs defrag_entry over every live entry of the directory
+ * starting at `dir_block`, recursing into subdirectories.
+ */
+static PennFatErr defrag_dir(defrag_ctx_t* ctx, uint32_t dir_block, int depth) {
+  if (depth >= MAX_DEPTH) {
+    LOG_WARN("[k_defrag] Skipping '%s': nested too deeply.", ctx->path);
+    return PennFatErr_OK;
+  }
+
+  char* buf = bpool_acquire();
+  if (!buf)
+    return PennFatErr_OUTOFMEM;
+
+  size_t path_len = strlen(ctx->path);
+  uint32_t entries_per_block = g_block_size / sizeof(dir_entry_t);
+  PennFatErr err = PennFatErr_OK;
+  for (uint32_t block = dir_block;
+       err == PennFatErr_OK && block != FAT_EOC && block != FAT_FREE;
+       block = fat_get(block)) {
+    if (read_block(buf, block) != 0) {
+      err = PennFatErr_IO;
+      break;
+    }
+    dir_entry_t* entries = (dir_entry_t*)buf;
+    for (uint32_t i = 0; err == PennFatErr_OK && i < entries_per_block; i++) {
+      dir_entry_t* e = &entries[i];
+      if (e->name[0] == 0)
+        break;  // end of directory
+      if ((uint8_t)e->name[0] == 1 || (uint8_t)e->name[0] == 2 ||
+          strcmp(e->name, ".") == 0 || strcmp(e->name, "..") == 0 ||
+          dirent_block(e) == FAT_FREE || dirent_block(e) == FAT_EOC)
+        continue;
+
+      snprintf(ctx->path + path_len, sizeof(ctx->path) - path_len, "%s%s",
+               path_len > 1 ? "/" : "", e->name);
+      err = defrag_entry(ctx, block, (int)i, e);
+      if (err == PennFatErr_OK && e->type == 2) {
+        if (!ctx->dry_run)
+          err = fix_dot_entries(dirent_block(e), dir_block);
+        if (err == PennFatErr_OK)
+          err = defrag_dir(ctx, dirent_block(e), depth + 1);
+      }
+      ctx->path[path_len] = '\0';
+    }
+  }
+
+  bpool_release(buf);
+  return err;
+}
+
+/*
+ * k_defrag: Relocates every fragmented chain into a single extent (see the
+ * section comment above). Refused while any file is open, since fds and
+ * system file entries cache block numbers.
+ */
+PennFatErr k_defrag(bool dry_run,
+                    pennfat_defrag_fn fn,
+                    void* arg,
+                    pennfat_defrag_report_t* report) {
+  if (!g_mounted) {
+    LOG_WARN("[k_defrag] Failed to defragment: Not mounted.");
+    return PennFatErr_NOT_MOUNTED;
+  }
+  for (int fd = 0; fd < MAX_FD; fd++) {
+    if (g_fd_table[fd].in_use) {
+      LOG_ERR("[k_defrag] Failed to defragment: fd %d is open.", fd);
+      return PennFatErr_BUSY;
+    }
+  }
+  for (int dh = 0; dh < MAX_DIR_STREAMS; dh++) {
+    if (g_dir_streams[dh].in_use) {
+      LOG_ERR("[k_defrag] Failed to defragment: directory handle %d is open.",
+              dh);
+      return PennFatErr_BUSY;
+    }
+  }
+
+  pennfat_defrag_report_t scratch;
+  defrag_ctx_t ctx = {.dry_run = dry_run,
+                      .fn = fn,
+                      .arg = arg,
+                      .report = report ? report : &scratch};
+  memset(ctx.report, 0, sizeof(*ctx.report));
+
+  // The root is pinned to block 1: reported, never moved
+  uint32_t blocks;
+  uint32_t root_extents = chain_extents(1, &blocks);
+  strcpy(ctx.path, "/");
+  ctx.report->chains++;
+  ctx.report->blocks += blocks;
+  ctx.report->extents_before += root_extents;
+  ctx.report->extents_after += root_extents;
+  if (fn)
+    fn(ctx.path, blocks, root_extents, root_extents, arg);
+
+  PennFatErr err = defrag_dir(&ctx, 1, 0);
+  if (!dry_run) {
+    dindex_clear();  // directory chains may have moved
+    dcache_clear();
+    PennFatErr sync_err = durability_point();
+    if (err == PennFatErr_OK)
+      err = sync_err;
+  }
+  LOG_INFO(
+      "[k_defrag] %u chains, %u blocks: %u extents before, %u after (%u "
+      "moved, %u skipped).",
+      ctx.report->chains, ctx.report->blocks, ctx.report->extents_before,
+      ctx.report->extents_after, ctx.report->moved, ctx.report->skipped);
+  return err;
+}
+
+/*
+ * k_sync: Writes back all dirty cached blocks and the FAT, then syncs the
+ * image. Open files stay open.
+ */
+PennFatErr k_sync(void) {
+  if (!g_mounted) {
+    LOG_WARN("[k_sync] Failed to sync filesystem: Not mounted.");
+    return PennFatErr_NOT_MOUNTED;
+  }
+
+  if (delay_flush_all() < 0) {
+    LOG_ERR("[k_sync] Failed to write back delayed data.");
+    return PennFatErr_IO;
+  }
+
+  if (fat_flush() < 0) {
+    LOG_ERR("[k_sync] Failed to synchronize FAT region to disk: %s",
+            strerror(errno));
+    return PennFatErr_IO;
+  }
+
+  // An explicit sync is honoured even on a PENNFAT_SYNC_NONE mount
+  if (bcache_flush() != 0 || sync_device() != 0) {
+    LOG_ERR("[k_sync] Failed to flush block cache.");
+    return PennFatErr_IO;
+  }
+
+  LOG_INFO("[k_sync] Filesystem synced to disk.");
+  return PennFatErr_OK;
+}
+
+/*
+ * k_stats: Reports block cache and device I/O counters for the mounted
+ * filesystem.
+ */
+PennFatErr k_stats(pennfat_stats_t* out) {
+  if (!out)
+    return PennFatErr_INVAD;
+  if (!g_mounted)
+    return PennFatErr_NOT_MOUNTED;
+
+  bcache_stats_t cs;
+  uint32_t nframes;
+  bcache_get_stats(&cs, &nframes);
+  bpool_stats_t ps;
+  bpool_get_stats(&ps);
+  dindex_stats_t ds;
+  dindex_get_stats(&ds);
+  dcache_stats_t dcs;
+  dcache_get_stats(&dcs);
+
+  memset(out, 0, sizeof(*out));
+  out->format_version = g_superblock.version;
+  out->block_size = g_block_size;
+  out->total_blocks = fmap_capacity();
+  out->free_blocks = fmap_free_count();
+  out->cache_frames = nframes;
+  out->cache_hits = cs.hits;
+  out->cache_misses = cs.misses;
+  out->cache_evictions = cs.evictions;
+  out->cache_writebacks = cs.writebacks;
+  out->prefetched = cs.prefetched;
+  out->prefetch_hits = cs.prefetch_hits;
+  out->dev_reads = __atomic_load_n(&g_dev_reads, __ATOMIC_RELAXED);
+  out->dev_writes = __atomic_load_n(&g_dev_writes, __ATOMIC_RELAXED);
+  out->dev_syncs = __atomic_load_n(&g_dev_syncs, __ATOMIC_RELAXED);
+  out->dev_requests = __atomic_load_n(&g_dev_requests, __ATOMIC_RELAXED);
+  out->rmw_skipped = __atomic_load_n(&g_rmw_skipped, __ATOMIC_RELAXED);
+  out->map_lookups = g_map_lookups;
+  out->map_bytes = g_map_bytes;
+  out->delay_bytes = g_delay_bytes;
+  out->delay_flushes = g_delay_flushes;
+  out->fat_msyncs = g_fat_msyncs;
+  out->fat_pages_synced = g_fat_pages_synced;
+  out->delay_dropped = g_delay_dropped;
+  out->buf_acquires = ps.acquires;
+  out->buf_overflows = ps.overflows;
+  out->buf_high_water = ps.high_water;
+  out->dir_lookups = ds.lookups;
+  out->dir_slot_hints = ds.slot_hints;
+  out->dir_index_builds = ds.builds;
+  out->dir_index_drops = ds.evictions;
+  out->dir_index_dirs = ds.dirs;
+  out->dir_index_bytes = ds.bytes;
+  out->dentry_hits = dcs.hits;
+  out->dentry_negative = dcs.negative_hits;
+  out->dentry_misses = dcs.misses;
+  out->dentry_dropped = dcs.invalidations;
+  out->dir_compactions = g_dir_compactions;
+  out->dir_blocks_freed = g_dir_blocks_freed;
+  out->sync_policy = g_sync_policy;
+  out->backend = g_dev.ops ? g_dev.ops->name : "none";
+  out->fat_scan = fatscan_impl();
+  return PennFatErr_OK;
+}
+
 /**
  * mkfs: Creates a new PennFAT filesystem.
  * Usage: mkfs FS_NAME BLOCKS_IN_FAT BLOCK_SIZE_CONFIG
@@ -2276,6 +4305,115 @@ PennFatErr k_unmount(void) {
 PennFatErr k_mkfs(const char* fs_name,
                   int blocks_in_fat,
                   int block_size_config) {
+  return k_mkfs_opts(fs_name, blocks_in_fat, block_size_config,
+                     PENNFAT_FORMAT_NARROW);
+}
+
+/*
+ * mkfs_wide: Writes a wide (v2) image. Block 0 holds a pennfat_superblock_t,
+ * blocks 1..blocks_in_fat the FAT of 32-bit entries, and the data region
+ * (root directory first) follows. Data block n lives at
+ * data_offset + (n - 1) * block_size, as on a narrow image. The FAT and data
+ * region are left as holes by ftruncate, so only the superblock, the first
+ * FAT block and the root directory are written.
+ */
+static PennFatErr mkfs_wide(const char* fs_name,
+                            int blocks_in_fat,
+                            int block_size_config) {
+  if (blocks_in_fat < 1 || blocks_in_fat > PENNFAT_WIDE_MAX_FAT_BLOCKS) {
+    LOG_ERR(
+        "[k_mkfs] Invalid number of blocks in FAT. Must be between 1 and "
+        "%d.",
+        PENNFAT_WIDE_MAX_FAT_BLOCKS);
+    return PennFatErr_INVAD;
+  }
+  if (block_size_config < 0 ||
+      block_size_config > PENNFAT_WIDE_MAX_BLOCK_CONFIG) {
+    LOG_ERR(
+        "[k_mkfs] Invalid block size configuration. Must be between 0 and "
+        "%d.",
+        PENNFAT_WIDE_MAX_BLOCK_CONFIG);
+    return PennFatErr_INVAD;
+  }
+  uint32_t block_size = block_sizes[block_size_config];
+
+  /* Entry 0 is reserved and entry 1 is the root directory, so every other
+     entry is a data block */
+  pennfat_superblock_t sb = {.version = PENNFAT_VERSION_WIDE,
+                             .block_size = block_size,
+                             .fat_blocks = (uint32_t)blocks_in_fat,
+                             .fat_entries = (uint32_t)blocks_in_fat *
+                                            (block_size / sizeof(uint32_t)),
+                             .root_block = 1};
+  memcpy(sb.magic, PENNFAT_MAGIC, sizeof(sb.magic));
+  off_t data_offset = (off_t)(1 + blocks_in_fat) * block_size;
+  off_t total_fs_size =
+      data_offset + (off_t)(sb.fat_entries - 1) * block_size;
+
+  LOG_DEBUG(
+      "[k_mkfs] Creating wide filesystem with %d blocks in FAT, block size "
+      "%u bytes, total size %lld bytes.",
+      blocks_in_fat, block_size, (long long)total_fs_size);
+
+  int fd = open(fs_name, O_RDWR | O_CREAT | O_TRUNC, 0666);
+  if (fd < 0) {
+    LOG_CRIT("[k_mkfs] Failed to open/create filesystem file '%s': %s", fs_name,
+             strerror(errno));
+    return PennFatErr_INTERNAL;
+  }
+  if (ftruncate(fd, total_fs_size) < 0) {
+    LOG_CRIT("[k_mkfs] Failed to size '%s' to %lld bytes: %s", fs_name,
+             (long long)total_fs_size, strerror(errno));
+    close(fd);
+    return PennFatErr_INTERNAL;
+  }
+
+  char* buf = calloc(1, block_size);
+  if (!buf) {
+    LOG_CRIT("[k_mkfs] Failed to allocate memory for zero buffer.");
+    close(fd);
+    return PennFatErr_OUTOFMEM;
+  }
+
+  /* Superblock, then FAT[0] (reserved) and FAT[1] (root directory) */
+  PennFatErr err = PennFatErr_SUCCESS;
+  memcpy(buf, &sb, sizeof(sb));
+  if (pwrite(fd, buf, block_size, 0) != (ssize_t)block_size)
+    err = PennFatErr_INTERNAL;
+  memset(buf, 0, block_size);
+  uint32_t* fat_head = (uint32_t*)buf;
+  fat_head[0] = FAT_EOC;
+  fat_head[1] = FAT_EOC;
+  if (err == PennFatErr_SUCCESS &&
+      pwrite(fd, buf, block_size, block_size) != (ssize_t)block_size)
+    err = PennFatErr_INTERNAL;
+  memset(buf, 0, block_size);
+  if (err == PennFatErr_SUCCESS &&
+      pwrite(fd, buf, block_size, data_offset) != (ssize_t)block_size)
+    err = PennFatErr_INTERNAL;
+  free(buf);
+  close(fd);
+
+  if (err != PennFatErr_SUCCESS) {
+    LOG_CRIT("[k_mkfs] Failed to write wide filesystem '%s': %s", fs_name,
+             strerror(errno));
+    return err;
+  }
+  LOG_INFO(
+      "[k_mkfs] Created wide filesystem '%s' with %d blocks in FAT and block "
+      "size %u bytes.",
+      fs_name, blocks_in_fat, block_size);
+  return PennFatErr_SUCCESS;
+}
+
+/*
+ * k_mkfs_opts: Same as k_mkfs, choosing the on-disk format. A wide image
+ * takes 1..65535 FAT blocks and block size configs 0..7 (up to 32 KiB).
+ */
+PennFatErr k_mkfs_opts(const char* fs_name,
+                       int blocks_in_fat,
+                       int block_size_config,
+                       pennfat_format_t format) {
   /* Check if a filesystem is already mounted */
   if (g_mounted) {
     LOG_WARN(
@@ -2283,6 +4421,10 @@ PennFatErr k_mkfs(const char* fs_name,
         "mounted.");
     return PennFatErr_UNEXPCMD;
   }
+  if (format == PENNFAT_FORMAT_WIDE)
+    return mkfs_wide(fs_name, blocks_in_fat, block_size_config);
+  if (format != PENNFAT_FORMAT_NARROW)
+    return PennFatErr_INVAD;
 
   /* Validate parameters */
   if (blocks_in_fat < 1 || blocks_in_fat > 32) {
@@ -2354,7 +4496,7 @@ PennFatErr k_mkfs(const char* fs_name,
 
   /* Set FAT[1] to FAT_EOC so that the root directory's first block is allocated
    * and marked as the end of chain */
-  fat_array[1] = FAT_EOC;
+  fat_array[1] = FAT_EOC_NARROW;
 
   /* Write the FAT region at offset 0 */
   if (lseek(fd, 0, SEEK_SET) < 0) {
@@ -2408,6 +4550,35 @@ PennFatErr k_mkfs(const char* fs_name,
   return PennFatErr_SUCCESS;
 }
 
+/*
+ * k_fsck: Checks (and with repair, fixes) an unmounted image; see
+ * pennfat_fsck.c. The image must not be in use, so nothing may be mounted.
+ */
+PennFatErr k_fsck(const char* fs_name,
+                  bool repair,
+                  uint32_t threads,
+                  pennfat_fsck_fn fn,
+                  void* arg,
+                  pennfat_fsck_report_t* report) {
+  if (g_mounted) {
+    LOG_WARN("[k_fsck] Cannot check '%s' while a filesystem is mounted.",
+             fs_name);
+    return PennFatErr_BUSY;
+  }
+
+  PennFatErr err = fsck_run(fs_name, repair, threads, fn, arg, report);
+  if (err != PennFatErr_OK) {
+    LOG_ERR("[k_fsck] Failed to check '%s' (Error %d).", fs_name, err);
+    return err;
+  }
+  LOG_INFO(
+      "[k_fsck] Checked '%s' with %u threads: %u dirs, %u files, %u symlinks, "
+      "%u blocks in use; %u problems repaired.",
+      fs_name, report->threads, report->dirs, report->files, report->symlinks,
+      report->blocks_used, report->repaired);
+  return PennFatErr_OK;
+}
+
 PennFatErr k_chdir(const char* path) {
   if (!g_mounted)
     return PennFatErr_NOT_MOUNTED;
@@ -2444,15 +4615,15 @@ PennFatErr k_chdir(const char* path) {
   }
 
   // Path resolved to a directory entry, update CWD block
-  g_cwd_block = resolved.entry.first_block;
+  g_cwd_block = dirent_block(&resolved.entry);
   LOG_INFO("[k_chdir] Changed directory to '%s' (block %u)", path, g_cwd_block);
   return PennFatErr_OK;
 }
 
 // Helper to find the name of a directory given its block number by looking in
 // its parent
-static PennFatErr find_dir_name_in_parent(uint16_t target_dir_block,
-                                          uint16_t parent_dir_block,
+static PennFatErr find_dir_name_in_parent(uint32_t target_dir_block,
+                                          uint32_t parent_dir_block,
                                           char* name_buf,
                                           size_t buf_size) {
   if (!g_mounted || !name_buf || buf_size == 0)
@@ -2467,8 +4638,8 @@ static PennFatErr find_dir_name_in_parent(uint16_t target_dir_block,
     return PennFatErr_OK;
   }
 
-  uint16_t current_block = parent_dir_block;
-  char* block_buffer = malloc(g_block_size);
+  uint32_t current_block = parent_dir_block;
+  char* block_buffer = bpool_acquire();
   if (!block_buffer)
     return PennFatErr_OUTOFMEM;
 
@@ -2477,7 +4648,7 @@ static PennFatErr find_dir_name_in_parent(uint16_t target_dir_block,
 
   while (current_block != FAT_EOC && current_block != FAT_FREE) {
     if (read_block(block_buffer, current_block) != 0) {
-      free(block_buffer);
+      bpool_release(block_buffer);
       return PennFatErr_IO;
     }
 
@@ -2486,7 +4657,7 @@ static PennFatErr find_dir_name_in_parent(uint16_t target_dir_block,
       if (dir_entries[i].name[0] != 0 && (uint8_t)dir_entries[i].name[0] != 1 &&
           (uint8_t)dir_entries[i].name[0] != 2 &&
           dir_entries[i].type == 2 &&  // Must be a directory
-          dir_entries[i].first_block == target_dir_block &&
+          dirent_block(&dir_entries[i]) == target_dir_block &&
           strcmp(dir_entries[i].name, ".") != 0 &&
           strcmp(dir_entries[i].name, "..") != 0)  // Exclude '.' and '..'
       {
@@ -2496,16 +4667,16 @@ static PennFatErr find_dir_name_in_parent(uint16_t target_dir_block,
             "[find_dir_name_in_parent] Found name '%s' for block %u in parent "
             "block %u",
             name_buf, target_dir_block, current_block);
-        free(block_buffer);
+        bpool_release(block_buffer);
         return PennFatErr_OK;
       }
       if (dir_entries[i].name[0] == 0)
         break;  // End of directory marker
     }
-    current_block = g_fat[current_block];
+    current_block = fat_get(current_block);
   }
 
-  free(block_buffer);
+  bpool_release(block_buffer);
   LOG_WARN(
       "[find_dir_name_in_parent] Could not find name for block %u in parent %u",
       target_dir_block, parent_dir_block);
@@ -2536,8 +4707,8 @@ PennFatErr k_getcwd(char* buf, size_t size) {
   char current_path[PATH_MAX] = "";  // Build path reversed
   char component[sizeof(((dir_entry_t*)0)->name) +
                  1];  // Max name length + slash
-  uint16_t current_dir = g_cwd_block;
-  uint16_t parent_dir = 0;   // Will be found via ".." entry
+  uint32_t current_dir = g_cwd_block;
+  uint32_t parent_dir = 0;   // Will be found via ".." entry
   int safety_count = 0;      // Prevent infinite loops
   const int max_depth = 64;  // Arbitrary limit
 
@@ -2547,7 +4718,7 @@ PennFatErr k_getcwd(char* buf, size_t size) {
     // Find the ".." entry in the current directory to get the parent block
     resolved_path_t dotdot_result;
     memset(&dotdot_result, 0, sizeof(resolved_path_t));
-    PennFatErr err = find_entry_in_dir(current_dir, "..", &dotdot_result);
+    PennFatErr err = lookup_component(current_dir, "..", &dotdot_result);
     if (err != PennFatErr_OK || !dotdot_result.found) {
       LOG_ERR(
           "[k_getcwd] Failed to find '..' entry in directory block %u (Error "
@@ -2559,7 +4730,7 @@ PennFatErr k_getcwd(char* buf, size_t size) {
       return PennFatErr_IO;  // Or a more specific error
     }
     parent_dir =
-        dotdot_result.entry.first_block;  // Found parent block from '..'
+        dirent_block(&dotdot_result.entry);  // Found parent block from '..'
 
     // Find the name of the current directory within its parent
     err = find_dir_name_in_parent(
@@ -2697,28 +4868,28 @@ PennFatErr k_symlink(const char* target, const char* linkpath) {
   LOG_DEBUG("[k_symlink] Allocated block %d for target string.", target_block);
 
   // 3. Write target string to the block
-  char* block_buffer =
-      calloc(1, g_block_size);  // Use calloc to zero-initialize
+  char* block_buffer = bpool_acquire();
   if (!block_buffer) {
-    g_fat[target_block] = FAT_FREE;  // Rollback alloc
+    release_block(target_block);  // Rollback alloc
     return PennFatErr_OUTOFMEM;
   }
+  memset(block_buffer, 0, g_block_size);
   strncpy(block_buffer, target,
           g_block_size - 1);  // Copy target, ensuring space for null term
   block_buffer[g_block_size - 1] = '\0';  // Ensure null termination
 
   err = write_block(block_buffer, target_block);
-  free(block_buffer);
+  bpool_release(block_buffer);
   if (err != 0) {
     LOG_ERR(
         "[k_symlink] Failed to write target string to block %d for link '%s'",
         target_block, linkpath);
-    g_fat[target_block] = FAT_FREE;  // Rollback alloc
+    release_block(target_block);  // Rollback alloc
     return PennFatErr_IO;
   }
 
-  // Ensure the symlink target data is immediately written to disk
-  fdatasync(g_fs_fd);
+  // Ensure the symlink target data is written to disk per the mount policy
+  durability_point();
   LOG_DEBUG("[k_symlink] Target data flushed to disk for symlink '%s' -> '%s'",
             linkpath, target);
 
@@ -2729,7 +4900,7 @@ PennFatErr k_symlink(const char* target, const char* linkpath) {
   link_entry.type = 4;  // Symbolic link
   link_entry.perm =
       DEF_PERM | PERM_EXEC;  // Default link perms (rwxrwxrwx often)
-  link_entry.first_block = (uint16_t)target_block;
+  dirent_set_block(&link_entry, (uint32_t)target_block);
   link_entry.size = target_len;  // Store length of target string
   link_entry.mtime = time(NULL);
 
@@ -2749,6 +4920,50 @@ PennFatErr k_symlink(const char* target, const char* linkpath) {
   return PennFatErr_OK;
 }
 
+/*
+ * k_readlink: Copies the target of the symbolic link at path (not followed)
+ * into buf, NUL-terminated. Returns the target's length, PennFatErr_INVAD if
+ * path is not a symlink or PennFatErr_RANGE if buf cannot hold the target.
+ */
+PennFatErr k_readlink(const char* path, char* buf, size_t size) {
+  if (!g_mounted) {
+    LOG_WARN("[k_readlink] Failed to read link: Filesystem not mounted.");
+    return PennFatErr_NOT_MOUNTED;
+  }
+  if (!path || path[0] == '\0' || !buf || size == 0)
+    return PennFatErr_INVAD;
+
+  resolved_path_t resolved;
+  PennFatErr err = resolve_path_no_follow(path, &resolved);
+  if (err != PennFatErr_OK)
+    return err;
+  if (!resolved.found) {
+    LOG_ERR("[k_readlink] Cannot read '%s': Path does not exist.", path);
+    return PennFatErr_EXISTS;
+  }
+  if (resolved.is_root || resolved.entry.type != 4) {
+    LOG_ERR("[k_readlink] Cannot read '%s': Not a symbolic link.", path);
+    return PennFatErr_INVAD;
+  }
+
+  char* block_buffer = bpool_acquire();
+  if (!block_buffer)
+    return PennFatErr_OUTOFMEM;
+  if (read_block(block_buffer, dirent_block(&resolved.entry)) != 0) {
+    bpool_release(block_buffer);
+    return PennFatErr_IO;
+  }
+  size_t len = strnlen(block_buffer, g_block_size - 1);
+  if (len >= size) {
+    bpool_release(block_buffer);
+    return PennFatErr_RANGE;
+  }
+  memcpy(buf, block_buffer, len);
+  buf[len] = '\0';
+  bpool_release(block_buffer);
+  return (PennFatErr)len;
+}
+
 /**
  * k_mkdir: Creates a new directory at the specified path.
  */
@@ -2817,7 +5032,7 @@ PennFatErr k_mkdir(const char* path) {
   strncpy(new_entry.name, dirname, sizeof(new_entry.name) - 1);
   new_entry.type = 2;         // Directory
   new_entry.perm = DEF_PERM;  // Default permissions
-  new_entry.first_block = (uint16_t)dir_block;
+  dirent_set_block(&new_entry, (uint32_t)dir_block);
   new_entry.size = 0;  // Size is 0 for directories
   new_entry.mtime = time(NULL);
 
@@ -2827,19 +5042,19 @@ PennFatErr k_mkdir(const char* path) {
         "[k_mkdir] Failed to add entry for '%s' to parent directory block %u "
         "(Error %d)",
         dirname, resolved.parent_dir_block, err);
-    g_fat[dir_block] = FAT_FREE;  // Rollback block allocation
+    release_block(dir_block);  // Rollback block allocation
     return err;
   }
 
   // 6. Initialize the directory with '.' and '..' entries
-  char* block_buffer =
-      calloc(1, g_block_size);  // Use calloc to zero-initialize
+  char* block_buffer = bpool_acquire();
   if (!block_buffer) {
     LOG_ERR(
         "[k_mkdir] Failed to allocate memory for directory initialization.");
-    g_fat[dir_block] = FAT_FREE;  // Rollback block allocation
+    release_block(dir_block);  // Rollback block allocation
     return PennFatErr_OUTOFMEM;
   }
+  memset(block_buffer, 0, g_block_size);
 
   dir_entry_t* dir_entries = (dir_entry_t*)block_buffer;
 
@@ -2847,26 +5062,26 @@ PennFatErr k_mkdir(const char* path) {
   strcpy(dir_entries[0].name, ".");
   dir_entries[0].type = 2;  // Directory
   dir_entries[0].perm = DEF_PERM;
-  dir_entries[0].first_block = (uint16_t)dir_block;
+  dirent_set_block(&dir_entries[0], (uint32_t)dir_block);
   dir_entries[0].mtime = time(NULL);
 
   // Create '..' entry (points to parent)
   strcpy(dir_entries[1].name, "..");
   dir_entries[1].type = 2;  // Directory
   dir_entries[1].perm = DEF_PERM;
-  dir_entries[1].first_block = resolved.parent_dir_block;
+  dirent_set_block(&dir_entries[1], resolved.parent_dir_block);
   dir_entries[1].mtime = time(NULL);
 
   // Write the initialized directory block
   if (write_block(block_buffer, dir_block) != 0) {
     LOG_ERR("[k_mkdir] Failed to write initialized directory block %u.",
             dir_block);
-    free(block_buffer);
-    g_fat[dir_block] = FAT_FREE;  // Rollback block allocation
+    bpool_release(block_buffer);
+    release_block(dir_block);  // Rollback block allocation
     return PennFatErr_IO;
   }
 
-  free(block_buffer);
+  bpool_release(block_buffer);
   LOG_INFO("[k_mkdir] Successfully created directory '%s' at block %u.", path,
            dir_block);
   return PennFatErr_OK;
@@ -2914,44 +5129,51 @@ PennFatErr k_rmdir(const char* path) {
   }
 
   // 3. Check if the directory is empty (only '.' and '..' entries)
-  uint16_t dir_block = resolved.entry.first_block;
-  char* block_buffer = malloc(g_block_size);
+  uint32_t dir_block = dirent_block(&resolved.entry);
+  char* block_buffer = bpool_acquire();
   if (!block_buffer) {
     LOG_ERR("[k_rmdir] Failed to allocate memory for directory check.");
     return PennFatErr_OUTOFMEM;
   }
 
-  if (read_block(block_buffer, dir_block) != 0) {
-    LOG_ERR("[k_rmdir] Failed to read directory block %u.", dir_block);
-    free(block_buffer);
-    return PennFatErr_IO;
-  }
-
   dir_entry_t* dir_entries = (dir_entry_t*)block_buffer;
   uint32_t entries_per_block = g_block_size / sizeof(dir_entry_t);
   bool is_empty = true;
-
-  for (uint32_t i = 0; i < entries_per_block; i++) {
-    if (dir_entries[i].name[0] == 0) {
-      // End of directory
-      break;
+  bool at_end = false;
+
+  // Live entries can sit in any block of the chain, not just the first
+  for (uint32_t block = dir_block;
+       is_empty && !at_end && block != FAT_EOC && block != FAT_FREE;
+       block = fat_get(block)) {
+    if (read_block(block_buffer, block) != 0) {
+      LOG_ERR("[k_rmdir] Failed to read directory block %u.", block);
+      bpool_release(block_buffer);
+      return PennFatErr_IO;
     }
 
-    if ((uint8_t)dir_entries[i].name[0] == 1 ||
-        (uint8_t)dir_entries[i].name[0] == 2) {
-      // Deleted entry, skip
-      continue;
-    }
+    for (uint32_t i = 0; i < entries_per_block; i++) {
+      if (dir_entries[i].name[0] == 0) {
+        // End of directory
+        at_end = true;
+        break;
+      }
 
-    if (strcmp(dir_entries[i].name, ".") != 0 &&
-        strcmp(dir_entries[i].name, "..") != 0) {
-      // Found a non-special entry, directory is not empty
-      is_empty = false;
-      break;
+      if ((uint8_t)dir_entries[i].name[0] == 1 ||
+          (uint8_t)dir_entries[i].name[0] == 2) {
+        // Deleted entry, skip
+        continue;
+      }
+
+      if (strcmp(dir_entries[i].name, ".") != 0 &&
+          strcmp(dir_entries[i].name, "..") != 0) {
+        // Found a non-special entry, directory is not empty
+        is_empty = false;
+        break;
+      }
     }
   }
 
-  free(block_buffer);
+  bpool_release(block_buffer);
 
   if (!is_empty) {
     LOG_ERR("[k_rmdir] Cannot remove directory '%s': Directory not empty.",
@@ -2970,14 +5192,40 @@ PennFatErr k_rmdir(const char* path) {
             err);
     return err;
   }
+  dindex_remove(resolved.parent_dir_block, resolved.entry.name,
+                resolved.entry_block, resolved.entry_index_in_block);
 
-  // 5. Free the directory block
-  g_fat[dir_block] = FAT_FREE;
+  // 5. Free the directory's blocks; streams still open on it just end
+  for (int dh = 0; dh < MAX_DIR_STREAMS; dh++) {
+    if (g_dir_streams[dh].in_use && g_dir_streams[dh].dir == dir_block)
+      g_dir_streams[dh].block = FAT_EOC;
+  }
+  dindex_drop(dir_block);
+  dcache_forget_dir(dir_block);
+  free_block_chain(dir_block);
+  maybe_compact_dir(resolved.parent_dir_block);
 
   LOG_INFO("[k_rmdir] Successfully removed directory '%s'.", path);
   return PennFatErr_OK;
 }
 
+/*
+ * dir_within: Reports whether directory dir is ancestor itself or lies below
+ * it, following '..' entries up to the root.
+ */
+static bool dir_within(uint32_t dir, uint32_t ancestor) {
+  for (uint32_t hops = 0; hops < g_superblock.fat_entries; hops++) {
+    if (dir == ancestor)
+      return true;
+    dir_entry_t dotdot;
+    if (dir == 1 || read_dirent(dir, 1, &dotdot) != PennFatErr_OK ||
+        strcmp(dotdot.name, "..") != 0)
+      return false;
+    dir = dirent_block(&dotdot);
+  }
+  return false;
+}
+
 // This function replaces the old k_rename implementation
 PennFatErr k_rename(const char* oldpath, const char* newpath) {
   if (!g_mounted) {
@@ -3050,6 +5298,15 @@ PennFatErr k_rename(const char* oldpath, const char* newpath) {
     return PennFatErr_INVAD;
   }
 
+  // A directory cannot move below itself; it would leave the tree
+  if (old_resolved.entry.type == 2 &&
+      dir_within(new_resolved.parent_dir_block,
+                 dirent_block(&old_resolved.entry))) {
+    LOG_ERR("[k_rename] Cannot move '%s' into its own subdirectory '%s'.",
+            oldpath, newpath);
+    return PennFatErr_INVAD;
+  }
+
   // 3. Handle if newpath already exists
   if (new_resolved.found) {
     // Cannot overwrite a directory with a non-directory or vice-versa without
@@ -3066,24 +5323,21 @@ PennFatErr k_rename(const char* oldpath, const char* newpath) {
     // Check permissions for overwrite (need write in new parent dir, and
     // potentially write on existing file/dir) (Skipping perm checks for now)
 
-    // Unlink/rmdir the existing destination
+    // Unlink/rmdir the existing destination. old_resolved must still point
+    // at the source entry afterwards, so nothing gets compacted meanwhile.
     PennFatErr unlink_err;
+    g_compact_held++;
     if (new_resolved.entry.type == 2) {  // It's a directory
       unlink_err = k_rmdir(newpath);     // Use k_rmdir for directories
-      if (unlink_err != PennFatErr_OK) {
-        LOG_ERR(
-            "[k_rename] Failed to remove existing directory '%s' (Error %d).",
-            newpath, unlink_err);
-        return unlink_err;  // Propagate error (e.g., NOTEMPTY)
-      }
-    } else {                           // It's a file or symlink
-      unlink_err = k_unlink(newpath);  // Use k_unlink
-      if (unlink_err != PennFatErr_OK) {
-        LOG_ERR(
-            "[k_rename] Failed to remove existing file/link '%s' (Error %d).",
-            newpath, unlink_err);
-        return unlink_err;  // Propagate error (e.g., BUSY)
-      }
+    } else {                             // It's a file or symlink
+      unlink_err = k_unlink(newpath);    // Use k_unlink
+    }
+    g_compact_held--;
+    if (unlink_err != PennFatErr_OK) {
+      LOG_ERR("[k_rename] Failed to remove existing destination '%s' (Error "
+              "%d).",
+              newpath, unlink_err);
+      return unlink_err;  // Propagate error (e.g., NOTEMPTY or BUSY)
     }
     LOG_DEBUG("[k_rename] Successfully removed existing destination '%s'.",
               newpath);
@@ -3124,6 +5378,29 @@ PennFatErr k_rename(const char* oldpath, const char* newpath) {
     // Difficult. For now, return error but acknowledge inconsistency.
     return err;
   }
+  dindex_remove(old_resolved.parent_dir_block, old_resolved.entry.name,
+                old_resolved.entry_block, old_resolved.entry_index_in_block);
+
+  // A directory that changed parents must point its '..' at the new one
+  if (entry_to_move.type == 2 &&
+      new_resolved.parent_dir_block != old_resolved.parent_dir_block) {
+    uint32_t moved = dirent_block(&entry_to_move);
+    dir_entry_t dotdot;
+    err = read_dirent(moved, 1, &dotdot);
+    if (err == PennFatErr_OK && strcmp(dotdot.name, "..") == 0) {
+      dirent_set_block(&dotdot, new_resolved.parent_dir_block);
+      err = write_dirent(moved, 1, &dotdot);
+    }
+    if (err != PennFatErr_OK) {
+      LOG_ERR("[k_rename] Failed to update '..' of moved directory '%s' "
+              "(Error %d).",
+              newpath, err);
+      return err;
+    }
+  }
+  maybe_compact_dir(old_resolved.parent_dir_block);
+  if (new_resolved.parent_dir_block != old_resolved.parent_dir_block)
+    maybe_compact_dir(new_resolved.parent_dir_block);  // lost a replaced entry
 
   LOG_INFO("[k_rename] Successfully renamed '%s' to '%s'.", oldpath, newpath);
   return PennFatErr_OK;
@@ -5,7 +5,114 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "../common/pennfat_definitions.h"
 #include "../common/pennfat_errors.h"
+#include "pennfat_blockdev.h"
+
+/* Durability policy, chosen at mount time */
+typedef enum {
+  PENNFAT_SYNC_ALWAYS,    // write through and fdatasync after every block
+  PENNFAT_SYNC_ON_CLOSE,  // write back and sync on k_close/k_sync/k_unmount
+  PENNFAT_SYNC_PERIODIC,  // background write back + sync every period
+  PENNFAT_SYNC_NONE,      // never sync (scratch images); k_sync still does
+} pennfat_sync_policy_t;
+
+#define PENNFAT_DEFAULT_SYNC_PERIOD_MS 1000
+
+/* On-disk formats accepted by k_mkfs_opts() */
+typedef enum {
+  PENNFAT_FORMAT_NARROW,  // 16-bit FAT, <= 32 FAT blocks (the original format)
+  PENNFAT_FORMAT_WIDE,    // superblock + 32-bit FAT, <= 65535 FAT blocks
+} pennfat_format_t;
+
+/* Mount options for k_mount_opts() */
+typedef struct {
+  pennfat_sync_policy_t sync_policy;
+  uint32_t sync_period_ms;  // PENNFAT_SYNC_PERIODIC only; 0 = default
+  pennfat_backend_t backend;  // block I/O backend (default pread/pwrite)
+} pennfat_mount_opts_t;
+
+/* Filesystem statistics reported by k_stats() */
+typedef struct {
+  uint32_t format_version;    // 1 = narrow 16-bit FAT, 2 = wide 32-bit FAT
+  uint32_t block_size;        // bytes per block
+  uint32_t total_blocks;      // allocatable data blocks
+  uint32_t free_blocks;       // of those, currently free
+  uint32_t cache_frames;      // frames in the block buffer cache
+  uint64_t cache_hits;        // block lookups served from the cache
+  uint64_t cache_misses;      // block lookups that went to the device
+  uint64_t cache_evictions;   // frames recycled to make room
+  uint64_t cache_writebacks;  // dirty frames written to the device
+  uint64_t prefetched;        // blocks pulled in by sequential read-ahead
+  uint64_t prefetch_hits;     // read-ahead blocks later read by k_read
+  uint64_t dev_reads;         // blocks read from the image
+  uint64_t dev_writes;        // blocks written to the image
+  uint64_t dev_syncs;         // fdatasync() calls on the image
+  uint64_t dev_requests;      // backend transfers (a contiguous run is one)
+  uint64_t rmw_skipped;       // partial-block writes that needed no read
+  uint64_t map_lookups;       // blocks located through a file block map
+  uint64_t map_bytes;         // memory held by block maps
+  uint64_t delay_bytes;       // memory held by delayed-allocation buffers
+  uint64_t delay_flushes;     // delayed regions given blocks
+  uint64_t delay_dropped;     // delayed blocks truncated before getting any
+  uint64_t fat_msyncs;        // msync() calls on runs of dirty FAT pages
+  uint64_t fat_pages_synced;  // FAT pages those calls wrote back
+  uint64_t buf_acquires;      // scratch block buffers handed out
+  uint64_t buf_overflows;     // of those, served by the heap (slab empty)
+  uint32_t buf_high_water;    // most scratch buffers held at once
+  uint64_t dir_lookups;       // names looked up through a directory index
+  uint64_t dir_slot_hints;    // entries added without a free-slot scan
+  uint64_t dir_index_builds;  // directory indexes built (one scan each)
+  uint64_t dir_index_drops;   // of those, dropped to stay in budget
+  uint32_t dir_index_dirs;    // directories currently indexed
+  uint64_t dir_index_bytes;   // memory held by directory indexes
+  uint64_t dentry_hits;       // path components resolved from the cache
+  uint64_t dentry_negative;   // of those, names known not to exist
+  uint64_t dentry_misses;     // components looked up in their directory
+  uint64_t dentry_dropped;    // cached results invalidated by changes
+  uint64_t dir_compactions;   // directories packed to drop deleted entries
+  uint64_t dir_blocks_freed;  // directory blocks those packings released
+  pennfat_sync_policy_t sync_policy;
+  const char* backend;  // name of the block I/O backend
+  const char* fat_scan;  // FAT scan implementation (avx2, sse2 or c)
+} pennfat_stats_t;
+
+/* Fragmentation figures reported by k_defrag() */
+typedef struct {
+  uint32_t chains;          // files, directories and symlinks examined
+  uint32_t blocks;          // blocks in those chains
+  uint32_t extents_before;  // contiguous runs over all chains, before
+  uint32_t extents_after;   // and after relocation
+  uint32_t moved;           // chains relocated into a single extent
+  uint32_t skipped;         // fragmented chains no free run could hold
+} pennfat_defrag_report_t;
+
+/* Called by k_defrag() once per chain, with its extents before and after */
+typedef void (*pennfat_defrag_fn)(const char* path,
+                                  uint32_t blocks,
+                                  uint32_t extents_before,
+                                  uint32_t extents_after,
+                                  void* arg);
+
+/* Consistency figures reported by k_fsck() */
+typedef struct {
+  uint32_t threads;      // worker threads used
+  uint32_t dirs;         // directories scanned
+  uint32_t files;        // regular files checked
+  uint32_t symlinks;     // symbolic links checked
+  uint32_t blocks_used;  // blocks reachable from the root directory
+  uint32_t free_blocks;  // free FAT entries (after any repair)
+  uint32_t bad_chains;   // chains that loop or leave the data region
+  uint32_t cross_links;  // chains running into a block another one owns
+  uint32_t size_errors;  // sizes larger than the chain can hold
+  uint32_t bad_entries;  // garbage, orphaned or misdirected entries
+  uint32_t leaked;       // allocated blocks no chain reaches
+  uint32_t dangling;     // symlinks whose target does not exist
+  uint32_t repaired;     // of the problems above, fixed in place
+} pennfat_fsck_report_t;
+
+/* Called by k_fsck() once per problem found, with a one-line description */
+typedef void (*pennfat_fsck_fn)(const char* problem, void* arg);
 
 /* Initialization function: call this from your main application */
 void pennfat_kernel_init(void);
@@ -20,14 +127,28 @@ PennFatErr k_read(int fd, int n, char* buf);
 PennFatErr k_write(int fd, const char* buf, int n);
 PennFatErr k_unlink(const char* path);
 PennFatErr k_lseek(int fd, int offset, int whence);
-PennFatErr k_ls(const char* path);
-PennFatErr k_ls_long(const char* path);
+PennFatErr k_ftruncate(int fd, int length);
+PennFatErr k_fallocate(int fd, int length);
 PennFatErr k_touch(const char* path);
 PennFatErr k_rename(const char* oldpath, const char* newpath);
 PennFatErr k_chmod(const char* path, uint8_t perm);
 PennFatErr k_mkdir(const char* path);
 PennFatErr k_rmdir(const char* path);
 PennFatErr k_symlink(const char* target, const char* linkpath);
+PennFatErr k_readlink(const char* path, char* buf, size_t size);
+
+/* Directory streams: k_opendir() returns a handle whose cursor (block, slot)
+ * walks the directory's chain; each k_readdir() copies the next batch of at
+ * most max live entries into buf and returns how many it copied, 0 at the
+ * end. Handles are released with k_closedir(). */
+PennFatErr k_opendir(const char* path);
+PennFatErr k_readdir(int dh, dir_entry_t* buf, int max);
+PennFatErr k_closedir(int dh);
+
+/* k_compact: Packs the live entries of the directory at path and frees the
+ * blocks this empties. Returns the blocks freed. Directories are also
+ * compacted on their own once most of their used slots are deleted. */
+PennFatErr k_compact(const char* path);
 
 /* Kernel-Level API - Process Context (will depend on PCB integration) */
 PennFatErr k_chdir(const char* path);
@@ -35,9 +156,37 @@ PennFatErr k_getcwd(char* buf, size_t size);
 
 /* Mount/Unmount */
 PennFatErr k_mount(const char* fs_name);
+PennFatErr k_mount_opts(const char* fs_name, const pennfat_mount_opts_t* opts);
 PennFatErr k_unmount(void);
 PennFatErr k_mkfs(const char* fs_name,
                   int blocks_in_fat,
                   int block_size_config);
+PennFatErr k_mkfs_opts(const char* fs_name,
+                       int blocks_in_fat,
+                       int block_size_config,
+                       pennfat_format_t format);
+
+/* k_defrag: Makes every file's chain contiguous; dry_run only reports. No
+ * file or directory may be open. fn (optional) gets one call per chain. */
+PennFatErr k_defrag(bool dry_run,
+                    pennfat_defrag_fn fn,
+                    void* arg,
+                    pennfat_defrag_report_t* report);
+
+/* k_fsck: Checks the unmounted image fs_name for broken, looping and
+ * cross-linked chains, leaked blocks, bad sizes and entries and dangling
+ * symlinks, using `threads` worker threads (0 = one per CPU). With repair the
+ * problems are fixed. Refused with PennFatErr_BUSY while a filesystem is
+ * mounted. */
+PennFatErr k_fsck(const char* fs_name,
+                  bool repair,
+                  uint32_t threads,
+                  pennfat_fsck_fn fn,
+                  void* arg,
+                  pennfat_fsck_report_t* report);
+
+/* Durability and statistics */
+PennFatErr k_sync(void);
+PennFatErr k_stats(pennfat_stats_t* out);
 
 #endif /* PENNFAT_KERNEL_H */
\ No newline at end of file
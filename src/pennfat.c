@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "common/pennfat_definitions.h"
 #include "common/pennfat_errors.h"
@@ -17,12 +18,18 @@
 // function declarations for special routines
 static PennFatErr mkfs(const char* fs_name,
                        int blocks_in_fat,
-                       int block_size_config);
-static PennFatErr mount(const char* fs_name);
+                       int block_size_config,
+                       pennfat_format_t format);
+static PennFatErr mount(const char** args);
 static PennFatErr unmount();
 static PennFatErr mv(const char* oldname, const char* newname);
 static PennFatErr chmod(const char** args);
 static PennFatErr cp(const char** args);
+static PennFatErr stats();
+static PennFatErr df();
+static PennFatErr defrag(const char** args);
+static PennFatErr fsck(const char** args);
+static PennFatErr ls(const char* target, bool long_format);
 
 static void cat(const char** args);
 static void rm(const char** args);
@@ -71,7 +78,11 @@ int main(int argc, char* argv[]) {
 
     if (strcmp(args[0], "mount") == 0) {
       /* mount */
-      status = mount(args[1]);
+      if (args[1] == NULL) {
+        fprintf(stderr, "mount: missing arguments\n");
+        goto AFTER_EXECUTE;
+      }
+      status = mount((const char**)args + 1);
       if (status) {
         fprintf(stderr, "mount failed: %s\n", PennFatErr_toErrString(status));
       }
@@ -84,7 +95,7 @@ int main(int argc, char* argv[]) {
       }
 
     } else if (strcmp(args[0], "mkfs") == 0) {
-      /* mkfs */
+      /* mkfs FS_NAME BLOCKS_IN_FAT BLOCK_SIZE_CONFIG [-w] */
       if (args[1] == NULL || args[2] == NULL || args[3] == NULL) {
         fprintf(stderr, "mkfs: missing arguments\n");
         goto AFTER_EXECUTE;
@@ -92,19 +103,29 @@ int main(int argc, char* argv[]) {
 
       int blocks_in_fat = atoi(args[2]);
       int block_size_config = atoi(args[3]);
+      pennfat_format_t format = PENNFAT_FORMAT_NARROW;
+      if (args[4] != NULL) {
+        if (strcmp(args[4], "-w") != 0) {
+          fprintf(stderr, "mkfs: unknown option '%s'\n", args[4]);
+          goto AFTER_EXECUTE;
+        }
+        format = PENNFAT_FORMAT_WIDE;
+      }
+      int max_fat_blocks = format == PENNFAT_FORMAT_WIDE ? 65535 : 32;
+      int max_block_config = format == PENNFAT_FORMAT_WIDE ? 7 : 4;
 
-      if (blocks_in_fat < 1 || blocks_in_fat > 32) {
+      if (blocks_in_fat < 1 || blocks_in_fat > max_fat_blocks) {
         fprintf(stderr, "Invalid number of blocks in FAT: %d\n", blocks_in_fat);
         goto AFTER_EXECUTE;
       }
 
-      if (block_size_config < 0 || block_size_config > 4) {
+      if (block_size_config < 0 || block_size_config > max_block_config) {
         fprintf(stderr, "Invalid block size configuration: %d\n",
                 block_size_config);
         goto AFTER_EXECUTE;
       }
 
-      status = mkfs(args[1], blocks_in_fat, block_size_config);
+      status = mkfs(args[1], blocks_in_fat, block_size_config, format);
       if (status) {
         fprintf(stderr, "mkfs failed: %s\n", PennFatErr_toErrString(status));
       }
@@ -132,11 +153,7 @@ int main(int argc, char* argv[]) {
         }
       }
 
-      if (long_format) {
-        status = k_ls_long(target);
-      } else {
-        status = k_ls(target);  // Modify existing k_ls to accept path
-      }
+      status = ls(target, long_format);
 
       if (status) {
         fprintf(stderr, "ls failed: %s\n", PennFatErr_toErrString(status));
@@ -202,6 +219,54 @@ int main(int argc, char* argv[]) {
         fprintf(stderr, "cp failed: %s\n", PennFatErr_toErrString(status));
       }
 
+    } else if (strcmp(args[0], "sync") == 0) {
+      /* sync */
+      status = k_sync();
+      if (status) {
+        fprintf(stderr, "sync failed: %s\n", PennFatErr_toErrString(status));
+      }
+
+    } else if (strcmp(args[0], "stats") == 0) {
+      /* stats */
+      status = stats();
+      if (status) {
+        fprintf(stderr, "stats failed: %s\n", PennFatErr_toErrString(status));
+      }
+
+    } else if (strcmp(args[0], "df") == 0) {
+      /* df */
+      status = df();
+      if (status) {
+        fprintf(stderr, "df failed: %s\n", PennFatErr_toErrString(status));
+      }
+
+    } else if (strcmp(args[0], "defrag") == 0) {
+      /* defrag [-n] */
+      status = defrag((const char**)args);
+      if (status) {
+        fprintf(stderr, "defrag failed: %s\n", PennFatErr_toErrString(status));
+      }
+
+    } else if (strcmp(args[0], "compact") == 0) {
+      /* compact [DIR] */
+      status = k_compact(args[1]);
+      if (status < 0) {
+        fprintf(stderr, "compact failed: %s\n", PennFatErr_toErrString(status));
+      } else {
+        printf("compact: freed %d block(s)\n", status);
+        status = PennFatErr_SUCCESS;
+      }
+
+    } else if (strcmp(args[0], "fsck") == 0) {
+      /* fsck FS_NAME [-r] [-j THREADS] */
+      status = fsck((const char**)args);
+      if (status == PennFatErr_BUSY) {
+        fprintf(stderr,
+                "fsck failed: a filesystem is mounted, unmount first\n");
+      } else if (status) {
+        fprintf(stderr, "fsck failed: %s\n", PennFatErr_toErrString(status));
+      }
+
     } else {
       fprintf(stderr, "pennfat: command not found: %s\n", args[0]);
     }
@@ -523,18 +588,350 @@ static PennFatErr cp(const char** args) {
   return ret;
 }
 
-static PennFatErr mount(const char* fs_name) {
-  return k_mount(fs_name);
+static const char* const sync_policy_names[] = {"always", "on-close",
+                                                "periodic", "none"};
+
+/**
+ * mount command usage:
+ *   mount FS_NAME [ -b BACKEND ] [ SYNC_POLICY [ PERIOD_MS ] ]
+ *       BACKEND is pread (default), mmap or io_uring.
+ *       SYNC_POLICY is one of always (default), on-close, periodic, none.
+ *       PERIOD_MS is the flush interval for the periodic policy.
+ */
+static PennFatErr mount(const char** args) {
+  pennfat_mount_opts_t opts = {.sync_policy = PENNFAT_SYNC_ALWAYS,
+                               .sync_period_ms = 0,
+                               .backend = PENNFAT_BACKEND_PREAD};
+  const char** rest = args + 1;
+
+  if (rest[0] != NULL && strcmp(rest[0], "-b") == 0) {
+    if (rest[1] == NULL || blockdev_parse(rest[1], &opts.backend) != 0) {
+      fprintf(stderr,
+              "mount: unknown backend '%s' (pread, mmap, io_uring)\n",
+              rest[1] ? rest[1] : "");
+      return PennFatErr_INVAD;
+    }
+    rest += 2;
+  }
+
+  if (rest[0] != NULL) {
+    int n_policies = sizeof(sync_policy_names) / sizeof(sync_policy_names[0]);
+    int i;
+    for (i = 0; i < n_policies; i++) {
+      if (strcmp(rest[0], sync_policy_names[i]) == 0)
+        break;
+    }
+    if (i == n_policies) {
+      fprintf(stderr,
+              "mount: unknown sync policy '%s' (always, on-close, periodic, "
+              "none)\n",
+              rest[0]);
+      return PennFatErr_INVAD;
+    }
+    opts.sync_policy = (pennfat_sync_policy_t)i;
+
+    if (rest[1] != NULL) {
+      int period = atoi(rest[1]);
+      if (opts.sync_policy != PENNFAT_SYNC_PERIODIC || period <= 0) {
+        fprintf(stderr, "mount: PERIOD_MS only applies to 'periodic'\n");
+        return PennFatErr_INVAD;
+      }
+      opts.sync_period_ms = (uint32_t)period;
+    }
+  }
+
+  return k_mount_opts(args[0], &opts);
 }
 
 static PennFatErr unmount() {
   return k_unmount();
 }
 
+static PennFatErr stats() {
+  pennfat_stats_t st;
+  PennFatErr err = k_stats(&st);
+  if (err)
+    return err;
+
+  uint64_t lookups = st.cache_hits + st.cache_misses;
+  printf("format:            v%u (%s FAT)\n", st.format_version,
+         st.format_version == 2 ? "32-bit" : "16-bit");
+  printf("block size:        %u\n", st.block_size);
+  printf("free blocks:       %u of %u\n", st.free_blocks, st.total_blocks);
+  printf("sync policy:       %s\n", sync_policy_names[st.sync_policy]);
+  printf("backend:           %s\n", st.backend);
+  printf("FAT scan:          %s\n", st.fat_scan);
+  printf("cache frames:      %u (%u KiB)\n", st.cache_frames,
+         st.cache_frames * st.block_size / 1024);
+  printf("cache hits:        %lu\n", (unsigned long)st.cache_hits);
+  printf("cache misses:      %lu\n", (unsigned long)st.cache_misses);
+  printf("cache hit rate:    %.1f%%\n",
+         lookups ? 100.0 * st.cache_hits / lookups : 0.0);
+  printf("cache evictions:   %lu\n", (unsigned long)st.cache_evictions);
+  printf("cache writebacks:  %lu\n", (unsigned long)st.cache_writebacks);
+  printf("prefetched blocks: %lu\n", (unsigned long)st.prefetched);
+  printf("prefetch hit rate: %.1f%%\n",
+         st.prefetched ? 100.0 * st.prefetch_hits / st.prefetched : 0.0);
+  printf("device reads:      %lu\n", (unsigned long)st.dev_reads);
+  printf("device writes:     %lu\n", (unsigned long)st.dev_writes);
+  printf("device syncs:      %lu\n", (unsigned long)st.dev_syncs);
+  printf("device requests:   %lu\n", (unsigned long)st.dev_requests);
+  printf("rmw reads skipped: %lu\n", (unsigned long)st.rmw_skipped);
+  printf("block map lookups: %lu (%lu KiB mapped)\n",
+         (unsigned long)st.map_lookups, (unsigned long)(st.map_bytes / 1024));
+  printf("delayed regions:   %lu (%lu blocks dropped, %lu KiB held)\n",
+         (unsigned long)st.delay_flushes, (unsigned long)st.delay_dropped,
+         (unsigned long)(st.delay_bytes / 1024));
+  printf("FAT flushes:       %lu msyncs, %lu pages\n",
+         (unsigned long)st.fat_msyncs, (unsigned long)st.fat_pages_synced);
+  printf("scratch buffers:   %lu (%lu from heap, peak %u held)\n",
+         (unsigned long)st.buf_acquires, (unsigned long)st.buf_overflows,
+         st.buf_high_water);
+  printf("dir index:         %lu lookups, %lu slot hints, %lu builds, "
+         "%lu dropped (%u dirs, %lu KiB)\n",
+         (unsigned long)st.dir_lookups, (unsigned long)st.dir_slot_hints,
+         (unsigned long)st.dir_index_builds,
+         (unsigned long)st.dir_index_drops, st.dir_index_dirs,
+         (unsigned long)(st.dir_index_bytes / 1024));
+  printf("dentry cache:      %lu hits (%lu negative), %lu misses, "
+         "%lu invalidated\n",
+         (unsigned long)st.dentry_hits, (unsigned long)st.dentry_negative,
+         (unsigned long)st.dentry_misses, (unsigned long)st.dentry_dropped);
+  printf("dir compaction:    %lu runs, %lu blocks freed\n",
+         (unsigned long)st.dir_compactions,
+         (unsigned long)st.dir_blocks_freed);
+  return PennFatErr_SUCCESS;
+}
+
+static PennFatErr df() {
+  pennfat_stats_t st;
+  PennFatErr err = k_stats(&st);
+  if (err)
+    return err;
+
+  uint32_t used = st.total_blocks - st.free_blocks;
+  printf("%10s %10s %10s %5s\n", "blocks", "used", "free", "use%");
+  printf("%10u %10u %10u %4.0f%%\n", st.total_blocks, used, st.free_blocks,
+         st.total_blocks ? 100.0 * used / st.total_blocks : 0.0);
+  return PennFatErr_SUCCESS;
+}
+
+/* Prints one line per chain that was (or, with -n, would be) fragmented */
+static void defrag_line(const char* path,
+                        uint32_t blocks,
+                        uint32_t extents_before,
+                        uint32_t extents_after,
+                        void* arg) {
+  bool dry_run = *(const bool*)arg;
+  if (extents_before <= 1)
+    return;
+  if (dry_run)
+    printf("%10u %10u  %s\n", blocks, extents_before, path);
+  else
+    printf("%10u %10u %10u  %s\n", blocks, extents_before, extents_after,
+           path);
+}
+
+/**
+ * defrag command usage:
+ *   defrag [-n]
+ *       Makes every file's chain physically contiguous and reports extents
+ *       per file before and after. -n only reports.
+ */
+static PennFatErr defrag(const char** args) {
+  bool dry_run = args[1] != NULL && strcmp(args[1], "-n") == 0;
+  if (args[1] != NULL && !dry_run) {
+    fprintf(stderr, "defrag: unknown option '%s'\n", args[1]);
+    return PennFatErr_INVAD;
+  }
+
+  pennfat_defrag_report_t rep;
+  if (dry_run)
+    printf("%10s %10s  %s\n", "blocks", "extents", "path");
+  else
+    printf("%10s %10s %10s  %s\n", "blocks", "before", "after", "path");
+  PennFatErr err = k_defrag(dry_run, defrag_line, &dry_run, &rep);
+  if (err)
+    return err;
+
+  double chains = rep.chains ? rep.chains : 1;
+  printf("%u files, %u blocks: %u extents (%.2f per file) -> %u (%.2f per "
+         "file)\n",
+         rep.chains, rep.blocks, rep.extents_before,
+         rep.extents_before / chains, rep.extents_after,
+         rep.extents_after / chains);
+  if (!dry_run)
+    printf("%u moved, %u left fragmented (no free run large enough)\n",
+           rep.moved, rep.skipped);
+  return PennFatErr_SUCCESS;
+}
+
+static void fsck_line(const char* problem, void* arg) {
+  (void)arg;
+  printf("  %s\n", problem);
+}
+
+/**
+ * fsck command usage:
+ *   fsck FS_NAME [-r] [-j THREADS]
+ *       Checks an unmounted image and prints each problem found, then a
+ *       summary. -r repairs what it can; -j sets the worker threads (default
+ *       one per CPU).
+ */
+static PennFatErr fsck(const char** args) {
+  if (args[1] == NULL) {
+    fprintf(stderr, "fsck: missing image name\n");
+    return PennFatErr_INVAD;
+  }
+  bool repair = false;
+  int threads = 0;
+  for (int i = 2; args[i]; i++) {
+    if (strcmp(args[i], "-r") == 0) {
+      repair = true;
+    } else if (strcmp(args[i], "-j") == 0 && args[i + 1]) {
+      threads = atoi(args[++i]);
+      if (threads < 1) {
+        fprintf(stderr, "fsck: invalid thread count '%s'\n", args[i]);
+        return PennFatErr_INVAD;
+      }
+    } else {
+      fprintf(stderr, "fsck: unknown option '%s'\n", args[i]);
+      return PennFatErr_INVAD;
+    }
+  }
+
+  pennfat_fsck_report_t rep;
+  PennFatErr err =
+      k_fsck(args[1], repair, (uint32_t)threads, fsck_line, NULL, &rep);
+  if (err)
+    return err;
+
+  uint32_t problems = rep.bad_chains + rep.cross_links + rep.size_errors +
+                      rep.bad_entries + rep.leaked + rep.dangling;
+  printf("%u dirs, %u files, %u symlinks, %u blocks in use, %u free (%u "
+         "threads)\n",
+         rep.dirs, rep.files, rep.symlinks, rep.blocks_used, rep.free_blocks,
+         rep.threads);
+  printf("bad chains %u, cross-links %u, bad sizes %u, bad entries %u, "
+         "leaked blocks %u, dangling symlinks %u\n",
+         rep.bad_chains, rep.cross_links, rep.size_errors, rep.bad_entries,
+         rep.leaked, rep.dangling);
+  if (problems == 0)
+    printf("%s: clean\n", args[1]);
+  else if (repair)
+    printf("%s: %u of %u problems repaired\n", args[1], rep.repaired,
+           problems);
+  else
+    printf("%s: %u problems (run with -r to repair)\n", args[1], problems);
+  return PennFatErr_SUCCESS;
+}
+
+#define LS_BATCH 64  // entries fetched per k_readdir() call
+
+/* Prints one entry as `ls` (short) or `ls -l` (long) */
+static void ls_line(const char* dir, const dir_entry_t* e, bool long_format) {
+  char time_str[20] = "";
+  struct tm* tm_info = localtime(&e->mtime);
+  if (tm_info)
+    strftime(time_str, sizeof(time_str), "%b %d %H:%M", tm_info);
+  uint32_t block = (uint32_t)e->first_block_hi << 16 | e->first_block;
+  char r = e->perm & PERM_READ ? 'r' : '-';
+  char w = e->perm & PERM_WRITE ? 'w' : '-';
+  char x = e->perm & PERM_EXEC ? 'x' : '-';
+
+  if (long_format) {
+    printf("%c%c%c%c------ 1 %u %u %8u %s %s", e->type == 2 ? 'd' : '-', r, w,
+           x, block, e->size, e->size, time_str, e->name);
+  } else {
+    char type = e->type == 2 ? 'd' : e->type == 4 ? 'l' : '-';
+    printf("%10u %c%c%c%c %-10u %s %s", block, type, r, w, x, e->size,
+           time_str, e->name);
+  }
+
+  if (e->type == 4) {  // Symlink
+    char path[MAX_CMD_LENGTH], target[MAX_CMD_LENGTH];
+    snprintf(path, sizeof(path), "%s/%s", dir, e->name);
+    if (k_readlink(path, target, sizeof(target)) >= 0)
+      printf(" -> %s", target);
+    else if (!long_format)
+      printf(" -> [Error reading target]");
+  }
+  printf("\n");
+}
+
+/*
+ * ls_total_blocks: Data blocks the entries of `dir` take up, counted from
+ * their sizes, for the "total" line of `ls -l`. Reads the directory once.
+ */
+static PennFatErr ls_total_blocks(const char* dir, uint32_t* total) {
+  pennfat_stats_t st;
+  PennFatErr err = k_stats(&st);
+  if (err != PennFatErr_OK)
+    return err;
+  int dh = k_opendir(dir);
+  if (dh < 0)
+    return dh;
+
+  dir_entry_t batch[LS_BATCH];
+  PennFatErr n;
+  *total = 0;
+  while ((n = k_readdir(dh, batch, LS_BATCH)) > 0) {
+    for (int i = 0; i < n; i++)
+      *total += (batch[i].size + st.block_size - 1) / st.block_size;
+  }
+  k_closedir(dh);
+  return n < 0 ? n : PennFatErr_OK;
+}
+
+/*
+ * ls: Lists the directory `target` (NULL = the current one) a batch of
+ * entries at a time, so the listing never has to fit in memory.
+ */
+static PennFatErr ls(const char* target, bool long_format) {
+  const char* dir = target ? target : ".";
+  uint32_t total = 0;
+  if (long_format) {
+    PennFatErr err = ls_total_blocks(dir, &total);
+    if (err != PennFatErr_OK)
+      return err;
+  }
+  int dh = k_opendir(dir);
+  if (dh < 0)
+    return dh;
+
+  if (long_format) {
+    printf("total %u\n", total);
+  } else {
+    printf("Listing directory %s:\n", dir);
+    printf("      Block Perm Size       Timestamp             Name\n");
+    printf("------------------------------------------------------------\n");
+  }
+
+  dir_entry_t batch[LS_BATCH];
+  PennFatErr n;
+  int listed = 0;
+  while ((n = k_readdir(dh, batch, LS_BATCH)) > 0) {
+    for (int i = 0; i < n; i++)
+      ls_line(dir, &batch[i], long_format);
+    listed += n;
+  }
+  k_closedir(dh);
+  if (n < 0)
+    return n;
+
+  if (!long_format) {
+    if (listed == 0)
+      printf("(Directory is empty)\n");
+    printf("------------------------------------------------------------\n");
+  }
+  return PennFatErr_OK;
+}
+
 static PennFatErr mkfs(const char* fs_name,
                        int blocks_in_fat,
-                       int block_size_config) {
-  return k_mkfs(fs_name, blocks_in_fat, block_size_config);
+                       int block_size_config,
+                       pennfat_format_t format) {
+  return k_mkfs_opts(fs_name, blocks_in_fat, block_size_config, format);
 }
 
 static void touch(const char** args) {
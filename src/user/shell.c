@@ -17,6 +17,7 @@
 #include <errno.h>
 #include <stdlib.h>  // NULL, atoi
 #include <string.h>
+#include <time.h>    // localtime (ls)
 #include <unistd.h>  // STDIN_FILENO / read
 
 // Process status macros
@@ -54,7 +55,6 @@ int s_write(int fd, const char *str, int n);
 int s_close(int fd);
 int s_unlink(const char *fname);
 int s_lseek(int fd, int offset, int whence);
-int s_ls(const char *filename);
 #endif
 
 // Process system calls
@@ -189,12 +189,64 @@ void* touch(void* arg) {
   return NULL;
 }
 
-/* ---------- ls (no arguments, PennFAT root only) ---------- */
+/* ---------- ls [DIR] ---------- */
+#define LS_BATCH 32     /* entries fetched per s_readdir() call */
+#define LS_PATH_MAX 256 /* longest path the kernel resolves */
+
+static void ls_print(const char* dir, const dir_entry_t* e) {
+  char perm[4] = {e->perm & PERM_READ ? 'r' : '-',
+                  e->perm & PERM_WRITE ? 'w' : '-',
+                  e->perm & PERM_EXEC ? 'x' : '-', '\0'};
+  char when[20] = "";
+  struct tm* tm_info = localtime(&e->mtime);
+  if (tm_info)
+    strftime(when, sizeof(when), "%b %d %H:%M", tm_info);
+  char type = e->type == 2 ? 'd' : e->type == 4 ? 'l' : '-';
+  uint32_t block = (uint32_t)e->first_block_hi << 16 | e->first_block;
+
+  printf("%10u %c%s %-10u %s %s", block, type, perm, e->size, when, e->name);
+  if (e->type == 4) {
+    char path[LS_PATH_MAX], target[LS_PATH_MAX];
+    if (dir)
+      snprintf(path, sizeof(path), "%s/%s", dir, e->name);
+    else
+      snprintf(path, sizeof(path), "%s", e->name);
+    if (s_readlink(path, target, sizeof(target)) >= 0)
+      printf(" -> %s", target);
+  }
+  printf("\n");
+}
+
 void* ls(void* arg) {
-  (void)arg; /* unused */
-  PennFatErr err = s_ls(NULL);
-  if (err)
-    fprintf(stderr, "ls: %s\n", PennFatErr_toErrString(err));
+  char** argv = (char**)arg;
+  const char* dir = (argv && argv[0] && argv[1]) ? argv[1] : NULL;
+  int dh = s_opendir(dir);
+  if (dh < 0) {
+    fprintf(stderr, "ls: %s\n", PennFatErr_toErrString(dh));
+    return NULL;
+  }
+
+  printf("Listing directory %s:\n", dir ? dir : ".");
+  printf("      Block Perm Size       Timestamp             Name\n");
+  printf("------------------------------------------------------------\n");
+
+  /* One batch at a time, however large the directory */
+  dir_entry_t batch[LS_BATCH];
+  PennFatErr n;
+  int listed = 0;
+  while ((n = s_readdir(dh, batch, LS_BATCH)) > 0) {
+    for (int i = 0; i < n; i++)
+      ls_print(dir, &batch[i]);
+    listed += n;
+  }
+  s_closedir(dh);
+  if (n < 0) {
+    fprintf(stderr, "ls: %s\n", PennFatErr_toErrString(n));
+    return NULL;
+  }
+  if (listed == 0)
+    printf("(Directory is empty)\n");
+  printf("------------------------------------------------------------\n");
   return NULL;
 }
 
@@ -189,12 +189,32 @@ PennFatErr s_write(int fd, const char* b, int n) {
   return k_write(fd, b, n);
 }
 
+PennFatErr s_ftruncate(int fd, int length) {
+  return k_ftruncate(fd, length);
+}
+
+PennFatErr s_fallocate(int fd, int length) {
+  return k_fallocate(fd, length);
+}
+
 PennFatErr s_touch(const char* p) {
   return k_touch(p);
 }
 
-PennFatErr s_ls(const char* p) {
-  return k_ls(p);
+PennFatErr s_opendir(const char* p) {
+  return k_opendir(p);
+}
+
+PennFatErr s_readdir(int dh, dir_entry_t* buf, int max) {
+  return k_readdir(dh, buf, max);
+}
+
+PennFatErr s_closedir(int dh) {
+  return k_closedir(dh);
+}
+
+PennFatErr s_readlink(const char* p, char* buf, size_t size) {
+  return k_readlink(p, buf, size);
 }
 
 PennFatErr s_chmod(const char* p, uint8_t perm) {
@@ -11,9 +11,14 @@ int s_open(const char* path, int mode);
 PennFatErr s_close(int fd);
 PennFatErr s_read(int fd, int n, char* buf);
 PennFatErr s_write(int fd, const char* buf, int n);
+PennFatErr s_ftruncate(int fd, int length);
+PennFatErr s_fallocate(int fd, int length); /* size unchanged */
 
 PennFatErr s_touch(const char* path);
-PennFatErr s_ls(const char* path /* or NULL = CWD */);
+PennFatErr s_opendir(const char* path /* or NULL = CWD */); /* handle */
+PennFatErr s_readdir(int dh, dir_entry_t* buf, int max);    /* count */
+PennFatErr s_closedir(int dh);
+PennFatErr s_readlink(const char* path, char* buf, size_t size);
 PennFatErr s_chmod(const char* path, uint8_t perm);
 int s_rename(const char* oldp, const char* newp); /* 0 / -1 */
 int s_unlink(const char* path);                   /* 0 / -1 */
@@ -0,0 +1,590 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common/pennfat_definitions.h"
+#include "common/pennfat_errors.h"
+#include "internal/pennfat_fatscan.h"
+#include "internal/pennfat_kernel.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// PennFAT block I/O benchmark
+//
+// 1. Durability policies: for every sync policy, mkfs a fresh image, copy
+//    KIB KiB into one file in 4 KiB writes, then open/write/close a batch of
+//    small files. Reports wall time and the device counters from k_stats() so
+//    the cost of each policy (mostly the number of fdatasync calls) is visible.
+// 2. Write I/O: write KIB KiB into a fresh file with several k_write sizes,
+//    aligned and not, and report the device reads and writes they cost.
+// 3. Fragmented free space: age a fresh image so single-block holes lie
+//    ahead of the allocator, write KIB KiB as two files from interleaved
+//    writers, then read both back from a cold mount and report the device
+//    requests the reads take (fewer requests = longer contiguous runs).
+// 4. Offline check: run k_fsck over the aged image from 3 with 1, 2, 4 and 8
+//    worker threads and report the time each takes.
+// 5. FAT scans: mount an empty wide image with BENCH_WIDE_FAT_BLOCKS 4 KiB
+//    FAT blocks (1 Mi entries) with each FAT scan implementation the host
+//    supports, and report the mount time, which is mostly the free-space scan.
+// 6. Directories: create BENCH_DIR_FILES empty files in one directory, then
+//    remount and open each of them by name, twice. Reports the time and the
+//    device reads of the creates and of each lookup pass.
+// 7. Deep paths: open a file BENCH_DEPTH directories down BENCH_PATH_LOOKUPS
+//    times, and as often a name next to it that does not exist, and report
+//    the time per lookup and the device reads.
+// 8. Directory churn: BENCH_CHURN_ROUNDS times, create BENCH_DIR_FILES
+//    files in one directory and delete all but every BENCH_CHURN_KEEP-th,
+//    then remount and list the directory with k_readdir. Reports the time
+//    and device reads of each listing, which follow the directory's length.
+// 9. Allocation over holes: on a fresh wide image, leave N single-block
+//    holes (touch 2N files, fill the rest of the disk, delete every other
+//    file), then write one file of N blocks that can only go into them.
+//    Reports the time per block for growing N; it should stay flat, not grow
+//    with the number of holes.
+//
+// usage: pennfat-bench [IMAGE_PATH [KIB [BACKEND]]]
+///////////////////////////////////////////////////////////////////////////////
+
+#define BENCH_CHUNK 4096
+#define BENCH_SMALL_FILES 32
+#define BENCH_SMALL_SIZE 100
+#define BENCH_PERIOD_MS 50
+#define BENCH_HOLES 128
+#define BENCH_WRITER_CHUNK (16 * 1024)
+#define BENCH_READ_CHUNK (64 * 1024)
+#define BENCH_WIDE_FAT_BLOCKS 1024
+#define BENCH_DIR_FILES 2000
+#define BENCH_DEPTH 12
+#define BENCH_PATH_LOOKUPS 5000
+#define BENCH_CHURN_ROUNDS 5
+#define BENCH_CHURN_KEEP 20
+#define BENCH_HOLE_FAT_BLOCKS 256  // of 512 B: 32 Ki blocks
+
+static const char* const policy_names[] = {"always", "on-close", "periodic",
+                                           "none"};
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int write_file(const char* name,
+                      const char* buf,
+                      size_t total,
+                      size_t chunk) {
+  int fd = k_open(name, K_O_CREATE | K_O_WRONLY);
+  if (fd < 0)
+    return fd;
+  size_t done = 0;
+  while (done < total) {
+    size_t n = total - done < chunk ? total - done : chunk;
+    PennFatErr w = k_write(fd, buf, (int)n);
+    if (w < 0 || (size_t)w != n) {
+      k_close(fd);
+      return -1;
+    }
+    done += n;
+  }
+  return k_close(fd);
+}
+
+static int run_policy(const char* image,
+                      pennfat_backend_t backend,
+                      pennfat_sync_policy_t policy,
+                      size_t total) {
+  static char buf[BENCH_CHUNK];
+  memset(buf, 'x', sizeof(buf));
+
+  if (k_mkfs(image, 32, 1) != PennFatErr_OK) {
+    fprintf(stderr, "mkfs %s failed\n", image);
+    return -1;
+  }
+  pennfat_mount_opts_t opts = {.sync_policy = policy,
+                               .sync_period_ms = BENCH_PERIOD_MS,
+                               .backend = backend};
+  if (k_mount_opts(image, &opts) != PennFatErr_OK) {
+    fprintf(stderr, "mount %s failed\n", image);
+    return -1;
+  }
+
+  double t0 = now_ms();
+  int rc = write_file("big", buf, total, BENCH_CHUNK);
+  for (int i = 0; rc >= 0 && i < BENCH_SMALL_FILES; i++) {
+    char name[16];
+    snprintf(name, sizeof(name), "s%d", i);
+    rc = write_file(name, buf, BENCH_SMALL_SIZE, BENCH_CHUNK);
+  }
+  double t1 = now_ms();
+
+  pennfat_stats_t st;
+  k_stats(&st);
+  k_unmount();
+  if (rc < 0) {
+    fprintf(stderr, "%s: write failed\n", policy_names[policy]);
+    return -1;
+  }
+
+  printf("%-10s %10.2f %10llu %10llu\n", policy_names[policy], t1 - t0,
+         (unsigned long long)st.dev_writes, (unsigned long long)st.dev_syncs);
+  return 0;
+}
+
+static int run_write_size(const char* image,
+                          pennfat_backend_t backend,
+                          size_t chunk,
+                          size_t total) {
+  static char buf[BENCH_CHUNK];
+  memset(buf, 'y', sizeof(buf));
+
+  if (k_mkfs(image, 32, 1) != PennFatErr_OK) {
+    fprintf(stderr, "mkfs %s failed\n", image);
+    return -1;
+  }
+  pennfat_mount_opts_t opts = {.sync_policy = PENNFAT_SYNC_ON_CLOSE,
+                               .backend = backend};
+  if (k_mount_opts(image, &opts) != PennFatErr_OK) {
+    fprintf(stderr, "mount %s failed\n", image);
+    return -1;
+  }
+
+  int rc = write_file("w", buf, total, chunk);
+  pennfat_stats_t st;
+  k_stats(&st);
+  k_unmount();
+  if (rc < 0) {
+    fprintf(stderr, "write of %zu B chunks failed\n", chunk);
+    return -1;
+  }
+
+  printf("%-10zu %10llu %10llu %10llu\n", chunk,
+         (unsigned long long)st.dev_reads, (unsigned long long)st.dev_writes,
+         (unsigned long long)st.dev_requests);
+  return 0;
+}
+
+static int read_file(const char* name, char* buf, size_t chunk) {
+  int fd = k_open(name, K_O_RDONLY);
+  if (fd < 0)
+    return fd;
+  PennFatErr r;
+  while ((r = k_read(fd, (int)chunk, buf)) > 0)
+    ;
+  k_close(fd);
+  return r < 0 ? -1 : 0;
+}
+
+static int run_fragmented(const char* image,
+                          pennfat_backend_t backend,
+                          size_t total) {
+  static char buf[BENCH_READ_CHUNK];
+  memset(buf, 'z', sizeof(buf));
+
+  if (k_mkfs(image, 32, 1) != PennFatErr_OK) {
+    fprintf(stderr, "mkfs %s failed\n", image);
+    return -1;
+  }
+  pennfat_mount_opts_t opts = {.sync_policy = PENNFAT_SYNC_ON_CLOSE,
+                               .backend = backend};
+  if (k_mount_opts(image, &opts) != PennFatErr_OK) {
+    fprintf(stderr, "mount %s failed\n", image);
+    return -1;
+  }
+
+  // Age the image: 2 * BENCH_HOLES one-block files, then a file filling
+  // nearly all the rest so the allocator's cursor ends up past them. Removing
+  // the filler and every other small file leaves the holes next in line.
+  int rc = 0;
+  for (int i = 0; rc >= 0 && i < 2 * BENCH_HOLES; i++) {
+    char name[16];
+    snprintf(name, sizeof(name), "h%d", i);
+    rc = write_file(name, buf, 1, BENCH_CHUNK);
+  }
+  pennfat_stats_t st;
+  k_stats(&st);
+  if (rc >= 0 && st.free_blocks > BENCH_HOLES)
+    rc = write_file("filler", buf,
+                    (size_t)(st.free_blocks - BENCH_HOLES) * st.block_size,
+                    sizeof(buf));
+  if (rc >= 0)
+    rc = k_unlink("filler");
+  for (int i = 0; rc >= 0 && i < 2 * BENCH_HOLES; i += 2) {
+    char name[16];
+    snprintf(name, sizeof(name), "h%d", i);
+    rc = k_unlink(name);
+  }
+
+  // Two writers taking turns, BENCH_WRITER_CHUNK at a time
+  int fa = rc >= 0 ? k_open("a", K_O_CREATE | K_O_WRONLY) : -1;
+  int fb = rc >= 0 ? k_open("b", K_O_CREATE | K_O_WRONLY) : -1;
+  for (size_t done = 0; fa >= 0 && fb >= 0 && done < total / 2;
+       done += BENCH_WRITER_CHUNK) {
+    if (k_write(fa, buf, BENCH_WRITER_CHUNK) != BENCH_WRITER_CHUNK ||
+        k_write(fb, buf, BENCH_WRITER_CHUNK) != BENCH_WRITER_CHUNK) {
+      rc = -1;
+      break;
+    }
+  }
+  if (fa < 0 || fb < 0)
+    rc = -1;
+  if (fa >= 0)
+    k_close(fa);
+  if (fb >= 0)
+    k_close(fb);
+  k_unmount();
+  if (rc < 0) {
+    fprintf(stderr, "fragmented: setup failed\n");
+    return -1;
+  }
+
+  if (k_mount_opts(image, &opts) != PennFatErr_OK) {
+    fprintf(stderr, "mount %s failed\n", image);
+    return -1;
+  }
+  rc = read_file("a", buf, sizeof(buf));
+  if (rc >= 0)
+    rc = read_file("b", buf, sizeof(buf));
+  k_stats(&st);
+  k_unmount();
+  if (rc < 0) {
+    fprintf(stderr, "fragmented: read failed\n");
+    return -1;
+  }
+
+  printf("%-10s %10llu %10llu\n", "a + b", (unsigned long long)st.dev_reads,
+         (unsigned long long)st.dev_requests);
+  return 0;
+}
+
+static int run_fsck(const char* image) {
+  for (uint32_t threads = 1; threads <= 8; threads *= 2) {
+    pennfat_fsck_report_t rep;
+    double t0 = now_ms();
+    PennFatErr err = k_fsck(image, false, threads, NULL, NULL, &rep);
+    double t1 = now_ms();
+    if (err != PennFatErr_OK) {
+      fprintf(stderr, "fsck %s failed\n", image);
+      return -1;
+    }
+    uint32_t problems = rep.bad_chains + rep.cross_links + rep.size_errors +
+                        rep.bad_entries + rep.leaked + rep.dangling;
+    printf("%-10u %10.2f %10u %10u\n", threads, t1 - t0, rep.blocks_used,
+           problems);
+  }
+  return 0;
+}
+
+static int run_fat_scan(const char* image, pennfat_backend_t backend) {
+  if (k_mkfs_opts(image, BENCH_WIDE_FAT_BLOCKS, 4, PENNFAT_FORMAT_WIDE) !=
+      PennFatErr_OK) {
+    fprintf(stderr, "mkfs %s failed\n", image);
+    return -1;
+  }
+  pennfat_mount_opts_t opts = {.sync_policy = PENNFAT_SYNC_NONE,
+                               .backend = backend};
+  static const char* const impls[] = {"c", "sse2", "avx2"};
+  for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+    if (fatscan_select(impls[i]) != 0)
+      continue;
+    double t0 = now_ms();
+    if (k_mount_opts(image, &opts) != PennFatErr_OK) {
+      fprintf(stderr, "mount %s failed\n", image);
+      return -1;
+    }
+    double t1 = now_ms();
+    pennfat_stats_t st;
+    k_stats(&st);
+    k_unmount();
+    printf("%-10s %10.2f %10u\n", impls[i], t1 - t0, st.free_blocks);
+  }
+  return 0;
+}
+
+static void print_dir_pass(const char* pass,
+                           double ms,
+                           const pennfat_stats_t* before) {
+  pennfat_stats_t st;
+  k_stats(&st);
+  printf("%-10s %10.2f %10lu\n", pass, ms,
+         (unsigned long)(st.dev_reads - before->dev_reads));
+}
+
+static int run_directory(const char* image, pennfat_backend_t backend) {
+  if (k_mkfs(image, 16, 1) != PennFatErr_OK) {
+    fprintf(stderr, "mkfs %s failed\n", image);
+    return -1;
+  }
+  pennfat_mount_opts_t opts = {.sync_policy = PENNFAT_SYNC_NONE,
+                               .backend = backend};
+  if (k_mount_opts(image, &opts) != PennFatErr_OK || k_mkdir("/d") != 0) {
+    fprintf(stderr, "mount %s failed\n", image);
+    return -1;
+  }
+
+  char path[64];
+  pennfat_stats_t before;
+  k_stats(&before);
+  double t0 = now_ms();
+  for (int i = 0; i < BENCH_DIR_FILES; i++) {
+    snprintf(path, sizeof(path), "/d/file%d", i);
+    if (k_touch(path) != PennFatErr_OK) {
+      fprintf(stderr, "touch %s failed\n", path);
+      return -1;
+    }
+  }
+  print_dir_pass("create", now_ms() - t0, &before);
+  k_unmount();
+
+  if (k_mount_opts(image, &opts) != PennFatErr_OK) {
+    fprintf(stderr, "mount %s failed\n", image);
+    return -1;
+  }
+  static const char* const passes[] = {"open cold", "open warm"};
+  for (int p = 0; p < 2; p++) {
+    k_stats(&before);
+    t0 = now_ms();
+    for (int i = 0; i < BENCH_DIR_FILES; i++) {
+      snprintf(path, sizeof(path), "/d/file%d", i);
+      int fd = k_open(path, K_O_RDONLY);
+      if (fd < 0) {
+        fprintf(stderr, "open %s failed\n", path);
+        return -1;
+      }
+      k_close(fd);
+    }
+    print_dir_pass(passes[p], now_ms() - t0, &before);
+  }
+  k_unmount();
+  return 0;
+}
+
+static int run_deep_paths(const char* image, pennfat_backend_t backend) {
+  if (k_mkfs(image, 16, 1) != PennFatErr_OK) {
+    fprintf(stderr, "mkfs %s failed\n", image);
+    return -1;
+  }
+  pennfat_mount_opts_t opts = {.sync_policy = PENNFAT_SYNC_NONE,
+                               .backend = backend};
+  if (k_mount_opts(image, &opts) != PennFatErr_OK) {
+    fprintf(stderr, "mount %s failed\n", image);
+    return -1;
+  }
+
+  char dir[256] = "";
+  for (int i = 0; i < BENCH_DEPTH; i++) {
+    size_t len = strlen(dir);
+    snprintf(dir + len, sizeof(dir) - len, "/level%d", i);
+    if (k_mkdir(dir) != PennFatErr_OK) {
+      fprintf(stderr, "mkdir %s failed\n", dir);
+      return -1;
+    }
+  }
+  char file[300], missing[300];
+  snprintf(file, sizeof(file), "%s/file", dir);
+  snprintf(missing, sizeof(missing), "%s/missing", dir);
+  if (k_touch(file) != PennFatErr_OK) {
+    fprintf(stderr, "touch %s failed\n", file);
+    return -1;
+  }
+
+  static const char* const passes[] = {"existing", "missing"};
+  for (int p = 0; p < 2; p++) {
+    pennfat_stats_t before, after;
+    k_stats(&before);
+    double t0 = now_ms();
+    for (int i = 0; i < BENCH_PATH_LOOKUPS; i++) {
+      int fd = k_open(p == 0 ? file : missing, K_O_RDONLY);
+      if ((fd >= 0) != (p == 0)) {
+        fprintf(stderr, "open %s: unexpected result\n", passes[p]);
+        return -1;
+      }
+      if (fd >= 0)
+        k_close(fd);
+    }
+    double t1 = now_ms();
+    k_stats(&after);
+    printf("%-10s %10.2f %10lu\n", passes[p],
+           (t1 - t0) * 1000 / BENCH_PATH_LOOKUPS,
+           (unsigned long)(after.dev_reads - before.dev_reads));
+  }
+  k_unmount();
+  return 0;
+}
+
+static int run_churn(const char* image, pennfat_backend_t backend) {
+  if (k_mkfs(image, 16, 1) != PennFatErr_OK) {
+    fprintf(stderr, "mkfs %s failed\n", image);
+    return -1;
+  }
+  pennfat_mount_opts_t opts = {.sync_policy = PENNFAT_SYNC_NONE,
+                               .backend = backend};
+  if (k_mount_opts(image, &opts) != PennFatErr_OK || k_mkdir("/c") != 0) {
+    fprintf(stderr, "mount %s failed\n", image);
+    return -1;
+  }
+
+  char path[64];
+  for (int r = 0; r < BENCH_CHURN_ROUNDS; r++) {
+    for (int i = 0; i < BENCH_DIR_FILES; i++) {
+      snprintf(path, sizeof(path), "/c/r%d_%d", r, i);
+      if (k_touch(path) != PennFatErr_OK) {
+        fprintf(stderr, "touch %s failed\n", path);
+        return -1;
+      }
+    }
+    for (int i = 0; i < BENCH_DIR_FILES; i++) {
+      snprintf(path, sizeof(path), "/c/r%d_%d", r, i);
+      if (i % BENCH_CHURN_KEEP != 0 && k_unlink(path) != PennFatErr_OK) {
+        fprintf(stderr, "unlink %s failed\n", path);
+        return -1;
+      }
+    }
+    k_unmount();
+    if (k_mount_opts(image, &opts) != PennFatErr_OK) {
+      fprintf(stderr, "mount %s failed\n", image);
+      return -1;
+    }
+
+    dir_entry_t batch[64];
+    pennfat_stats_t before, after;
+    k_stats(&before);
+    double t0 = now_ms();
+    int dh = k_opendir("/c"), n, entries = 0;
+    while ((n = k_readdir(dh, batch, 64)) > 0)
+      entries += n;
+    k_closedir(dh);
+    double t1 = now_ms();
+    k_stats(&after);
+    if (n < 0) {
+      fprintf(stderr, "readdir /c failed\n");
+      return -1;
+    }
+    printf("%-10d %10d %10.2f %10lu\n", r + 1, entries, t1 - t0,
+           (unsigned long)(after.dev_reads - before.dev_reads));
+  }
+  k_unmount();
+  return 0;
+}
+
+static int run_holes(const char* image,
+                     pennfat_backend_t backend,
+                     uint32_t holes) {
+  static char buf[BENCH_READ_CHUNK];
+  memset(buf, 'h', sizeof(buf));
+  if (k_mkfs_opts(image, BENCH_HOLE_FAT_BLOCKS, 1, PENNFAT_FORMAT_WIDE) !=
+      PennFatErr_OK) {
+    fprintf(stderr, "mkfs %s failed\n", image);
+    return -1;
+  }
+  pennfat_mount_opts_t opts = {.sync_policy = PENNFAT_SYNC_NONE,
+                               .backend = backend};
+  if (k_mount_opts(image, &opts) != PennFatErr_OK || k_mkdir("/h") != 0) {
+    fprintf(stderr, "mount %s failed\n", image);
+    return -1;
+  }
+
+  char path[64];
+  for (uint32_t i = 0; i < 2 * holes; i++) {
+    snprintf(path, sizeof(path), "/h/%u", i);
+    if (k_touch(path) != PennFatErr_OK) {
+      fprintf(stderr, "touch %s failed\n", path);
+      return -1;
+    }
+  }
+  pennfat_stats_t st;
+  k_stats(&st);
+  if (write_file("/fill", buf, (size_t)st.free_blocks * st.block_size,
+                 sizeof(buf)) != 0) {
+    fprintf(stderr, "write /fill failed\n");
+    return -1;
+  }
+  for (uint32_t i = 0; i < 2 * holes; i += 2) {
+    snprintf(path, sizeof(path), "/h/%u", i);
+    if (k_unlink(path) != PennFatErr_OK) {
+      fprintf(stderr, "unlink %s failed\n", path);
+      return -1;
+    }
+  }
+
+  double t0 = now_ms();
+  if (write_file("/big", buf, (size_t)holes * st.block_size, sizeof(buf)) !=
+      0) {
+    fprintf(stderr, "write /big failed\n");
+    return -1;
+  }
+  double t1 = now_ms();
+  printf("%-10u %10.2f %10.3f\n", holes, t1 - t0, (t1 - t0) * 1000 / holes);
+  k_unmount();
+  return 0;
+}
+
+int main(int argc, char* argv[]) {
+  const char* image = argc > 1 ? argv[1] : "pennfat-bench.img";
+  size_t kib = argc > 2 ? strtoul(argv[2], NULL, 10) : 1024;
+  pennfat_backend_t backend = PENNFAT_BACKEND_PREAD;
+  if (argc > 3 && blockdev_parse(argv[3], &backend) != 0) {
+    fprintf(stderr, "unknown backend '%s'\n", argv[3]);
+    return EXIT_FAILURE;
+  }
+
+  pennfat_kernel_init();
+
+  printf("%zu KiB + %d x %d B files, 512 B blocks, %s backend\n", kib,
+         BENCH_SMALL_FILES, BENCH_SMALL_SIZE, blockdev_name(backend));
+  printf("%-10s %10s %10s %10s\n", "policy", "ms", "writes", "syncs");
+  for (int p = PENNFAT_SYNC_ALWAYS; p <= PENNFAT_SYNC_NONE; p++) {
+    if (run_policy(image, backend, (pennfat_sync_policy_t)p, kib * 1024) != 0)
+      return EXIT_FAILURE;
+  }
+
+  static const size_t write_sizes[] = {4096, 1000, 100};
+  printf("\n%zu KiB written per k_write size, on-close\n", kib);
+  printf("%-10s %10s %10s %10s\n", "write B", "reads", "writes", "requests");
+  for (size_t i = 0; i < sizeof(write_sizes) / sizeof(write_sizes[0]); i++) {
+    if (run_write_size(image, backend, write_sizes[i], kib * 1024) != 0)
+      return EXIT_FAILURE;
+  }
+
+  printf("\n%zu KiB from 2 interleaved writers, %d holes, cold read\n", kib,
+         BENCH_HOLES);
+  printf("%-10s %10s %10s\n", "files", "reads", "requests");
+  if (run_fragmented(image, backend, kib * 1024) != 0)
+    return EXIT_FAILURE;
+
+  printf("\nfsck of the aged image\n");
+  printf("%-10s %10s %10s %10s\n", "threads", "ms", "blocks", "problems");
+  if (run_fsck(image) != 0)
+    return EXIT_FAILURE;
+
+  printf("\nmount of an empty wide image, %d FAT blocks of 4 KiB\n",
+         BENCH_WIDE_FAT_BLOCKS);
+  printf("%-10s %10s %10s\n", "FAT scan", "ms", "free");
+  if (run_fat_scan(image, backend) != 0)
+    return EXIT_FAILURE;
+
+  printf("\n%d files in one directory, 512 B blocks\n", BENCH_DIR_FILES);
+  printf("%-10s %10s %10s\n", "pass", "ms", "reads");
+  if (run_directory(image, backend) != 0)
+    return EXIT_FAILURE;
+
+  printf("\n%d lookups %d directories deep\n", BENCH_PATH_LOOKUPS,
+         BENCH_DEPTH);
+  printf("%-10s %10s %10s\n", "path", "us each", "reads");
+  if (run_deep_paths(image, backend) != 0)
+    return EXIT_FAILURE;
+
+  printf("\n%d rounds of %d creates, all but 1 in %d deleted, cold listing\n",
+         BENCH_CHURN_ROUNDS, BENCH_DIR_FILES, BENCH_CHURN_KEEP);
+  printf("%-10s %10s %10s %10s\n", "round", "entries", "ms", "reads");
+  if (run_churn(image, backend) != 0)
+    return EXIT_FAILURE;
+
+  printf("\none file written into single-block holes, 512 B blocks\n");
+  printf("%-10s %10s %10s\n", "holes", "ms", "us/block");
+  for (uint32_t holes = 2000; holes <= 8000; holes *= 2) {
+    if (run_holes(image, backend, holes) != 0)
+      return EXIT_FAILURE;
+  }
+  remove(image);
+  return EXIT_SUCCESS;
+}
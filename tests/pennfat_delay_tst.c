@@ -0,0 +1,286 @@
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pennfat_tst.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// PennFAT delayed allocation tests
+//
+// Data a k_write puts past the end of a file's chain waits in a per-file
+// buffer until close, sync, a periodic flush or memory pressure gives it
+// blocks. These cases check that it reads back before and after that, that
+// truncation and sparse writes around the buffer keep the file's bytes, that
+// a full disk ends a write short (or with PennFatErr_NOSPACE) rather than
+// failing it, and that data lost while flushing is reported and cut from the
+// file's size. Every case remounts and runs k_fsck over the result.
+//
+// usage: pennfat_delay_tst [IMAGE_PATH]
+///////////////////////////////////////////////////////////////////////////////
+
+#define TST_MAX_FILE (2 * 1024 * 1024)
+
+static char g_data[TST_MAX_FILE];
+static char g_back[TST_MAX_FILE];
+
+static bool all_zero(const char* p, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    if (p[i] != 0)
+      return false;
+  }
+  return true;
+}
+
+/* Writes in small pieces, reads back through a second fd before close. */
+static void case_read_while_delayed(const char* image, const tst_config_t* c) {
+  uint32_t bs = tst_block_size();
+  size_t len = 7 * bs + 123;
+  tst_pattern(g_data, len, 1);
+
+  int fd = k_open("r", K_O_CREATE | K_O_WRONLY);
+  CHECK(fd >= 0);
+  for (size_t done = 0; done < len; done += 100) {
+    int chunk = len - done < 100 ? (int)(len - done) : 100;
+    CHECK(k_write(fd, g_data + done, chunk) == chunk);
+  }
+  CHECK(tst_read_file("r", g_back, len + 10) == (int)len);
+  CHECK(memcmp(g_data, g_back, len) == 0);
+  CHECK(k_close(fd) == PennFatErr_OK);
+
+  tst_remount(image, c);
+  CHECK(tst_read_file("r", g_back, len + 10) == (int)len);
+  CHECK(memcmp(g_data, g_back, len) == 0);
+  CHECK(k_unlink("r") == PennFatErr_OK);
+}
+
+/* Shrinks a file inside its delay buffer; the cut blocks are never used. */
+static void case_truncate_in_buffer(const char* image, const tst_config_t* c) {
+  uint32_t bs = tst_block_size();
+  size_t len = 20 * bs;
+  uint32_t keep = 2 * bs + 17;
+  tst_pattern(g_data, len, 2);
+
+  uint32_t before = tst_free_blocks();
+  int fd = k_open("t", K_O_CREATE | K_O_WRONLY);
+  CHECK(fd >= 0);
+  CHECK(k_write(fd, g_data, (int)len) == (int)len);
+  CHECK(k_ftruncate(fd, (int)keep) == PennFatErr_OK);
+  // Growing it again must read back zeroes, not the old buffered bytes
+  CHECK(k_ftruncate(fd, (int)keep + 50) == PennFatErr_OK);
+  CHECK(k_close(fd) == PennFatErr_OK);
+  CHECK(tst_free_blocks() == before - 3);
+
+  tst_remount(image, c);
+  CHECK(tst_read_file("t", g_back, len) == (int)keep + 50);
+  CHECK(memcmp(g_data, g_back, keep) == 0);
+  CHECK(all_zero(g_back + keep, 50));
+  CHECK(k_unlink("t") == PennFatErr_OK);
+}
+
+/* Writes past EOF leave gaps that read back as zeroes. */
+static void case_sparse(const char* image, const tst_config_t* c) {
+  uint32_t bs = tst_block_size();
+  tst_pattern(g_data, 4 * bs, 3);
+
+  int fd = k_open("s", K_O_CREATE | K_O_WRONLY);
+  CHECK(fd >= 0);
+  CHECK(k_write(fd, g_data, 10) == 10);
+  CHECK(k_lseek(fd, (int)(5 * bs + 7), F_SEEK_SET) >= 0);
+  CHECK(k_write(fd, g_data + 10, (int)bs) == (int)bs);
+  CHECK(k_lseek(fd, (int)(12 * bs), F_SEEK_SET) >= 0);
+  CHECK(k_write(fd, g_data + 10 + bs, 30) == 30);
+  CHECK(k_close(fd) == PennFatErr_OK);
+
+  tst_remount(image, c);
+  size_t len = 12 * bs + 30;
+  CHECK(tst_read_file("s", g_back, 2 * len) == (int)len);
+  CHECK(memcmp(g_back, g_data, 10) == 0);
+  CHECK(all_zero(g_back + 10, 5 * bs + 7 - 10));
+  CHECK(memcmp(g_back + 5 * bs + 7, g_data + 10, bs) == 0);
+  CHECK(all_zero(g_back + 6 * bs + 7, 12 * bs - (6 * bs + 7)));
+  CHECK(memcmp(g_back + 12 * bs, g_data + 10 + bs, 30) == 0);
+  CHECK(k_unlink("s") == PennFatErr_OK);
+}
+
+/*
+ * fill_disk: Writes `name` until the disk is full and returns its open fd and
+ * the bytes that went in. The last write must come back short or with
+ * PennFatErr_NOSPACE, never with an I/O error.
+ */
+static int fill_disk(const char* name, size_t* written) {
+  int fd = k_open(name, K_O_CREATE | K_O_WRONLY);
+  CHECK(fd >= 0);
+  *written = 0;
+  for (;;) {
+    size_t chunk = 64 * 1024;
+    tst_pattern(g_data, chunk, (uint32_t)(*written / chunk));
+    PennFatErr w = k_write(fd, g_data, (int)chunk);
+    if (w > 0)
+      *written += (size_t)w;
+    if (w != (PennFatErr)chunk) {
+      CHECK(w >= 0 || w == PennFatErr_NOSPACE);
+      break;
+    }
+  }
+  return fd;
+}
+
+/* Fills the disk through the delay buffer; everything written survives. */
+static void case_fill_disk(const char* image, const tst_config_t* c) {
+  uint32_t bs = tst_block_size();
+  uint32_t before = tst_free_blocks();
+  size_t written;
+  int fd = fill_disk("full", &written);
+  CHECK(k_close(fd) == PennFatErr_OK);
+  CHECK(tst_free_blocks() == 0);
+  CHECK(written > (size_t)(before - 1) * bs && written <= (size_t)before * bs);
+
+  tst_remount(image, c);
+  CHECK(tst_read_file("full", g_back, sizeof(g_back)) == (int)written);
+  CHECK(k_unlink("full") == PennFatErr_OK);
+}
+
+/*
+ * On a nearly full disk, a write past EOF that the free blocks cannot reach
+ * fails with PennFatErr_NOSPACE, and one they partly reach comes back short.
+ */
+static void case_full_sparse_write(const char* image, const tst_config_t* c) {
+  uint32_t bs = tst_block_size();
+  size_t written;
+  int fill = fill_disk("full", &written);
+  uint32_t cut = (uint32_t)(written / bs) * bs - 4 * bs;
+  CHECK(k_ftruncate(fill, (int)cut) == PennFatErr_OK);
+  CHECK(k_close(fill) == PennFatErr_OK);
+
+  // The new file can hold its first block and the ones still free
+  int fd = k_open("sp", K_O_CREATE | K_O_WRONLY);
+  CHECK(fd >= 0);
+  uint32_t cap = tst_free_blocks() + 1;
+  CHECK(cap >= 4);
+  tst_pattern(g_data, (cap + 8) * bs, 5);
+  CHECK(k_lseek(fd, (int)((cap + 8) * bs), F_SEEK_SET) >= 0);
+  CHECK(k_write(fd, g_data, 10) == PennFatErr_NOSPACE);
+
+  uint32_t at = 2 * bs + 10;
+  CHECK(k_lseek(fd, (int)at, F_SEEK_SET) >= 0);
+  PennFatErr w = k_write(fd, g_data, (int)((cap + 4) * bs));
+  CHECK(w == (PennFatErr)(cap * bs - at));
+  CHECK(tst_free_blocks() == 0);
+  CHECK(k_close(fd) == PennFatErr_OK);
+
+  tst_remount(image, c);
+  int len = tst_read_file("sp", g_back, sizeof(g_back));
+  CHECK(len == (int)(cap * bs));
+  CHECK(all_zero(g_back, at));
+  CHECK(len > 0 && memcmp(g_back + at, g_data, (size_t)len - at) == 0);
+  CHECK(k_unlink("sp") == PennFatErr_OK);
+  CHECK(k_unlink("full") == PennFatErr_OK);
+}
+
+/*
+ * limit_image_writes: Makes every pwrite at or past the last `blocks` blocks
+ * of the image fail (RLIMIT_FSIZE), or lifts the limit when blocks is 0.
+ */
+static void limit_image_writes(const char* image, uint32_t blocks) {
+  struct stat st;
+  CHECK(stat(image, &st) == 0);
+  struct rlimit rl;
+  getrlimit(RLIMIT_FSIZE, &rl);
+  rl.rlim_cur = blocks ? (rlim_t)(st.st_size - (off_t)blocks * tst_block_size())
+                       : rl.rlim_max;
+  CHECK(setrlimit(RLIMIT_FSIZE, &rl) == 0);
+}
+
+/*
+ * Delayed data that cannot be written at close is reported by k_close, and
+ * the size on disk covers only what reached the chain.
+ */
+static void case_close_flush_fails(const char* image, const tst_config_t* c) {
+  uint32_t bs = tst_block_size();
+  // Leave only the image's last blocks free, so the flush has to use them
+  size_t written;
+  int fill = fill_disk("full", &written);
+  uint32_t cut = (uint32_t)(written / bs) * bs - 16 * bs;
+  CHECK(k_ftruncate(fill, (int)cut) == PennFatErr_OK);
+  CHECK(k_close(fill) == PennFatErr_OK);
+
+  int fd = k_open("lost", K_O_CREATE | K_O_WRONLY);
+  CHECK(fd >= 0);
+  tst_pattern(g_data, 8 * bs, 6);
+  CHECK(k_write(fd, g_data, (int)(8 * bs)) == (int)(8 * bs));
+  limit_image_writes(image, 12);
+  CHECK(k_close(fd) == PennFatErr_IO);
+  limit_image_writes(image, 0);
+
+  tst_remount(image, c);
+  int len = tst_read_file("lost", g_back, sizeof(g_back));
+  CHECK(len >= 0 && len < (int)(8 * bs));
+  CHECK(len >= 0 && memcmp(g_back, g_data, (size_t)len) == 0);
+  CHECK(k_unlink("lost") == PennFatErr_OK);
+  CHECK(k_unlink("full") == PennFatErr_OK);
+}
+
+/*
+ * On a periodic mount the flush happens in whatever call comes after the
+ * period; a failure there is kept for the file's own k_close.
+ */
+static void case_periodic_flush_fails(const char* image,
+                                      const tst_config_t* c) {
+  uint32_t bs = tst_block_size();
+  size_t written;
+  int fill = fill_disk("full", &written);
+  uint32_t cut = (uint32_t)(written / bs) * bs - 16 * bs;
+  CHECK(k_ftruncate(fill, (int)cut) == PennFatErr_OK);
+  CHECK(k_close(fill) == PennFatErr_OK);
+
+  int fd = k_open("lost", K_O_CREATE | K_O_WRONLY);
+  CHECK(fd >= 0);
+  tst_pattern(g_data, 8 * bs, 7);
+  CHECK(k_write(fd, g_data, (int)(8 * bs)) == (int)(8 * bs));
+  limit_image_writes(image, 12);
+  usleep(100 * 1000);  // several flusher periods
+  int other = k_open("other", K_O_CREATE | K_O_WRONLY);
+  limit_image_writes(image, 0);
+  CHECK(other >= 0);
+  CHECK(k_close(other) == PennFatErr_OK);
+  CHECK(k_close(fd) == PennFatErr_IO);
+
+  tst_remount(image, c);
+  CHECK(tst_read_file("lost", g_back, sizeof(g_back)) < (int)(8 * bs));
+  CHECK(k_unlink("lost") == PennFatErr_OK);
+  CHECK(k_unlink("other") == PennFatErr_OK);
+  CHECK(k_unlink("full") == PennFatErr_OK);
+}
+
+int main(int argc, char* argv[]) {
+  const char* image = argc > 1 ? argv[1] : "pennfat_delay_tst.img";
+  signal(SIGXFSZ, SIG_IGN);  // over-limit pwrites fail with EFBIG instead
+  pennfat_kernel_init();
+
+  static const tst_config_t configs[] = {
+      {PENNFAT_FORMAT_NARROW, 16, 1, PENNFAT_BACKEND_PREAD,
+       PENNFAT_SYNC_ON_CLOSE},
+      {PENNFAT_FORMAT_NARROW, 16, 1, PENNFAT_BACKEND_MMAP,
+       PENNFAT_SYNC_NONE},
+      {PENNFAT_FORMAT_WIDE, 4, 2, PENNFAT_BACKEND_PREAD,
+       PENNFAT_SYNC_PERIODIC},
+  };
+  for (size_t i = 0; i < sizeof(configs) / sizeof(configs[0]); i++) {
+    const tst_config_t* c = &configs[i];
+    tst_run(image, c, "read while delayed", case_read_while_delayed);
+    tst_run(image, c, "truncate in buffer", case_truncate_in_buffer);
+    tst_run(image, c, "sparse", case_sparse);
+    tst_run(image, c, "fill disk", case_fill_disk);
+    tst_run(image, c, "full sparse write", case_full_sparse_write);
+  }
+
+  // RLIMIT_FSIZE only stops pwrite, so these need the pread backend
+  tst_config_t c = configs[0];
+  tst_run(image, &c, "close flush fails", case_close_flush_fails);
+  c.policy = PENNFAT_SYNC_PERIODIC;
+  tst_run(image, &c, "periodic flush fails", case_periodic_flush_fails);
+
+  unlink(image);
+  return tst_result("pennfat_delay_tst");
+}
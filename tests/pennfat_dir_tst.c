@@ -0,0 +1,752 @@
+#include <unistd.h>
+
+#include "pennfat_tst.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// PennFAT directory tests
+//
+// Lookups go through a per-directory name index and, above it, a cache of
+// path components and missing names; every change to a directory has to keep
+// both in step. These cases look names up after creating, unlinking, renaming
+// and removing them and after a remount, and a randomized run mixes those
+// operations with compaction and defragmentation over every format, block
+// size, backend and durability policy, comparing the tree against a model of
+// what it should hold and running k_fsck after each unmount.
+//
+// usage: pennfat_dir_tst [IMAGE_PATH]
+///////////////////////////////////////////////////////////////////////////////
+
+#define TST_MAX_FILE (16 * 1024)
+
+static char g_data[TST_MAX_FILE];
+static char g_back[TST_MAX_FILE];
+
+static bool is_file(const char* path) {
+  int fd = k_open(path, K_O_RDONLY);
+  if (fd < 0)
+    return false;
+  k_close(fd);
+  return true;
+}
+
+static bool is_dir(const char* path) {
+  int dh = k_opendir(path);
+  if (dh < 0)
+    return false;
+  k_closedir(dh);
+  return true;
+}
+
+/* file_holds: Reports whether path reads back as len bytes of pattern seed. */
+static bool file_holds(const char* path, size_t len, uint32_t seed) {
+  tst_pattern(g_data, len, seed);
+  return tst_read_file(path, g_back, sizeof(g_back)) == (int)len &&
+         memcmp(g_data, g_back, len) == 0;
+}
+
+static int make_file(const char* path, size_t len, uint32_t seed) {
+  tst_pattern(g_data, len, seed);
+  return tst_write_file(path, g_data, len);
+}
+
+static uint64_t index_lookups(void) {
+  pennfat_stats_t st;
+  k_stats(&st);
+  return st.dir_lookups;
+}
+
+/* Finds every name of a directory spanning many blocks through its index. */
+static void case_index_lookups(const char* image, const tst_config_t* c) {
+  uint32_t per_block = tst_block_size() / sizeof(dir_entry_t);
+  uint32_t count = 6 * per_block;
+  char path[64];
+
+  CHECK(k_mkdir("big") == PennFatErr_OK);
+  for (uint32_t i = 0; i < count; i++) {
+    snprintf(path, sizeof(path), "big/f%u", i);
+    CHECK(make_file(path, i % 50, i) == PennFatErr_OK);
+  }
+
+  // A remount empties the path cache, so the names come from the index
+  tst_remount(image, c);
+  uint64_t before = index_lookups();
+  for (uint32_t i = 0; i < count; i++) {
+    snprintf(path, sizeof(path), "big/f%u", i);
+    CHECK(file_holds(path, i % 50, i));
+  }
+  CHECK(index_lookups() > before);
+  CHECK(!is_file("big/f_missing"));
+
+  // Every other name goes; the rest must still be found, old and new
+  for (uint32_t i = 0; i < count; i += 2) {
+    snprintf(path, sizeof(path), "big/f%u", i);
+    CHECK(k_unlink(path) == PennFatErr_OK);
+  }
+  for (uint32_t i = 1; i < count; i += 4) {
+    char to[64];
+    snprintf(path, sizeof(path), "big/f%u", i);
+    snprintf(to, sizeof(to), "big/r%u", i);
+    CHECK(k_rename(path, to) == PennFatErr_OK);
+  }
+  for (int pass = 0; pass < 2; pass++) {
+    for (uint32_t i = 0; i < count; i++) {
+      snprintf(path, sizeof(path), "big/f%u", i);
+      bool renamed = i % 4 == 1;
+      CHECK(is_file(path) == (i % 2 == 1 && !renamed));
+      snprintf(path, sizeof(path), "big/r%u", i);
+      CHECK(is_file(path) == renamed);
+      if (renamed)
+        CHECK(file_holds(path, i % 50, i));
+    }
+    if (pass == 0)
+      tst_remount(image, c);
+  }
+
+  // Names freed by unlink are taken again and found under their new data
+  for (uint32_t i = 0; i < count; i += 2) {
+    snprintf(path, sizeof(path), "big/f%u", i);
+    CHECK(make_file(path, 7, i + 1000) == PennFatErr_OK);
+  }
+  for (uint32_t i = 0; i < count; i += 2) {
+    snprintf(path, sizeof(path), "big/f%u", i);
+    CHECK(file_holds(path, 7, i + 1000));
+  }
+}
+
+/* Looks up names in directories that were removed and made again. */
+static void case_index_rmdir(const char* image, const tst_config_t* c) {
+  uint32_t per_block = tst_block_size() / sizeof(dir_entry_t);
+  char path[64];
+
+  for (int round = 0; round < 3; round++) {
+    CHECK(k_mkdir("d") == PennFatErr_OK);
+    for (uint32_t i = 0; i < 3 * per_block; i++) {
+      snprintf(path, sizeof(path), "d/f%u", i);
+      CHECK(make_file(path, 1, (uint32_t)round) == PennFatErr_OK);
+    }
+    CHECK(k_rmdir("d") == PennFatErr_NOTEMPTY);
+
+    // A live entry in the last block alone keeps the directory
+    for (uint32_t i = 0; i + 1 < 3 * per_block; i++) {
+      snprintf(path, sizeof(path), "d/f%u", i);
+      CHECK(k_unlink(path) == PennFatErr_OK);
+    }
+    CHECK(k_rmdir("d") == PennFatErr_NOTEMPTY);
+    snprintf(path, sizeof(path), "d/f%u", 3 * per_block - 1);
+    CHECK(k_unlink(path) == PennFatErr_OK);
+
+    CHECK(k_rmdir("d") == PennFatErr_OK);
+    CHECK(!is_dir("d"));
+    CHECK(!is_file("d/f0"));
+  }
+  CHECK(k_mkdir("d") == PennFatErr_OK);
+  CHECK(!is_file("d/f0"));
+  tst_remount(image, c);
+  CHECK(is_dir("d"));
+  CHECK(!is_file("d/f0"));
+}
+
+/* Resolves deep paths from the cache while the tree changes under them. */
+static void case_dentry_cache(const char* image, const tst_config_t* c) {
+  pennfat_stats_t before;
+  k_stats(&before);
+
+  // Misses are remembered, and forgotten once the names appear
+  CHECK(!is_file("a/b/c/f"));
+  CHECK(!is_file("a/b/c/f"));
+  CHECK(k_mkdir("a") == PennFatErr_OK);
+  CHECK(k_mkdir("a/b") == PennFatErr_OK);
+  CHECK(k_mkdir("a/b/c") == PennFatErr_OK);
+  CHECK(!is_file("a/b/c/f"));
+  CHECK(make_file("a/b/c/f", 300, 1) == PennFatErr_OK);
+  for (int i = 0; i < 4; i++)
+    CHECK(file_holds("a/b/c/f", 300, 1));
+  CHECK(!is_file("a/link"));
+  CHECK(k_symlink("/a/b/c/f", "a/link") == PennFatErr_OK);
+  CHECK(file_holds("a/link", 300, 1));
+
+  pennfat_stats_t after;
+  k_stats(&after);
+  CHECK(after.dentry_hits > before.dentry_hits);
+  CHECK(after.dentry_negative > before.dentry_negative);
+
+  // Renaming a directory moves everything below it
+  CHECK(k_rename("a/b", "z") == PennFatErr_OK);
+  CHECK(!is_file("a/b/c/f"));
+  CHECK(!is_dir("a/b"));
+  CHECK(file_holds("z/c/f", 300, 1));
+  CHECK(!is_file("a/link"));  // dangles now
+  CHECK(k_rename("z", "a/b") == PennFatErr_OK);
+  CHECK(!is_file("z/c/f"));
+  CHECK(file_holds("a/link", 300, 1));
+
+  // Relative lookups from a working directory see the same changes
+  CHECK(k_chdir("a") == PennFatErr_OK);
+  CHECK(file_holds("b/c/f", 300, 1));
+  CHECK(k_rename("/a/b/c", "/a/y") == PennFatErr_OK);
+  CHECK(!is_file("b/c/f"));
+  CHECK(file_holds("y/f", 300, 1));
+  CHECK(file_holds("../a/y/f", 300, 1));
+  CHECK(k_rename("y", "b/c") == PennFatErr_OK);
+  CHECK(k_chdir("/") == PennFatErr_OK);
+
+  // A directory made again under the old name starts out empty
+  CHECK(k_unlink("a/b/c/f") == PennFatErr_OK);
+  CHECK(k_rmdir("a/b/c") == PennFatErr_OK);
+  CHECK(!is_dir("a/b/c"));
+  CHECK(k_mkdir("a/b/c") == PennFatErr_OK);
+  CHECK(is_dir("a/b/c"));
+  CHECK(!is_file("a/b/c/f"));
+  CHECK(make_file("a/b/c/f", 20, 2) == PennFatErr_OK);
+  CHECK(file_holds("a/link", 20, 2));
+
+  k_stats(&after);
+  CHECK(after.dentry_dropped > before.dentry_dropped);
+  tst_remount(image, c);
+  CHECK(file_holds("a/b/c/f", 20, 2));
+  CHECK(file_holds("a/link", 20, 2));
+  CHECK(!is_dir("z") && !is_dir("a/y"));
+}
+
+/*
+ * list_dir: Reads the rest of stream dh in batches of max entries, counting
+ * each "f<i>" name in seen[i] (i < count). Returns the entries read.
+ */
+static int list_dir(int dh, int max, int* seen, uint32_t count) {
+  dir_entry_t batch[64];
+  int total = 0;
+  int got;
+  while ((got = k_readdir(dh, batch, max)) > 0) {
+    CHECK(got <= max);
+    for (int i = 0; i < got; i++) {
+      unsigned n;
+      if (sscanf(batch[i].name, "f%u", &n) == 1 && n < count)
+        seen[n]++;
+    }
+    total += got;
+  }
+  CHECK(got == 0);
+  return total;
+}
+
+/* Streams a directory in batches while entries ahead of it are unlinked. */
+static void case_readdir(const char* image, const tst_config_t* c) {
+  uint32_t per_block = tst_block_size() / sizeof(dir_entry_t);
+  uint32_t count = 5 * per_block;
+  static int seen[64 * 5];
+  char path[64];
+
+  CHECK(k_mkdir("r") == PennFatErr_OK);
+  for (uint32_t i = 0; i < count; i++) {
+    snprintf(path, sizeof(path), "r/f%u", i);
+    CHECK(make_file(path, 0, 0) == PennFatErr_OK);
+  }
+
+  // Any batch size lists every name once, plus '.' and '..'
+  static const int sizes[] = {1, 3, 64};
+  for (size_t k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++) {
+    memset(seen, 0, sizeof(seen));
+    int dh = k_opendir("r");
+    CHECK(dh >= 0);
+    CHECK(list_dir(dh, sizes[k], seen, count) == (int)count + 2);
+    CHECK(k_readdir(dh, (dir_entry_t[1]){}, 1) == 0);
+    CHECK(k_closedir(dh) == PennFatErr_OK);
+    for (uint32_t i = 0; i < count; i++)
+      CHECK(seen[i] == 1);
+  }
+
+  // Unlinked names vanish from later listings, also after a remount
+  for (uint32_t i = 0; i < count; i += 3) {
+    snprintf(path, sizeof(path), "r/f%u", i);
+    CHECK(k_unlink(path) == PennFatErr_OK);
+  }
+  for (int pass = 0; pass < 2; pass++) {
+    memset(seen, 0, sizeof(seen));
+    int dh = k_opendir("r");
+    list_dir(dh, 7, seen, count);
+    CHECK(k_closedir(dh) == PennFatErr_OK);
+    for (uint32_t i = 0; i < count; i++)
+      CHECK(seen[i] == (i % 3 != 0));
+    if (pass == 0)
+      tst_remount(image, c);
+  }
+
+  // A stream half way through skips what is unlinked ahead of its cursor
+  // and returns nothing twice
+  memset(seen, 0, sizeof(seen));
+  int dh = k_opendir("r");
+  dir_entry_t first[8];
+  int got = k_readdir(dh, first, 8);
+  CHECK(got == 8);
+  for (int i = 0; i < got; i++) {
+    unsigned n;
+    if (sscanf(first[i].name, "f%u", &n) == 1 && n < count)
+      seen[n]++;
+  }
+  for (uint32_t i = 1; i < count; i += 3) {
+    snprintf(path, sizeof(path), "r/f%u", i);
+    if (seen[i] == 0)
+      CHECK(k_unlink(path) == PennFatErr_OK);
+  }
+  list_dir(dh, 5, seen, count);
+  CHECK(k_closedir(dh) == PennFatErr_OK);
+  for (uint32_t i = 0; i < count; i++) {
+    snprintf(path, sizeof(path), "r/f%u", i);
+    CHECK(seen[i] <= 1);
+    CHECK((seen[i] == 1) == is_file(path));
+  }
+
+  // A stream on a removed directory just ends; handles are checked
+  CHECK(k_mkdir("gone") == PennFatErr_OK);
+  dh = k_opendir("gone");
+  CHECK(k_rmdir("gone") == PennFatErr_OK);
+  CHECK(k_readdir(dh, first, 8) == 0);
+  CHECK(k_closedir(dh) == PennFatErr_OK);
+  CHECK(k_readdir(dh, first, 8) == PennFatErr_INVAD);
+  CHECK(k_closedir(dh) == PennFatErr_INVAD);
+  CHECK(k_opendir("r/f2") == PennFatErr_NOTDIR);
+  CHECK(k_opendir("nowhere") < 0);
+}
+
+/* count_listed: Number of entries dir lists, '.' and '..' included. */
+static int count_listed(const char* dir) {
+  static int unused[1];
+  int dh = k_opendir(dir);
+  CHECK(dh >= 0);
+  int n = list_dir(dh, 64, unused, 0);
+  CHECK(k_closedir(dh) == PennFatErr_OK);
+  return n;
+}
+
+/* Packs directories on demand and on their own, keeping every live entry. */
+static void case_compaction(const char* image, const tst_config_t* c) {
+  uint32_t per_block = tst_block_size() / sizeof(dir_entry_t);
+  uint32_t count = 8 * per_block;
+  char path[64];
+  pennfat_stats_t before, after;
+
+  // Deleted slots pile up while a stream holds the directory open
+  CHECK(k_mkdir("k") == PennFatErr_OK);
+  for (uint32_t i = 0; i < count; i++) {
+    snprintf(path, sizeof(path), "k/f%u", i);
+    CHECK(make_file(path, i % 40, i) == PennFatErr_OK);
+  }
+  uint32_t full = tst_free_blocks();
+  int dh = k_opendir("k");
+  for (uint32_t i = 0; i < count; i++) {
+    snprintf(path, sizeof(path), "k/f%u", i);
+    if (i % 8 != 3)
+      CHECK(k_unlink(path) == PennFatErr_OK);
+  }
+  CHECK(k_compact("k") == PennFatErr_BUSY);
+  CHECK(k_closedir(dh) == PennFatErr_OK);
+
+  // An open file pins its entry's slot
+  int fd = k_open("k/f3", K_O_RDONLY);
+  CHECK(k_compact("k") == PennFatErr_BUSY);
+  CHECK(k_close(fd) == PennFatErr_OK);
+
+  uint32_t unpacked = tst_free_blocks();
+  k_stats(&before);
+  PennFatErr freed = k_compact("k");
+  k_stats(&after);
+  CHECK(freed > 0);
+  CHECK(tst_free_blocks() == unpacked + (uint32_t)freed);
+  CHECK(after.dir_compactions == before.dir_compactions + 1);
+  CHECK(after.dir_blocks_freed == before.dir_blocks_freed + (uint64_t)freed);
+  CHECK(tst_free_blocks() > full);
+  CHECK(count_listed("k") == (int)(count / 8) + 2);
+  for (uint32_t i = 3; i < count; i += 8) {
+    snprintf(path, sizeof(path), "k/f%u", i);
+    CHECK(file_holds(path, i % 40, i));
+  }
+  CHECK(k_compact("k") == 0);  // nothing left to pack
+  CHECK(k_compact("k/f3") == PennFatErr_NOTDIR);
+
+  // Unlinking most of a directory packs it without being asked
+  CHECK(k_mkdir("auto") == PennFatErr_OK);
+  for (uint32_t i = 0; i < count; i++) {
+    snprintf(path, sizeof(path), "auto/f%u", i);
+    CHECK(make_file(path, 0, 0) == PennFatErr_OK);
+  }
+  k_stats(&before);
+  for (uint32_t i = 0; i + 2 < count; i++) {
+    snprintf(path, sizeof(path), "auto/f%u", i);
+    CHECK(k_unlink(path) == PennFatErr_OK);
+  }
+  k_stats(&after);
+  CHECK(after.dir_compactions > before.dir_compactions);
+  CHECK(after.dir_blocks_freed > before.dir_blocks_freed);
+  CHECK(count_listed("auto") == 4);
+  snprintf(path, sizeof(path), "auto/f%u", count - 1);
+  CHECK(is_file(path));
+  snprintf(path, sizeof(path), "auto/f%u", count - 3);
+  CHECK(!is_file(path));
+
+  // The packed directories grow again and survive a remount
+  for (uint32_t i = 0; i < 2 * per_block; i++) {
+    snprintf(path, sizeof(path), "auto/g%u", i);
+    CHECK(make_file(path, 5, i) == PennFatErr_OK);
+  }
+  tst_remount(image, c);
+  CHECK(count_listed("k") == (int)(count / 8) + 2);
+  CHECK(count_listed("auto") == (int)(2 * per_block) + 4);
+  for (uint32_t i = 0; i < 2 * per_block; i++) {
+    snprintf(path, sizeof(path), "auto/g%u", i);
+    CHECK(file_holds(path, 5, i));
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Randomized run against a model of the tree
+///////////////////////////////////////////////////////////////////////////////
+
+#define MODEL_NODES 96
+#define MODEL_DEPTH 4
+#define MODEL_PATH 128
+
+typedef struct {
+  bool live;
+  bool dir;
+  char path[MODEL_PATH];  // absolute; "" for nothing
+  uint32_t seed;
+  uint32_t len;
+} model_node_t;
+
+static model_node_t g_nodes[MODEL_NODES];
+static uint32_t g_rand;
+static uint32_t g_names;
+
+static uint32_t next_rand(uint32_t bound) {
+  g_rand = g_rand * 1103515245u + 12345u;
+  return (g_rand >> 8) % bound;
+}
+
+static int depth_of(const char* path) {
+  int d = 0;
+  for (; *path; path++)
+    d += *path == '/';
+  return d;
+}
+
+/* below: Reports whether path lies strictly inside directory dir. */
+static bool below(const char* path, const char* dir) {
+  size_t n = strlen(dir);
+  return strncmp(path, dir, n) == 0 && path[n] == '/';
+}
+
+static model_node_t* free_node(void) {
+  for (int i = 0; i < MODEL_NODES; i++) {
+    if (!g_nodes[i].live)
+      return &g_nodes[i];
+  }
+  return NULL;
+}
+
+/* pick: A random live node (dirs or files as asked), or NULL if none. */
+static model_node_t* pick(bool dir) {
+  int start = (int)next_rand(MODEL_NODES);
+  for (int k = 0; k < MODEL_NODES; k++) {
+    model_node_t* n = &g_nodes[(start + k) % MODEL_NODES];
+    if (n->live && n->dir == dir)
+      return n;
+  }
+  return NULL;
+}
+
+/* pick_parent: A random directory to put something in; "" is the root. */
+static const char* pick_parent(void) {
+  model_node_t* d = next_rand(3) == 0 ? NULL : pick(true);
+  return d && depth_of(d->path) < MODEL_DEPTH ? d->path : "";
+}
+
+static int children_of(const char* dir) {
+  int n = 0;
+  for (int i = 0; i < MODEL_NODES; i++) {
+    const model_node_t* m = &g_nodes[i];
+    if (m->live && below(m->path, dir) &&
+        strchr(m->path + strlen(dir) + 1, '/') == NULL)
+      n++;
+  }
+  return n;
+}
+
+static model_node_t* find_node(const char* path) {
+  for (int i = 0; i < MODEL_NODES; i++) {
+    if (g_nodes[i].live && strcmp(g_nodes[i].path, path) == 0)
+      return &g_nodes[i];
+  }
+  return NULL;
+}
+
+/* verify_dir: Lists dir and checks it against the model's children. */
+static void verify_dir(const char* dir) {
+  int dh = k_opendir(dir[0] ? dir : "/");
+  CHECK(dh >= 0);
+  if (dh < 0)
+    return;
+  dir_entry_t batch[5];
+  int listed = 0;
+  int got;
+  while ((got = k_readdir(dh, batch, 5)) > 0) {
+    for (int i = 0; i < got; i++) {
+      if (strcmp(batch[i].name, ".") == 0 || strcmp(batch[i].name, "..") == 0)
+        continue;
+      char path[MODEL_PATH + 40];
+      snprintf(path, sizeof(path), "%s/%s", dir, batch[i].name);
+      model_node_t* m = find_node(path);
+      CHECK(m != NULL && m->dir == (batch[i].type == 2));
+      listed++;
+    }
+  }
+  CHECK(got == 0);
+  CHECK(k_closedir(dh) == PennFatErr_OK);
+  CHECK(listed == children_of(dir));
+}
+
+/* verify_tree: Every directory lists as modeled; every file reads back. */
+static void verify_tree(void) {
+  verify_dir("");
+  for (int i = 0; i < MODEL_NODES; i++) {
+    const model_node_t* m = &g_nodes[i];
+    if (!m->live)
+      continue;
+    if (m->dir) {
+      CHECK(is_dir(m->path));
+      verify_dir(m->path);
+    } else {
+      CHECK(file_holds(m->path, m->len, m->seed));
+    }
+  }
+}
+
+static void op_create(bool dir) {
+  model_node_t* n = free_node();
+  if (!n)
+    return;
+  snprintf(n->path, sizeof(n->path), "%s/%c%u", pick_parent(), dir ? 'd' : 'f',
+           g_names++);
+  n->dir = dir;
+  n->seed = g_names;
+  n->len = next_rand(4 * tst_block_size());
+  PennFatErr err = dir ? k_mkdir(n->path) : make_file(n->path, n->len, n->seed);
+  CHECK(err == PennFatErr_OK);
+  n->live = err == PennFatErr_OK;
+}
+
+static void op_unlink(void) {
+  model_node_t* n = pick(false);
+  if (!n)
+    return;
+  CHECK(k_unlink(n->path) == PennFatErr_OK);
+  CHECK(!is_file(n->path));
+  n->live = false;
+}
+
+static void op_rmdir(void) {
+  model_node_t* n = pick(true);
+  if (!n)
+    return;
+  if (children_of(n->path) > 0) {
+    CHECK(k_rmdir(n->path) == PennFatErr_NOTEMPTY);
+    return;
+  }
+  CHECK(k_rmdir(n->path) == PennFatErr_OK);
+  CHECK(!is_dir(n->path));
+  n->live = false;
+}
+
+/* op_churn: Grows a new directory over several blocks, empties it and
+ * removes it. */
+static void op_churn(void) {
+  uint32_t count = 3 * (tst_block_size() / sizeof(dir_entry_t)) + 1;
+  char dir[MODEL_PATH];
+  char path[MODEL_PATH + 16];
+  snprintf(dir, sizeof(dir), "%s/c%u", pick_parent(), g_names++);
+  CHECK(k_mkdir(dir) == PennFatErr_OK);
+  for (uint32_t i = 0; i < count; i++) {
+    snprintf(path, sizeof(path), "%s/x%u", dir, i);
+    CHECK(make_file(path, 0, 0) == PennFatErr_OK);
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t x = i < count / 2 ? 2 * i + 1 : 2 * (i - count / 2);
+    snprintf(path, sizeof(path), "%s/x%u", dir, x);
+    CHECK(k_unlink(path) == PennFatErr_OK);
+  }
+  CHECK(k_rmdir(dir) == PennFatErr_OK);
+  CHECK(!is_dir(dir));
+}
+
+/* op_rename: Moves a node under a random directory, sometimes over an
+ * existing file, and checks where it can be found afterwards. */
+static void op_rename(void) {
+  bool dir = next_rand(3) == 0;
+  model_node_t* n = pick(dir);
+  if (!n)
+    return;
+  char to[MODEL_PATH];
+  model_node_t* victim = dir ? NULL : pick(false);
+  if (victim && victim != n && next_rand(4) == 0) {
+    snprintf(to, sizeof(to), "%s", victim->path);
+  } else {
+    victim = NULL;
+    snprintf(to, sizeof(to), "%s/%c%u", pick_parent(), dir ? 'd' : 'f',
+             g_names++);
+  }
+
+  if (dir && below(to, n->path)) {
+    CHECK(k_rename(n->path, to) == PennFatErr_INVAD);
+    CHECK(is_dir(n->path));
+    return;
+  }
+  // Deeper trees than the model allows are left where they are
+  int deepest = depth_of(n->path);
+  for (int i = 0; i < MODEL_NODES; i++) {
+    if (g_nodes[i].live && below(g_nodes[i].path, n->path) &&
+        depth_of(g_nodes[i].path) > deepest)
+      deepest = depth_of(g_nodes[i].path);
+  }
+  if (deepest - depth_of(n->path) + depth_of(to) > MODEL_DEPTH + 1)
+    return;
+
+  CHECK(k_rename(n->path, to) == PennFatErr_OK);
+  if (victim)
+    victim->live = false;
+  char from[MODEL_PATH];
+  snprintf(from, sizeof(from), "%s", n->path);
+  size_t from_len = strlen(from);
+  for (int i = 0; i < MODEL_NODES; i++) {
+    model_node_t* m = &g_nodes[i];
+    if (m->live && below(m->path, from)) {
+      size_t to_len = strlen(to);
+      size_t rest = strlen(m->path + from_len);
+      CHECK(to_len + rest < sizeof(m->path));
+      memmove(m->path + to_len, m->path + from_len, rest + 1);
+      memcpy(m->path, to, to_len);
+    }
+  }
+  snprintf(n->path, sizeof(n->path), "%s", to);
+
+  CHECK(dir ? !is_dir(from) : !is_file(from));
+  if (!dir) {
+    CHECK(file_holds(n->path, n->len, n->seed));
+    return;
+  }
+  // '..' of the moved directory leads to its new parent
+  char cwd[MODEL_PATH + 8];
+  CHECK(k_chdir(n->path) == PennFatErr_OK);
+  CHECK(k_getcwd(cwd, sizeof(cwd)) == PennFatErr_OK);
+  CHECK(strcmp(cwd, n->path) == 0);
+  CHECK(k_chdir("..") == PennFatErr_OK);
+  CHECK(k_getcwd(cwd, sizeof(cwd)) == PennFatErr_OK);
+  *strrchr(to, '/') = '\0';
+  CHECK(strcmp(cwd, to[0] ? to : "/") == 0);
+  CHECK(k_chdir("/") == PennFatErr_OK);
+}
+
+static void op_compact(void) {
+  model_node_t* d = pick(true);
+  CHECK(k_compact(d ? d->path : "/") >= 0);
+}
+
+static void op_defrag(void) {
+  pennfat_defrag_report_t rep;
+  CHECK(k_defrag(false, NULL, NULL, &rep) == PennFatErr_OK);
+}
+
+/* Runs random directory operations, checking the tree as it goes. */
+static void case_random_ops(const char* image, const tst_config_t* c) {
+  memset(g_nodes, 0, sizeof(g_nodes));
+  g_names = 0;
+  uint32_t fresh_free = tst_free_blocks();
+
+  for (int op = 1; op <= 600; op++) {
+    uint32_t r = next_rand(100);
+    if (r < 25)
+      op_create(false);
+    else if (r < 38)
+      op_create(true);
+    else if (r < 55)
+      op_unlink();
+    else if (r < 65)
+      op_rmdir();
+    else if (r < 69)
+      op_churn();
+    else if (r < 90)
+      op_rename();
+    else if (r < 96)
+      op_compact();
+    else if (r < 98)
+      op_defrag();
+    else
+      CHECK(!is_file("/f_never") && !is_dir("/d_never"));
+
+    if (op % 40 == 0)
+      verify_tree();
+    if (op % 150 == 0) {
+      tst_remount(image, c);
+      verify_tree();
+    }
+  }
+
+  // Taking everything away again leaves the disk as it started
+  for (int i = 0; i < MODEL_NODES; i++) {
+    if (g_nodes[i].live && !g_nodes[i].dir) {
+      CHECK(k_unlink(g_nodes[i].path) == PennFatErr_OK);
+      g_nodes[i].live = false;
+    }
+  }
+  for (int d = MODEL_DEPTH + 1; d > 0; d--) {
+    for (int i = 0; i < MODEL_NODES; i++) {
+      if (g_nodes[i].live && depth_of(g_nodes[i].path) == d) {
+        CHECK(k_rmdir(g_nodes[i].path) == PennFatErr_OK);
+        g_nodes[i].live = false;
+      }
+    }
+  }
+  CHECK(k_compact("/") >= 0);
+  verify_tree();
+  CHECK(tst_free_blocks() == fresh_free);
+}
+
+int main(int argc, char* argv[]) {
+  const char* image = argc > 1 ? argv[1] : "pennfat_dir_tst.img";
+  pennfat_kernel_init();
+
+  static const tst_config_t configs[] = {
+      {PENNFAT_FORMAT_NARROW, 16, 0, PENNFAT_BACKEND_PREAD,
+       PENNFAT_SYNC_ALWAYS},
+      {PENNFAT_FORMAT_WIDE, 4, 2, PENNFAT_BACKEND_MMAP, PENNFAT_SYNC_NONE},
+  };
+  for (size_t i = 0; i < sizeof(configs) / sizeof(configs[0]); i++) {
+    tst_run(image, &configs[i], "index lookups", case_index_lookups);
+    tst_run(image, &configs[i], "index after rmdir", case_index_rmdir);
+    tst_run(image, &configs[i], "dentry cache", case_dentry_cache);
+    tst_run(image, &configs[i], "readdir", case_readdir);
+    tst_run(image, &configs[i], "compaction", case_compaction);
+  }
+
+  // The randomized run goes over every block size of both formats, taking
+  // the backends and durability policies in turn
+  static const pennfat_backend_t backends[] = {
+      PENNFAT_BACKEND_PREAD, PENNFAT_BACKEND_MMAP, PENNFAT_BACKEND_IO_URING};
+  int turn = 0;
+  for (int format = 0; format < 2; format++) {
+    for (int bc = 0; bc <= 4; bc++, turn++) {
+      uint32_t bs = 256u << bc;
+      int per_fat_block = (int)(bs / (format ? 4 : 2));
+      tst_config_t c = {
+          .format = (pennfat_format_t)format,
+          .fat_blocks = (2048 + per_fat_block - 1) / per_fat_block,
+          .block_config = bc,
+          .backend = backends[turn % 3],
+          .policy = (pennfat_sync_policy_t)(turn % 4),
+      };
+      g_rand = 1234u + (uint32_t)turn;
+      tst_run(image, &c, "random ops", case_random_ops);
+    }
+  }
+
+  unlink(image);
+  return tst_result("pennfat_dir_tst");
+}
@@ -0,0 +1,180 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal/pennfat_fatscan.h"
+#include "pennfat_tst.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// PennFAT FAT scan tests
+//
+// The bulk FAT scans have an AVX2, an SSE2 and a plain C implementation.
+// Every one the host can run is compared here against entry-at-a-time
+// reference loops, on narrow and wide FATs filled with different mixes of
+// free, chained, end-of-chain and out-of-range entries, over ranges that
+// start and end anywhere. FATs are allocated to their exact size, so a scan
+// reading past `to` shows up under a sanitizer.
+//
+// usage: pennfat_fatscan_tst
+///////////////////////////////////////////////////////////////////////////////
+
+#define FAT_ENTRIES 3000
+#define LIMIT 2900  // block numbers in [2, LIMIT) are valid
+
+static uint32_t g_rand = 99;
+
+static uint32_t next_rand(uint32_t bound) {
+  g_rand = g_rand * 1103515245u + 12345u;
+  return (g_rand >> 8) % bound;
+}
+
+static uint32_t get(const void* fat, uint32_t size, uint32_t i) {
+  return size == 2 ? ((const uint16_t*)fat)[i] : ((const uint32_t*)fat)[i];
+}
+
+static void set(void* fat, uint32_t size, uint32_t i, uint32_t v) {
+  if (size == 2)
+    ((uint16_t*)fat)[i] = (uint16_t)v;
+  else
+    ((uint32_t*)fat)[i] = v;
+}
+
+/* fill: Gives the FAT one of several mixes of entries. */
+static void fill(void* fat, uint32_t size, int mix) {
+  uint32_t eoc = size == 2 ? 0xFFFFu : 0xFFFFFFFFu;
+  for (uint32_t i = 0; i < FAT_ENTRIES; i++) {
+    uint32_t v;
+    switch (mix) {
+      case 0:  // all free
+        v = 0;
+        break;
+      case 1:  // all in use
+        v = i + 1 < LIMIT ? i + 1 : eoc;
+        break;
+      case 2:  // mostly free, with scattered use
+        v = next_rand(10) == 0 ? 2 + next_rand(LIMIT - 2) : 0;
+        break;
+      case 3:  // free runs of every length between used blocks
+        v = next_rand(50) < 1 + i % 49 ? 0 : eoc;
+        break;
+      default:  // anything, including out-of-range values
+        v = next_rand(4) == 0 ? 0 : next_rand(4) == 0 ? eoc : next_rand(5000);
+        if (size == 4 && next_rand(8) == 0)
+          v = 0x80000000u | next_rand(1000);
+        break;
+    }
+    set(fat, size, i, v);
+  }
+}
+
+static uint32_t ref_count_free(const void* fat,
+                               uint32_t size,
+                               uint32_t from,
+                               uint32_t to) {
+  uint32_t n = 0;
+  for (uint32_t i = from; i < to; i++)
+    n += get(fat, size, i) == 0;
+  return n;
+}
+
+static uint32_t ref_find_free_run(const void* fat,
+                                  uint32_t size,
+                                  uint32_t from,
+                                  uint32_t to,
+                                  uint32_t k) {
+  uint32_t run = 0;
+  for (uint32_t i = from; i < to; i++) {
+    run = get(fat, size, i) == 0 ? run + 1 : 0;
+    if (run == k)
+      return i + 1 - k;
+  }
+  return to;
+}
+
+static uint32_t ref_count_invalid(const void* fat,
+                                  uint32_t size,
+                                  uint32_t from,
+                                  uint32_t to,
+                                  uint32_t* first) {
+  uint32_t eoc = size == 2 ? 0xFFFFu : 0xFFFFFFFFu;
+  uint32_t n = 0;
+  *first = to;
+  for (uint32_t i = from; i < to; i++) {
+    uint32_t v = get(fat, size, i);
+    if (v != 0 && v != eoc && (v < 2 || v >= LIMIT)) {
+      if (n++ == 0)
+        *first = i;
+    }
+  }
+  return n;
+}
+
+/* check_range: Compares every scan over [from, to) with the references. */
+static void check_range(const void* fat,
+                        uint32_t size,
+                        uint32_t from,
+                        uint32_t to) {
+  static uint64_t words[FAT_ENTRIES / 64 + 2];
+  uint32_t want = ref_count_free(fat, size, from, to);
+  CHECK(fatscan_count_free(fat, size, from, to) == want);
+
+  memset(words, 0xA5, sizeof(words));
+  CHECK(fatscan_free_mask(fat, size, from, to, words) == want);
+  for (uint32_t i = from; i < (to - from + 63) / 64 * 64 + from; i++) {
+    uint32_t bit = i - from;
+    bool set_bit = words[bit / 64] >> (bit % 64) & 1;
+    CHECK(set_bit == (i < to && get(fat, size, i) == 0));
+  }
+
+  static const uint32_t ks[] = {1, 2, 3, 17, 63, 64, 65, 130};
+  for (size_t j = 0; j < sizeof(ks) / sizeof(ks[0]); j++) {
+    CHECK(fatscan_find_free_run(fat, size, from, to, ks[j]) ==
+          ref_find_free_run(fat, size, from, to, ks[j]));
+  }
+
+  uint32_t first, ref_first;
+  uint32_t bad = ref_count_invalid(fat, size, from, to, &ref_first);
+  CHECK(fatscan_count_invalid(fat, size, from, to, LIMIT, &first) == bad);
+  CHECK(first == ref_first);
+  CHECK(fatscan_count_invalid(fat, size, from, to, LIMIT, NULL) == bad);
+}
+
+static void check_impl(const char* impl) {
+  int failures = tst_failures;
+  for (uint32_t size = 2; size <= 4; size += 2) {
+    void* fat = malloc((size_t)FAT_ENTRIES * size);
+    for (int mix = 0; mix < 5; mix++) {
+      fill(fat, size, mix);
+      check_range(fat, size, 0, FAT_ENTRIES);
+      check_range(fat, size, 2, FAT_ENTRIES);
+      check_range(fat, size, 64, 128);
+      check_range(fat, size, 100, 100);
+      for (int r = 0; r < 40; r++) {
+        uint32_t from = next_rand(FAT_ENTRIES);
+        uint32_t to = from + next_rand(FAT_ENTRIES - from + 1);
+        check_range(fat, size, from, to);
+      }
+    }
+    free(fat);
+  }
+  if (tst_failures != failures)
+    fprintf(stderr, "  in the %s implementation\n", impl);
+}
+
+int main(void) {
+  static const char* const impls[] = {"c", "sse2", "avx2"};
+  int ran = 0;
+  for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+    if (fatscan_select(impls[i]) != 0) {
+      printf("%s: not supported here, skipped\n", impls[i]);
+      continue;
+    }
+    CHECK(strcmp(fatscan_impl(), impls[i]) == 0);
+    check_impl(impls[i]);
+    ran++;
+  }
+  CHECK(ran > 0);
+  CHECK(fatscan_select("none") == -1);
+  return tst_result("pennfat_fatscan_tst");
+}
@@ -0,0 +1,355 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "pennfat_tst.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// PennFAT fsck tests
+//
+// Each case builds a small tree, unmounts it and damages the image the way a
+// crash or a bug would: a looping chain, two chains sharing blocks, a size
+// past the chain's end, leaked blocks, a garbage entry or a wrong '..'.
+// k_fsck must count the damage under the right heading, with one worker and
+// with several, and `repair` must leave an image that checks clean and still
+// holds the files the damage did not touch.
+//
+// usage: pennfat_fsck_tst [IMAGE_PATH]
+///////////////////////////////////////////////////////////////////////////////
+
+#define TST_MAX_FILE (64 * 1024)
+
+static char g_data[TST_MAX_FILE];
+static char g_back[TST_MAX_FILE];
+static int g_problems;
+
+/* The tree every case starts from; sizes are in blocks, plus a few bytes */
+typedef struct {
+  const char* path;
+  uint32_t blocks;
+} tree_file_t;
+
+static const tree_file_t g_tree[] = {
+    {"a", 6}, {"b", 4}, {"c", 2}, {"d/x", 3}, {"d/e/y", 1}, {"gone", 2},
+};
+#define TREE_FILES (sizeof(g_tree) / sizeof(g_tree[0]))
+
+static size_t tree_len(size_t i) {
+  return (g_tree[i].blocks - 1) * tst_block_size() + 10 + i;
+}
+
+static void make_tree(void) {
+  CHECK(k_mkdir("d") == PennFatErr_OK);
+  CHECK(k_mkdir("d/e") == PennFatErr_OK);
+  for (size_t i = 0; i < TREE_FILES; i++) {
+    tst_pattern(g_data, tree_len(i), (uint32_t)i);
+    CHECK(tst_write_file(g_tree[i].path, g_data, tree_len(i)) ==
+          PennFatErr_OK);
+  }
+  CHECK(k_symlink("/d/x", "l") == PennFatErr_OK);
+}
+
+/* tree_intact: Checks the tree's files read back, except those named. */
+static void tree_intact(const char* skip1, const char* skip2) {
+  for (size_t i = 0; i < TREE_FILES; i++) {
+    const char* p = g_tree[i].path;
+    if ((skip1 && strcmp(p, skip1) == 0) || (skip2 && strcmp(p, skip2) == 0))
+      continue;
+    tst_pattern(g_data, tree_len(i), (uint32_t)i);
+    CHECK(tst_read_file(p, g_back, sizeof(g_back)) == (int)tree_len(i));
+    CHECK(memcmp(g_data, g_back, tree_len(i)) == 0);
+  }
+}
+
+static void count_problem(const char* problem, void* arg) {
+  (void)problem;
+  (void)arg;
+  g_problems++;
+}
+
+/* fsck: Runs k_fsck with the given workers and returns its report. */
+static pennfat_fsck_report_t fsck(const char* image,
+                                  bool repair,
+                                  uint32_t threads) {
+  pennfat_fsck_report_t rep;
+  memset(&rep, 0, sizeof(rep));
+  g_problems = 0;
+  CHECK(k_fsck(image, repair, threads, count_problem, NULL, &rep) ==
+        PennFatErr_OK);
+  return rep;
+}
+
+static uint32_t problems(const pennfat_fsck_report_t* r) {
+  return r->bad_chains + r->cross_links + r->size_errors + r->bad_entries +
+         r->leaked;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Raw access to an unmounted image
+///////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+  int fd;
+  bool wide;
+  uint32_t block_size;
+  off_t fat_offset;   // image offset of FAT entry 0
+  off_t data_offset;  // image offset of block 1 (the root directory)
+} raw_image_t;
+
+static raw_image_t raw_open(const char* image, const tst_config_t* c) {
+  raw_image_t r = {.fd = open(image, O_RDWR),
+                   .wide = c->format == PENNFAT_FORMAT_WIDE,
+                   .block_size = 256u << c->block_config};
+  CHECK(r.fd >= 0);
+  r.fat_offset = r.wide ? r.block_size : 0;
+  r.data_offset = (off_t)(c->fat_blocks + (r.wide ? 1 : 0)) * r.block_size;
+  return r;
+}
+
+static uint32_t raw_fat_get(const raw_image_t* r, uint32_t i) {
+  if (r->wide) {
+    uint32_t v = 0;
+    CHECK(pread(r->fd, &v, 4, r->fat_offset + (off_t)i * 4) == 4);
+    return v;
+  }
+  uint16_t v = 0;
+  CHECK(pread(r->fd, &v, 2, r->fat_offset + (off_t)i * 2) == 2);
+  return v == FAT_EOC_NARROW ? FAT_EOC : v;
+}
+
+static void raw_fat_set(const raw_image_t* r, uint32_t i, uint32_t value) {
+  if (r->wide) {
+    CHECK(pwrite(r->fd, &value, 4, r->fat_offset + (off_t)i * 4) == 4);
+    return;
+  }
+  uint16_t v = value == FAT_EOC ? FAT_EOC_NARROW : (uint16_t)value;
+  CHECK(pwrite(r->fd, &v, 2, r->fat_offset + (off_t)i * 2) == 2);
+}
+
+static off_t raw_block(const raw_image_t* r, uint32_t block) {
+  return r->data_offset + (off_t)(block - 1) * r->block_size;
+}
+
+static uint32_t entry_block(const dir_entry_t* e) {
+  return e->first_block | (uint32_t)e->first_block_hi << 16;
+}
+
+/*
+ * raw_find: Finds name in the first block of directory dir_block, leaving
+ * the entry in *e. Returns its image offset, or -1 if it is not there.
+ */
+static off_t raw_find(const raw_image_t* r,
+                      uint32_t dir_block,
+                      const char* name,
+                      dir_entry_t* e) {
+  for (uint32_t i = 0; i < r->block_size / sizeof(dir_entry_t); i++) {
+    off_t at = raw_block(r, dir_block) + (off_t)(i * sizeof(dir_entry_t));
+    CHECK(pread(r->fd, e, sizeof(*e), at) == (ssize_t)sizeof(*e));
+    if (e->name[0] == 0)
+      break;
+    if (strcmp(e->name, name) == 0)
+      return at;
+  }
+  CHECK(!"entry found");
+  return -1;
+}
+
+static void raw_put(const raw_image_t* r, off_t at, const dir_entry_t* e) {
+  CHECK(pwrite(r->fd, e, sizeof(*e), at) == (ssize_t)sizeof(*e));
+}
+
+/* raw_tail: The last block of the chain starting at block. */
+static uint32_t raw_tail(const raw_image_t* r, uint32_t block) {
+  while (raw_fat_get(r, block) != FAT_EOC)
+    block = raw_fat_get(r, block);
+  return block;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Cases
+///////////////////////////////////////////////////////////////////////////////
+
+/*
+ * unmount_damaged: Unmounts and opens the image for damage. finish_repair
+ * then checks the damage is found by 1 and 4 workers, repairs it and mounts
+ * the image again.
+ */
+static raw_image_t unmount_damaged(const char* image, const tst_config_t* c) {
+  CHECK(k_unmount() == PennFatErr_OK);
+  return raw_open(image, c);
+}
+
+static pennfat_fsck_report_t finish_repair(const char* image,
+                                           const tst_config_t* c,
+                                           raw_image_t* r) {
+  close(r->fd);
+  pennfat_fsck_report_t one = fsck(image, false, 1);
+  int found = g_problems;
+  pennfat_fsck_report_t four = fsck(image, false, 4);
+  CHECK(problems(&one) > 0);
+  CHECK(g_problems == found);
+  CHECK(problems(&four) == problems(&one));
+  CHECK(four.threads == 4);
+
+  pennfat_fsck_report_t fixed = fsck(image, true, 3);
+  CHECK(fixed.repaired > 0);
+  CHECK(tst_fsck_clean(image));
+  CHECK(tst_mount(image, c, false) == PennFatErr_OK);
+  return one;
+}
+
+/* A healthy tree checks clean; the check is refused while mounted. */
+static void case_clean(const char* image, const tst_config_t* c) {
+  make_tree();
+  pennfat_fsck_report_t rep;
+  CHECK(k_fsck(image, false, 1, NULL, NULL, &rep) == PennFatErr_BUSY);
+  CHECK(k_unmount() == PennFatErr_OK);
+
+  pennfat_fsck_report_t one = fsck(image, false, 1);
+  CHECK(g_problems == 0);
+  CHECK(problems(&one) == 0 && one.dangling == 0);
+  CHECK(one.files == TREE_FILES);
+  CHECK(one.symlinks == 1);
+  CHECK(one.dirs == 3);
+  pennfat_fsck_report_t four = fsck(image, false, 4);
+  CHECK(four.blocks_used == one.blocks_used);
+  CHECK(four.free_blocks == one.free_blocks);
+  CHECK(fsck(image, true, 2).repaired == 0);
+  CHECK(tst_mount(image, c, false) == PennFatErr_OK);
+  tree_intact(NULL, NULL);
+}
+
+/* The last block of "a" points back at its first. */
+static void case_loop(const char* image, const tst_config_t* c) {
+  make_tree();
+  raw_image_t r = unmount_damaged(image, c);
+  dir_entry_t e;
+  raw_find(&r, 1, "a", &e);
+  raw_fat_set(&r, raw_tail(&r, entry_block(&e)), entry_block(&e));
+  pennfat_fsck_report_t rep = finish_repair(image, c, &r);
+  CHECK(rep.bad_chains == 1);
+  tree_intact(NULL, NULL);
+}
+
+/* The chain of "b" runs into the second block of "a". */
+static void case_cross_link(const char* image, const tst_config_t* c) {
+  make_tree();
+  raw_image_t r = unmount_damaged(image, c);
+  dir_entry_t a, b;
+  raw_find(&r, 1, "a", &a);
+  raw_find(&r, 1, "b", &b);
+  raw_fat_set(&r, raw_fat_get(&r, entry_block(&b)),
+              raw_fat_get(&r, entry_block(&a)));
+  pennfat_fsck_report_t rep = finish_repair(image, c, &r);
+  CHECK(rep.cross_links >= 1);
+  tree_intact("a", "b");
+}
+
+/* "c" claims far more bytes than its two blocks hold. */
+static void case_size(const char* image, const tst_config_t* c) {
+  make_tree();
+  raw_image_t r = unmount_damaged(image, c);
+  dir_entry_t e;
+  off_t at = raw_find(&r, 1, "c", &e);
+  e.size = 999999;
+  raw_put(&r, at, &e);
+  pennfat_fsck_report_t rep = finish_repair(image, c, &r);
+  CHECK(rep.size_errors == 1);
+  tree_intact("c", NULL);
+  CHECK(tst_read_file("c", g_back, sizeof(g_back)) ==
+        (int)(2 * tst_block_size()));
+  tst_pattern(g_data, tree_len(2), 2);
+  CHECK(memcmp(g_data, g_back, tree_len(2)) == 0);
+}
+
+/* "gone" is deleted without its blocks being freed. */
+static void case_leak(const char* image, const tst_config_t* c) {
+  make_tree();
+  uint32_t free_before = tst_free_blocks();
+  raw_image_t r = unmount_damaged(image, c);
+  dir_entry_t e;
+  off_t at = raw_find(&r, 1, "gone", &e);
+  e.name[0] = 1;
+  raw_put(&r, at, &e);
+  pennfat_fsck_report_t rep = finish_repair(image, c, &r);
+  CHECK(rep.leaked == 2);
+  CHECK(rep.free_blocks == free_before);
+  CHECK(tst_free_blocks() == free_before + 2);
+  tree_intact("gone", NULL);
+}
+
+/* A slot of the root is overwritten with something that is no entry. */
+static void case_garbage(const char* image, const tst_config_t* c) {
+  make_tree();
+  raw_image_t r = unmount_damaged(image, c);
+  dir_entry_t e;
+  off_t at = raw_find(&r, 1, "l", &e);
+  memset(&e, 0x5a, sizeof(e));
+  raw_put(&r, at, &e);
+  pennfat_fsck_report_t rep = finish_repair(image, c, &r);
+  CHECK(rep.bad_entries == 1);
+  CHECK(rep.leaked == 1);  // the link's block
+  tree_intact(NULL, NULL);
+}
+
+/* The '..' of d/e points at the root rather than at d. */
+static void case_dotdot(const char* image, const tst_config_t* c) {
+  make_tree();
+  raw_image_t r = unmount_damaged(image, c);
+  dir_entry_t d, sub, dotdot;
+  raw_find(&r, 1, "d", &d);
+  raw_find(&r, entry_block(&d), "e", &sub);
+  off_t at = raw_find(&r, entry_block(&sub), "..", &dotdot);
+  dotdot.first_block = 1;
+  dotdot.first_block_hi = 0;
+  raw_put(&r, at, &dotdot);
+  pennfat_fsck_report_t rep = finish_repair(image, c, &r);
+  CHECK(rep.bad_entries == 1);
+
+  char cwd[64];
+  CHECK(k_chdir("/d/e") == PennFatErr_OK);
+  CHECK(k_chdir("..") == PennFatErr_OK);
+  CHECK(k_getcwd(cwd, sizeof(cwd)) == PennFatErr_OK);
+  CHECK(strcmp(cwd, "/d") == 0);
+  CHECK(k_chdir("/") == PennFatErr_OK);
+  tree_intact(NULL, NULL);
+}
+
+/* A symlink whose target was unlinked is reported and kept. */
+static void case_dangling(const char* image, const tst_config_t* c) {
+  make_tree();
+  CHECK(k_unlink("d/x") == PennFatErr_OK);
+  CHECK(k_unmount() == PennFatErr_OK);
+  pennfat_fsck_report_t rep = fsck(image, true, 2);
+  CHECK(rep.dangling == 1);
+  CHECK(problems(&rep) == 0 && rep.repaired == 0);
+  CHECK(tst_mount(image, c, false) == PennFatErr_OK);
+  char target[32];
+  CHECK(k_readlink("l", target, sizeof(target)) >= 0);
+  CHECK(strncmp(target, "/d/x", 4) == 0);
+}
+
+int main(int argc, char* argv[]) {
+  const char* image = argc > 1 ? argv[1] : "pennfat_fsck_tst.img";
+  pennfat_kernel_init();
+
+  static const tst_config_t configs[] = {
+      {PENNFAT_FORMAT_NARROW, 16, 1, PENNFAT_BACKEND_PREAD,
+       PENNFAT_SYNC_ALWAYS},
+      {PENNFAT_FORMAT_WIDE, 4, 2, PENNFAT_BACKEND_MMAP,
+       PENNFAT_SYNC_ON_CLOSE},
+  };
+  for (size_t i = 0; i < sizeof(configs) / sizeof(configs[0]); i++) {
+    const tst_config_t* c = &configs[i];
+    tst_run(image, c, "clean", case_clean);
+    tst_run(image, c, "loop", case_loop);
+    tst_run(image, c, "cross link", case_cross_link);
+    tst_run(image, c, "size", case_size);
+    tst_run(image, c, "leak", case_leak);
+    tst_run(image, c, "garbage", case_garbage);
+    tst_run(image, c, "dotdot", case_dotdot);
+    tst_run(image, c, "dangling", case_dangling);
+  }
+
+  unlink(image);
+  return tst_result("pennfat_fsck_tst");
+}
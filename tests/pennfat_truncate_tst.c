@@ -0,0 +1,188 @@
+#include <unistd.h>
+
+#include "pennfat_tst.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// PennFAT k_ftruncate / k_fallocate tests
+//
+// k_ftruncate cuts a file's chain after the block holding its new last byte
+// and frees the tail in one step, or grows the file with zero-filled blocks;
+// k_fallocate gives a file blocks ahead of its size. These cases check the
+// bytes a file reads back and the free block count after each, that cut
+// bytes never reappear when the file grows again, and the refusals. Every
+// case ends with a remount and k_fsck.
+//
+// usage: pennfat_truncate_tst [IMAGE_PATH]
+///////////////////////////////////////////////////////////////////////////////
+
+#define TST_MAX_FILE (256 * 1024)
+
+static char g_data[TST_MAX_FILE];
+static char g_back[TST_MAX_FILE];
+
+/* free_now: Free blocks once delayed data has been given its blocks. */
+static uint32_t free_now(void) {
+  CHECK(k_sync() == PennFatErr_OK);
+  return tst_free_blocks();
+}
+
+static bool all_zero(const char* p, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    if (p[i] != 0)
+      return false;
+  }
+  return true;
+}
+
+/* Shrinks a file to part of a block, then grows it back with zeroes. */
+static void case_shrink_grow(const char* image, const tst_config_t* c) {
+  uint32_t bs = tst_block_size();
+  size_t len = 10 * bs + 77;
+  size_t cut = 2 * bs + bs / 2;
+  tst_pattern(g_data, len, 1);
+
+  int fd = k_open("t", K_O_CREATE | K_O_WRONLY);
+  CHECK(fd >= 0);
+  CHECK(k_write(fd, g_data, (int)len) == (int)len);
+  uint32_t full = free_now();
+
+  CHECK(k_ftruncate(fd, (int)cut) == PennFatErr_OK);
+  CHECK(free_now() == full + 8);  // 11 blocks down to 3
+  CHECK(tst_read_file("t", g_back, sizeof(g_back)) == (int)cut);
+  CHECK(memcmp(g_data, g_back, cut) == 0);
+
+  // Growing exposes zeroes, not what was cut
+  CHECK(k_ftruncate(fd, (int)(6 * bs)) == PennFatErr_OK);
+  CHECK(free_now() == full + 5);
+  CHECK(tst_read_file("t", g_back, sizeof(g_back)) == (int)(6 * bs));
+  CHECK(memcmp(g_data, g_back, cut) == 0);
+  CHECK(all_zero(g_back + cut, 6 * bs - cut));
+
+  // So does writing past the end after a cut inside the last block
+  CHECK(k_ftruncate(fd, 100) == PennFatErr_OK);
+  CHECK(k_lseek(fd, (int)(bs + 10), F_SEEK_SET) == (int)(bs + 10));
+  CHECK(k_write(fd, "xyz", 3) == 3);
+  CHECK(k_close(fd) == PennFatErr_OK);
+  CHECK(tst_read_file("t", g_back, sizeof(g_back)) == (int)(bs + 13));
+  CHECK(memcmp(g_data, g_back, 100) == 0);
+  CHECK(all_zero(g_back + 100, bs + 10 - 100));
+  CHECK(memcmp(g_back + bs + 10, "xyz", 3) == 0);
+
+  tst_remount(image, c);
+  CHECK(tst_read_file("t", g_back, sizeof(g_back)) == (int)(bs + 13));
+  CHECK(memcmp(g_back + bs + 10, "xyz", 3) == 0);
+
+  // A file cut to nothing keeps only its first block
+  fd = k_open("t", K_O_APPEND);
+  CHECK(fd >= 0);
+  uint32_t before = free_now();
+  CHECK(k_ftruncate(fd, 0) == PennFatErr_OK);
+  CHECK(free_now() == before + 1);
+  CHECK(k_close(fd) == PennFatErr_OK);
+  CHECK(tst_read_file("t", g_back, sizeof(g_back)) == 0);
+}
+
+/* Readers past the new end see end of file, not stale bytes. */
+static void case_readers(const char* image, const tst_config_t* c) {
+  (void)image;
+  (void)c;
+  uint32_t bs = tst_block_size();
+  size_t len = 4 * bs;
+  tst_pattern(g_data, len, 2);
+  CHECK(tst_write_file("r", g_data, len) == PennFatErr_OK);
+
+  int rd = k_open("r", K_O_RDONLY);
+  CHECK(k_lseek(rd, (int)(3 * bs), F_SEEK_SET) == (int)(3 * bs));
+  int wr = k_open("r", K_O_APPEND);
+  CHECK(wr >= 0);
+  CHECK(k_ftruncate(wr, (int)bs) == PennFatErr_OK);
+  CHECK(k_read(rd, 10, g_back) == 0);
+  CHECK(k_ftruncate(wr, (int)(4 * bs)) == PennFatErr_OK);
+  CHECK(k_read(rd, (int)bs, g_back) == (int)bs);
+  CHECK(all_zero(g_back, bs));
+  CHECK(k_ftruncate(rd, 10) == PennFatErr_PERM);
+  CHECK(k_fallocate(rd, (int)(8 * bs)) == PennFatErr_PERM);
+  CHECK(k_ftruncate(wr, -1) == PennFatErr_INVAD);
+  CHECK(k_fallocate(wr, -1) == PennFatErr_INVAD);
+  CHECK(k_close(rd) == PennFatErr_OK);
+  CHECK(k_close(wr) == PennFatErr_OK);
+  CHECK(k_ftruncate(wr, 0) < 0);  // closed
+}
+
+/* Reserves blocks ahead of the size; writes into them allocate nothing. */
+static void case_fallocate(const char* image, const tst_config_t* c) {
+  uint32_t bs = tst_block_size();
+  int fd = k_open("p", K_O_CREATE | K_O_WRONLY);
+  CHECK(fd >= 0);
+  CHECK(k_write(fd, "head", 4) == 4);
+  uint32_t before = free_now();
+
+  CHECK(k_fallocate(fd, (int)(8 * bs)) == PennFatErr_OK);
+  CHECK(free_now() == before - 7);
+  CHECK(tst_read_file("p", g_back, sizeof(g_back)) == 4);
+  CHECK(k_fallocate(fd, (int)(2 * bs)) == PennFatErr_OK);  // already there
+  CHECK(free_now() == before - 7);
+
+  size_t len = 8 * bs - 4;
+  tst_pattern(g_data, len, 3);
+  CHECK(k_write(fd, g_data, (int)len) == (int)len);
+  CHECK(free_now() == before - 7);
+  CHECK(k_close(fd) == PennFatErr_OK);
+
+  tst_remount(image, c);
+  CHECK(tst_read_file("p", g_back, sizeof(g_back)) == (int)(8 * bs));
+  CHECK(memcmp(g_back, "head", 4) == 0);
+  CHECK(memcmp(g_back + 4, g_data, len) == 0);
+
+  // Blocks reserved past the size survive a remount and go with a truncate
+  fd = k_open("p", K_O_APPEND);
+  before = free_now();
+  CHECK(k_fallocate(fd, (int)(12 * bs)) == PennFatErr_OK);
+  CHECK(k_close(fd) == PennFatErr_OK);
+  tst_remount(image, c);
+  CHECK(free_now() == before - 4);
+  CHECK(tst_read_file("p", g_back, sizeof(g_back)) == (int)(8 * bs));
+  fd = k_open("p", K_O_APPEND);
+  CHECK(k_ftruncate(fd, (int)(8 * bs)) == PennFatErr_OK);
+  CHECK(free_now() == before);
+  CHECK(k_close(fd) == PennFatErr_OK);
+}
+
+/* Asking for more than the disk holds keeps what it got. */
+static void case_fallocate_full(const char* image, const tst_config_t* c) {
+  (void)image;
+  (void)c;
+  uint32_t bs = tst_block_size();
+  int fd = k_open("big", K_O_CREATE | K_O_WRONLY);
+  CHECK(fd >= 0);
+  uint32_t avail = free_now();
+  CHECK(k_fallocate(fd, (int)((avail + 10) * bs)) == PennFatErr_NOSPACE);
+  CHECK(free_now() == 0);
+  CHECK(tst_write_file("other", "x", 1) < 0);
+  CHECK(k_ftruncate(fd, 0) == PennFatErr_OK);
+  CHECK(free_now() == avail);
+  CHECK(k_close(fd) == PennFatErr_OK);
+}
+
+int main(int argc, char* argv[]) {
+  const char* image = argc > 1 ? argv[1] : "pennfat_truncate_tst.img";
+  pennfat_kernel_init();
+
+  static const tst_config_t configs[] = {
+      {PENNFAT_FORMAT_NARROW, 16, 1, PENNFAT_BACKEND_PREAD,
+       PENNFAT_SYNC_ALWAYS},
+      {PENNFAT_FORMAT_NARROW, 4, 0, PENNFAT_BACKEND_MMAP, PENNFAT_SYNC_NONE},
+      {PENNFAT_FORMAT_WIDE, 4, 2, PENNFAT_BACKEND_PREAD,
+       PENNFAT_SYNC_PERIODIC},
+  };
+  for (size_t i = 0; i < sizeof(configs) / sizeof(configs[0]); i++) {
+    const tst_config_t* c = &configs[i];
+    tst_run(image, c, "shrink and grow", case_shrink_grow);
+    tst_run(image, c, "readers", case_readers);
+    tst_run(image, c, "fallocate", case_fallocate);
+    tst_run(image, c, "fallocate full", case_fallocate_full);
+  }
+
+  unlink(image);
+  return tst_result("pennfat_truncate_tst");
+}
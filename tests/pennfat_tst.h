@@ -0,0 +1,176 @@
+#ifndef PENNFAT_TST_H
+#define PENNFAT_TST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common/pennfat_definitions.h"
+#include "common/pennfat_errors.h"
+#include "internal/pennfat_kernel.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Shared helpers for the PennFAT *_tst programs
+//
+// Each program runs its cases against an image it formats itself and exits
+// non-zero if any CHECK failed, printing one line per failed check.
+///////////////////////////////////////////////////////////////////////////////
+
+static int tst_failures = 0;
+
+#define CHECK(cond)                                                     \
+  do {                                                                  \
+    if (!(cond)) {                                                      \
+      fprintf(stderr, "%s:%d: %s: check failed: %s\n", __FILE__,        \
+              __LINE__, __func__, #cond);                               \
+      tst_failures++;                                                   \
+    }                                                                   \
+  } while (0)
+
+/* One image layout and mount configuration a case runs under */
+typedef struct {
+  pennfat_format_t format;
+  int fat_blocks;
+  int block_config;
+  pennfat_backend_t backend;
+  pennfat_sync_policy_t policy;
+} tst_config_t;
+
+static const char* const tst_format_names[] = {"narrow", "wide"};
+static const char* const tst_policy_names[] = {"always", "on-close",
+                                               "periodic", "none"};
+
+static inline const char* tst_describe(const tst_config_t* c) {
+  static char buf[96];
+  snprintf(buf, sizeof(buf), "%s, %d FAT blocks, config %d, %s, %s",
+           tst_format_names[c->format], c->fat_blocks, c->block_config,
+           blockdev_name(c->backend), tst_policy_names[c->policy]);
+  return buf;
+}
+
+/* tst_mount: Mounts image under c, formatting it first if fresh is set. */
+static inline PennFatErr tst_mount(const char* image,
+                                   const tst_config_t* c,
+                                   bool fresh) {
+  if (fresh) {
+    PennFatErr err =
+        k_mkfs_opts(image, c->fat_blocks, c->block_config, c->format);
+    if (err != PennFatErr_OK)
+      return err;
+  }
+  pennfat_mount_opts_t opts = {.sync_policy = c->policy,
+                               .sync_period_ms = 20,
+                               .backend = c->backend};
+  return k_mount_opts(image, &opts);
+}
+
+/* tst_block_size: Block size of the mounted filesystem. */
+static inline uint32_t tst_block_size(void) {
+  pennfat_stats_t st;
+  k_stats(&st);
+  return st.block_size;
+}
+
+/* tst_free_blocks: Free data blocks of the mounted filesystem. */
+static inline uint32_t tst_free_blocks(void) {
+  pennfat_stats_t st;
+  k_stats(&st);
+  return st.free_blocks;
+}
+
+/* tst_pattern: Fills buf with bytes that depend on their offset and seed. */
+static inline void tst_pattern(char* buf, size_t len, uint32_t seed) {
+  for (size_t i = 0; i < len; i++)
+    buf[i] = (char)((i * 131 + seed * 7 + (i >> 9)) & 0xFF);
+}
+
+/* tst_write_file: Creates name holding buf; returns 0 or a PennFatErr. */
+static inline int tst_write_file(const char* name,
+                                 const char* buf,
+                                 size_t len) {
+  int fd = k_open(name, K_O_CREATE | K_O_WRONLY);
+  if (fd < 0)
+    return fd;
+  size_t done = 0;
+  while (done < len) {
+    int chunk = len - done > 8192 ? 8192 : (int)(len - done);
+    PennFatErr w = k_write(fd, buf + done, chunk);
+    if (w != chunk) {
+      k_close(fd);
+      return w < 0 ? w : PennFatErr_NOSPACE;
+    }
+    done += (size_t)chunk;
+  }
+  return k_close(fd);
+}
+
+/*
+ * tst_read_file: Reads all of name into buf (at most cap bytes). Returns the
+ * bytes read, or a PennFatErr.
+ */
+static inline int tst_read_file(const char* name, char* buf, size_t cap) {
+  int fd = k_open(name, K_O_RDONLY);
+  if (fd < 0)
+    return fd;
+  size_t done = 0;
+  PennFatErr r;
+  while (done < cap && (r = k_read(fd, (int)(cap - done), buf + done)) > 0)
+    done += (size_t)r;
+  k_close(fd);
+  return r < 0 ? r : (int)done;
+}
+
+static inline void tst_print_problem(const char* problem, void* arg) {
+  fprintf(stderr, "  fsck %s: %s\n", (const char*)arg, problem);
+}
+
+/*
+ * tst_fsck_clean: Runs k_fsck over the unmounted image and returns true if it
+ * found nothing wrong. Dangling symlinks are not counted.
+ */
+static inline bool tst_fsck_clean(const char* image) {
+  pennfat_fsck_report_t rep;
+  PennFatErr err =
+      k_fsck(image, false, 2, tst_print_problem, (void*)image, &rep);
+  return err == PennFatErr_OK && rep.bad_chains == 0 &&
+         rep.cross_links == 0 && rep.size_errors == 0 &&
+         rep.bad_entries == 0 && rep.leaked == 0;
+}
+
+/* tst_remount: Unmounts, checks the image and mounts it again. */
+static inline void tst_remount(const char* image, const tst_config_t* c) {
+  CHECK(k_unmount() == PennFatErr_OK);
+  CHECK(tst_fsck_clean(image));
+  CHECK(tst_mount(image, c, false) == PennFatErr_OK);
+}
+
+typedef void (*tst_case_fn)(const char* image, const tst_config_t* c);
+
+/*
+ * tst_run: Runs one case on a freshly formatted image and checks the image
+ * once it is unmounted again. Failed checks are followed by the case's name.
+ */
+static inline void tst_run(const char* image,
+                           const tst_config_t* c,
+                           const char* name,
+                           tst_case_fn fn) {
+  int failures = tst_failures;
+  CHECK(tst_mount(image, c, true) == PennFatErr_OK);
+  fn(image, c);
+  CHECK(k_unmount() == PennFatErr_OK);
+  CHECK(tst_fsck_clean(image));
+  if (tst_failures != failures)
+    fprintf(stderr, "  in %s (%s)\n", name, tst_describe(c));
+}
+
+/* tst_result: Prints the summary line; the program's exit status. */
+static inline int tst_result(const char* name) {
+  if (tst_failures > 0) {
+    printf("%s: %d check(s) failed\n", name, tst_failures);
+    return EXIT_FAILURE;
+  }
+  printf("%s: all checks passed\n", name);
+  return EXIT_SUCCESS;
+}
+
+#endif /* PENNFAT_TST_H */